@@ -0,0 +1,162 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Event to callback latency of fswatch, blocking and busy polling.
+* @details A writer modifies a watched file and waits until the callback
+* saw the event before it writes the next one. The events come in bursts,
+* an idle gap between the bursts lets the watcher fall back to blocking.
+* The latency runs from just before the write() to the start of the
+* callback. Compared are the blocking poll(), busy polling after activity
+* and busy polling with the watcher pinned to a core. The CPU time of the
+* process per event shows what the spinning costs.
+****************************************************************************/
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fswatch.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string root{"/tmp/bench_busypoll"};
+  size_t events{20000};
+  size_t burst{16};
+  long gap_us{1000};
+  long spin_us{50};
+  int cpu{0};
+};
+
+static double CpuSeconds() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+         static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void Run(const Options &options, const char *name, long spin_us, int cpu) {
+  std::atomic<int64_t> written_at{0};
+  std::atomic<uint64_t> seen{0};
+  std::vector<double> latencies;
+  latencies.reserve(options.events);
+
+  fswatch watcher(options.root);
+  watcher.on(fswatch::Event::FILE_MODIFIED, [&](const fswatch::EventInfo &) {
+    auto now = Clock::now().time_since_epoch().count();
+    latencies.push_back(static_cast<double>(now - written_at.load(std::memory_order_acquire)) / 1000.0);
+    seen.fetch_add(1, std::memory_order_release);
+    seen.notify_one();
+  });
+  watcher.busy_poll(std::chrono::microseconds(spin_us), cpu);
+  watcher.run_async();
+  // let the watcher reach poll()
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  auto path = options.root + "/file";
+  int fd = open(path.c_str(), O_WRONLY);
+  auto cpu_start = CpuSeconds();
+  auto start = Clock::now();
+  for (uint64_t event = 0; event < options.events; ++event) {
+    if (event % options.burst == 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(options.gap_us));
+    }
+    written_at.store(Clock::now().time_since_epoch().count(), std::memory_order_release);
+    if (pwrite(fd, "x", 1, 0) != 1) {
+      break;
+    }
+    seen.wait(event);
+  }
+  auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  auto cpu_used = CpuSeconds() - cpu_start;
+  close(fd);
+  watcher.join();
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double p) {
+    return latencies.empty() ? 0.0 : latencies[static_cast<size_t>(p * static_cast<double>(latencies.size() - 1))];
+  };
+  printf("%-8s events %6zu  p50 %7.1f us  p99 %7.1f us  p99.9 %7.1f us  cpu %5.1f%%\n", name, latencies.size(),
+         percentile(0.5), percentile(0.99), percentile(0.999), 100.0 * cpu_used / elapsed);
+}
+
+static void ViewHelp(const char *prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -r, --root=DIR         scratch directory, default /tmp/bench_busypoll\n"
+         "  -e, --events=N         events per mode, default 20000\n"
+         "  -b, --burst=N          events per burst, default 16\n"
+         "  -g, --gap=US           idle time between the bursts, default 1000\n"
+         "  -s, --spin=US          busy poll budget after activity, default 50\n"
+         "  -c, --cpu=N            core of the pinned watcher, default 0\n",
+         prog);
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"root", required_argument, 0, 'r'},
+      {"events", required_argument, 0, 'e'},
+      {"burst", required_argument, 0, 'b'},
+      {"gap", required_argument, 0, 'g'},
+      {"spin", required_argument, 0, 's'},
+      {"cpu", required_argument, 0, 'c'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "r:e:b:g:s:c:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'r':
+        options.root = optarg;
+        break;
+      case 'e':
+        options.events = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'b':
+        options.burst = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'g':
+        options.gap_us = std::stol(optarg);
+        break;
+      case 's':
+        options.spin_us = std::max<long>(1, std::stol(optarg));
+        break;
+      case 'c':
+        options.cpu = std::stoi(optarg);
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  std::filesystem::remove_all(options.root);
+  std::filesystem::create_directories(options.root);
+  if (int fd = open((options.root + "/file").c_str(), O_CREAT | O_WRONLY, 0644); fd >= 0) {
+    close(fd);
+  }
+  printf("cores %u, bursts of %zu events, %ld us apart\n", std::thread::hardware_concurrency(), options.burst,
+         options.gap_us);
+  Run(options, "blocking", 0, -1);
+  Run(options, "spin", options.spin_us, -1);
+  Run(options, "pinned", options.spin_us, options.cpu);
+  std::filesystem::remove_all(options.root);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,259 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Coroutine event loop versus thread per task.
+* @details Two workloads, each run in both models:
+* - timer: every task restarts a StopTimer with a period and waits for its
+*   expiry; reports ticks and wakeup lateness.
+* - context: every task serves a ConcreteContext, a notifier wakes all of
+*   them periodically like filesystem events do in the state demo.
+* For both the process CPU time, context switches and max RSS are reported.
+****************************************************************************/
+
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "contextAsync.hpp"
+#include "contextConcrete.hpp"
+#include "eventLoop.hpp"
+#include "stopTimer.hpp"
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  size_t tasks{1000};
+  std::chrono::milliseconds period{10ms};
+  std::chrono::seconds duration{3s};
+};
+
+struct Result {
+  uint64_t work{0};          ///< ticks or serves
+  uint64_t lateness_us{0};   ///< sum of wakeup lateness
+};
+
+static void Report(const char* name, const Options& options, const Result& result, Clock::duration wall) {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  auto cpu = usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3 + usage.ru_stime.tv_sec * 1e3 +
+             usage.ru_stime.tv_usec / 1e3;
+  printf("%-22s tasks %6zu  work %9lu  avg late %7.1f us  wall %6.0f ms  cpu %7.1f ms  "
+         "csw vol %8ld invol %6ld  maxrss %7ld KiB\n",
+         name, options.tasks, result.work, result.work ? double(result.lateness_us) / result.work : 0.0,
+         std::chrono::duration<double, std::milli>(wall).count(), cpu, usage.ru_nvcsw, usage.ru_nivcsw,
+         usage.ru_maxrss);
+}
+
+//-----------------------------------------------------------------------------
+// timer workload
+//-----------------------------------------------------------------------------
+
+static Result TimerThreads(const Options& options) {
+  std::atomic<uint64_t> work{0}, lateness{0};
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < options.tasks; ++i) {
+    threads.emplace_back([&] {
+      watch::TimerMs timer;
+      while (!stop.load(std::memory_order_relaxed)) {
+        auto deadline = Clock::now() + options.period;
+        timer.Start(options.period);
+        while (!timer.IsElapsed().value_or(true)) {
+          std::this_thread::sleep_for(timer.LeftTime() + 1ms);
+        }
+        work.fetch_add(1, std::memory_order_relaxed);
+        lateness.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - deadline).count(),
+                           std::memory_order_relaxed);
+      }
+    });
+  }
+  std::this_thread::sleep_for(options.duration);
+  stop = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return {work, lateness};
+}
+
+static Result TimerCoroutines(const Options& options) {
+  watch::EventLoop loop;
+  Result result;
+  auto task = [](watch::EventLoop& loop, const Options& options, Result& result) -> watch::Task<> {
+    watch::AsyncTimer timer(loop);
+    while (!loop.IsStopping()) {
+      auto deadline = Clock::now() + options.period;
+      timer.Start(options.period);
+      co_await timer.Expiry();
+      if (loop.IsStopping()) {
+        break;
+      }
+      result.work++;
+      result.lateness_us += std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - deadline).count();
+    }
+  };
+  for (size_t i = 0; i < options.tasks; ++i) {
+    loop.Spawn(task(loop, options, result));
+  }
+  std::thread stopper([&] {
+    std::this_thread::sleep_for(options.duration);
+    loop.Stop();
+  });
+  loop.Run();
+  stopper.join();
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// context workload
+//-----------------------------------------------------------------------------
+
+static Result ContextThreads(const Options& options) {
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::atomic<uint64_t> work{0};
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < options.tasks; ++i) {
+    threads.emplace_back([&] {
+      state::ConcreteContext context;
+      while (!stop.load(std::memory_order_relaxed)) {
+        auto sooner = context.Serve(4000ms);
+        work.fetch_add(1, std::memory_order_relaxed);
+        std::unique_lock lck(mutex);
+        condition.wait_for(lck, std::max(sooner, 1ms));
+      }
+    });
+  }
+  for (auto end = Clock::now() + options.duration; Clock::now() < end;) {
+    std::this_thread::sleep_for(options.period);
+    std::lock_guard lck(mutex);
+    condition.notify_all();
+  }
+  stop = true;
+  {
+    std::lock_guard lck(mutex);
+    condition.notify_all();
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return {work, 0};
+}
+
+static Result ContextCoroutines(const Options& options) {
+  watch::EventLoop loop;
+  watch::AsyncEvent wakeup(loop);
+  std::vector<state::ConcreteContext> contexts(options.tasks);
+  Result result;
+  auto serve = [](watch::EventLoop& loop, state::ConcreteContext& context, watch::AsyncEvent& wakeup,
+                  Result& result) -> watch::Task<> {
+    while (!loop.IsStopping()) {
+      auto sooner = context.Serve(4000ms);
+      result.work++;
+      co_await wakeup.Wait(std::max(sooner, 1ms));
+    }
+  };
+  auto notifier = [](watch::EventLoop& loop, watch::AsyncEvent& wakeup, const Options& options) -> watch::Task<> {
+    for (auto end = Clock::now() + options.duration; Clock::now() < end;) {
+      co_await loop.SleepFor(options.period);
+      wakeup.Notify();
+    }
+    loop.Stop();
+  };
+  for (auto& context : contexts) {
+    loop.Spawn(serve(loop, context, wakeup, result));
+  }
+  loop.Spawn(notifier(loop, wakeup, options));
+  loop.Run();
+  return result;
+}
+
+static void ViewHelp(const char* prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -m, --mode=MODE        threads, coroutines or both, default both\n"
+         "  -w, --workload=NAME    timer or context, default timer\n"
+         "  -t, --tasks=N          number of tasks, default 1000\n"
+         "  -p, --period-ms=N      timer period / notify period, default 10\n"
+         "  -s, --seconds=N        duration, default 3\n",
+         prog);
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  std::string mode = "both";
+  std::string workload = "timer";
+  static const struct option long_options[] = {
+      {"mode", required_argument, 0, 'm'},     {"workload", required_argument, 0, 'w'},
+      {"tasks", required_argument, 0, 't'},    {"period-ms", required_argument, 0, 'p'},
+      {"seconds", required_argument, 0, 's'},  {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "m:w:t:p:s:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'm':
+        mode = optarg;
+        break;
+      case 'w':
+        workload = optarg;
+        break;
+      case 't':
+        options.tasks = std::stoul(optarg);
+        break;
+      case 'p':
+        options.period = std::chrono::milliseconds(std::stoul(optarg));
+        break;
+      case 's':
+        options.duration = std::chrono::seconds(std::stoul(optarg));
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  spdlog::set_level(spdlog::level::warn);
+
+  // rusage is process wide, so run one model per process when comparing
+  if (mode == "both") {
+    for (const char* run : {"threads", "coroutines"}) {
+      std::string command = std::string(argv[0]) + " -m " + run + " -w " + workload + " -t " +
+                            std::to_string(options.tasks) + " -p " + std::to_string(options.period.count()) + " -s " +
+                            std::to_string(options.duration.count());
+      if (std::system(command.c_str()) != 0) {
+        return EXIT_FAILURE;
+      }
+    }
+    return EXIT_SUCCESS;
+  }
+
+  auto start = Clock::now();
+  bool threads = mode == "threads";
+  Result result;
+  if (workload == "context") {
+    result = threads ? ContextThreads(options) : ContextCoroutines(options);
+  } else {
+    result = threads ? TimerThreads(options) : TimerCoroutines(options);
+  }
+  Report((workload + "/" + mode).c_str(), options, result, Clock::now() - start);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,219 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Multi consumer throughput of the event bus.
+* @details P producers publish small events, every one of C consumers must
+* see every event. Compared are:
+* - locked: one mutex and condition variable, a queue per consumer, the way
+*   the global event structs connected the tasks;
+* - ring: a topic of watch::EventBus, consumers read in batches and sleep
+*   on the ring when it is empty.
+* Reported are the delivered events per second (events x consumers) and the
+* mean batch size of a consumer read.
+****************************************************************************/
+
+#include <getopt.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "eventBus.hpp"
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+struct Options {
+  size_t producers{2};
+  size_t consumers{4};
+  size_t events{2'000'000};
+  size_t capacity{4096};
+};
+
+struct Sample {
+  uint64_t producer;
+  uint64_t number;
+};
+
+struct Result {
+  double seconds;
+  uint64_t delivered;
+  uint64_t reads;
+  uint64_t checksum;
+};
+
+static void Print(const char* name, const Options& options, const Result& result) {
+  printf("%-7s producers %zu  consumers %zu  delivered/s %10.0f  batch %7.1f  (%llu)\n", name, options.producers,
+         options.consumers, result.delivered / result.seconds,
+         result.reads ? static_cast<double>(result.delivered) / result.reads : 0.0,
+         static_cast<unsigned long long>(result.checksum));
+}
+
+static Result RunLocked(const Options& options) {
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::vector<std::deque<Sample>> queues(options.consumers);
+  std::atomic<uint64_t> delivered{0};
+  std::atomic<uint64_t> reads{0};
+  std::atomic<uint64_t> checksum{0};
+  auto per_producer = options.events / options.producers;
+  auto expected = per_producer * options.producers;
+
+  auto start = Clock::now();
+  std::vector<std::thread> threads;
+  for (size_t consumer = 0; consumer < options.consumers; ++consumer) {
+    threads.emplace_back([&, consumer]() {
+      uint64_t seen = 0;
+      uint64_t sum = 0;
+      std::deque<Sample> batch;
+      while (seen < expected) {
+        {
+          std::unique_lock lock(mutex);
+          condition.wait(lock, [&]() { return !queues[consumer].empty(); });
+          batch.swap(queues[consumer]);
+        }
+        // producers wait on the same condition for space
+        condition.notify_all();
+        reads.fetch_add(1, std::memory_order_relaxed);
+        for (auto& sample : batch) {
+          sum += sample.number;
+        }
+        seen += batch.size();
+        batch.clear();
+      }
+      delivered.fetch_add(seen);
+      checksum.fetch_add(sum);
+    });
+  }
+  for (size_t producer = 0; producer < options.producers; ++producer) {
+    threads.emplace_back([&, producer]() {
+      for (uint64_t number = 0; number < per_producer; ++number) {
+        {
+          std::unique_lock lock(mutex);
+          condition.wait(lock, [&]() {
+            for (auto& queue : queues) {
+              if (queue.size() >= options.capacity) {
+                return false;
+              }
+            }
+            return true;
+          });
+          for (auto& queue : queues) {
+            queue.push_back(Sample{producer, number});
+          }
+        }
+        condition.notify_all();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return Result{std::chrono::duration<double>(Clock::now() - start).count(), delivered.load(), reads.load(),
+                checksum.load()};
+}
+
+static Result RunRing(const Options& options) {
+  watch::EventBus bus(options.capacity);
+  auto& topic = bus.Topic<Sample>();
+  std::atomic<uint64_t> delivered{0};
+  std::atomic<uint64_t> reads{0};
+  std::atomic<uint64_t> checksum{0};
+  auto per_producer = options.events / options.producers;
+  auto expected = per_producer * options.producers;
+
+  // subscribe before any producer runs
+  std::vector<watch::BroadcastRing<Sample>::Subscriber> subscribers;
+  for (size_t consumer = 0; consumer < options.consumers; ++consumer) {
+    subscribers.push_back(bus.Subscribe<Sample>());
+  }
+
+  auto start = Clock::now();
+  std::vector<std::thread> threads;
+  for (auto& subscriber : subscribers) {
+    threads.emplace_back([&]() {
+      uint64_t seen = 0;
+      uint64_t sum = 0;
+      while (seen < expected) {
+        auto count = subscriber.Poll([&](const Sample& sample, uint64_t) { sum += sample.number; });
+        if (count == 0) {
+          subscriber.Wait(10ms);
+          continue;
+        }
+        reads.fetch_add(1, std::memory_order_relaxed);
+        seen += count;
+      }
+      delivered.fetch_add(seen);
+      checksum.fetch_add(sum);
+    });
+  }
+  for (size_t producer = 0; producer < options.producers; ++producer) {
+    threads.emplace_back([&, producer]() {
+      for (uint64_t number = 0; number < per_producer; ++number) {
+        topic.Publish(Sample{producer, number});
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return Result{std::chrono::duration<double>(Clock::now() - start).count(), delivered.load(), reads.load(),
+                checksum.load()};
+}
+
+static void ViewHelp(const char* prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -p, --producers=N      producer threads, default 2\n"
+         "  -c, --consumers=N      consumer threads, default 4\n"
+         "  -e, --events=N         events published, default 2000000\n"
+         "  -q, --capacity=N       ring slots and queue limit, default 4096\n",
+         prog);
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"producers", required_argument, 0, 'p'},
+      {"consumers", required_argument, 0, 'c'},
+      {"events", required_argument, 0, 'e'},
+      {"capacity", required_argument, 0, 'q'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "p:c:e:q:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'p':
+        options.producers = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'c':
+        options.consumers = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'e':
+        options.events = std::stoul(optarg);
+        break;
+      case 'q':
+        options.capacity = std::max<size_t>(2, std::stoul(optarg));
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  Print("locked", options, RunLocked(options));
+  Print("ring", options, RunRing(options));
+  return EXIT_SUCCESS;
+}
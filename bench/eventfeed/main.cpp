@@ -0,0 +1,207 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Cost of the shared memory event feed.
+* @details Measured are:
+* - publish: Publish() without consumers, what the watcher thread pays;
+* - fanout: 1, 2, 4 ... subscriber processes reading a producer that
+*   publishes at full speed, events read and lost per subscriber;
+* - wakeup: one event every interval to sleeping subscriber processes, time
+*   from Publish() to the subscriber holding the event.
+****************************************************************************/
+
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "eventFeed.hpp"
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+struct Options {
+  size_t events{2000000};
+  size_t subscribers{4};
+  size_t wakeups{2000};
+};
+
+/**
+ * @brief what a subscriber process reports, in memory shared with the parent
+ */
+struct Report {
+  uint64_t events;
+  uint64_t lost;
+  uint64_t resyncs;
+  uint64_t latency_ns;
+};
+
+static const char *kPath = "/srv/data/some/directory/file.name";
+
+static double PublishNanoseconds(const std::string &name, size_t events) {
+  watch::FeedPublisher feed(name);
+  auto start = Clock::now();
+  for (size_t event = 0; event < events; ++event) {
+    feed.Publish(fswatch_types::Event::FILE_MODIFIED, kPath);
+  }
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / static_cast<double>(events);
+}
+
+/**
+ * @brief child: read until the feed closes; with timed, the path holds the publish time
+ */
+static void Subscribe(const std::string &name, Report &report, bool timed) {
+  watch::FeedSubscriber subscriber(name);
+  watch::FeedSubscriber::Record record{};
+  Report result{};
+  for (;;) {
+    auto status = subscriber.Next(record, 1s);
+    if (status == watch::FeedSubscriber::Status::Closed) {
+      break;
+    }
+    if (status == watch::FeedSubscriber::Status::Event) {
+      result.events++;
+      if (timed) {
+        auto now = Clock::now().time_since_epoch().count();
+        result.latency_ns += static_cast<uint64_t>(now - std::stoll(std::string(record.path)));
+      }
+    } else if (status == watch::FeedSubscriber::Status::Resync) {
+      result.resyncs++;
+    }
+  }
+  result.lost = subscriber.Lost();
+  report = result;
+}
+
+/**
+ * @brief parent: start the subscribers, publish with publish(feed), collect the reports
+ */
+template <typename TPublish>
+static std::vector<Report> Run(const std::string &name, size_t subscribers, bool timed, TPublish &&publish) {
+  auto *reports = static_cast<Report *>(
+      mmap(nullptr, sizeof(Report) * subscribers, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+  std::vector<pid_t> children;
+  {
+    watch::FeedPublisher feed(name);
+    for (size_t child = 0; child < subscribers; ++child) {
+      if (auto pid = fork(); pid == 0) {
+        Subscribe(name, reports[child], timed);
+        _exit(EXIT_SUCCESS);
+      } else {
+        children.push_back(pid);
+      }
+    }
+    for (size_t attached = 0; attached < subscribers;) {
+      std::this_thread::sleep_for(1ms);
+      attached = 0;
+      feed.ForEachConsumer([&attached](int64_t, uint64_t, uint64_t, uint64_t) { attached++; });
+    }
+    publish(feed);
+  }
+  for (auto pid : children) {
+    waitpid(pid, nullptr, 0);
+  }
+  std::vector<Report> result(reports, reports + subscribers);
+  munmap(reports, sizeof(Report) * subscribers);
+  return result;
+}
+
+static void ViewHelp(const char *prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -e, --events=N         events published, default 2000000\n"
+         "  -s, --subscribers=N    max. number of subscriber processes, default 4\n"
+         "  -w, --wakeups=N        events published one by one to sleeping subscribers, default 2000\n",
+         prog);
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"events", required_argument, 0, 'e'},
+      {"subscribers", required_argument, 0, 's'},
+      {"wakeups", required_argument, 0, 'w'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "e:s:w:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'e':
+        options.events = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 's':
+        options.subscribers = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'w':
+        options.wakeups = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  auto name = "/fswatch_feed_bench." + std::to_string(getpid());
+  printf("publish                 %6.2f ns/event\n", PublishNanoseconds(name, options.events));
+
+  for (size_t subscribers = 1;; subscribers = std::min(subscribers * 2, options.subscribers)) {
+    double seconds = 0;
+    auto reports = Run(name, subscribers, false, [&options, &seconds](watch::FeedPublisher &feed) {
+      auto start = Clock::now();
+      for (size_t event = 0; event < options.events; ++event) {
+        feed.Publish(fswatch_types::Event::FILE_MODIFIED, kPath);
+      }
+      seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    });
+    uint64_t read = 0, lost = 0, resyncs = 0;
+    for (auto &report : reports) {
+      read += report.events;
+      lost += report.lost;
+      resyncs += report.resyncs;
+    }
+    printf("fanout   subscribers %2zu  %6.2f Mevents/s published, per subscriber %5.1f%% read, %llu lost in %.1f resyncs\n",
+           subscribers, static_cast<double>(options.events) / seconds / 1e6,
+           100.0 * static_cast<double>(read) / static_cast<double>(options.events * subscribers),
+           static_cast<unsigned long long>(lost / subscribers), static_cast<double>(resyncs) / static_cast<double>(subscribers));
+    if (subscribers == options.subscribers) {
+      break;
+    }
+  }
+
+  for (size_t subscribers = 1;; subscribers = std::min(subscribers * 2, options.subscribers)) {
+    auto reports = Run(name, subscribers, true, [&options](watch::FeedPublisher &feed) {
+      for (size_t event = 0; event < options.wakeups; ++event) {
+        // long enough for every subscriber to go back to sleep
+        std::this_thread::sleep_for(200us);
+        feed.Publish(fswatch_types::Event::FILE_MODIFIED, std::to_string(Clock::now().time_since_epoch().count()));
+      }
+    });
+    uint64_t events = 0, latency = 0;
+    for (auto &report : reports) {
+      events += report.events;
+      latency += report.latency_ns;
+    }
+    printf("wakeup   subscribers %2zu  %6.2f us publish to read, %llu of %zu read\n", subscribers,
+           static_cast<double>(latency) / static_cast<double>(std::max<uint64_t>(events, 1)) / 1e3,
+           static_cast<unsigned long long>(events), options.wakeups * subscribers);
+    if (subscribers == options.subscribers) {
+      break;
+    }
+  }
+  return EXIT_SUCCESS;
+}
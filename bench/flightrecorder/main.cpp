@@ -0,0 +1,127 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Cost of the always-on flight recorder.
+* @details Measured are:
+* - closed: Record() while the recorder is not open, what a build pays that
+*   never opens it;
+* - record: Record() on 1, 2, 4 ... threads, each on a ring of its own;
+* - contexts: the simulated concrete contexts without and with recording,
+*   every serve that changes the state or expires the timer writes a record.
+****************************************************************************/
+
+#include <getopt.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "contextSimulation.hpp"
+#include "flightRecorder.hpp"
+
+using Clock = std::chrono::steady_clock;
+using logging::FlightRecorder;
+
+struct Options {
+  size_t records{10000000};
+  size_t threads{4};
+  size_t contexts{10000};
+};
+
+static double RecordNanoseconds(size_t records) {
+  auto& recorder = FlightRecorder::Instance();
+  auto start = Clock::now();
+  for (size_t record = 0; record < records; ++record) {
+    recorder.Record(logging::flight::Kind::Transition, record, 1, 2, 500);
+  }
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / static_cast<double>(records);
+}
+
+static double Simulate(size_t contexts) {
+  auto start = Clock::now();
+  state::ContextSimulation simulation(contexts);
+  auto result = simulation.Run(std::chrono::minutes(10));
+  return static_cast<double>(result.serves) / std::chrono::duration<double>(Clock::now() - start).count() / 1e6;
+}
+
+static void ViewHelp(const char *prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -r, --records=N        records per thread, default 10000000\n"
+         "  -t, --threads=N        max. number of recording threads, default 4\n"
+         "  -c, --contexts=N       simulated contexts, default 10000\n",
+         prog);
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"records", required_argument, 0, 'r'},
+      {"threads", required_argument, 0, 't'},
+      {"contexts", required_argument, 0, 'c'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "r:t:c:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'r':
+        options.records = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 't':
+        options.threads = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'c':
+        options.contexts = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  auto &recorder = FlightRecorder::Instance();
+  printf("closed   threads  1  %6.2f ns/record\n", RecordNanoseconds(options.records));
+
+  auto name = logging::flight::Name(getpid()) + ".bench";
+  recorder.Open(name, static_cast<uint32_t>(options.threads));
+  for (size_t threads = 1;; threads = std::min(threads * 2, options.threads)) {
+    std::vector<double> costs(threads);
+    std::vector<std::thread> workers;
+    for (size_t thread = 0; thread < threads; ++thread) {
+      workers.emplace_back([&costs, thread, &options]() { costs[thread] = RecordNanoseconds(options.records); });
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+    double sum = 0;
+    for (auto cost : costs) {
+      sum += cost;
+    }
+    printf("record   threads %2zu  %6.2f ns/record\n", threads, sum / static_cast<double>(threads));
+    if (threads == options.threads) {
+      break;
+    }
+  }
+
+  // the states log every transition
+  spdlog::set_level(spdlog::level::warn);
+  recorder.Close();
+  auto plain = Simulate(options.contexts);
+  recorder.Open(name);
+  auto recorded = Simulate(options.contexts);
+  recorder.Close();
+  printf("contexts %zu  %6.2f M serves/s without, %6.2f M serves/s with recording\n", options.contexts, plain,
+         recorded);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,249 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Heap allocations and RSS of fswatch while a large tree is created.
+* @details A watcher observes an empty directory, then the benchmark creates
+* the subdirectories (each one becomes a watch) and the files in them,
+* draining the inotify fd as it goes. Every event has a callback that looks
+* at the path. Reported per phase:
+* - heap allocations and bytes per raw inotify event;
+* - RSS growth of the process;
+* - time per event spent in read_events(), the filesystem calls excluded.
+* Allocations are counted by replacing all global operator new and delete.
+****************************************************************************/
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <new>
+#include <string>
+
+#include "fswatch.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<size_t> heap_allocations{0};
+static std::atomic<size_t> heap_bytes{0};
+static Clock::duration dispatch_time{};
+
+// the complete set of the replaceable allocation functions, every new and delete
+// of the program goes through the counted malloc() and free()
+static void* Allocate(size_t size, size_t alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__) noexcept {
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  heap_bytes.fetch_add(size, std::memory_order_relaxed);
+  size = std::max<size_t>(size, 1);
+  if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    return std::malloc(size);
+  }
+  // aligned_alloc() wants a multiple of the alignment
+  return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+static void* AllocateOrThrow(size_t size, size_t alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+  if (auto* memory = Allocate(size, alignment)) {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new(size_t size) {
+  return AllocateOrThrow(size);
+}
+void* operator new[](size_t size) {
+  return AllocateOrThrow(size);
+}
+void* operator new(size_t size, std::align_val_t alignment) {
+  return AllocateOrThrow(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+  return AllocateOrThrow(size, static_cast<size_t>(alignment));
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  return Allocate(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  return Allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* memory) noexcept {
+  std::free(memory);
+}
+void operator delete[](void* memory) noexcept {
+  std::free(memory);
+}
+void operator delete(void* memory, size_t) noexcept {
+  std::free(memory);
+}
+void operator delete[](void* memory, size_t) noexcept {
+  std::free(memory);
+}
+void operator delete(void* memory, std::align_val_t) noexcept {
+  std::free(memory);
+}
+void operator delete[](void* memory, std::align_val_t) noexcept {
+  std::free(memory);
+}
+void operator delete(void* memory, size_t, std::align_val_t) noexcept {
+  std::free(memory);
+}
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept {
+  std::free(memory);
+}
+void operator delete(void* memory, const std::nothrow_t&) noexcept {
+  std::free(memory);
+}
+void operator delete[](void* memory, const std::nothrow_t&) noexcept {
+  std::free(memory);
+}
+void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept {
+  std::free(memory);
+}
+void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept {
+  std::free(memory);
+}
+
+struct Options {
+  std::string dir{"/tmp/bench_fspaths"};
+  size_t dirs{1000};
+  size_t files{1000};
+};
+
+/**
+ * @brief resident set size in KiB
+ */
+static long Rss() {
+  long pages = 0, resident = 0;
+  if (FILE* statm = fopen("/proc/self/statm", "r")) {
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+      resident = 0;
+    }
+    fclose(statm);
+  }
+  return resident * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+/**
+ * @brief state at the start of a phase
+ */
+struct Mark {
+  size_t allocations{heap_allocations.load()};
+  size_t bytes{heap_bytes.load()};
+  long rss{Rss()};
+  uint64_t events{0};
+  Clock::duration dispatch{dispatch_time};
+};
+
+static void Report(const char* name, const Mark& mark, uint64_t events) {
+  auto elapsed = dispatch_time - mark.dispatch;
+  auto count = static_cast<double>(std::max<uint64_t>(events - mark.events, 1));
+  printf("%-6s events %9lu  %6.2f allocs/event  %7.1f B/event  rss +%8ld KiB (%8ld KiB)  %6.0f ns/event\n", name,
+         events - mark.events, (heap_allocations.load() - mark.allocations) / count,
+         (heap_bytes.load() - mark.bytes) / count, Rss() - mark.rss, Rss(),
+         std::chrono::duration<double, std::nano>(elapsed).count() / count);
+}
+
+static void Drain(fswatch& watcher) {
+  auto start = Clock::now();
+  while (watcher.read_events() > 0) {
+  }
+  dispatch_time += Clock::now() - start;
+}
+
+static void ViewHelp(const char* prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -d, --dir=PATH         directory to create the tree in, default /tmp/bench_fspaths\n"
+         "  -n, --dirs=N           number of subdirectories, default 1000\n"
+         "  -f, --files=N          number of files per subdirectory, default 1000\n",
+         prog);
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"dir", required_argument, 0, 'd'},
+      {"dirs", required_argument, 0, 'n'},
+      {"files", required_argument, 0, 'f'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "d:n:f:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'd':
+        options.dir = optarg;
+        break;
+      case 'n':
+        options.dirs = std::stoul(optarg);
+        break;
+      case 'f':
+        options.files = std::stoul(optarg);
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  std::filesystem::remove_all(options.dir);
+  std::filesystem::create_directories(options.dir);
+
+  fswatch watcher(options.dir);
+  size_t path_bytes = 0;
+  watcher.on({fswatch::Event::FILE_CREATED, fswatch::Event::FILE_OPENED, fswatch::Event::FILE_MODIFIED,
+              fswatch::Event::FILE_CLOSED, fswatch::Event::FILE_DELETED, fswatch::Event::DIR_CREATED,
+              fswatch::Event::DIR_OPENED, fswatch::Event::DIR_MODIFIED, fswatch::Event::DIR_CLOSED,
+              fswatch::Event::DIR_DELETED},
+             [&path_bytes](const fswatch::EventInfo& event) { path_bytes += event.path.native().size(); });
+  watcher.init();
+
+  // one watch per subdirectory
+  Mark dirs;
+  char name[64];
+  for (size_t d = 0; d < options.dirs; ++d) {
+    snprintf(name, sizeof(name), "%s/dir%06zu", options.dir.c_str(), d);
+    ::mkdir(name, 0755);
+    if (d % 1000 == 999) {
+      Drain(watcher);
+    }
+  }
+  Drain(watcher);
+  Report("dirs", dirs, watcher.counters().events_read);
+
+  // create, open and close events of every file
+  Mark files;
+  files.events = watcher.counters().events_read;
+  for (size_t d = 0; d < options.dirs; ++d) {
+    for (size_t f = 0; f < options.files; ++f) {
+      snprintf(name, sizeof(name), "%s/dir%06zu/file%06zu", options.dir.c_str(), d, f);
+      ::close(::open(name, O_CREAT | O_WRONLY, 0644));
+    }
+    Drain(watcher);
+  }
+  Report("files", files, watcher.counters().events_read);
+
+  auto counters = watcher.counters();
+  printf("watches %lu  callbacks %lu  path bytes %zu\n", counters.watches, counters.callbacks, path_bytes);
+  watcher.cleanup();
+  std::filesystem::remove_all(options.dir);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,322 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Dispatch cost of the hierarchical state machine versus flat states.
+* @details The same behaviour (four states in a ring, events next, tick, reset
+* and an ignored one) is implemented three times:
+* - classic: flat state pattern, every transition allocates the next state
+*   like ConcreteContext does;
+* - flat: StateMachine with four top level states, every state handles all
+*   events itself;
+* - nested: StateMachine with root / two groups / four leaves, tick is
+*   handled by the group, reset by the root and the ignored event bubbles
+*   through all levels.
+* Events are dispatched round robin over many contexts so that the state
+* storage does not fit into L1.
+****************************************************************************/
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hsm.hpp"
+#include "state.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+enum class Event : uint8_t { Next, Tick, Reset, Ignored };
+
+struct Counters {
+  uint64_t ticks{0};
+  uint64_t enters{0};
+  uint64_t exits{0};
+};
+
+//-----------------------------------------------------------------------------
+// classic flat state pattern
+//-----------------------------------------------------------------------------
+
+class Classic : public state::State<Counters> {
+ public:
+  using state::State<Counters>::State;
+  using Next = std::unique_ptr<Classic> (*)(Counters* context);
+  [[nodiscard]] std::optional<Transition> DoServe() override {
+    return std::nullopt;
+  }
+  [[nodiscard]] virtual std::optional<Next> Handle(Event event) = 0;
+  void DoExit() override {
+    m_contextPtr->exits++;
+  }
+
+ protected:
+  void DoEnter() override {
+    m_contextPtr->enters++;
+  }
+};
+
+template <int N>
+class ClassicLeaf : public Classic {
+ public:
+  explicit ClassicLeaf(Counters* context) : Classic(context) {
+    DoEnter();
+  }
+  [[nodiscard]] std::optional<Next> Handle(Event event) override {
+    switch (event) {
+      case Event::Next:
+        return [](Counters* context) -> std::unique_ptr<Classic> {
+          return std::make_unique<ClassicLeaf<(N + 1) % 4>>(context);
+        };
+      case Event::Tick:
+        m_contextPtr->ticks++;
+        return std::nullopt;
+      case Event::Reset:
+        return [](Counters* context) -> std::unique_ptr<Classic> { return std::make_unique<ClassicLeaf<0>>(context); };
+      default:
+        return std::nullopt;
+    }
+  }
+};
+
+struct ClassicContext {
+  Counters counters;
+  std::unique_ptr<Classic> state{std::make_unique<ClassicLeaf<0>>(&counters)};
+
+  void Dispatch(Event event) {
+    if (auto next = state->Handle(event); next.has_value()) {
+      state->DoExit();
+      state.reset();
+      state = (*next)(&counters);
+    }
+  }
+};
+
+//-----------------------------------------------------------------------------
+// hierarchical machine
+//-----------------------------------------------------------------------------
+
+using HState = state::HierarchicalState<Counters, Event>;
+using Chart = state::StateChart<Counters, Event>;
+using Machine = state::StateMachine<Counters, Event>;
+
+// ids are assigned in the order the states are added to the chart
+struct Ids {
+  static inline state::StateId leaf[4];
+};
+
+class Counted : public HState {
+ public:
+  using HState::HState;
+
+ protected:
+  void DoEnter() override {
+    m_contextPtr->enters++;
+  }
+  void DoExit() override {
+    m_contextPtr->exits++;
+  }
+};
+
+template <int N>
+class FlatLeaf : public Counted {
+ public:
+  using Counted::Counted;
+  [[nodiscard]] state::Reaction DoHandle(const Event& event) override {
+    switch (event) {
+      case Event::Next:
+        return TransitionTo(Ids::leaf[(N + 1) % 4]);
+      case Event::Tick:
+        m_contextPtr->ticks++;
+        return Handled();
+      case Event::Reset:
+        return TransitionTo(Ids::leaf[0]);
+      default:
+        return Unhandled();
+    }
+  }
+};
+
+class Root : public Counted {
+ public:
+  using Counted::Counted;
+  [[nodiscard]] state::Reaction DoHandle(const Event& event) override {
+    return event == Event::Reset ? TransitionTo(Ids::leaf[0]) : Unhandled();
+  }
+};
+
+class Group : public Counted {
+ public:
+  using Counted::Counted;
+  [[nodiscard]] state::Reaction DoHandle(const Event& event) override {
+    if (event == Event::Tick) {
+      m_contextPtr->ticks++;
+      return Handled();
+    }
+    return Unhandled();
+  }
+};
+
+template <int N>
+class NestedLeaf : public Counted {
+ public:
+  using Counted::Counted;
+  [[nodiscard]] state::Reaction DoHandle(const Event& event) override {
+    return event == Event::Next ? TransitionTo(Ids::leaf[(N + 1) % 4]) : Unhandled();
+  }
+};
+
+static std::shared_ptr<const Chart> FlatChart() {
+  auto chart = std::make_shared<Chart>();
+  Ids::leaf[0] = chart->Add<FlatLeaf<0>>();
+  Ids::leaf[1] = chart->Add<FlatLeaf<1>>();
+  Ids::leaf[2] = chart->Add<FlatLeaf<2>>();
+  Ids::leaf[3] = chart->Add<FlatLeaf<3>>();
+  return chart;
+}
+
+static std::shared_ptr<const Chart> NestedChart() {
+  auto chart = std::make_shared<Chart>();
+  auto root = chart->Add<Root>();
+  auto first = chart->Add<Group>(root, true);
+  auto second = chart->Add<Group>(root, true);
+  Ids::leaf[0] = chart->Add<NestedLeaf<0>>(first);
+  Ids::leaf[1] = chart->Add<NestedLeaf<1>>(first);
+  Ids::leaf[2] = chart->Add<NestedLeaf<2>>(second);
+  Ids::leaf[3] = chart->Add<NestedLeaf<3>>(second);
+  return chart;
+}
+
+struct HsmContext {
+  Counters counters;
+  Machine machine;
+
+  explicit HsmContext(std::shared_ptr<const Chart> chart) : machine(std::move(chart), &counters) {}
+
+  void Dispatch(Event event) {
+    machine.Dispatch(event);
+  }
+};
+
+//-----------------------------------------------------------------------------
+// driver
+//-----------------------------------------------------------------------------
+
+struct Options {
+  size_t contexts{1000};
+  size_t events{10'000'000};
+  unsigned next_percent{20};
+};
+
+static std::vector<Event> MakeEvents(const Options& options) {
+  std::mt19937 random(1);
+  std::uniform_int_distribution<unsigned> percent(0, 99);
+  std::vector<Event> events(options.events);
+  for (auto& event : events) {
+    auto value = percent(random);
+    if (value < options.next_percent) {
+      event = Event::Next;
+    } else if (value < options.next_percent + 2) {
+      event = Event::Reset;
+    } else if (value < 85) {
+      event = Event::Tick;
+    } else {
+      event = Event::Ignored;
+    }
+  }
+  return events;
+}
+
+template <class TContexts>
+static void Run(const char* name, TContexts& contexts, const std::vector<Event>& events,
+                const std::vector<Counters*>& counters) {
+  auto start = Clock::now();
+  size_t index = 0;
+  for (auto event : events) {
+    contexts[index]->Dispatch(event);
+    if (++index == contexts.size()) {
+      index = 0;
+    }
+  }
+  auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  Counters total;
+  for (auto* counter : counters) {
+    total.ticks += counter->ticks;
+    total.enters += counter->enters;
+    total.exits += counter->exits;
+  }
+  printf("%-8s contexts %7zu  events %9zu  %6.2f ns/event  ticks %9lu  enters %9lu  exits %9lu\n", name,
+         contexts.size(), events.size(), elapsed / events.size(), total.ticks, total.enters, total.exits);
+}
+
+static void ViewHelp(const char* prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -c, --contexts=N       number of state machines, default 1000\n"
+         "  -n, --events=N         number of dispatched events, default 10000000\n"
+         "  -t, --transitions=N    percentage of next events, default 20\n",
+         prog);
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"contexts", required_argument, 0, 'c'},
+      {"events", required_argument, 0, 'n'},
+      {"transitions", required_argument, 0, 't'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "c:n:t:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'c':
+        options.contexts = std::stoul(optarg);
+        break;
+      case 'n':
+        options.events = std::stoul(optarg);
+        break;
+      case 't':
+        options.next_percent = std::min(83UL, std::stoul(optarg));
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  auto events = MakeEvents(options);
+
+  {
+    std::vector<std::unique_ptr<ClassicContext>> contexts;
+    std::vector<Counters*> counters;
+    for (size_t i = 0; i < options.contexts; ++i) {
+      counters.push_back(&contexts.emplace_back(std::make_unique<ClassicContext>())->counters);
+    }
+    Run("classic", contexts, events, counters);
+  }
+
+  // the leaf ids are global, so build each chart right before it is used
+  for (auto [name, make_chart] : {std::pair{"flat", &FlatChart}, std::pair{"nested", &NestedChart}}) {
+    auto chart = make_chart();
+    std::vector<std::unique_ptr<HsmContext>> contexts;
+    std::vector<Counters*> counters;
+    for (size_t i = 0; i < options.contexts; ++i) {
+      counters.push_back(&contexts.emplace_back(std::make_unique<HsmContext>(chart))->counters);
+      contexts.back()->machine.Start();
+    }
+    Run(name, contexts, events, counters);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Event throughput of parallel_fswatch with 1..N inotify instances.
+* @details The root gets one subdirectory per writer thread, each with a set
+* of open files. The writers modify their files round robin, so inotify does
+* not coalesce the events, and keep at most a window of events in flight
+* below the inotify queue limit. The handler spins for a given time per
+* event to stand for real work. Every instance count runs for the same time
+* in unordered mode (callbacks on the reader threads) and ordered mode
+* (callbacks on one thread from the merged stream).
+****************************************************************************/
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "parallelFswatch.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string root{"/tmp/bench_parallelwatch"};
+  size_t subtrees{8};
+  size_t files{64};
+  size_t max_instances{8};
+  size_t window{4096};
+  long work_ns{2000};
+  double seconds{2.0};
+};
+
+static void Spin(long ns) {
+  auto until = Clock::now() + std::chrono::nanoseconds(ns);
+  while (Clock::now() < until) {
+  }
+}
+
+static void Run(const Options& options, size_t instances, bool ordered) {
+  std::atomic<uint64_t> written{0};
+  std::atomic<uint64_t> handled{0};
+  std::atomic<bool> running{true};
+
+  parallel_fswatch watcher({options.root}, instances, ordered);
+  watcher.on(fswatch::Event::FILE_MODIFIED, [&](const fswatch::EventInfo&) {
+    Spin(options.work_ns);
+    handled.fetch_add(1, std::memory_order_relaxed);
+  });
+  watcher.run_async();
+  // let the readers reach poll()
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  std::vector<std::jthread> writers;
+  for (size_t subtree = 0; subtree < options.subtrees; ++subtree) {
+    writers.emplace_back([&, subtree]() {
+      std::vector<int> fds;
+      for (size_t file = 0; file < options.files; ++file) {
+        auto path = options.root + "/s" + std::to_string(subtree) + "/f" + std::to_string(file);
+        fds.push_back(open(path.c_str(), O_WRONLY));
+      }
+      for (size_t i = 0; running.load(std::memory_order_relaxed); ++i) {
+        if (written.load(std::memory_order_relaxed) - handled.load(std::memory_order_relaxed) > options.window) {
+          std::this_thread::yield();
+          continue;
+        }
+        if (pwrite(fds[i % fds.size()], "x", 1, 0) == 1) {
+          written.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+      for (auto fd : fds) {
+        close(fd);
+      }
+    });
+  }
+
+  auto start = Clock::now();
+  auto first = handled.load();
+  std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+  auto events = handled.load() - first;
+  auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  running = false;
+  writers.clear();
+  watcher.join();
+
+  auto counters = watcher.counters();
+  printf("%-9s instances %zu  events/s %9.0f  overflows %llu\n", ordered ? "ordered" : "unordered",
+         watcher.instances(), events / elapsed, static_cast<unsigned long long>(counters.overflows));
+}
+
+static void ViewHelp(const char* prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -r, --root=DIR         scratch directory, default /tmp/bench_parallelwatch\n"
+         "  -s, --subtrees=N       subdirectories and writer threads, default 8\n"
+         "  -f, --files=N          files per subdirectory, default 64\n"
+         "  -i, --instances=N      largest instance count, default 8\n"
+         "  -w, --work=NS          handler time per event, default 2000\n"
+         "  -t, --time=SECONDS     run time per configuration, default 2\n",
+         prog);
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"root", required_argument, 0, 'r'},
+      {"subtrees", required_argument, 0, 's'},
+      {"files", required_argument, 0, 'f'},
+      {"instances", required_argument, 0, 'i'},
+      {"work", required_argument, 0, 'w'},
+      {"time", required_argument, 0, 't'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "r:s:f:i:w:t:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'r':
+        options.root = optarg;
+        break;
+      case 's':
+        options.subtrees = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'f':
+        options.files = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'i':
+        options.max_instances = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'w':
+        options.work_ns = std::stol(optarg);
+        break;
+      case 't':
+        options.seconds = std::stod(optarg);
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  std::filesystem::remove_all(options.root);
+  for (size_t subtree = 0; subtree < options.subtrees; ++subtree) {
+    auto dir = options.root + "/s" + std::to_string(subtree);
+    std::filesystem::create_directories(dir);
+    for (size_t file = 0; file < options.files; ++file) {
+      close(open((dir + "/f" + std::to_string(file)).c_str(), O_CREAT | O_WRONLY, 0644));
+    }
+  }
+
+  printf("cores %u  subtrees %zu  work %ld ns\n", std::thread::hardware_concurrency(), options.subtrees,
+         options.work_ns);
+  for (bool ordered : {false, true}) {
+    for (size_t instances = 1; instances <= options.max_instances; instances *= 2) {
+      Run(options, instances, ordered);
+    }
+  }
+  std::filesystem::remove_all(options.root);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,179 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Routing of event paths to the contexts owning them.
+* @details Every context owns one directory /srv/data/gG/cC, 1000 per group,
+* every group directory is owned by a group context as well. An event path
+* lies two levels below a random context directory, so it has two owners.
+* Compared are:
+* - scan: test every registered directory for being a prefix, what waking
+*   every context and letting it filter comes down to (on fewer events);
+* - map: std::unordered_map of the directories, one std::string per probed
+*   prefix;
+* - router: watch::PathRouter;
+* - churn: watch::PathRouter while another thread keeps adding and removing
+*   contexts of their own.
+****************************************************************************/
+
+#include <getopt.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "pathRouter.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  size_t contexts{100000};
+  size_t events{1000000};
+};
+
+static std::string ContextDirectory(size_t context) {
+  return "/srv/data/g" + std::to_string(context / 1000) + "/c" + std::to_string(context % 1000);
+}
+
+static void Report(const char *name, size_t events, uint64_t routed, Clock::duration elapsed) {
+  auto seconds = std::chrono::duration<double>(elapsed).count();
+  printf("%-7s events %8zu  %7.1f ns/event  %6.2f M events/s  (routed %llu)\n", name, events,
+         seconds * 1e9 / static_cast<double>(events), static_cast<double>(events) / seconds / 1e6,
+         static_cast<unsigned long long>(routed));
+}
+
+static void ViewHelp(const char *prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -c, --contexts=N       contexts owning a directory each, default 100000\n"
+         "  -e, --events=N         routed event paths, default 1000000\n",
+         prog);
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"contexts", required_argument, 0, 'c'},
+      {"events", required_argument, 0, 'e'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "c:e:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'c':
+        options.contexts = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'e':
+        options.events = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  std::vector<std::string> directories;
+  for (size_t context = 0; context < options.contexts; ++context) {
+    directories.push_back(ContextDirectory(context));
+  }
+  auto groups = (options.contexts + 999) / 1000;
+  for (size_t group = 0; group < groups; ++group) {
+    directories.push_back("/srv/data/g" + std::to_string(group));
+  }
+
+  std::mt19937_64 random(1);
+  std::vector<std::string> paths;
+  for (size_t path = 0; path < 4096; ++path) {
+    paths.push_back(ContextDirectory(random() % options.contexts) + "/in/" + std::to_string(random() % 100) +
+                    ".dat");
+  }
+
+  {
+    // every event compared with every directory
+    auto events = std::max<size_t>(1, options.events / 1000);
+    uint64_t routed = 0;
+    auto start = Clock::now();
+    for (size_t event = 0; event < events; ++event) {
+      const auto &path = paths[event % paths.size()];
+      for (const auto &directory : directories) {
+        if (path.size() > directory.size() && path[directory.size()] == '/' && path.starts_with(directory)) {
+          routed++;
+        }
+      }
+    }
+    Report("scan", events, routed, Clock::now() - start);
+  }
+  {
+    std::unordered_map<std::string, std::vector<uint32_t>> owners;
+    for (uint32_t context = 0; context < directories.size(); ++context) {
+      owners[directories[context]].push_back(context);
+    }
+    uint64_t routed = 0;
+    auto start = Clock::now();
+    for (size_t event = 0; event < options.events; ++event) {
+      const auto &path = paths[event % paths.size()];
+      for (size_t i = 1; i < path.size(); ++i) {
+        if (path[i] == '/') {
+          if (auto found = owners.find(path.substr(0, i)); found != owners.end()) {
+            routed += found->second.size();
+          }
+        }
+      }
+    }
+    Report("map", options.events, routed, Clock::now() - start);
+  }
+
+  watch::PathRouter router;
+  auto start = Clock::now();
+  for (uint32_t context = 0; context < directories.size(); ++context) {
+    router.Add(directories[context], context);
+  }
+  printf("router  %zu directories added in %.1f ms\n", router.Size(),
+         std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+
+  for (int repeat = 0; repeat < 2; ++repeat) {
+    uint64_t routed = 0;
+    start = Clock::now();
+    for (size_t event = 0; event < options.events; ++event) {
+      router.Route(paths[event % paths.size()], [&routed](watch::PathRouter::ContextId) { routed++; });
+    }
+    Report("router", options.events, routed, Clock::now() - start);
+  }
+
+  {
+    // contexts of their own come and go under /srv/churn while events flow
+    std::atomic<bool> done{false};
+    uint64_t changes = 0;
+    std::thread churn([&]() {
+      auto base = static_cast<uint32_t>(directories.size());
+      for (uint32_t round = 0; !done.load(std::memory_order_relaxed); ++round) {
+        auto directory = "/srv/churn/c" + std::to_string(round % 1000);
+        router.Add(directory, base + round % 1000);
+        router.Remove(directory, base + round % 1000);
+        changes += 2;
+      }
+    });
+    uint64_t routed = 0;
+    start = Clock::now();
+    for (size_t event = 0; event < options.events; ++event) {
+      router.Route(paths[event % paths.size()], [&routed](watch::PathRouter::ContextId) { routed++; });
+    }
+    auto elapsed = Clock::now() - start;
+    done = true;
+    churn.join();
+    Report("churn", options.events, routed, elapsed);
+    printf("churn   %llu adds and removes meanwhile\n", static_cast<unsigned long long>(changes));
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Startup time of the context registry: from scratch versus restore.
+* @details
+* - scratch: every context is created and served once, like after a plain
+*   restart (all states and timers begin again);
+* - save: the snapshot of all contexts is written;
+* - restore: a new registry is rebuilt from the snapshot with 1..N threads.
+* The restored registry is compared with the saved one.
+****************************************************************************/
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+#include "contextRegistry.hpp"
+#include "stateConcreteTwo.hpp"
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  size_t contexts{1'000'000};
+  size_t shards{64};
+  size_t threads{0};
+  std::filesystem::path file{"/dev/shm/contexts.snap"};
+};
+
+static double Ms(Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+static void ViewHelp(const char* prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -c, --contexts=N       number of contexts, default 1000000\n"
+         "  -s, --shards=N         number of registry shards, default 64\n"
+         "  -t, --threads=N        max restore threads, default hardware concurrency\n"
+         "  -f, --file=PATH        snapshot file, default /dev/shm/contexts.snap\n",
+         prog);
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"contexts", required_argument, 0, 'c'}, {"shards", required_argument, 0, 's'},
+      {"threads", required_argument, 0, 't'},  {"file", required_argument, 0, 'f'},
+      {"help", no_argument, 0, 'h'},           {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "c:s:t:f:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'c':
+        options.contexts = std::stoul(optarg);
+        break;
+      case 's':
+        options.shards = std::stoul(optarg);
+        break;
+      case 't':
+        options.threads = std::stoul(optarg);
+        break;
+      case 'f':
+        options.file = optarg;
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (options.threads == 0) {
+    options.threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  spdlog::set_level(spdlog::level::warn);
+
+  state::ContextRegistry saved(options.shards);
+  auto start = Clock::now();
+  for (uint64_t key = 0; key < options.contexts; ++key) {
+    auto& context = saved.Emplace(key);
+    (void)context.Serve(4000ms);
+    // every third context is in the second state
+    if (key % 3 == 0) {
+      context.Restore({state::StateConcreteTwo::kId, true, 6s});
+    }
+  }
+  printf("scratch    contexts %8zu  %8.1f ms\n", options.contexts, Ms(Clock::now() - start));
+
+  start = Clock::now();
+  saved.Save(options.file, options.threads);
+  printf("save       contexts %8zu  %8.1f ms  %6.1f MiB\n", options.contexts, Ms(Clock::now() - start),
+         std::filesystem::file_size(options.file) / 1048576.0);
+
+  for (size_t threads = 1; threads <= options.threads; threads *= 2) {
+    state::ContextRegistry restored(options.shards);
+    start = Clock::now();
+    auto count = restored.Restore(options.file, threads);
+    auto elapsed = Clock::now() - start;
+
+    size_t mismatches = 0;
+    saved.ForEach([&](uint64_t key, state::ConcreteContext& context) {
+      auto* other = restored.Find(key);
+      if (other == nullptr || other->Save().state != context.Save().state) {
+        mismatches++;
+      }
+    });
+    printf("restore    contexts %8zu  %8.1f ms  threads %2zu  mismatches %zu\n", count, Ms(elapsed), threads,
+           mismatches);
+  }
+  std::filesystem::remove(options.file);
+  return EXIT_SUCCESS;
+}
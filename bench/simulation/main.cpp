@@ -0,0 +1,83 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Concrete contexts served in simulated time.
+* @details For 1, 10, 100 ... up to the given number of contexts the demo
+* states (500 ms, 6 s) run for the given simulated time on the virtual
+* clock. Reported are the serves and state transitions per wall second and
+* how much faster than real time the simulation ran.
+****************************************************************************/
+
+#include <getopt.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <spdlog/spdlog.h>
+
+#include "contextSimulation.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  size_t contexts{100000};
+  std::chrono::minutes simulated{10};
+};
+
+static void ViewHelp(const char *prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -c, --contexts=N       max. number of contexts, default 100000\n"
+         "  -m, --minutes=N        simulated minutes per run, default 10\n",
+         prog);
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"contexts", required_argument, 0, 'c'},
+      {"minutes", required_argument, 0, 'm'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "c:m:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'c':
+        options.contexts = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'm':
+        options.simulated = std::chrono::minutes(std::max<unsigned long>(1, std::stoul(optarg)));
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  // the states log every transition
+  spdlog::set_level(spdlog::level::warn);
+  for (size_t contexts = 1;; contexts = std::min(contexts * 10, options.contexts)) {
+    auto start = Clock::now();
+    state::ContextSimulation simulation(contexts);
+    auto result = simulation.Run(options.simulated);
+    auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    printf("contexts %7zu  serves %10llu  transitions %10llu  %6.2f M serves/s  %6.2f M transitions/s  "
+           "%9.0fx real time\n",
+           contexts, static_cast<unsigned long long>(result.serves),
+           static_cast<unsigned long long>(result.transitions), static_cast<double>(result.serves) / seconds / 1e6,
+           static_cast<double>(result.transitions) / seconds / 1e6,
+           std::chrono::duration<double>(options.simulated).count() / seconds);
+    if (contexts == options.contexts) {
+      break;
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Runtime callbacks of fswatch versus the handlers of basic_fswatch.
+* @details Both watchers observe a directory of open files and get the same
+* trivial handler for FILE_MODIFIED, plus handlers for the other file
+* events so that the callback map has some entries. Every round writes one
+* byte to each file, the files in turn so that inotify does not coalesce the
+* events, and then drains the inotify fd. Only read_events() is timed: the
+* read() of the events, decoding and dispatch, the writes are excluded.
+****************************************************************************/
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "basicFswatch.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string dir{"/tmp/bench_staticdispatch"};
+  size_t files{8192};
+  size_t rounds{50};
+};
+
+struct Tally {
+  uint64_t events{0};
+  uint64_t bytes{0};
+};
+
+struct on_modified {
+  Tally *tally;
+  void operator()(fswatch::on_event<fswatch::Event::FILE_MODIFIED>, const fswatch::event_view &event) {
+    tally->events++;
+    tally->bytes += event.path.size();
+  }
+};
+
+struct on_other {
+  Tally *tally;
+  void operator()(fswatch::on_event<fswatch::Event::FILE_CREATED>, const fswatch::event_view &) { tally->events++; }
+  void operator()(fswatch::on_event<fswatch::Event::FILE_DELETED>, const fswatch::event_view &) { tally->events++; }
+};
+
+/**
+ * @brief write every file once per round, time the drains
+ */
+template <typename TWatcher>
+static void Run(const char *name, const Options &options, TWatcher &watcher, const Tally &tally) {
+  std::vector<int> fds;
+  for (size_t file = 0; file < options.files; ++file) {
+    fds.push_back(open((options.dir + "/f" + std::to_string(file)).c_str(), O_WRONLY));
+  }
+  watcher.init();
+  Clock::duration elapsed{};
+  for (size_t round = 0; round < options.rounds; ++round) {
+    for (auto fd : fds) {
+      [[maybe_unused]] auto written = pwrite(fd, "x", 1, 0);
+    }
+    auto start = Clock::now();
+    while (watcher.read_events() > 0) {
+    }
+    elapsed += Clock::now() - start;
+  }
+  watcher.cleanup();
+  for (auto fd : fds) {
+    close(fd);
+  }
+  auto counters = watcher.counters();
+  printf("%-8s events %9llu  %6.1f ns/event  (handled %llu, path bytes %llu)\n", name,
+         static_cast<unsigned long long>(counters.events_read),
+         std::chrono::duration<double, std::nano>(elapsed).count() / std::max<uint64_t>(counters.events_read, 1),
+         static_cast<unsigned long long>(tally.events), static_cast<unsigned long long>(tally.bytes));
+}
+
+static void ViewHelp(const char *prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -d, --dir=PATH         scratch directory, default /tmp/bench_staticdispatch\n"
+         "  -f, --files=N          files, events per round, default 8192\n"
+         "  -r, --rounds=N         rounds, default 50\n",
+         prog);
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"dir", required_argument, 0, 'd'},
+      {"files", required_argument, 0, 'f'},
+      {"rounds", required_argument, 0, 'r'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "d:f:r:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'd':
+        options.dir = optarg;
+        break;
+      case 'f':
+        // stay below the default inotify queue of 16384 events
+        options.files = std::min<size_t>(std::max<size_t>(1, std::stoul(optarg)), 16000);
+        break;
+      case 'r':
+        options.rounds = std::stoul(optarg);
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  std::filesystem::remove_all(options.dir);
+  std::filesystem::create_directories(options.dir);
+  for (size_t file = 0; file < options.files; ++file) {
+    close(open((options.dir + "/f" + std::to_string(file)).c_str(), O_CREAT | O_WRONLY, 0644));
+  }
+
+  for (int repeat = 0; repeat < 2; ++repeat) {
+    {
+      Tally tally;
+      fswatch watcher(options.dir);
+      watcher.on(fswatch::Event::FILE_MODIFIED, [&tally](const fswatch::EventInfo &event) {
+        tally.events++;
+        tally.bytes += event.path.native().size();
+      });
+      watcher.on({fswatch::Event::FILE_CREATED, fswatch::Event::FILE_DELETED},
+                 [&tally](const fswatch::EventInfo &) { tally.events++; });
+      Run("runtime", options, watcher, tally);
+    }
+    {
+      Tally tally;
+      basic_fswatch<on_modified, on_other> watcher({on_modified{&tally}, on_other{&tally}}, options.dir);
+      Run("static", options, watcher, tally);
+    }
+  }
+  std::filesystem::remove_all(options.dir);
+  return EXIT_SUCCESS;
+}
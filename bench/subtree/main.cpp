@@ -0,0 +1,173 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Entries of an extracted archive the watcher reports.
+* @details A tree of groups of directories of files is packed with tar once,
+* then extracted into a watched, empty directory. tar creates directories
+* and fills them at once, most entries exist before the watch of their
+* directory does. Measured are the entries reported as created, missed and
+* reported more than once, the time tar takes and the time until the
+* watcher reported the last entry.
+****************************************************************************/
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "fswatch.hpp"
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+struct Options {
+  std::string root{"/dev/shm/bench_subtree"};
+  size_t groups{10};
+  size_t dirs{100};
+  size_t files{100};
+  size_t runs{3};
+};
+
+/**
+ * @brief source tree and its archive, returns the number of entries
+ */
+static size_t Pack(const Options &options) {
+  std::filesystem::remove_all(options.root);
+  auto source = std::filesystem::path(options.root) / "source" / "tree";
+  size_t entries = 1;
+  for (size_t group = 0; group < options.groups; ++group) {
+    for (size_t dir = 0; dir < options.dirs; ++dir) {
+      auto path = source / ("group" + std::to_string(group)) / ("dir" + std::to_string(dir));
+      std::filesystem::create_directories(path);
+      for (size_t file = 0; file < options.files; ++file) {
+        std::ofstream(path / ("file" + std::to_string(file))) << file;
+      }
+      entries += 1 + options.files;
+    }
+    entries++;
+  }
+  auto command = "tar -C " + options.root + "/source -cf " + options.root + "/tree.tar tree";
+  if (std::system(command.c_str()) != 0) {
+    fprintf(stderr, "%s failed\n", command.c_str());
+    exit(EXIT_FAILURE);
+  }
+  std::filesystem::remove_all(options.root + "/source");
+  return entries;
+}
+
+static void Extract(const Options &options, size_t entries) {
+  auto target = options.root + "/target";
+  std::filesystem::remove_all(target);
+  std::filesystem::create_directories(target);
+
+  std::unordered_map<std::string, uint32_t> reported;
+  size_t duplicates = 0;
+  std::atomic<size_t> count{0};
+  fswatch watcher(target);
+  watcher.on({fswatch::Event::FILE_CREATED, fswatch::Event::DIR_CREATED},
+             [&](const fswatch::EventInfo &event) {
+               if (reported[event.path.string()]++ != 0) {
+                 duplicates++;
+               }
+               count.fetch_add(1, std::memory_order_relaxed);
+             });
+  watcher.run_async();
+  // let the watcher reach poll()
+  std::this_thread::sleep_for(50ms);
+
+  auto start = Clock::now();
+  auto command = "tar -C " + target + " -xf " + options.root + "/tree.tar";
+  if (std::system(command.c_str()) != 0) {
+    fprintf(stderr, "%s failed\n", command.c_str());
+    exit(EXIT_FAILURE);
+  }
+  auto extracted = Clock::now();
+  // done when every entry came or nothing came for a while
+  auto last = Clock::now();
+  for (size_t seen = 0; seen < entries && Clock::now() - last < 1s;) {
+    std::this_thread::sleep_for(1ms);
+    if (auto now = count.load(std::memory_order_relaxed); now != seen) {
+      seen = now;
+      last = Clock::now();
+    }
+  }
+  std::string error;
+  try {
+    watcher.join();
+  } catch (const std::exception &what) {
+    error = what.what();
+  }
+
+  auto counters = watcher.counters();
+  printf("%zu entries: %zu reported, %zu missed, %zu duplicates  tar %7.1f ms  last report %7.1f ms  "
+         "(%llu events read, %llu scanned, %llu watches)%s%s\n",
+         entries, reported.size(), entries - std::min(entries, reported.size()), duplicates,
+         std::chrono::duration<double, std::milli>(extracted - start).count(),
+         std::chrono::duration<double, std::milli>(last - start).count(),
+         static_cast<unsigned long long>(counters.events_read), static_cast<unsigned long long>(counters.scanned),
+         static_cast<unsigned long long>(counters.watches), error.empty() ? "" : "  ", error.c_str());
+}
+
+static void ViewHelp(const char *prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -r, --root=DIR         scratch directory, default /dev/shm/bench_subtree\n"
+         "  -g, --groups=N         top level directories, default 10\n"
+         "  -d, --dirs=N           directories per group, default 100\n"
+         "  -f, --files=N          files per directory, default 100\n"
+         "  -n, --runs=N           extractions, default 3\n",
+         prog);
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"root", required_argument, 0, 'r'},  {"groups", required_argument, 0, 'g'},
+      {"dirs", required_argument, 0, 'd'},  {"files", required_argument, 0, 'f'},
+      {"runs", required_argument, 0, 'n'},  {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "r:g:d:f:n:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'r':
+        options.root = optarg;
+        break;
+      case 'g':
+        options.groups = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'd':
+        options.dirs = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'f':
+        options.files = std::stoul(optarg);
+        break;
+      case 'n':
+        options.runs = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  auto entries = Pack(options);
+  for (size_t run = 0; run < options.runs; ++run) {
+    Extract(options, entries);
+  }
+  std::filesystem::remove_all(options.root);
+  return EXIT_SUCCESS;
+}
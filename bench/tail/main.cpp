@@ -0,0 +1,202 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Sustained tailing of many growing files.
+* @details Writer threads append blocks to the files of a scratch directory
+* round robin until a total is written, with at most a window of events
+* not read by the watcher yet, below the inotify queue limit. The watcher
+* hands the appended bytes to a consumer that reads one byte per cache
+* line. Measured is the time from the first write until every byte was
+* delivered. Compared are:
+* - reread: the FILE_MODIFIED handler opens the file, pread()s everything
+*   after its last offset into a buffer and closes it again, per event;
+* - tail: watch::FileTail, mapped views, one delivery per file and batch.
+****************************************************************************/
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "fileTail.hpp"
+#include "fswatch.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string root{"/tmp/bench_tail"};
+  size_t files{1000};
+  size_t writers{4};
+  size_t block{4096};
+  size_t megabytes{1024};
+  size_t window{8192};
+};
+
+static uint64_t Consume(std::span<const char> bytes) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < bytes.size(); i += 64) {
+    sum += static_cast<unsigned char>(bytes[i]);
+  }
+  return sum;
+}
+
+static std::vector<std::string> CreateFiles(const Options &options) {
+  std::filesystem::remove_all(options.root);
+  std::filesystem::create_directories(options.root);
+  std::vector<std::string> files;
+  for (size_t file = 0; file < options.files; ++file) {
+    files.push_back(options.root + "/f" + std::to_string(file) + ".log");
+    close(open(files.back().c_str(), O_CREAT | O_WRONLY, 0644));
+  }
+  return files;
+}
+
+template <typename TWatcher>
+static void Run(const Options &options, const char *name, const std::vector<std::string> &files,
+                TWatcher &watcher, std::atomic<uint64_t> &delivered) {
+  auto total = static_cast<uint64_t>(options.megabytes) << 20;
+  auto blocks = total / options.block;
+  watcher.run_async();
+  // let the watcher reach poll()
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  // events in flight stay below the inotify queue limit, 16384 by default
+  std::atomic<uint64_t> written_blocks{0};
+  auto start = Clock::now();
+  std::vector<std::jthread> writers;
+  for (size_t writer = 0; writer < options.writers; ++writer) {
+    writers.emplace_back([&, writer]() {
+      std::vector<char> block(options.block, 'x');
+      std::vector<int> fds;
+      for (size_t file = writer; file < files.size(); file += options.writers) {
+        fds.push_back(open(files[file].c_str(), O_WRONLY | O_APPEND));
+      }
+      for (uint64_t index = writer; index < blocks; index += options.writers) {
+        while (written_blocks.load(std::memory_order_relaxed) - watcher.counters().events_read > options.window) {
+          std::this_thread::yield();
+        }
+        if (write(fds[(index / options.writers) % fds.size()], block.data(), block.size()) > 0) {
+          written_blocks.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+      for (auto fd : fds) {
+        close(fd);
+      }
+    });
+  }
+  writers.clear();
+  auto written = Clock::now();
+  for (auto deadline = written + std::chrono::seconds(60);
+       delivered.load(std::memory_order_relaxed) < blocks * options.block && Clock::now() < deadline;) {
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  watcher.join();
+  printf("%-7s files %5zu  delivered %6.0f MB  %6.2f GB/s  (writers done after %.2f s)\n", name, files.size(),
+         static_cast<double>(delivered.load()) / 1e6, static_cast<double>(delivered.load()) / elapsed / 1e9,
+         std::chrono::duration<double>(written - start).count());
+}
+
+static void ViewHelp(const char *prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -r, --root=DIR         scratch directory, default /tmp/bench_tail\n"
+         "  -f, --files=N          tailed files, default 1000\n"
+         "  -w, --writers=N        writer threads, default 4\n"
+         "  -b, --block=BYTES      bytes per write, default 4096\n"
+         "  -m, --megabytes=N      bytes written per mode, default 1024 MiB\n"
+         "  -W, --window=N         max. events not read by the watcher, default 8192\n",
+         prog);
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"root", required_argument, 0, 'r'},
+      {"files", required_argument, 0, 'f'},
+      {"writers", required_argument, 0, 'w'},
+      {"block", required_argument, 0, 'b'},
+      {"megabytes", required_argument, 0, 'm'},
+      {"window", required_argument, 0, 'W'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "r:f:w:b:m:W:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'r':
+        options.root = optarg;
+        break;
+      case 'f':
+        options.files = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'w':
+        options.writers = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'b':
+        options.block = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'm':
+        options.megabytes = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'W':
+        options.window = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  options.writers = std::min(options.writers, options.files);
+
+  uint64_t sum = 0;
+  {
+    auto files = CreateFiles(options);
+    std::atomic<uint64_t> delivered{0};
+    std::unordered_map<std::string, uint64_t> offsets;
+    std::vector<char> buffer(1 << 20);
+    fswatch watcher(options.root);
+    watcher.on(fswatch::Event::FILE_MODIFIED, [&](const fswatch::EventInfo &event) {
+      auto &offset = offsets[event.path.string()];
+      int fd = open(event.path.c_str(), O_RDONLY);
+      for (ssize_t got; (got = pread(fd, buffer.data(), buffer.size(), static_cast<off_t>(offset))) > 0;) {
+        sum += Consume({buffer.data(), static_cast<size_t>(got)});
+        offset += static_cast<uint64_t>(got);
+        delivered.fetch_add(static_cast<uint64_t>(got), std::memory_order_relaxed);
+      }
+      close(fd);
+    });
+    Run(options, "reread", files, watcher, delivered);
+  }
+  {
+    auto files = CreateFiles(options);
+    std::atomic<uint64_t> delivered{0};
+    watch::FileTail tail([&](std::string_view, std::span<const char> bytes) {
+      sum += Consume(bytes);
+      delivered.fetch_add(bytes.size(), std::memory_order_relaxed);
+    });
+    for (const auto &file : files) {
+      tail.Follow(file, watch::FileTail::Start::Begin);
+    }
+    fswatch watcher(options.root);
+    watcher.tail(&tail);
+    Run(options, "tail", files, watcher, delivered);
+  }
+  std::filesystem::remove_all(options.root);
+  return sum == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
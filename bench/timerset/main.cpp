@@ -0,0 +1,144 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Expiry scan over many timers: StopTimer objects versus TimerSet.
+* @details The same timers (random timeouts, a part of them stopped) are
+* kept as a vector of StopTimer and in a TimerSet. Every round looks for
+* the elapsed timers and for the nearest deadline:
+* - stoptimer: IsElapsed() and LeftTime() of every object;
+* - timerset/<isa>: Expired() and NextDeadline() with the given kernel;
+* - poll/<isa>: both in one pass with Poll().
+* The set rows check against the time of the first set scan, the "half"
+* rows against a time point 5.5 s later, where about half of the running
+* timers are elapsed.
+****************************************************************************/
+
+#include <getopt.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "stopTimer.hpp"
+#include "timerSet.hpp"
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  size_t timers{1'000'000};
+  size_t rounds{20};
+  unsigned running_percent{90};
+};
+
+static void Report(const char* name, const Options& options, Clock::duration elapsed, size_t expired,
+                   std::chrono::milliseconds left) {
+  auto ns = std::chrono::duration<double, std::nano>(elapsed).count() / options.rounds;
+  printf("%-22s timers %8zu  %9.1f us/scan  %5.2f ns/timer  expired %8zu  next in %5ld ms\n", name, options.timers,
+         ns / 1e3, ns / options.timers, expired, left.count());
+}
+
+static void ViewHelp(const char* prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -n, --timers=N         number of timers, default 1000000\n"
+         "  -r, --rounds=N         number of scans, default 20\n"
+         "  -p, --running=N        percentage of running timers, default 90\n",
+         prog);
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"timers", required_argument, 0, 'n'},
+      {"rounds", required_argument, 0, 'r'},
+      {"running", required_argument, 0, 'p'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "n:r:p:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'n':
+        options.timers = std::stoul(optarg);
+        break;
+      case 'r':
+        options.rounds = std::stoul(optarg);
+        break;
+      case 'p':
+        options.running_percent = std::stoul(optarg);
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  std::mt19937 random(1);
+  std::uniform_int_distribution<int> timeout(1000, 10000);
+  std::uniform_int_distribution<unsigned> percent(0, 99);
+  std::vector<watch::TimerMs> objects(options.timers);
+  watch::TimerMsSet set(options.timers);
+  std::vector<watch::TimerMsSet::Timer> handles;
+  handles.reserve(options.timers);
+  for (auto& object : objects) {
+    auto& handle = handles.emplace_back(set.Make());
+    if (percent(random) < options.running_percent) {
+      auto duration = std::chrono::milliseconds(timeout(random));
+      object.Start(duration);
+      handle.Start(duration);
+    }
+  }
+
+  // AoS: the only interface is per object
+  {
+    size_t expired = 0;
+    auto left = std::chrono::milliseconds::max();
+    auto start = Clock::now();
+    for (size_t round = 0; round < options.rounds; ++round) {
+      expired = 0;
+      left = std::chrono::milliseconds::max();
+      for (auto& object : objects) {
+        if (object.IsElapsed().value_or(false)) {
+          expired++;
+        } else if (object.IsRunning()) {
+          left = std::min(left, object.LeftTime());
+        }
+      }
+    }
+    Report("stoptimer", options, Clock::now() - start, expired, left);
+  }
+
+  // the set rows check against fixed time points, so all of them see the same elapsed timers
+  auto base = std::chrono::time_point_cast<std::chrono::milliseconds>(Clock::now());
+  std::vector<uint32_t> ids;
+  ids.reserve(options.timers);
+  for (bool poll : {false, true}) {
+    for (auto isa : {watch::simd::Isa::Scalar, watch::simd::Isa::Sse42, watch::simd::Isa::Avx2}) {
+      if (isa > watch::simd::Detect()) {
+        continue;
+      }
+      for (auto ahead : {0ms, 5500ms}) {
+        std::chrono::milliseconds left{};
+        auto start = Clock::now();
+        for (size_t round = 0; round < options.rounds; ++round) {
+          ids.clear();
+          auto now = base + ahead;
+          auto next = poll ? set.Poll(now, ids, isa) : (set.Expired(now, ids, isa), set.NextDeadline(isa));
+          left = std::chrono::duration_cast<std::chrono::milliseconds>(next.value() - now);
+        }
+        auto name = std::string(poll ? "poll/" : "timerset/") + watch::simd::Name(isa) + (ahead.count() ? " half" : "");
+        Report(name.c_str(), options, Clock::now() - start, ids.size(), left);
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,224 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Replay of a recorded inotify trace through the dispatch pipeline.
+* @details Without --replay-only a workload of directories with files that
+* are created, written and deleted is recorded first. The trace, or one
+* recorded by fsload --trace, is then replayed as fast as possible through
+* fswatch with runtime callbacks and through basic_fswatch: decoding, the
+* Watch lookups and dispatch run as on the live fd, there is no filesystem
+* I/O and no read(). With --paced one more replay keeps the recorded timing.
+****************************************************************************/
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "basicFswatch.hpp"
+#include "eventTrace.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string dir{"/tmp/bench_tracereplay"};
+  std::string trace{"/tmp/bench_tracereplay.trace"};
+  size_t dirs{64};
+  size_t files{64};
+  size_t rounds{20};
+  bool record{true};
+  bool paced{false};
+};
+
+struct on_file {
+  uint64_t *count;
+  void operator()(fswatch::on_event<fswatch::Event::FILE_CREATED>, const fswatch::event_view &) { (*count)++; }
+  void operator()(fswatch::on_event<fswatch::Event::FILE_MODIFIED>, const fswatch::event_view &) { (*count)++; }
+  void operator()(fswatch::on_event<fswatch::Event::FILE_DELETED>, const fswatch::event_view &) { (*count)++; }
+  void operator()(fswatch::on_event<fswatch::Event::DIR_CREATED>, const fswatch::event_view &) { (*count)++; }
+};
+
+/**
+ * @brief create, write and delete the files of one directory after the other
+ */
+static void Record(const Options &options) {
+  std::filesystem::remove_all(options.dir);
+  std::filesystem::create_directories(options.dir);
+  watch::TraceWriter writer(options.trace);
+  fswatch watcher(options.dir);
+  watcher.on({fswatch::Event::FILE_CREATED, fswatch::Event::FILE_MODIFIED, fswatch::Event::FILE_DELETED,
+              fswatch::Event::DIR_CREATED},
+             [](const fswatch::EventInfo &) {});
+  watcher.record(&writer);
+  watcher.init();
+  auto drain = [&watcher]() {
+    while (watcher.read_events() > 0) {
+    }
+  };
+  for (size_t dir = 0; dir < options.dirs; ++dir) {
+    auto path = options.dir + "/d" + std::to_string(dir);
+    std::filesystem::create_directory(path);
+    drain();
+    for (size_t file = 0; file < options.files; ++file) {
+      auto name = path + "/f" + std::to_string(file);
+      int fd = open(name.c_str(), O_CREAT | O_WRONLY, 0644);
+      [[maybe_unused]] auto written = write(fd, "x", 1);
+      close(fd);
+      unlink(name.c_str());
+    }
+    drain();
+  }
+  watcher.cleanup();
+  writer.Flush();
+  printf("recorded %llu batches, %llu events to %s\n", static_cast<unsigned long long>(writer.Batches()),
+         static_cast<unsigned long long>(watcher.counters().events_read), options.trace.c_str());
+  std::filesystem::remove_all(options.dir);
+}
+
+/**
+ * @brief root paths of the first roots record
+ */
+static std::vector<std::string> TraceRoots(const watch::TraceReader &trace) {
+  std::vector<std::string> roots;
+  trace.ForEach([&roots](const watch::TraceReader::Record &record) {
+    if (record.kind != watch::trace::Kind::Roots) {
+      return true;
+    }
+    for (auto &root : watch::TraceReader::Roots(record)) {
+      roots.emplace_back(root.path);
+    }
+    return false;
+  });
+  if (roots.empty()) {
+    throw std::runtime_error("trace without roots");
+  }
+  return roots;
+}
+
+template <typename TWatcher>
+static void Replay(const char *name, const Options &options, const watch::TraceReader &trace, TWatcher &watcher,
+                   const uint64_t &handled) {
+  auto start = Clock::now();
+  size_t batches = 0;
+  for (size_t round = 0; round < options.rounds; ++round) {
+    batches += watcher.replay(trace);
+  }
+  auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  auto events = watcher.counters().events_read;
+  printf("%-8s %zu batches, events %9llu  %6.1f ns/event  %6.2f M events/s  (handled %llu)\n", name, batches,
+         static_cast<unsigned long long>(events), elapsed * 1e9 / std::max<uint64_t>(events, 1),
+         static_cast<double>(events) / elapsed / 1e6, static_cast<unsigned long long>(handled));
+}
+
+template <typename TWatcher>
+static void AddRoots(TWatcher &watcher, const std::vector<std::string> &roots) {
+  for (size_t root = 1; root < roots.size(); ++root) {
+    watcher.append_to_path(roots[root]);
+  }
+}
+
+static void ViewHelp(const char *prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -d, --dir=PATH         scratch directory of the recording, default /tmp/bench_tracereplay\n"
+         "  -t, --trace=PATH       trace file, default /tmp/bench_tracereplay.trace\n"
+         "  -R, --replay-only      replay the trace file, e.g. one of fsload --trace, without recording\n"
+         "  -D, --dirs=N           directories of the recording, default 64\n"
+         "  -f, --files=N          files per directory, default 64\n"
+         "  -r, --rounds=N         replays per watcher, default 20\n"
+         "  -p, --paced            replay once more at the recorded pace\n",
+         prog);
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"dir", required_argument, 0, 'd'},
+      {"trace", required_argument, 0, 't'},
+      {"replay-only", no_argument, 0, 'R'},
+      {"dirs", required_argument, 0, 'D'},
+      {"files", required_argument, 0, 'f'},
+      {"rounds", required_argument, 0, 'r'},
+      {"paced", no_argument, 0, 'p'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "d:t:RD:f:r:ph", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'd':
+        options.dir = optarg;
+        break;
+      case 't':
+        options.trace = optarg;
+        break;
+      case 'R':
+        options.record = false;
+        break;
+      case 'D':
+        options.dirs = std::stoul(optarg);
+        break;
+      case 'f':
+        // one directory is drained at once, stay below the inotify queue of 16384 events
+        options.files = std::min<size_t>(std::max<size_t>(1, std::stoul(optarg)), 5000);
+        break;
+      case 'r':
+        options.rounds = std::stoul(optarg);
+        break;
+      case 'p':
+        options.paced = true;
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  try {
+    if (options.record) {
+      Record(options);
+    }
+    watch::TraceReader trace(options.trace);
+    auto roots = TraceRoots(trace);
+    for (int repeat = 0; repeat < 2; ++repeat) {
+      {
+        uint64_t handled = 0;
+        fswatch watcher(roots[0]);
+        AddRoots(watcher, roots);
+        watcher.on({fswatch::Event::FILE_CREATED, fswatch::Event::FILE_MODIFIED, fswatch::Event::FILE_DELETED,
+                    fswatch::Event::DIR_CREATED},
+                   [&handled](const fswatch::EventInfo &) { handled++; });
+        Replay("runtime", options, trace, watcher, handled);
+      }
+      {
+        uint64_t handled = 0;
+        basic_fswatch<on_file> watcher({on_file{&handled}}, roots[0]);
+        AddRoots(watcher, roots);
+        Replay("static", options, trace, watcher, handled);
+      }
+    }
+    if (options.paced) {
+      uint64_t handled = 0;
+      basic_fswatch<on_file> watcher({on_file{&handled}}, roots[0]);
+      AddRoots(watcher, roots);
+      auto start = Clock::now();
+      auto batches = watcher.replay(trace, true);
+      printf("paced    %zu batches in %.3f s\n", batches, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+  } catch (std::exception &error) {
+    fprintf(stderr, "%s\n", error.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,173 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Queries of watch::TreeMirror against asking the filesystem.
+* @details A scratch tree of directories with files each is mirrored once.
+* Compared are listing a directory, counting the files below the root and,
+* after a round of modifications, finding the changed files: with
+* std::filesystem on every query and with the mirror. The cost of applying
+* events to the mirror, the write and the stat() in Flush() included, is
+* reported as well.
+****************************************************************************/
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "treeMirror.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string root{"/tmp/bench_treemirror"};
+  size_t directories{100};
+  size_t files{100};
+  size_t queries{1000};
+};
+
+static void Report(const char *name, size_t operations, uint64_t result, Clock::duration elapsed) {
+  printf("%-24s %9.2f us/op  (result %llu)\n", name,
+         std::chrono::duration<double, std::micro>(elapsed).count() / static_cast<double>(operations),
+         static_cast<unsigned long long>(result));
+}
+
+static void ViewHelp(const char *prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -r, --root=DIR         scratch directory, default /tmp/bench_treemirror\n"
+         "  -d, --directories=N    directories below the root, default 100\n"
+         "  -f, --files=N          files per directory, default 100\n"
+         "  -q, --queries=N        queries per kind, default 1000\n",
+         prog);
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"root", required_argument, 0, 'r'},
+      {"directories", required_argument, 0, 'd'},
+      {"files", required_argument, 0, 'f'},
+      {"queries", required_argument, 0, 'q'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "r:d:f:q:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'r':
+        options.root = optarg;
+        break;
+      case 'd':
+        options.directories = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'f':
+        options.files = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'q':
+        options.queries = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  std::filesystem::remove_all(options.root);
+  std::vector<std::string> files;
+  for (size_t directory = 0; directory < options.directories; ++directory) {
+    auto path = options.root + "/d" + std::to_string(directory);
+    std::filesystem::create_directories(path);
+    for (size_t file = 0; file < options.files; ++file) {
+      files.push_back(path + "/f" + std::to_string(file));
+      close(open(files.back().c_str(), O_CREAT | O_WRONLY, 0644));
+    }
+  }
+
+  watch::TreeMirror tree;
+  auto start = Clock::now();
+  tree.AddRoot(options.root);
+  printf("mirrored %zu entries in %.1f ms\n", tree.Size(),
+         std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+
+  auto listed = options.root + "/d0";
+  uint64_t result = 0;
+  start = Clock::now();
+  for (size_t query = 0; query < options.queries; ++query) {
+    for (const auto &entry : std::filesystem::directory_iterator(listed)) {
+      result += entry.is_regular_file();
+    }
+  }
+  Report("list    filesystem", options.queries, result / options.queries, Clock::now() - start);
+  result = 0;
+  start = Clock::now();
+  for (size_t query = 0; query < options.queries; ++query) {
+    tree.List(listed, [&result](std::string_view, const watch::TreeMirror::Info &info) {
+      result += info.type == watch::TreeMirror::Type::File;
+    });
+  }
+  Report("list    mirror", options.queries, result / options.queries, Clock::now() - start);
+
+  auto counts = std::max<size_t>(1, options.queries / 100);
+  result = 0;
+  start = Clock::now();
+  for (size_t query = 0; query < counts; ++query) {
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(options.root)) {
+      result += entry.is_regular_file();
+    }
+  }
+  Report("count   filesystem", counts, result / counts, Clock::now() - start);
+  result = 0;
+  start = Clock::now();
+  for (size_t query = 0; query < options.queries; ++query) {
+    result += tree.CountFiles(options.root);
+  }
+  Report("count   mirror", options.queries, result / options.queries, Clock::now() - start);
+
+  // one file in a hundred is written, the mirror gets the events a watcher would apply
+  // mtimes are as coarse as the kernel tick
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  auto before = std::filesystem::file_time_type::clock::now() - std::chrono::milliseconds(20);
+  auto sequence = tree.Sequence();
+  size_t modified = 0;
+  start = Clock::now();
+  for (size_t file = 0; file < files.size(); file += 100) {
+    int fd = open(files[file].c_str(), O_WRONLY);
+    [[maybe_unused]] auto written = write(fd, "x", 1);
+    close(fd);
+    tree.Modified(files[file]);
+    modified++;
+  }
+  tree.Flush();
+  Report("write   and apply", modified, modified, Clock::now() - start);
+
+  result = 0;
+  start = Clock::now();
+  for (size_t query = 0; query < counts; ++query) {
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(options.root)) {
+      result += entry.is_regular_file() && entry.last_write_time() >= before;
+    }
+  }
+  Report("changed filesystem", counts, result / counts, Clock::now() - start);
+  result = 0;
+  start = Clock::now();
+  for (size_t query = 0; query < options.queries; ++query) {
+    tree.ChangedSince(sequence, [&result](std::string_view, const watch::TreeMirror::Info &) { result++; });
+  }
+  Report("changed mirror", options.queries, result / options.queries, Clock::now() - start);
+
+  std::filesystem::remove_all(options.root);
+  return EXIT_SUCCESS;
+}
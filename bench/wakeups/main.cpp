@@ -0,0 +1,206 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Context switches of notify_all versus the wakeup router.
+* @details A number of tasks wait with a timeout, as the context workers do.
+* Every task is interested in one of the event sources. A notifier thread
+* sends bursts of events to random sources:
+* - notify_all: one mutex and condition variable, every event wakes every
+*   task, the former WakeUpRunningTasks();
+* - router: every event wakes the tasks of its source only, a task which is
+*   pending already is not woken again.
+* A woken task spends some time on its work. Reported are the voluntary and
+* involuntary context switches of the process (getrusage), the wakeups of
+* the tasks and the wakeups a task needed.
+****************************************************************************/
+
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "wakeupRouter.hpp"
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+struct Options {
+  size_t tasks{32};
+  size_t sources{8};
+  size_t events{20'000};
+  size_t burst{16};
+  long work_us{20};
+};
+
+struct Result {
+  long voluntary;
+  long involuntary;
+  uint64_t wakeups;
+  uint64_t useful;
+  double seconds;
+};
+
+static void Spin(long us) {
+  auto until = Clock::now() + std::chrono::microseconds(us);
+  while (Clock::now() < until) {
+  }
+}
+
+/**
+ * @brief run the tasks and the notifier, wait(task, index) blocks a task, notify(source) sends an event
+ */
+template <typename TWait, typename TNotify, typename TStop>
+static Result Run(const Options& options, TWait wait, TNotify notify, TStop stop) {
+  std::atomic<bool> running{true};
+  std::atomic<uint64_t> wakeups{0};
+  std::atomic<uint64_t> useful{0};
+  // events per source not seen by their tasks yet
+  std::vector<std::atomic<uint64_t>> sent(options.sources);
+  std::vector<uint64_t> seen(options.tasks, 0);
+
+  rusage before;
+  getrusage(RUSAGE_SELF, &before);
+  auto start = Clock::now();
+
+  std::vector<std::thread> tasks;
+  for (size_t task = 0; task < options.tasks; ++task) {
+    tasks.emplace_back([&, task]() {
+      auto source = task % options.sources;
+      while (running.load(std::memory_order_relaxed)) {
+        wait(task);
+        wakeups.fetch_add(1, std::memory_order_relaxed);
+        if (auto now = sent[source].load(std::memory_order_relaxed); now != seen[task]) {
+          seen[task] = now;
+          useful.fetch_add(1, std::memory_order_relaxed);
+          Spin(options.work_us);
+        }
+      }
+    });
+  }
+
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<size_t> any(0, options.sources - 1);
+  for (size_t event = 0; event < options.events; ++event) {
+    auto source = any(rng);
+    sent[source].fetch_add(1, std::memory_order_relaxed);
+    notify(source);
+    if (event % options.burst == options.burst - 1) {
+      std::this_thread::sleep_for(200us);
+    }
+  }
+  running = false;
+  stop();
+  for (auto& task : tasks) {
+    task.join();
+  }
+
+  rusage after;
+  getrusage(RUSAGE_SELF, &after);
+  return Result{after.ru_nvcsw - before.ru_nvcsw, after.ru_nivcsw - before.ru_nivcsw, wakeups.load(),
+                useful.load(), std::chrono::duration<double>(Clock::now() - start).count()};
+}
+
+static void Print(const char* name, const Result& result) {
+  printf("%-10s  csw vol %8ld  invol %7ld  wakeups %8llu  useful %7llu (%5.1f%%)  %6.2f s\n", name,
+         result.voluntary, result.involuntary, static_cast<unsigned long long>(result.wakeups),
+         static_cast<unsigned long long>(result.useful), result.wakeups ? 100.0 * result.useful / result.wakeups : 0.0,
+         result.seconds);
+}
+
+static void ViewHelp(const char* prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -t, --tasks=N          waiting tasks, default 32\n"
+         "  -s, --sources=N        event sources, default 8\n"
+         "  -e, --events=N         events sent, default 20000\n"
+         "  -b, --burst=N          events per burst, default 16\n"
+         "  -w, --work=US          work of a task per wakeup, default 20\n",
+         prog);
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"tasks", required_argument, 0, 't'},
+      {"sources", required_argument, 0, 's'},
+      {"events", required_argument, 0, 'e'},
+      {"burst", required_argument, 0, 'b'},
+      {"work", required_argument, 0, 'w'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "t:s:e:b:w:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 't':
+        options.tasks = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 's':
+        options.sources = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'e':
+        options.events = std::stoul(optarg);
+        break;
+      case 'b':
+        options.burst = std::max<size_t>(1, std::stoul(optarg));
+        break;
+      case 'w':
+        options.work_us = std::stol(optarg);
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  printf("tasks %zu  sources %zu  events %zu  burst %zu  work %ld us\n", options.tasks, options.sources,
+         options.events, options.burst, options.work_us);
+
+  {
+    std::mutex mutex;
+    std::condition_variable condition;
+    Print("notify_all", Run(
+                            options,
+                            [&](size_t) {
+                              std::unique_lock lock(mutex);
+                              condition.wait_for(lock, 4000ms);
+                            },
+                            [&](size_t) {
+                              std::unique_lock lock(mutex);
+                              condition.notify_all();
+                            },
+                            [&]() {
+                              std::unique_lock lock(mutex);
+                              condition.notify_all();
+                            }));
+  }
+  {
+    watch::WakeupRouter router;
+    for (size_t task = 0; task < options.tasks; ++task) {
+      router.Subscribe(router.AddTask(), static_cast<watch::WakeupRouter::Source>(task % options.sources));
+    }
+    Print("router", Run(
+                        options,
+                        [&](size_t task) { router.Wait(static_cast<watch::WakeupRouter::Task>(task), 4000ms); },
+                        [&](size_t source) { router.Notify(static_cast<watch::WakeupRouter::Source>(source)); },
+                        [&]() { router.NotifyAll(); }));
+    auto counters = router.GetCounters();
+    printf("router      notified %llu  futex wakes %llu  coalesced %llu\n",
+           static_cast<unsigned long long>(counters.notified), static_cast<unsigned long long>(counters.woken),
+           static_cast<unsigned long long>(counters.coalesced));
+  }
+  return EXIT_SUCCESS;
+}
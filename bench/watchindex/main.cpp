@@ -0,0 +1,265 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Watch lookups: red-black trees versus the flat hash index.
+* @details MapWatch is the former Watch, two std::map keyed by wd and by
+* (parent wd, name id). Both variants get the same tree of watches with
+* the given fanout and run:
+* - insert: all watches, parents first;
+* - path: full path of a random wd, the lookup of every event;
+* - reverse: wd of a random (parent wd, name), as for IN_DELETE;
+* - churn: erase a random watch and insert it again;
+* - erase: all watches in random order.
+* Heap is the memory held by the structure after the inserts.
+****************************************************************************/
+
+#include <getopt.h>
+#include <malloc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "fswatch.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static size_t heap_bytes = 0;
+
+void* operator new(size_t size) {
+  if (auto* memory = std::malloc(size == 0 ? 1 : size)) {
+    heap_bytes += malloc_usable_size(memory);
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+  heap_bytes -= malloc_usable_size(memory);
+  std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+  operator delete(memory);
+}
+
+// former Watch
+class MapWatch {
+  using name_id = ::watch::InternPool::Id;
+  struct wd_elem {
+    int pd;
+    name_id name;
+    bool operator()(const wd_elem &l, const wd_elem &r) const {
+      return l.pd < r.pd ? true
+             : l.pd == r.pd && l.name < r.name ? true : false;
+    }
+  };
+  ::watch::InternPool names;
+  std::map<int, wd_elem> watch;
+  std::map<wd_elem, int, wd_elem> rwatch;
+
+ public:
+  void insert(int pd, std::string_view name, int wd, int /*root*/) {
+    wd_elem elem = {pd, names.Intern(name)};
+    if (auto old = watch.find(wd); old != watch.end()) {
+      // inotify hands out the same wd for the same inode
+      rwatch.erase(old->second);
+      names.Release(old->second.name);
+    }
+    watch[wd] = elem;
+    rwatch[elem] = wd;
+  }
+  int erase(int pd, std::string_view name) {
+    auto elem = rwatch.find(wd_elem{pd, names.Find(name)});
+    if (elem == rwatch.end()) {
+      return -1;
+    }
+    int wd = elem->second;
+    names.Release(elem->first.name);
+    rwatch.erase(elem);
+    watch.erase(wd);
+    return wd;
+  }
+  std::string_view path(int wd, ::watch::PathArena &arena) const {
+    size_t length = 0;
+    for (auto it = watch.find(wd); it != watch.end(); it = parent(it)) {
+      length += names.View(it->second.name).size() + (it->second.pd == -1 ? 0 : 1);
+    }
+    char *text = arena.Allocate(length);
+    text[length] = '\0';
+    size_t end = length;
+    for (auto it = watch.find(wd); it != watch.end(); it = parent(it)) {
+      auto name = names.View(it->second.name);
+      end -= name.size();
+      std::memcpy(text + end, name.data(), name.size());
+      if (it->second.pd != -1) {
+        text[--end] = '/';
+      }
+    }
+    return {text, length};
+  }
+  int get(int pd, std::string_view name) {
+    auto elem = rwatch.find(wd_elem{pd, names.Find(name)});
+    return elem == rwatch.end() ? -1 : elem->second;
+  }
+  void compact() { names.Compact(); }
+  void cleanup(int fd) {
+    for (auto wi = watch.begin(); wi != watch.end();) {
+      inotify_rm_watch(fd, wi->first);
+      names.Release(wi->second.name);
+      wi = watch.erase(wi);
+    }
+    rwatch.clear();
+    names.Compact();
+  }
+
+ private:
+  std::map<int, wd_elem>::const_iterator parent(
+      std::map<int, wd_elem>::const_iterator it) const {
+    return it->second.pd == -1 ? watch.end() : watch.find(it->second.pd);
+  }
+};
+
+struct Options {
+  size_t watches{100'000};
+  size_t fanout{64};
+  size_t lookups{1'000'000};
+};
+
+/**
+ * @brief the tree of watches, wd 1 is the root
+ */
+struct Tree {
+  std::vector<int> parent;
+  std::vector<std::string> name;
+
+  Tree(const Options& options) : parent(options.watches + 1), name(options.watches + 1) {
+    char text[32];
+    name[1] = "/tmp/bench_watchindex";
+    parent[1] = -1;
+    for (size_t wd = 2; wd <= options.watches; ++wd) {
+      snprintf(text, sizeof(text), "dir%06zu", wd);
+      name[wd] = text;
+      parent[wd] = static_cast<int>(1 + (wd - 2) / options.fanout);
+    }
+  }
+};
+
+static double Ns(Clock::duration elapsed, size_t count) {
+  return std::chrono::duration<double, std::nano>(elapsed).count() / count;
+}
+
+template <typename TWatch>
+static void Run(const char* name, const Options& options, const Tree& tree) {
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> any(2, static_cast<int>(options.watches));
+  std::vector<int> random(options.lookups);
+  for (auto& wd : random) {
+    wd = any(rng);
+  }
+
+  auto heap = heap_bytes;
+  auto watch = std::make_unique<TWatch>();
+  auto start = Clock::now();
+  for (size_t wd = 1; wd <= options.watches; ++wd) {
+    watch->insert(tree.parent[wd], tree.name[wd], static_cast<int>(wd), 0);
+  }
+  auto insert = Ns(Clock::now() - start, options.watches);
+  heap = heap_bytes - heap;
+
+  watch::PathArena arena;
+  size_t length = 0;
+  start = Clock::now();
+  for (size_t i = 0; i < random.size(); ++i) {
+    length += watch->path(random[i], arena).size();
+    if (i % 256 == 255) {
+      arena.Reset();
+    }
+  }
+  auto path = Ns(Clock::now() - start, random.size());
+
+  int found = 0;
+  start = Clock::now();
+  for (auto wd : random) {
+    found += watch->get(tree.parent[wd], tree.name[wd]) == wd;
+  }
+  auto reverse = Ns(Clock::now() - start, random.size());
+
+  start = Clock::now();
+  for (size_t i = 0; i < random.size() / 4; ++i) {
+    auto wd = random[i];
+    found += watch->erase(tree.parent[wd], tree.name[wd]) == wd;
+    watch->insert(tree.parent[wd], tree.name[wd], wd, 0);
+  }
+  auto churn = Ns(Clock::now() - start, random.size() / 4);
+
+  std::vector<int> order(options.watches);
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = static_cast<int>(i + 1);
+  }
+  std::shuffle(order.begin(), order.end(), rng);
+  start = Clock::now();
+  for (auto wd : order) {
+    watch->erase(tree.parent[wd], tree.name[wd]);
+  }
+  auto erase = Ns(Clock::now() - start, options.watches);
+
+  printf("%-5s watches %8zu  insert %6.1f  path %6.1f  reverse %6.1f  churn %6.1f  erase %6.1f ns"
+         "  heap %6.1f B/watch  (%zu %d)\n",
+         name, options.watches, insert, path, reverse, churn, erase, static_cast<double>(heap) / options.watches,
+         length, found);
+}
+
+static void ViewHelp(const char* prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -n, --watches=N        number of watches, default 100000\n"
+         "  -f, --fanout=N         subdirectories per directory, default 64\n"
+         "  -l, --lookups=N        number of random lookups, default 1000000\n",
+         prog);
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  static const struct option long_options[] = {
+      {"watches", required_argument, 0, 'n'},
+      {"fanout", required_argument, 0, 'f'},
+      {"lookups", required_argument, 0, 'l'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "n:f:l:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'n':
+        options.watches = std::stoul(optarg);
+        break;
+      case 'f':
+        options.fanout = std::stoul(optarg);
+        break;
+      case 'l':
+        options.lookups = std::stoul(optarg);
+        break;
+      default:
+        ViewHelp(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  options.watches = std::max<size_t>(options.watches, 2);
+
+  Tree tree(options);
+  Run<MapWatch>("map", options, tree);
+  Run<Watch>("flat", options, tree);
+  return EXIT_SUCCESS;
+}
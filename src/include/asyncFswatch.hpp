@@ -0,0 +1,59 @@
+#pragma once
+#include <deque>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "eventLoop.hpp"
+#include "fswatch.hpp"
+
+#ifdef __linux__
+// Coroutine front end of fswatch. The inotify fd is polled by a
+// watch::EventLoop instead of a blocking thread, so one thread can serve
+// any number of watchers:
+//
+//   async_fswatch watcher(loop, "/home/tmp", {fswatch::Event::FILE_CREATED});
+//   while (auto event = co_await watcher.next_event()) { ... }
+//
+class async_fswatch {
+ public:
+  async_fswatch(watch::EventLoop &loop, const std::string &path,
+                const std::vector<fswatch::Event> &events)
+      : loop(loop), watcher(path) {
+    watcher.on(events, [this](const fswatch::EventInfo &event) {
+      queue.push_back(event);
+    });
+    watcher.init();
+  }
+
+  async_fswatch(const async_fswatch &) = delete;
+  async_fswatch &operator=(const async_fswatch &) = delete;
+
+  ~async_fswatch() {
+    loop.Forget(watcher.native_handle());
+    watcher.cleanup();
+  }
+
+  // Wait for the next event. Returns std::nullopt when the loop stops.
+  watch::Task<std::optional<fswatch::EventInfo>> next_event() {
+    while (queue.empty()) {
+      if (loop.IsStopping()) {
+        co_return std::nullopt;
+      }
+      co_await loop.Readable(watcher.native_handle());
+      watcher.read_events();
+    }
+    auto event = std::move(queue.front());
+    queue.pop_front();
+    co_return event;
+  }
+
+  fswatch::Counters counters() const { return watcher.counters(); }
+
+ private:
+  watch::EventLoop &loop;
+  fswatch watcher;
+  // Events decoded but not yet consumed by next_event()
+  std::deque<fswatch::EventInfo> queue;
+};
+#endif
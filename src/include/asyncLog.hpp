@@ -0,0 +1,512 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Asynchronous low-latency log sink in front of spdlog.
+* @details A log call on a hot path only copies a fixed-size binary record
+* (format string pointer, level, timestamp and up to four arguments) into a
+* lock-free ring owned by the calling thread. A background flusher drains
+* all rings, orders the records by time, formats them and hands them to the
+* spdlog default logger. Until the flusher is started, records are
+* formatted and logged synchronously. String arguments share the text of a
+* record, one cut to fit is marked with "..." when it is formatted.
+* Levels below ALOG_ACTIVE_LEVEL are removed at compile time:
+* @code
+* #define ALOG_ACTIVE_LEVEL ALOG_LEVEL_WARN
+* #include <asyncLog.hpp>
+* ALOG_INFO("elided {}", 1);
+* @endcode
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_ASYNC_LOG_HPP
+#define SRC_INCLUDE_ASYNC_LOG_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <fmt/args.h>
+
+//-----------------------------------------------------------------------------
+// Defines and macros
+//-----------------------------------------------------------------------------
+#define ALOG_LEVEL_TRACE 0
+#define ALOG_LEVEL_DEBUG 1
+#define ALOG_LEVEL_INFO 2
+#define ALOG_LEVEL_WARN 3
+#define ALOG_LEVEL_ERROR 4
+#define ALOG_LEVEL_CRITICAL 5
+#define ALOG_LEVEL_OFF 6
+
+#ifndef ALOG_ACTIVE_LEVEL
+#define ALOG_ACTIVE_LEVEL ALOG_LEVEL_INFO
+#endif
+
+#if ALOG_ACTIVE_LEVEL <= ALOG_LEVEL_TRACE
+#define ALOG_TRACE(...) ::logging::Log(::spdlog::level::trace, __VA_ARGS__)
+#else
+#define ALOG_TRACE(...) (void)0
+#endif
+
+#if ALOG_ACTIVE_LEVEL <= ALOG_LEVEL_DEBUG
+#define ALOG_DEBUG(...) ::logging::Log(::spdlog::level::debug, __VA_ARGS__)
+#else
+#define ALOG_DEBUG(...) (void)0
+#endif
+
+#if ALOG_ACTIVE_LEVEL <= ALOG_LEVEL_INFO
+#define ALOG_INFO(...) ::logging::Log(::spdlog::level::info, __VA_ARGS__)
+#else
+#define ALOG_INFO(...) (void)0
+#endif
+
+#if ALOG_ACTIVE_LEVEL <= ALOG_LEVEL_WARN
+#define ALOG_WARN(...) ::logging::Log(::spdlog::level::warn, __VA_ARGS__)
+#else
+#define ALOG_WARN(...) (void)0
+#endif
+
+#if ALOG_ACTIVE_LEVEL <= ALOG_LEVEL_ERROR
+#define ALOG_ERROR(...) ::logging::Log(::spdlog::level::err, __VA_ARGS__)
+#else
+#define ALOG_ERROR(...) (void)0
+#endif
+
+#if ALOG_ACTIVE_LEVEL <= ALOG_LEVEL_CRITICAL
+#define ALOG_CRITICAL(...) ::logging::Log(::spdlog::level::critical, __VA_ARGS__)
+#else
+#define ALOG_CRITICAL(...) (void)0
+#endif
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace logging {
+
+/**
+ * @brief one argument of a deferred record
+ */
+struct Argument {
+  enum class Type : uint8_t { Signed, Unsigned, Double, Bool, Text };
+  Type type;
+  bool truncated;  ///< text cut to the room left in the record
+  union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    bool b;
+    struct {
+      uint16_t offset;
+      uint16_t length;
+    } text;
+  };
+};
+
+/**
+ * @brief fixed-size binary log record, formatted by the flusher only
+ */
+struct Record {
+  static constexpr size_t kMaxArguments = 4;
+  static constexpr size_t kTextSize = 256;
+
+  int64_t timestamp;                            ///< spdlog::log_clock ticks
+  const char* format;                           ///< format string literal
+  spdlog::level::level_enum level;              ///< level
+  uint8_t count;                                ///< number of arguments
+  uint16_t text_used;                           ///< bytes used in text
+  std::array<Argument, kMaxArguments> arguments;  ///< arguments
+  std::array<char, kTextSize> text;             ///< storage of string arguments
+};
+
+/**
+ * @brief single producer, single consumer ring of records owned by one thread
+ */
+class ThreadRing {
+ public:
+  static constexpr size_t kCapacity = 4096;  ///< power of two
+
+  /**
+   * @brief get a slot to fill, nullptr if the ring is full
+   */
+  [[nodiscard]] Record* Claim() noexcept {
+    auto head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail_cache == kCapacity) {
+      m_tail_cache = m_tail.load(std::memory_order_acquire);
+      if (head - m_tail_cache == kCapacity) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+    }
+    return &m_records[head & (kCapacity - 1)];
+  }
+
+  /**
+   * @brief the owner is about to check the mode and fill a record, see AsyncLogger::Stop()
+   */
+  void BeginWrite() noexcept {
+    m_writing.store(true, std::memory_order_seq_cst);
+  }
+
+  void EndWrite() noexcept {
+    m_writing.store(false, std::memory_order_release);
+  }
+
+  [[nodiscard]] bool IsWriting() const noexcept {
+    return m_writing.load(std::memory_order_seq_cst);
+  }
+
+  /**
+   * @brief publish the slot returned by Claim()
+   */
+  void Publish() noexcept {
+    m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  /**
+   * @brief move all published records to output
+   * @return number of moved records
+   */
+  size_t Drain(std::vector<Record>& output) {
+    auto tail = m_tail.load(std::memory_order_relaxed);
+    auto head = m_head.load(std::memory_order_acquire);
+    for (auto i = tail; i != head; ++i) {
+      output.push_back(m_records[i & (kCapacity - 1)]);
+    }
+    m_tail.store(head, std::memory_order_release);
+    return head - tail;
+  }
+
+  [[nodiscard]] bool Empty() const noexcept {
+    return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief number of records lost because the ring was full
+   */
+  [[nodiscard]] uint64_t Dropped() const noexcept {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
+  void Retire() noexcept {
+    m_retired.store(true, std::memory_order_release);
+  }
+
+  [[nodiscard]] bool IsRetired() const noexcept {
+    return m_retired.load(std::memory_order_acquire);
+  }
+
+ private:
+  alignas(64) std::atomic<uint64_t> m_head{0};  ///< written by the producer
+  std::atomic<bool> m_writing{false};           ///< producer between BeginWrite() and EndWrite()
+  uint64_t m_tail_cache{0};                     ///< producer copy of tail
+  alignas(64) std::atomic<uint64_t> m_tail{0};  ///< written by the flusher
+  std::atomic<uint64_t> m_dropped{0};           ///< records lost on a full ring
+  std::atomic<bool> m_retired{false};           ///< owner thread has exited
+  std::array<Record, kCapacity> m_records;      ///< records
+};
+
+/**
+ * @brief registry of thread rings and the background flusher
+ */
+class AsyncLogger {
+ public:
+  /**
+   * @brief get the process wide logger
+   */
+  static AsyncLogger& Instance() {
+    static AsyncLogger logger;
+    return logger;
+  }
+
+  ~AsyncLogger() {
+    Stop();
+  }
+
+  /**
+   * @brief switch to the asynchronous mode and start the flusher
+   * @param interval - max. time records wait in a ring
+   */
+  void Start(std::chrono::milliseconds interval = std::chrono::milliseconds(10)) {
+    std::lock_guard lck(m_mutex);
+    if (m_flusher.joinable()) {
+      return;
+    }
+    m_interval = interval;
+    m_flusher = std::jthread([this](std::stop_token token) { Flusher(token); });
+    m_running.store(true, std::memory_order_release);
+  }
+
+  /**
+   * @brief flush everything and go back to synchronous logging
+   * @details a thread that still saw the asynchronous mode is waited for,
+   * its record is in the final flush
+   */
+  void Stop() {
+    std::jthread flusher;
+    std::vector<std::shared_ptr<ThreadRing>> rings;
+    {
+      std::lock_guard lck(m_mutex);
+      m_running.store(false, std::memory_order_seq_cst);
+      flusher = std::move(m_flusher);
+      rings = m_rings;
+    }
+    for (const auto& ring : rings) {
+      while (ring->IsWriting()) {
+        std::this_thread::yield();
+      }
+    }
+    if (flusher.joinable()) {
+      flusher.request_stop();
+      m_wakeup.notify_all();
+      flusher.join();
+    }
+    Flush();
+  }
+
+  /**
+   * @brief is the asynchronous mode active
+   */
+  [[nodiscard]] bool IsRunning() const noexcept {
+    return m_running.load(std::memory_order_seq_cst);
+  }
+
+  /**
+   * @brief ring of the calling thread, created on first use
+   */
+  ThreadRing& Ring() {
+    thread_local RingOwner owner(*this);
+    return *owner.ring;
+  }
+
+  /**
+   * @brief total number of records lost on full rings
+   */
+  [[nodiscard]] uint64_t Dropped() {
+    std::lock_guard lck(m_mutex);
+    auto dropped = m_dropped_retired;
+    for (const auto& ring : m_rings) {
+      dropped += ring->Dropped();
+    }
+    return dropped;
+  }
+
+  /**
+   * @brief drain all rings and write the records to spdlog
+   */
+  void Flush() {
+    std::lock_guard flush_lck(m_flush_mutex);
+    m_batch.clear();
+    {
+      std::lock_guard lck(m_mutex);
+      for (auto it = m_rings.begin(); it != m_rings.end();) {
+        (*it)->Drain(m_batch);
+        if ((*it)->IsRetired() && (*it)->Empty()) {
+          m_dropped_retired += (*it)->Dropped();
+          it = m_rings.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+    std::stable_sort(m_batch.begin(), m_batch.end(),
+                     [](const Record& l, const Record& r) { return l.timestamp < r.timestamp; });
+    auto* logger = spdlog::default_logger_raw();
+    for (const auto& record : m_batch) {
+      auto time = spdlog::log_clock::time_point(spdlog::log_clock::duration(record.timestamp));
+      logger->log(time, spdlog::source_loc{}, record.level, Format(record));
+    }
+    if (!m_batch.empty()) {
+      logger->flush();
+    }
+  }
+
+  /**
+   * @brief format one record
+   */
+  static std::string Format(const Record& record) {
+    fmt::dynamic_format_arg_store<fmt::format_context> store;
+    for (size_t i = 0; i < record.count; ++i) {
+      const auto& argument = record.arguments[i];
+      switch (argument.type) {
+        case Argument::Type::Signed:
+          store.push_back(argument.i);
+          break;
+        case Argument::Type::Unsigned:
+          store.push_back(argument.u);
+          break;
+        case Argument::Type::Double:
+          store.push_back(argument.d);
+          break;
+        case Argument::Type::Bool:
+          store.push_back(argument.b);
+          break;
+        case Argument::Type::Text: {
+          std::string_view text(record.text.data() + argument.text.offset, argument.text.length);
+          if (argument.truncated) {
+            store.push_back(std::string(text) + "...");
+          } else {
+            store.push_back(text);
+          }
+          break;
+        }
+      }
+    }
+    try {
+      return fmt::vformat(record.format, store);
+    } catch (const fmt::format_error& error) {
+      return std::string(record.format) + " [format error: " + error.what() + "]";
+    }
+  }
+
+ private:
+  /**
+   * @brief thread local owner of a ring, retires it on thread exit
+   */
+  struct RingOwner {
+    explicit RingOwner(AsyncLogger& logger) : ring(std::make_shared<ThreadRing>()) {
+      std::lock_guard lck(logger.m_mutex);
+      logger.m_rings.push_back(ring);
+    }
+    ~RingOwner() {
+      ring->Retire();
+    }
+    std::shared_ptr<ThreadRing> ring;
+  };
+
+  AsyncLogger() = default;
+
+  void Flusher(std::stop_token token) {
+    while (!token.stop_requested()) {
+      {
+        std::unique_lock lck(m_wakeup_mutex);
+        m_wakeup.wait_for(lck, token, m_interval, [] { return false; });
+      }
+      Flush();
+    }
+  }
+
+  std::mutex m_mutex;                                ///< guards rings and flusher
+  std::mutex m_flush_mutex;                          ///< serializes Flush()
+  std::vector<std::shared_ptr<ThreadRing>> m_rings;  ///< registered rings
+  std::vector<Record> m_batch;                       ///< records of one flush
+  uint64_t m_dropped_retired{0};                     ///< dropped by exited threads
+  std::atomic<bool> m_running{false};                ///< asynchronous mode
+  std::chrono::milliseconds m_interval{10};          ///< flush interval
+  std::mutex m_wakeup_mutex;                         ///< flusher wakeup
+  std::condition_variable_any m_wakeup;              ///< flusher wakeup
+  std::jthread m_flusher;                            ///< background flusher
+};
+
+namespace detail {
+
+/**
+ * @brief store one argument into a record
+ */
+template <typename T>
+inline void Encode(Record& record, const T& value) {
+  auto& argument = record.arguments[record.count++];
+  using Type = std::decay_t<T>;
+  if constexpr (std::is_same_v<Type, bool>) {
+    argument.type = Argument::Type::Bool;
+    argument.b = value;
+  } else if constexpr (std::is_enum_v<Type>) {
+    argument.type = Argument::Type::Signed;
+    argument.i = static_cast<int64_t>(value);
+  } else if constexpr (std::is_integral_v<Type> && std::is_signed_v<Type>) {
+    argument.type = Argument::Type::Signed;
+    argument.i = value;
+  } else if constexpr (std::is_integral_v<Type>) {
+    argument.type = Argument::Type::Unsigned;
+    argument.u = value;
+  } else if constexpr (std::is_floating_point_v<Type>) {
+    argument.type = Argument::Type::Double;
+    argument.d = value;
+  } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+    std::string_view text(value);
+    auto length = std::min(text.size(), Record::kTextSize - record.text_used);
+    std::memcpy(record.text.data() + record.text_used, text.data(), length);
+    argument.type = Argument::Type::Text;
+    argument.truncated = length < text.size();
+    argument.text.offset = record.text_used;
+    argument.text.length = static_cast<uint16_t>(length);
+    record.text_used = static_cast<uint16_t>(record.text_used + length);
+  } else {
+    static_assert(sizeof(T) == 0, "unsupported log argument type");
+  }
+}
+
+}  // namespace detail
+
+/**
+ * @brief log a message
+ * @details The format must be a string literal, it is formatted later by the flusher.
+ * @param level - spdlog level
+ * @param format - fmt format string literal
+ * @param args - up to Record::kMaxArguments arguments: arithmetic, enum or string-like
+ */
+template <size_t N, typename... Args>
+inline void Log(spdlog::level::level_enum level, const char (&format)[N], const Args&... args) {
+  static_assert(sizeof...(Args) <= Record::kMaxArguments, "too many log arguments");
+  if (!spdlog::default_logger_raw()->should_log(level)) {
+    return;
+  }
+  auto fill = [&](Record& record) {
+    record.timestamp = spdlog::log_clock::now().time_since_epoch().count();
+    record.format = format;
+    record.level = level;
+    record.count = 0;
+    record.text_used = 0;
+    (detail::Encode(record, args), ...);
+  };
+  auto log_now = [&]() {
+    Record record;
+    fill(record);
+    spdlog::default_logger_raw()->log(level, AsyncLogger::Format(record));
+  };
+  auto& logger = AsyncLogger::Instance();
+  if (!logger.IsRunning()) {
+    log_now();
+    return;
+  }
+  // checked again once marked writing: either Stop() waits for this record
+  // or it is logged synchronously
+  auto& ring = logger.Ring();
+  ring.BeginWrite();
+  if (!logger.IsRunning()) {
+    ring.EndWrite();
+    log_now();
+    return;
+  }
+  if (auto* record = ring.Claim()) {
+    fill(*record);
+    ring.Publish();
+  }
+  ring.EndWrite();
+}
+
+}  // namespace logging
+
+#endif /* SRC_INCLUDE_ASYNC_LOG_HPP */
@@ -0,0 +1,101 @@
+#pragma once
+#include <array>
+#include <concepts>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+
+#include "fswatch.hpp"
+
+// Overload of a handler for one event: operator()(on_event<E>, event_view).
+// A handler with a generic operator() handles every event.
+template <typename THandler, fswatch_types::Event E>
+concept fswatch_handles =
+    std::invocable<THandler &, fswatch_types::on_event<E>, const fswatch_types::event_view &>;
+
+// Watcher with handlers fixed at compile time. No std::function and no map
+// lookup: the handler types are template parameters, the events each one
+// handles follow from its overloads, and every event dispatches through a
+// constexpr table of functions calling the handlers directly, so they can
+// be inlined into the decoder:
+//
+//   struct on_change {
+//     void operator()(fswatch::on_event<fswatch::Event::FILE_MODIFIED>,
+//                     const fswatch::event_view &event) { ... }
+//   };
+//   basic_fswatch<on_change> watcher({on_change{}}, "/srv/data");
+//   watcher.start(token);
+//
+// The events without a handler are known at compile time as well, the
+// kernel is never asked for them. Handlers run on the thread reading the
+// events, in the order of the template parameters. The path of the
+// event_view is valid during the call only.
+//
+template <typename... Handlers>
+class basic_fswatch : public fswatch_engine<basic_fswatch<Handlers...>> {
+  using engine = fswatch_engine<basic_fswatch<Handlers...>>;
+  friend engine;
+
+ public:
+  using Event = fswatch_types::Event;
+  using event_view = fswatch_types::event_view;
+
+  // Some handler handles event E
+  template <Event E>
+  static constexpr bool kAnyHandles = (fswatch_handles<Handlers, E> || ...);
+
+  // Events with a handler, bits by Event
+  static constexpr uint32_t kHandled = []<size_t... I>(std::index_sequence<I...>) {
+    return ((kAnyHandles<static_cast<Event>(I)> ? 1u << I : 0u) | ...);
+  }(std::make_index_sequence<fswatch_types::kEventCount>{});
+
+  static_assert(sizeof...(Handlers) == 0 || kHandled != 0, "basic_fswatch: no handler handles any event");
+
+  template <class... T>
+  basic_fswatch(std::tuple<Handlers...> handlers, T... paths)
+      : engine(paths...), handlers(std::move(handlers)) {}
+
+  // The run_async() thread runs the handlers, it ends before they go.
+  ~basic_fswatch() { this->shutdown(); }
+
+  template <typename THandler>
+  THandler &handler() {
+    return std::get<THandler>(handlers);
+  }
+
+ private:
+  using entry = void (*)(basic_fswatch &, const event_view &);
+
+  static constexpr uint32_t handled_events() { return kHandled; }
+
+  // All handlers of one event, in template parameter order
+  template <Event E>
+  static void invoke(basic_fswatch &self, const event_view &view) {
+    std::apply(
+        [&view](auto &...handler) {
+          (
+              [&] {
+                if constexpr (fswatch_handles<std::remove_reference_t<decltype(handler)>, E>) {
+                  handler(fswatch_types::on_event<E>{}, view);
+                }
+              }(),
+              ...);
+        },
+        self.handlers);
+  }
+
+  static constexpr std::array<entry, fswatch_types::kEventCount> table =
+      []<size_t... I>(std::index_sequence<I...>) {
+        return std::array<entry, fswatch_types::kEventCount>{&invoke<static_cast<Event>(I)>...};
+      }(std::make_index_sequence<fswatch_types::kEventCount>{});
+
+  // The decoder passes the event as a type, the entry is selected at compile
+  // time and called directly.
+  template <Event E>
+  void dispatch(fswatch_types::on_event<E>, std::string_view path) {
+    constexpr entry target = table[static_cast<size_t>(E)];
+    target(*this, event_view{E, path});
+  }
+
+  std::tuple<Handlers...> handlers;
+};
@@ -0,0 +1,325 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief In-process publish/subscribe bus with one broadcast ring per event type.
+* @details Every topic is a ring of sequenced slots in the style of the LMAX
+* disruptor. Producers claim a sequence with one atomic add, fill the slot and
+* publish it by storing its sequence. Every subscriber owns a cursor and reads
+* the published slots in batches at its own pace; the cursor is stored once
+* per batch. A producer only waits when it would overwrite a slot the slowest
+* subscriber has not read yet, so nothing is lost and no lock is taken on the
+* hot path. Subscribers that want to block sleep on a futex word which the
+* producers only touch while somebody sleeps.
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_EVENT_BUS_HPP
+#define SRC_INCLUDE_EVENT_BUS_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace watch {
+
+/**
+ * @brief multi producer broadcast ring, every subscriber sees every value
+ * @details subscribers are added while the topic is set up: one that joins
+ * under load starts at the next claimed sequence and may miss the values
+ * claimed just before.
+ */
+template <typename T>
+class BroadcastRing {
+  static constexpr size_t kMaxSubscribers = 64;
+  static constexpr int kYields = 16;  ///< yields of WaitFor() before it sleeps
+
+ public:
+  /**
+   * @brief cursor of one subscriber, unsubscribes when destroyed
+   */
+  class Subscriber {
+   public:
+    Subscriber() = default;
+    Subscriber(BroadcastRing* ring, size_t index) : m_ring(ring), m_index(index) {}
+    Subscriber(Subscriber&& other) noexcept
+        : m_ring(std::exchange(other.m_ring, nullptr)), m_index(other.m_index) {}
+    Subscriber& operator=(Subscriber&& other) noexcept {
+      if (this != &other) {
+        Reset();
+        m_ring = std::exchange(other.m_ring, nullptr);
+        m_index = other.m_index;
+      }
+      return *this;
+    }
+    ~Subscriber() {
+      Reset();
+    }
+
+    /**
+     * @brief call fn(value, sequence) for up to max published values
+     * @return number of values read, 0 if nothing is published
+     */
+    template <typename TFn>
+    size_t Poll(TFn&& fn, size_t max = SIZE_MAX) {
+      return m_ring->Read(m_index, std::forward<TFn>(fn), max);
+    }
+
+    /**
+     * @brief block until a value is published or the timeout expires
+     * @return true if a value is ready to be read
+     */
+    bool Wait(std::chrono::nanoseconds timeout) {
+      return m_ring->WaitFor(m_index, timeout);
+    }
+
+    /**
+     * @brief published values not read yet
+     */
+    [[nodiscard]] uint64_t Backlog() const noexcept {
+      return m_ring->Published() - m_ring->m_gates[m_index].cursor.load(std::memory_order_relaxed);
+    }
+
+    void Reset() noexcept {
+      if (auto* ring = std::exchange(m_ring, nullptr)) {
+        ring->Unsubscribe(m_index);
+      }
+    }
+
+   private:
+    BroadcastRing* m_ring{nullptr};
+    size_t m_index{0};
+  };
+
+  explicit BroadcastRing(size_t capacity = 1024)
+      : m_mask(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1), m_slots(new Slot[m_mask + 1]) {}
+
+  BroadcastRing(const BroadcastRing&) = delete;
+  BroadcastRing& operator=(const BroadcastRing&) = delete;
+
+  /**
+   * @brief add a subscriber, it reads the values published from now on
+   */
+  Subscriber Subscribe() {
+    std::lock_guard lock(m_subscribe);
+    for (size_t index = 0; index < kMaxSubscribers; ++index) {
+      auto& gate = m_gates[index];
+      if (!gate.active.load(std::memory_order_relaxed)) {
+        gate.cursor.store(m_claim.load(std::memory_order_acquire), std::memory_order_relaxed);
+        gate.active.store(true, std::memory_order_seq_cst);
+        m_gate_count.store(std::max(m_gate_count.load(std::memory_order_relaxed), index + 1),
+                           std::memory_order_release);
+        return Subscriber(this, index);
+      }
+    }
+    throw std::runtime_error("BroadcastRing: too many subscribers");
+  }
+
+  /**
+   * @brief publish a value, waits while the slowest subscriber is a full ring behind
+   * @return sequence of the value
+   */
+  template <typename TValue>
+  uint64_t Publish(TValue&& value) {
+    auto sequence = m_claim.fetch_add(1, std::memory_order_acq_rel);
+    for (unsigned spins = 0; sequence - LowestCursor(sequence) > m_mask; ++spins) {
+      if (spins < 64) {
+        continue;
+      }
+      std::this_thread::yield();
+    }
+    auto& slot = m_slots[sequence & m_mask];
+    slot.value = std::forward<TValue>(value);
+    slot.sequence.store(sequence + 1, std::memory_order_release);
+    // pairs with the fence in WaitFor(): either we see the sleeper or it sees the value
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // the first producer after a subscriber went to sleep wakes all of them
+    if (m_sleepers.load(std::memory_order_relaxed) != 0 && m_sleepers.exchange(0, std::memory_order_acq_rel) != 0) {
+      m_signal.fetch_add(1, std::memory_order_release);
+      Futex(&m_signal, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr);
+    }
+    return sequence;
+  }
+
+  /**
+   * @brief number of claimed sequences, the next one to be published
+   */
+  [[nodiscard]] uint64_t Published() const noexcept {
+    return m_claim.load(std::memory_order_acquire);
+  }
+
+  [[nodiscard]] size_t Capacity() const noexcept {
+    return m_mask + 1;
+  }
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> sequence{0};  ///< sequence + 1 once published
+    T value{};
+  };
+
+  struct alignas(64) Gate {
+    std::atomic<uint64_t> cursor{0};  ///< next sequence the subscriber reads
+    std::atomic<bool> active{false};
+  };
+
+  /**
+   * @brief lowest cursor of the subscribers, cached until a producer runs into it
+   */
+  uint64_t LowestCursor(uint64_t sequence) noexcept {
+    auto gate = m_gate_cache.load(std::memory_order_acquire);
+    if (sequence - gate <= m_mask) {
+      return gate;
+    }
+    gate = sequence;
+    for (size_t index = 0, count = m_gate_count.load(std::memory_order_acquire); index < count; ++index) {
+      if (m_gates[index].active.load(std::memory_order_acquire)) {
+        gate = std::min(gate, m_gates[index].cursor.load(std::memory_order_acquire));
+      }
+    }
+    m_gate_cache.store(gate, std::memory_order_release);
+    return gate;
+  }
+
+  template <typename TFn>
+  size_t Read(size_t index, TFn&& fn, size_t max) {
+    auto& gate = m_gates[index];
+    auto cursor = gate.cursor.load(std::memory_order_relaxed);
+    size_t count = 0;
+    for (; count < max; ++count, ++cursor) {
+      auto& slot = m_slots[cursor & m_mask];
+      if (slot.sequence.load(std::memory_order_acquire) != cursor + 1) {
+        break;
+      }
+      fn(static_cast<const T&>(slot.value), cursor);
+    }
+    if (count != 0) {
+      // one store per batch releases the slots to the producers
+      gate.cursor.store(cursor, std::memory_order_release);
+    }
+    return count;
+  }
+
+  bool WaitFor(size_t index, std::chrono::nanoseconds timeout) {
+    auto cursor = m_gates[index].cursor.load(std::memory_order_relaxed);
+    auto ready = [&]() {
+      return m_slots[cursor & m_mask].sequence.load(std::memory_order_acquire) == cursor + 1;
+    };
+    // yield first, a producer on the same core gets to publish a batch
+    for (int yields = 0; yields < kYields; ++yields) {
+      if (ready()) {
+        return true;
+      }
+      std::this_thread::yield();
+    }
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!ready()) {
+      auto left = deadline - std::chrono::steady_clock::now();
+      if (left <= std::chrono::nanoseconds::zero()) {
+        return false;
+      }
+      // a sleeper is counted until a producer wakes it, a timed out one costs one spare wake
+      m_sleepers.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      auto signal = m_signal.load(std::memory_order_acquire);
+      if (!ready()) {
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(left);
+        timespec relative{static_cast<time_t>(seconds.count()),
+                          static_cast<long>(std::chrono::nanoseconds(left - seconds).count())};
+        Futex(&m_signal, FUTEX_WAIT_PRIVATE, signal, &relative);
+      }
+    }
+    return true;
+  }
+
+  void Unsubscribe(size_t index) noexcept {
+    std::lock_guard lock(m_subscribe);
+    m_gates[index].active.store(false, std::memory_order_release);
+    // a producer waiting on this cursor recomputes the gate
+    m_gate_cache.store(0, std::memory_order_release);
+  }
+
+  static void Futex(std::atomic<uint32_t>* word, int op, uint32_t value, const timespec* timeout) noexcept {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value, timeout, nullptr, 0);
+  }
+
+  const uint64_t m_mask;                       ///< capacity - 1, power of two
+  std::unique_ptr<Slot[]> m_slots;             ///< values by sequence & mask
+  alignas(64) std::atomic<uint64_t> m_claim{0};       ///< next sequence to claim
+  alignas(64) std::atomic<uint64_t> m_gate_cache{0};  ///< last computed lowest cursor
+  alignas(64) std::atomic<uint32_t> m_signal{0};      ///< futex word of the sleeping subscribers
+  std::atomic<uint32_t> m_sleepers{0};                ///< subscribers in WaitFor()
+  std::array<Gate, kMaxSubscribers> m_gates;          ///< cursors by subscriber
+  std::atomic<size_t> m_gate_count{0};                ///< highest used gate + 1
+  std::mutex m_subscribe;                             ///< serializes Subscribe() and Unsubscribe()
+};
+
+/**
+ * @brief typed topics, one broadcast ring per event type
+ * @details Topic() takes a lock to find the ring, producers on a hot path
+ * keep the returned reference.
+ */
+class EventBus {
+ public:
+  explicit EventBus(size_t capacity = 1024) : m_capacity(capacity) {}
+
+  EventBus(const EventBus&) = delete;
+  EventBus& operator=(const EventBus&) = delete;
+
+  /**
+   * @brief the ring of an event type, created on first use
+   */
+  template <typename T>
+  BroadcastRing<T>& Topic() {
+    std::lock_guard lock(m_mutex);
+    auto& topic = m_topics[std::type_index(typeid(T))];
+    if (!topic) {
+      topic = std::make_shared<BroadcastRing<T>>(m_capacity);
+    }
+    return *static_cast<BroadcastRing<T>*>(topic.get());
+  }
+
+  template <typename T>
+  uint64_t Publish(T&& value) {
+    return Topic<std::decay_t<T>>().Publish(std::forward<T>(value));
+  }
+
+  template <typename T>
+  typename BroadcastRing<T>::Subscriber Subscribe() {
+    return Topic<T>().Subscribe();
+  }
+
+ private:
+  size_t m_capacity;                                               ///< slots of a new topic
+  std::mutex m_mutex;                                              ///< guards m_topics
+  std::unordered_map<std::type_index, std::shared_ptr<void>> m_topics;  ///< rings by event type
+};
+
+}  // namespace watch
+
+#endif /* SRC_INCLUDE_EVENT_BUS_HPP */
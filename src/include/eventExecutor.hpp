@@ -0,0 +1,411 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Work-stealing executor running event handlers off the reading thread.
+* @details Tasks are posted with a key (e.g. the hash of an event path). All
+* tasks with the same key land in the same strand and run one after another
+* in posting order, while different strands run in parallel on the worker
+* threads. A strand with pending work is scheduled on one worker deque; idle
+* workers steal strands from the other deques. When the number of queued
+* tasks reaches the capacity, the backpressure policy decides what happens.
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_EVENT_EXECUTOR_HPP
+#define SRC_INCLUDE_EVENT_EXECUTOR_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace watch {
+
+/**
+ * @brief what Post() does when the executor queue is full
+ */
+enum class Backpressure {
+  Block,       ///< wait until a worker frees a slot
+  DropOldest,  ///< drop the oldest queued task of the same key (or the new one if there is none)
+  Coalesce     ///< merge with the last queued task of the strand if it has the same key and coalesce key, else
+               ///< drop the oldest like DropOldest
+};
+
+/**
+ * @brief executor setup
+ */
+struct ExecutorOptions {
+  size_t threads{std::max(1u, std::thread::hardware_concurrency())};  ///< worker threads
+  size_t strands{256};                                                ///< serial lanes keyed by task key
+  size_t capacity{65536};                                             ///< max. queued tasks
+  size_t batch{32};                                                   ///< tasks run per strand visit
+  Backpressure policy{Backpressure::Block};                           ///< full queue behaviour
+};
+
+/**
+ * @brief executor metrics snapshot
+ */
+struct ExecutorMetrics {
+  static constexpr size_t kBuckets = 32;  ///< log2(ns) latency buckets
+
+  uint64_t posted;         ///< tasks accepted
+  uint64_t executed;       ///< tasks finished
+  uint64_t failed;         ///< tasks finished by an exception
+  uint64_t dropped;        ///< tasks dropped by DropOldest/Coalesce
+  uint64_t coalesced;      ///< tasks merged with a queued one
+  uint64_t blocked;        ///< Post() calls that had to wait
+  uint64_t depth;          ///< currently queued tasks
+  uint64_t max_depth;      ///< high watermark of queued tasks
+  uint64_t steals;         ///< strands taken from another worker
+  uint64_t handler_ns;     ///< total handler time
+  std::array<uint64_t, kBuckets> handler_latency;  ///< handler run time histogram, bucket i: < 2^i ns
+  std::array<uint64_t, kBuckets> queue_latency;    ///< time from Post() to start, bucket i: < 2^i ns
+
+  /**
+   * @brief approximate percentile from a histogram
+   * @return upper bound of the bucket in ns
+   */
+  static uint64_t Percentile(const std::array<uint64_t, kBuckets>& histogram, double p) {
+    uint64_t total = 0;
+    for (auto count : histogram) {
+      total += count;
+    }
+    uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; ++i) {
+      seen += histogram[i];
+      if (seen > rank) {
+        return uint64_t{1} << i;
+      }
+    }
+    return total ? uint64_t{1} << (kBuckets - 1) : 0;
+  }
+};
+
+/**
+ * @brief work-stealing executor with per-key ordering
+ */
+class EventExecutor {
+ public:
+  using Task = std::function<void()>;
+  using Clock = std::chrono::steady_clock;
+
+  explicit EventExecutor(ExecutorOptions options = {})
+      : m_options(options), m_strands(std::max<size_t>(1, options.strands)), m_workers(std::max<size_t>(1, options.threads)) {
+    m_options.capacity = std::max<size_t>(1, m_options.capacity);
+    m_options.batch = std::max<size_t>(1, m_options.batch);
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+      m_workers[i].thread = std::thread([this, i] { Work(i); });
+    }
+  }
+
+  EventExecutor(const EventExecutor&) = delete;
+  EventExecutor& operator=(const EventExecutor&) = delete;
+
+  /**
+   * @brief run all queued tasks and stop the workers
+   */
+  ~EventExecutor() {
+    Drain();
+    {
+      std::lock_guard lck(m_idle_mutex);
+      m_stop = true;
+    }
+    m_idle.notify_all();
+    for (auto& worker : m_workers) {
+      worker.thread.join();
+    }
+  }
+
+  /**
+   * @brief queue a task
+   * @param key - tasks with the same key run in posting order
+   * @param coalesce_key - identity of the task for Backpressure::Coalesce
+   * @param task - task to run
+   * @return false if the task was dropped or merged
+   */
+  bool Post(uint64_t key, uint64_t coalesce_key, Task task) {
+    auto& strand = m_strands[key % m_strands.size()];
+    std::unique_lock lck(strand.mutex);
+
+    auto depth = m_depth.load(std::memory_order_relaxed);
+    bool blocked = false;
+    while (true) {
+      // reserve the slot before the push, posters on other strands can't go past the capacity
+      if (depth < m_options.capacity) {
+        if (m_depth.compare_exchange_weak(depth, depth + 1, std::memory_order_relaxed)) {
+          ++depth;
+          break;
+        }
+        continue;
+      }
+      if (m_options.policy == Backpressure::Block) {
+        if (!blocked) {
+          blocked = true;
+          m_blocked.fetch_add(1, std::memory_order_relaxed);
+        }
+        lck.unlock();
+        {
+          std::unique_lock space_lck(m_space_mutex);
+          m_waiting++;
+          m_space.wait(space_lck, [this] { return m_depth.load(std::memory_order_relaxed) < m_options.capacity; });
+          m_waiting--;
+        }
+        // another poster woken with this one may have taken the slot, check again
+        lck.lock();
+        depth = m_depth.load(std::memory_order_relaxed);
+        continue;
+      }
+      // only the last task of the strand, an earlier one would run before the tasks queued after it
+      if (m_options.policy == Backpressure::Coalesce && !strand.items.empty() && strand.items.back().key == key &&
+          strand.items.back().coalesce_key == coalesce_key) {
+        m_coalesced.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      // the strand is shared with other keys, drop a task of this key only
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      auto oldest = std::find_if(strand.items.begin(), strand.items.end(),
+                                 [key](const Item& item) { return item.key == key; });
+      if (oldest == strand.items.end()) {
+        return false;
+      }
+      // the new task takes over the slot
+      strand.items.erase(oldest);
+      break;
+    }
+
+    strand.items.push_back(Item{key, coalesce_key, Clock::now(), std::move(task)});
+    m_posted.fetch_add(1, std::memory_order_relaxed);
+    for (auto max = m_max_depth.load(std::memory_order_relaxed);
+         depth > max && !m_max_depth.compare_exchange_weak(max, depth, std::memory_order_relaxed);) {
+    }
+    if (!strand.scheduled) {
+      strand.scheduled = true;
+      lck.unlock();
+      Schedule(key % m_workers.size(), &strand);
+    }
+    return true;
+  }
+
+  /**
+   * @brief wait until all queued tasks have run
+   */
+  void Drain() {
+    std::unique_lock lck(m_space_mutex);
+    m_waiting++;
+    m_space.wait(lck, [this] {
+      return m_depth.load(std::memory_order_relaxed) == 0 && m_running.load(std::memory_order_relaxed) == 0;
+    });
+    m_waiting--;
+  }
+
+  /**
+   * @brief get a metrics snapshot, lock-free
+   */
+  [[nodiscard]] ExecutorMetrics Metrics() const {
+    ExecutorMetrics metrics{};
+    metrics.posted = m_posted.load(std::memory_order_relaxed);
+    metrics.executed = m_executed.load(std::memory_order_relaxed);
+    metrics.failed = m_failed.load(std::memory_order_relaxed);
+    metrics.dropped = m_dropped.load(std::memory_order_relaxed);
+    metrics.coalesced = m_coalesced.load(std::memory_order_relaxed);
+    metrics.blocked = m_blocked.load(std::memory_order_relaxed);
+    metrics.depth = m_depth.load(std::memory_order_relaxed);
+    metrics.max_depth = m_max_depth.load(std::memory_order_relaxed);
+    metrics.steals = m_steals.load(std::memory_order_relaxed);
+    metrics.handler_ns = m_handler_ns.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < ExecutorMetrics::kBuckets; ++i) {
+      metrics.handler_latency[i] = m_handler_latency[i].load(std::memory_order_relaxed);
+      metrics.queue_latency[i] = m_queue_latency[i].load(std::memory_order_relaxed);
+    }
+    return metrics;
+  }
+
+  [[nodiscard]] const ExecutorOptions& Options() const noexcept {
+    return m_options;
+  }
+
+ private:
+  struct Item {
+    uint64_t key;
+    uint64_t coalesce_key;
+    Clock::time_point posted;
+    Task task;
+  };
+
+  struct Strand {
+    std::mutex mutex;
+    std::deque<Item> items;
+    bool scheduled{false};  ///< strand sits in a worker deque or is being run
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Strand*> strands;
+    std::thread thread;
+  };
+
+  void Schedule(size_t index, Strand* strand) {
+    {
+      std::lock_guard lck(m_workers[index].mutex);
+      m_workers[index].strands.push_back(strand);
+    }
+    {
+      std::lock_guard lck(m_idle_mutex);
+      m_ready++;
+    }
+    m_idle.notify_one();
+  }
+
+  Strand* Take(size_t index) {
+    {
+      auto& own = m_workers[index];
+      std::lock_guard lck(own.mutex);
+      if (!own.strands.empty()) {
+        auto* strand = own.strands.front();
+        own.strands.pop_front();
+        return strand;
+      }
+    }
+    for (size_t i = 1; i < m_workers.size(); ++i) {
+      auto& victim = m_workers[(index + i) % m_workers.size()];
+      std::lock_guard lck(victim.mutex);
+      if (!victim.strands.empty()) {
+        auto* strand = victim.strands.back();
+        victim.strands.pop_back();
+        m_steals.fetch_add(1, std::memory_order_relaxed);
+        return strand;
+      }
+    }
+    return nullptr;
+  }
+
+  static size_t Bucket(Clock::duration duration) {
+    auto ns = static_cast<uint64_t>(std::max<Clock::rep>(0, std::chrono::nanoseconds(duration).count()));
+    return std::min<size_t>(ExecutorMetrics::kBuckets - 1, std::bit_width(ns));
+  }
+
+  void Run(size_t index, Strand* strand) {
+    for (size_t n = 0; n < m_options.batch; ++n) {
+      Item item;
+      {
+        std::lock_guard lck(strand->mutex);
+        if (strand->items.empty()) {
+          strand->scheduled = false;
+          return;
+        }
+        item = std::move(strand->items.front());
+        strand->items.pop_front();
+        m_running.fetch_add(1, std::memory_order_relaxed);
+        m_depth.fetch_sub(1, std::memory_order_relaxed);
+      }
+      NotifySpace();
+
+      auto start = Clock::now();
+      m_queue_latency[Bucket(start - item.posted)].fetch_add(1, std::memory_order_relaxed);
+      try {
+        item.task();
+      } catch (...) {
+        // a failing handler must not kill the worker
+        m_failed.fetch_add(1, std::memory_order_relaxed);
+      }
+      auto elapsed = Clock::now() - start;
+      m_handler_latency[Bucket(elapsed)].fetch_add(1, std::memory_order_relaxed);
+      m_handler_ns.fetch_add(std::chrono::nanoseconds(elapsed).count(), std::memory_order_relaxed);
+      m_executed.fetch_add(1, std::memory_order_relaxed);
+      m_running.fetch_sub(1, std::memory_order_relaxed);
+      NotifySpace();
+    }
+    // batch used up, give other strands a turn
+    bool more;
+    {
+      std::lock_guard lck(strand->mutex);
+      more = !strand->items.empty();
+      strand->scheduled = more;
+    }
+    if (more) {
+      Schedule(index, strand);
+    }
+  }
+
+  /**
+   * @brief wake Post() calls blocked on a full queue and Drain(), only if there are any
+   */
+  void NotifySpace() {
+    {
+      std::lock_guard lck(m_space_mutex);
+      if (m_waiting == 0) {
+        return;
+      }
+    }
+    m_space.notify_all();
+  }
+
+  void Work(size_t index) {
+    while (true) {
+      {
+        std::unique_lock lck(m_idle_mutex);
+        m_idle.wait(lck, [this] { return m_stop || m_ready > 0; });
+        if (m_ready == 0) {
+          return;
+        }
+        m_ready--;
+      }
+      if (auto* strand = Take(index)) {
+        Run(index, strand);
+      }
+    }
+  }
+
+  ExecutorOptions m_options;       ///< setup
+  std::vector<Strand> m_strands;   ///< serial lanes
+  std::vector<Worker> m_workers;   ///< worker threads with their deques
+
+  std::mutex m_idle_mutex;              ///< guards m_ready and m_stop
+  std::condition_variable m_idle;       ///< wakes idle workers
+  size_t m_ready{0};                    ///< scheduled strands not yet taken
+  bool m_stop{false};                   ///< workers exit
+  std::mutex m_space_mutex;             ///< Block policy and Drain()
+  std::condition_variable m_space;      ///< signalled when a task leaves the queue
+  size_t m_waiting{0};                  ///< threads waiting on m_space
+
+  std::atomic<uint64_t> m_posted{0};
+  std::atomic<uint64_t> m_executed{0};
+  std::atomic<uint64_t> m_failed{0};
+  std::atomic<uint64_t> m_dropped{0};
+  std::atomic<uint64_t> m_coalesced{0};
+  std::atomic<uint64_t> m_blocked{0};
+  std::atomic<uint64_t> m_depth{0};
+  std::atomic<uint64_t> m_max_depth{0};
+  std::atomic<uint64_t> m_running{0};
+  std::atomic<uint64_t> m_steals{0};
+  std::atomic<uint64_t> m_handler_ns{0};
+  std::array<std::atomic<uint64_t>, ExecutorMetrics::kBuckets> m_handler_latency{};
+  std::array<std::atomic<uint64_t>, ExecutorMetrics::kBuckets> m_queue_latency{};
+};
+
+}  // namespace watch
+
+#endif /* SRC_INCLUDE_EVENT_EXECUTOR_HPP */
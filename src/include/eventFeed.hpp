@@ -0,0 +1,483 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Decoded watcher events shared with other processes.
+* @details One process watches and publishes every decoded event into a
+* ring of fixed-size slots in a POSIX shared memory object; any number of
+* processes subscribe to it without an inotify instance of their own:
+*   header | consumer cursors | slots
+* The producer never waits for a consumer. A slot carries the sequence it
+* was written at, cleared while it is written, so a consumer that copies a
+* slot and finds another sequence before or after the copy was overrun: it
+* resyncs to the newest event and is told how many it lost, to rebuild its
+* state from the filesystem. Every consumer keeps its cursor in the shared
+* memory, the producer sees how far behind each one is. Consumers that wait
+* sleep on a futex word in the shared memory; the producer issues the wake
+* only if somebody sleeps.
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_EVENT_FEED_HPP
+#define SRC_INCLUDE_EVENT_FEED_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "fswatch.hpp"
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace watch {
+
+/**
+ * @brief shared memory layout of the event feed
+ */
+namespace feed {
+
+inline constexpr char kMagic[8] = {'F', 'S', 'W', 'F', 'E', 'E', 'D', '1'};
+inline constexpr uint32_t kVersion = 1;
+inline constexpr uint32_t kMaxConsumers = 64;
+inline constexpr char kDefaultName[] = "/fswatch_feed";
+
+inline constexpr uint16_t kTruncated = 0x0001;  ///< the path did not fit into the slot
+
+struct Header {
+  char magic[8];           ///< kMagic
+  uint32_t version;        ///< kVersion
+  uint32_t slots;          ///< slots in the ring, power of two
+  uint32_t slot_bytes;     ///< bytes per slot, header included
+  uint32_t closed;         ///< 1 once the producer stopped
+  int64_t pid;             ///< producing process
+  uint64_t reserved[4];
+  alignas(64) uint64_t head;  ///< events published, the next one goes to head % slots
+  alignas(64) uint32_t signal;  ///< futex word of the sleeping consumers
+  uint32_t sleepers;            ///< consumers about to sleep
+};
+
+struct Consumer {
+  int64_t pid;       ///< consuming process, 0 - free
+  uint64_t cursor;   ///< next event the consumer reads
+  uint64_t lost;     ///< events skipped by resyncs
+  uint64_t resyncs;  ///< times the consumer was overrun
+  uint64_t reserved[4];
+};
+
+struct Slot {
+  uint64_t sequence;  ///< event sequence + 1, 0 while written
+  uint16_t type;      ///< fswatch_types::Event
+  uint16_t flags;     ///< kTruncated
+  uint16_t length;    ///< path bytes
+  uint16_t reserved;
+  // path characters follow, not terminated
+};
+
+static_assert(sizeof(Header) == 192 && sizeof(Consumer) == 64 && sizeof(Slot) == 16,
+              "event feed layout must not depend on the compiler");
+
+[[nodiscard]] inline size_t Bytes(uint32_t slots, uint32_t slot_bytes) noexcept {
+  return sizeof(Header) + kMaxConsumers * sizeof(Consumer) + size_t{slots} * slot_bytes;
+}
+
+inline void Futex(uint32_t* word, int op, uint32_t value, const timespec* timeout) noexcept {
+  // not FUTEX_PRIVATE: the word is shared between processes
+  syscall(SYS_futex, word, op, value, timeout, nullptr, 0);
+}
+
+}  // namespace feed
+
+/**
+ * @brief producing side of the feed, called from the watcher thread
+ */
+class FeedPublisher {
+ public:
+  /**
+   * @brief create the shared memory object, a stale one of the same name is replaced
+   * @param name - shared memory name
+   * @param slots - events kept for slow consumers, rounded up to a power of two
+   * @param slot_bytes - bytes per event, longer paths are truncated
+   * @throw std::runtime_error if a live process publishes the feed or the object can not be created
+   */
+  explicit FeedPublisher(std::string name = feed::kDefaultName, uint32_t slots = 65536, uint32_t slot_bytes = 512)
+      : m_name(std::move(name)) {
+    slots = std::bit_ceil(std::max<uint32_t>(slots, 2));
+    slot_bytes = std::clamp<uint32_t>(slot_bytes, sizeof(feed::Slot) + 16, sizeof(feed::Slot) + UINT16_MAX) / 8 * 8;
+    m_size = feed::Bytes(slots, slot_bytes);
+    if (auto pid = LivePublisher(m_name); pid != 0) {
+      throw std::runtime_error("event feed: " + m_name + " is published by the running process " +
+                               std::to_string(pid));
+    }
+    // consumers of a previous producer keep their mapping and see it closed
+    shm_unlink(m_name.c_str());
+    int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("event feed: can't create " + m_name + ": " + std::strerror(errno));
+    }
+    if (ftruncate(fd, static_cast<off_t>(m_size)) != 0) {
+      auto error = errno;
+      ::close(fd);
+      shm_unlink(m_name.c_str());
+      throw std::runtime_error("event feed: can't size " + m_name + ": " + std::strerror(error));
+    }
+    auto* base = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+      shm_unlink(m_name.c_str());
+      throw std::runtime_error("event feed: can't map " + m_name + ": " + std::strerror(errno));
+    }
+    m_base = static_cast<char*>(base);
+    m_header = reinterpret_cast<feed::Header*>(m_base);
+    m_header->version = feed::kVersion;
+    m_header->slots = slots;
+    m_header->slot_bytes = slot_bytes;
+    m_header->pid = getpid();
+    m_mask = slots - 1;
+    m_slot_bytes = slot_bytes;
+    m_slots = m_base + sizeof(feed::Header) + feed::kMaxConsumers * sizeof(feed::Consumer);
+    // the magic last, a consumer attaching meanwhile finds no feed yet
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(m_header->magic, feed::kMagic, sizeof(m_header->magic));
+  }
+
+  FeedPublisher(const FeedPublisher&) = delete;
+  FeedPublisher& operator=(const FeedPublisher&) = delete;
+
+  /**
+   * @brief tell the consumers the feed ended and remove the object
+   */
+  ~FeedPublisher() {
+    std::atomic_ref<uint32_t>(m_header->closed).store(1, std::memory_order_release);
+    Wake();
+    shm_unlink(m_name.c_str());
+    munmap(m_base, m_size);
+  }
+
+  /**
+   * @brief append an event, overwrites the oldest one
+   * @return sequence of the event
+   */
+  uint64_t Publish(fswatch_types::Event type, std::string_view path) noexcept {
+    auto head = std::atomic_ref<uint64_t>(m_header->head).load(std::memory_order_relaxed);
+    auto* slot = reinterpret_cast<feed::Slot*>(m_slots + (head & m_mask) * m_slot_bytes);
+    std::atomic_ref<uint64_t> sequence(slot->sequence);
+    // a consumer that sees the old sequence after its copy must also see this 0 before it
+    sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    auto length = std::min(path.size(), m_slot_bytes - sizeof(feed::Slot));
+    slot->type = static_cast<uint16_t>(type);
+    slot->flags = length < path.size() ? feed::kTruncated : 0;
+    slot->length = static_cast<uint16_t>(length);
+    std::memcpy(reinterpret_cast<char*>(slot + 1), path.data(), length);
+    sequence.store(head + 1, std::memory_order_release);
+    std::atomic_ref<uint64_t>(m_header->head).store(head + 1, std::memory_order_release);
+    // pairs with the fence in FeedSubscriber::Wait(): either we see the sleeper or it sees the event
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (std::atomic_ref<uint32_t>(m_header->sleepers).load(std::memory_order_relaxed) != 0) {
+      Wake();
+    }
+    return head;
+  }
+
+  /**
+   * @brief call fn(pid, lag, lost, resyncs) for every attached consumer
+   */
+  template <typename TFn>
+  void ForEachConsumer(TFn&& fn) const {
+    auto head = std::atomic_ref<uint64_t>(m_header->head).load(std::memory_order_acquire);
+    auto* consumers = reinterpret_cast<feed::Consumer*>(m_base + sizeof(feed::Header));
+    for (uint32_t index = 0; index < feed::kMaxConsumers; ++index) {
+      auto& consumer = consumers[index];
+      auto pid = std::atomic_ref<int64_t>(consumer.pid).load(std::memory_order_acquire);
+      if (pid != 0) {
+        auto cursor = std::atomic_ref<uint64_t>(consumer.cursor).load(std::memory_order_relaxed);
+        fn(pid, head > cursor ? head - cursor : 0, std::atomic_ref<uint64_t>(consumer.lost).load(std::memory_order_relaxed),
+           std::atomic_ref<uint64_t>(consumer.resyncs).load(std::memory_order_relaxed));
+      }
+    }
+  }
+
+  [[nodiscard]] uint64_t Published() const noexcept {
+    return std::atomic_ref<uint64_t>(m_header->head).load(std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] const std::string& Name() const noexcept {
+    return m_name;
+  }
+
+ private:
+  /**
+   * @brief pid of the process publishing an existing feed, 0 if there is none or it is gone
+   */
+  static int64_t LivePublisher(const std::string& name) noexcept {
+    int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+      return 0;
+    }
+    struct stat status {};
+    int64_t pid = 0;
+    if (fstat(fd, &status) == 0 && static_cast<size_t>(status.st_size) >= sizeof(feed::Header)) {
+      auto* base = mmap(nullptr, sizeof(feed::Header), PROT_READ, MAP_SHARED, fd, 0);
+      if (base != MAP_FAILED) {
+        // read-only mapping, the atomic load does not write to it
+        auto* header = static_cast<feed::Header*>(base);
+        auto closed = std::atomic_ref<uint32_t>(header->closed).load(std::memory_order_acquire);
+        if (std::memcmp(header->magic, feed::kMagic, sizeof(header->magic)) == 0 && closed == 0) {
+          pid = header->pid;
+        }
+        munmap(base, sizeof(feed::Header));
+      }
+    }
+    ::close(fd);
+    // a process of another user is alive as well
+    if (pid <= 0 || (kill(static_cast<pid_t>(pid), 0) != 0 && errno == ESRCH)) {
+      return 0;
+    }
+    return pid;
+  }
+
+  void Wake() noexcept {
+    std::atomic_ref<uint32_t>(m_header->sleepers).store(0, std::memory_order_relaxed);
+    std::atomic_ref<uint32_t>(m_header->signal).fetch_add(1, std::memory_order_release);
+    feed::Futex(&m_header->signal, FUTEX_WAKE, INT32_MAX, nullptr);
+  }
+
+  std::string m_name;              ///< shared memory name
+  size_t m_size{0};                ///< mapped bytes
+  char* m_base{nullptr};           ///< mapping
+  feed::Header* m_header{nullptr}; ///< at m_base
+  char* m_slots{nullptr};          ///< first slot
+  uint64_t m_mask{0};              ///< slots - 1
+  size_t m_slot_bytes{0};          ///< bytes per slot
+};
+
+/**
+ * @brief consuming side of the feed, one per thread
+ */
+class FeedSubscriber {
+ public:
+  enum class Status {
+    Event,    ///< an event was read
+    Timeout,  ///< no event within the timeout
+    Resync,   ///< overrun, continues with the next event published; Lost() tells how many were missed
+    Closed,   ///< the producer stopped, all events are read
+  };
+
+  struct Record {
+    fswatch_types::Event type;
+    std::string_view path;  ///< valid until the next call
+    bool truncated;         ///< path cut at the slot size
+    uint64_t sequence;      ///< position in the feed
+  };
+
+  /**
+   * @brief attach to a feed and start at its newest event
+   * @throw std::runtime_error if there is no feed or no free consumer slot
+   */
+  explicit FeedSubscriber(const std::string& name = feed::kDefaultName) {
+    int fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+    struct stat status {};
+    if (fd < 0 || fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(feed::Header)) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      throw std::runtime_error("event feed: can't open " + name);
+    }
+    m_size = static_cast<size_t>(status.st_size);
+    auto* base = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+      throw std::runtime_error("event feed: can't map " + name + ": " + std::strerror(errno));
+    }
+    m_base = static_cast<char*>(base);
+    m_header = reinterpret_cast<feed::Header*>(m_base);
+    // the magic first, the publisher writes it after the rest of the header
+    char magic[sizeof(m_header->magic)];
+    std::memcpy(magic, m_header->magic, sizeof(magic));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    auto slots = m_header->slots;
+    auto slot_bytes = m_header->slot_bytes;
+    // the slot sequences are 8 byte aligned and a slot holds at least its header
+    if (std::memcmp(magic, feed::kMagic, sizeof(magic)) != 0 || m_header->version != feed::kVersion ||
+        !std::has_single_bit(slots) || slot_bytes < sizeof(feed::Slot) || slot_bytes % 8 != 0 ||
+        feed::Bytes(slots, slot_bytes) > m_size) {
+      munmap(m_base, m_size);
+      throw std::runtime_error("event feed: " + name + " is no feed of this version");
+    }
+    m_mask = slots - 1;
+    m_slot_bytes = slot_bytes;
+    m_slots = m_base + sizeof(feed::Header) + feed::kMaxConsumers * sizeof(feed::Consumer);
+    m_consumer = Claim();
+    if (!m_consumer) {
+      munmap(m_base, m_size);
+      throw std::runtime_error("event feed: no free consumer slot in " + name);
+    }
+    m_cursor = std::atomic_ref<uint64_t>(m_header->head).load(std::memory_order_acquire);
+    std::atomic_ref<uint64_t>(m_consumer->cursor).store(m_cursor, std::memory_order_relaxed);
+  }
+
+  FeedSubscriber(const FeedSubscriber&) = delete;
+  FeedSubscriber& operator=(const FeedSubscriber&) = delete;
+
+  ~FeedSubscriber() {
+    std::atomic_ref<int64_t>(m_consumer->pid).store(0, std::memory_order_release);
+    munmap(m_base, m_size);
+  }
+
+  /**
+   * @brief read the next event, wait up to timeout for one
+   */
+  Status Next(Record& record, std::chrono::nanoseconds timeout) {
+    std::chrono::steady_clock::time_point deadline{};
+    for (;;) {
+      auto head = std::atomic_ref<uint64_t>(m_header->head).load(std::memory_order_acquire);
+      if (m_cursor < head) {
+        if (head - m_cursor <= m_mask + 1 && Read(record)) {
+          return Status::Event;
+        }
+        Resync();
+        return Status::Resync;
+      }
+      if (std::atomic_ref<uint32_t>(m_header->closed).load(std::memory_order_acquire) != 0) {
+        return Status::Closed;
+      }
+      if (deadline == std::chrono::steady_clock::time_point{}) {
+        deadline = std::chrono::steady_clock::now() + timeout;
+      }
+      if (!Wait(head, deadline)) {
+        return Status::Timeout;
+      }
+    }
+  }
+
+  /**
+   * @brief events skipped by resyncs so far
+   */
+  [[nodiscard]] uint64_t Lost() const noexcept {
+    return std::atomic_ref<uint64_t>(m_consumer->lost).load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief events published and not read yet
+   */
+  [[nodiscard]] uint64_t Lag() const noexcept {
+    return std::atomic_ref<uint64_t>(m_header->head).load(std::memory_order_relaxed) - m_cursor;
+  }
+
+ private:
+  /**
+   * @brief take a free consumer slot or one of a process that is gone
+   */
+  feed::Consumer* Claim() noexcept {
+    auto* consumers = reinterpret_cast<feed::Consumer*>(m_base + sizeof(feed::Header));
+    int64_t self = getpid();
+    for (int pass = 0; pass < 2; ++pass) {
+      for (uint32_t index = 0; index < feed::kMaxConsumers; ++index) {
+        std::atomic_ref<int64_t> pid(consumers[index].pid);
+        auto owner = pid.load(std::memory_order_acquire);
+        // the second pass takes over the slots of dead consumers
+        auto stale = pass == 1 && owner != 0 && kill(static_cast<pid_t>(owner), 0) != 0 && errno == ESRCH;
+        if ((owner == 0 || stale) && pid.compare_exchange_strong(owner, self, std::memory_order_acq_rel)) {
+          std::atomic_ref<uint64_t>(consumers[index].lost).store(0, std::memory_order_relaxed);
+          std::atomic_ref<uint64_t>(consumers[index].resyncs).store(0, std::memory_order_relaxed);
+          return &consumers[index];
+        }
+      }
+    }
+    return nullptr;
+  }
+
+  bool Read(Record& record) {
+    // the mapping is writable, atomic_ref needs a non-const object
+    auto* slot = reinterpret_cast<feed::Slot*>(m_slots + (m_cursor & m_mask) * m_slot_bytes);
+    std::atomic_ref<uint64_t> sequence(slot->sequence);
+    if (sequence.load(std::memory_order_acquire) != m_cursor + 1) {
+      return false;
+    }
+    auto type = slot->type;
+    auto flags = slot->flags;
+    auto length = std::min<size_t>(slot->length, m_slot_bytes - sizeof(feed::Slot));
+    m_path.assign(reinterpret_cast<const char*>(slot + 1), length);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // overwritten while it was copied
+    if (sequence.load(std::memory_order_relaxed) != m_cursor + 1) {
+      return false;
+    }
+    record = Record{static_cast<fswatch_types::Event>(type), m_path, (flags & feed::kTruncated) != 0, m_cursor};
+    m_cursor++;
+    std::atomic_ref<uint64_t>(m_consumer->cursor).store(m_cursor, std::memory_order_release);
+    return true;
+  }
+
+  void Resync() noexcept {
+    auto head = std::atomic_ref<uint64_t>(m_header->head).load(std::memory_order_acquire);
+    std::atomic_ref<uint64_t>(m_consumer->lost).fetch_add(head - m_cursor, std::memory_order_relaxed);
+    std::atomic_ref<uint64_t>(m_consumer->resyncs).fetch_add(1, std::memory_order_relaxed);
+    m_cursor = head;
+    std::atomic_ref<uint64_t>(m_consumer->cursor).store(m_cursor, std::memory_order_release);
+  }
+
+  /**
+   * @brief sleep until the head moves past seen or the deadline passes
+   * @return false on timeout
+   */
+  bool Wait(uint64_t seen, std::chrono::steady_clock::time_point deadline) {
+    auto left = deadline - std::chrono::steady_clock::now();
+    if (left <= std::chrono::nanoseconds::zero()) {
+      return false;
+    }
+    std::atomic_ref<uint32_t> signal_word(m_header->signal);
+    auto signal = signal_word.load(std::memory_order_acquire);
+    std::atomic_ref<uint32_t>(m_header->sleepers).fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (std::atomic_ref<uint64_t>(m_header->head).load(std::memory_order_acquire) == seen &&
+        std::atomic_ref<uint32_t>(m_header->closed).load(std::memory_order_acquire) == 0) {
+      auto seconds = std::chrono::duration_cast<std::chrono::seconds>(left);
+      timespec relative{static_cast<time_t>(seconds.count()),
+                        static_cast<long>(std::chrono::nanoseconds(left - seconds).count())};
+      feed::Futex(&m_header->signal, FUTEX_WAIT, signal, &relative);
+    }
+    return true;
+  }
+
+  size_t m_size{0};                      ///< mapped bytes
+  char* m_base{nullptr};                 ///< mapping
+  feed::Header* m_header{nullptr};       ///< at m_base
+  feed::Consumer* m_consumer{nullptr};   ///< own cursor in the feed
+  char* m_slots{nullptr};                ///< first slot
+  uint64_t m_mask{0};                    ///< slots - 1
+  size_t m_slot_bytes{0};                ///< bytes per slot
+  uint64_t m_cursor{0};                  ///< next event to read
+  std::string m_path;                    ///< path of the last record
+};
+
+}  // namespace watch
+
+#endif /* SRC_INCLUDE_EVENT_FEED_HPP */
@@ -0,0 +1,587 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Single-threaded epoll event loop for C++20 coroutines.
+* @details Task<T> is a lazily started coroutine that can be co_awaited.
+* EventLoop multiplexes any number of spawned tasks on the calling thread:
+* tasks suspend on fd readiness (Readable), on time (SleepFor/SleepUntil)
+* or on an AsyncEvent, and the loop resumes them from epoll_wait(). A stop
+* request makes all pending and further awaits complete immediately, so
+* tasks can observe IsStopping() and return.
+* @code
+* watch::EventLoop loop;
+* loop.Spawn([](watch::EventLoop& loop) -> watch::Task<> {
+*   watch::AsyncTimer timer(loop);
+*   timer.Start(500ms);
+*   co_await timer.Expiry();
+* }(loop));
+* loop.Run();
+* @endcode
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_EVENT_LOOP_HPP
+#define SRC_INCLUDE_EVENT_LOOP_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "stopTimer.hpp"
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace watch {
+
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+/**
+ * @brief common part of the task promises
+ */
+struct PromiseBase {
+  struct FinalAwaiter {
+    [[nodiscard]] bool await_ready() const noexcept {
+      return false;
+    }
+    template <typename TPromise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<TPromise> handle) noexcept {
+      return handle.promise().continuation;
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept {
+    return {};
+  }
+  FinalAwaiter final_suspend() noexcept {
+    return {};
+  }
+  void unhandled_exception() noexcept {
+    exception = std::current_exception();
+  }
+
+  std::coroutine_handle<> continuation{std::noop_coroutine()};  ///< awaiting coroutine
+  std::exception_ptr exception;                                ///< exception escaped from the task
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+  Task<T> get_return_object() noexcept;
+  template <typename TValue>
+  void return_value(TValue&& result) {
+    value.emplace(std::forward<TValue>(result));
+  }
+  T Result() {
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+    return std::move(*value);
+  }
+  std::optional<T> value;
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+  Task<void> get_return_object() noexcept;
+  void return_void() noexcept {}
+  void Result() {
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+};
+
+}  // namespace detail
+
+/**
+ * @brief lazily started, awaitable coroutine owning its frame
+ * @tparam T - result type
+ */
+template <typename T>
+class Task {
+ public:
+  using promise_type = detail::Promise<T>;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  Task() = default;
+  explicit Task(Handle handle) : m_handle(handle) {}
+  Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      Reset();
+      m_handle = std::exchange(other.m_handle, {});
+    }
+    return *this;
+  }
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+  ~Task() {
+    Reset();
+  }
+
+  [[nodiscard]] bool await_ready() const noexcept {
+    return !m_handle || m_handle.done();
+  }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+    m_handle.promise().continuation = continuation;
+    return m_handle;
+  }
+  T await_resume() {
+    return m_handle.promise().Result();
+  }
+
+ private:
+  void Reset() noexcept {
+    if (m_handle) {
+      m_handle.destroy();
+      m_handle = {};
+    }
+  }
+
+  Handle m_handle{};  ///< coroutine frame
+};
+
+namespace detail {
+
+template <typename T>
+inline Task<T> Promise<T>::get_return_object() noexcept {
+  return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() noexcept {
+  return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+}  // namespace detail
+
+/**
+ * @brief epoll based loop running coroutines on one thread
+ */
+class EventLoop {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  EventLoop() : m_epoll(epoll_create1(EPOLL_CLOEXEC)), m_wakeup(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    if (m_epoll < 0 || m_wakeup < 0) {
+      throw std::runtime_error("event loop: epoll/eventfd creation failed");
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = m_wakeup;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &event);
+  }
+
+  EventLoop(const EventLoop&) = delete;
+  EventLoop& operator=(const EventLoop&) = delete;
+
+  ~EventLoop() {
+    ::close(m_wakeup);
+    ::close(m_epoll);
+  }
+
+  /**
+   * @brief start a task owned by the loop; it runs up to its first suspension
+   */
+  void Spawn(Task<void> task) {
+    m_tasks++;
+    Detach(std::move(task));
+  }
+
+  /**
+   * @brief run until all spawned tasks finished
+   * @details Rethrows the first exception which escaped from a spawned task.
+   */
+  void Run() {
+    std::array<epoll_event, 256> events;
+    while (m_tasks > 0) {
+      RunReady();
+      if (m_stopping) {
+        CancelAll();
+        continue;
+      }
+      if (m_tasks == 0) {
+        break;
+      }
+
+      int timeout = -1;
+      if (!m_ready.empty()) {
+        timeout = 0;
+      } else if (auto next = NextDeadline()) {
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(*next - Clock::now()).count();
+        timeout = static_cast<int>(std::clamp<int64_t>(left, 0, INT32_MAX));
+      }
+
+      int count = epoll_wait(m_epoll, events.data(), static_cast<int>(events.size()), timeout);
+      for (int i = 0; i < count; ++i) {
+        int fd = events[i].data.fd;
+        if (fd == m_wakeup) {
+          uint64_t value;
+          [[maybe_unused]] auto ignored = read(m_wakeup, &value, sizeof(value));
+          if (m_stop_requested.load(std::memory_order_acquire)) {
+            m_stopping = true;
+          }
+        } else if (auto it = m_fd_waiters.find(fd); it != m_fd_waiters.end()) {
+          auto handle = it->second;
+          m_fd_waiters.erase(it);
+          m_ready.push_back(handle);
+        }
+      }
+      FireTimers();
+    }
+    m_stopping = false;
+    m_stop_requested.store(false, std::memory_order_relaxed);
+    if (m_exception) {
+      std::rethrow_exception(std::exchange(m_exception, nullptr));
+    }
+  }
+
+  /**
+   * @brief request stop, can be called from any thread
+   */
+  void Stop() {
+    m_stop_requested.store(true, std::memory_order_release);
+    uint64_t one = 1;
+    [[maybe_unused]] auto ignored = write(m_wakeup, &one, sizeof(one));
+  }
+
+  /**
+   * @brief stop was requested, awaits complete immediately
+   */
+  [[nodiscard]] bool IsStopping() const noexcept {
+    return m_stopping;
+  }
+
+  /**
+   * @brief awaitable: resumes when fd is readable (or the loop stops)
+   */
+  auto Readable(int fd) {
+    struct Awaiter {
+      EventLoop& loop;
+      int fd;
+      [[nodiscard]] bool await_ready() const noexcept {
+        return loop.m_stopping;
+      }
+      void await_suspend(std::coroutine_handle<> handle) {
+        loop.WaitFd(fd, handle);
+      }
+      void await_resume() const noexcept {}
+    };
+    return Awaiter{*this, fd};
+  }
+
+  /**
+   * @brief awaitable: resumes at deadline (or when the loop stops)
+   */
+  auto SleepUntil(Clock::time_point deadline) {
+    struct Awaiter {
+      EventLoop& loop;
+      Clock::time_point deadline;
+      [[nodiscard]] bool await_ready() const noexcept {
+        return loop.m_stopping || deadline <= Clock::now();
+      }
+      void await_suspend(std::coroutine_handle<> handle) {
+        loop.AddTimer(deadline, handle);
+      }
+      void await_resume() const noexcept {}
+    };
+    return Awaiter{*this, deadline};
+  }
+
+  /**
+   * @brief awaitable: resumes after duration (or when the loop stops)
+   */
+  template <typename TRep, typename TPeriod>
+  auto SleepFor(std::chrono::duration<TRep, TPeriod> duration) {
+    return SleepUntil(Clock::now() + std::chrono::duration_cast<Clock::duration>(duration));
+  }
+
+  /**
+   * @brief resume handle on the next loop iteration
+   */
+  void Post(std::coroutine_handle<> handle) {
+    m_ready.push_back(handle);
+  }
+
+  /**
+   * @brief resume handle at deadline
+   * @return timer id for CancelTimer()
+   */
+  uint64_t AddTimer(Clock::time_point deadline, std::coroutine_handle<> handle) {
+    auto id = ++m_timer_id;
+    m_timers.emplace(deadline, id);
+    m_timer_handles.emplace(id, handle);
+    return id;
+  }
+
+  /**
+   * @brief forget a timer which has not fired yet
+   * @return false if it fired or was cancelled already, its handle is resumed by the loop
+   */
+  bool CancelTimer(uint64_t id) {
+    return m_timer_handles.erase(id) != 0;
+  }
+
+  /**
+   * @brief remove fd from epoll before it is closed
+   */
+  void Forget(int fd) {
+    if (m_registered.erase(fd)) {
+      epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    m_fd_waiters.erase(fd);
+  }
+
+ private:
+  /**
+   * @brief self destroying wrapper of a spawned task
+   */
+  struct Detached {
+    struct promise_type {
+      Detached get_return_object() noexcept {
+        return {};
+      }
+      std::suspend_never initial_suspend() noexcept {
+        return {};
+      }
+      std::suspend_never final_suspend() noexcept {
+        return {};
+      }
+      void return_void() noexcept {}
+      void unhandled_exception() noexcept {}
+    };
+  };
+
+  Detached Detach(Task<void> task) {
+    try {
+      co_await task;
+    } catch (...) {
+      if (!m_exception) {
+        m_exception = std::current_exception();
+      }
+    }
+    m_tasks--;
+  }
+
+  void WaitFd(int fd, std::coroutine_handle<> handle) {
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.fd = fd;
+    if (m_registered.insert(fd).second) {
+      epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event);
+    } else {
+      epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &event);
+    }
+    m_fd_waiters[fd] = handle;
+  }
+
+  void RunReady() {
+    while (!m_ready.empty()) {
+      std::vector<std::coroutine_handle<>> ready;
+      ready.swap(m_ready);
+      for (auto handle : ready) {
+        handle.resume();
+      }
+    }
+  }
+
+  std::optional<Clock::time_point> NextDeadline() {
+    while (!m_timers.empty() && !m_timer_handles.count(m_timers.top().second)) {
+      m_timers.pop();
+    }
+    if (m_timers.empty()) {
+      return std::nullopt;
+    }
+    return m_timers.top().first;
+  }
+
+  void FireTimers() {
+    auto now = Clock::now();
+    while (!m_timers.empty() && m_timers.top().first <= now) {
+      auto id = m_timers.top().second;
+      m_timers.pop();
+      if (auto it = m_timer_handles.find(id); it != m_timer_handles.end()) {
+        m_ready.push_back(it->second);
+        m_timer_handles.erase(it);
+      }
+    }
+  }
+
+  /**
+   * @brief resume every suspended awaiter after a stop request
+   */
+  void CancelAll() {
+    for (auto& [fd, handle] : m_fd_waiters) {
+      m_ready.push_back(handle);
+    }
+    m_fd_waiters.clear();
+    for (auto& [id, handle] : m_timer_handles) {
+      m_ready.push_back(handle);
+    }
+    m_timer_handles.clear();
+    m_timers = {};
+  }
+
+  using TimerEntry = std::pair<Clock::time_point, uint64_t>;
+
+  int m_epoll;                                                  ///< epoll instance
+  int m_wakeup;                                                 ///< eventfd for Stop()
+  size_t m_tasks{0};                                            ///< spawned tasks alive
+  bool m_stopping{false};                                       ///< stop observed by the loop
+  std::atomic<bool> m_stop_requested{false};                    ///< stop requested by any thread
+  std::exception_ptr m_exception;                               ///< first exception of a task
+  std::vector<std::coroutine_handle<>> m_ready;                 ///< handles to resume
+  std::unordered_map<int, std::coroutine_handle<>> m_fd_waiters;  ///< fd readiness waiters
+  std::unordered_set<int> m_registered;                         ///< fds added to epoll
+  std::priority_queue<TimerEntry, std::vector<TimerEntry>, std::greater<>> m_timers;  ///< deadlines
+  std::unordered_map<uint64_t, std::coroutine_handle<>> m_timer_handles;              ///< live timers
+  uint64_t m_timer_id{0};                                       ///< last timer id
+};
+
+/**
+ * @brief condition variable for coroutines of one loop
+ */
+class AsyncEvent {
+ public:
+  explicit AsyncEvent(EventLoop& loop) : m_loop(loop) {}
+
+  /**
+   * @brief awaitable: resumes on Notify(), after timeout or when the loop stops
+   * @return true if notified
+   */
+  template <typename TRep, typename TPeriod>
+  auto Wait(std::chrono::duration<TRep, TPeriod> timeout) {
+    auto now = EventLoop::Clock::now();
+    auto deadline = EventLoop::Clock::time_point::max();
+    if (timeout < std::chrono::duration_cast<std::chrono::duration<TRep, TPeriod>>(deadline - now)) {
+      deadline = now + std::chrono::duration_cast<EventLoop::Clock::duration>(timeout);
+    }
+    return Awaiter{*this, deadline};
+  }
+
+  /**
+   * @brief resume all waiters
+   * @details A waiter whose timeout fired or which a stop resumed is queued
+   * by the loop already, it stays a timeout and is not posted twice.
+   */
+  void Notify() {
+    auto waiters = std::move(m_waiters);
+    m_waiters.clear();
+    for (auto* waiter : waiters) {
+      if (m_loop.CancelTimer(waiter->timer)) {
+        waiter->notified = true;
+        m_loop.Post(waiter->handle);
+      }
+    }
+  }
+
+ private:
+  struct Awaiter {
+    AsyncEvent& event;
+    EventLoop::Clock::time_point deadline;
+    std::coroutine_handle<> handle{};
+    uint64_t timer{0};
+    bool notified{false};
+
+    [[nodiscard]] bool await_ready() const noexcept {
+      return event.m_loop.IsStopping();
+    }
+    void await_suspend(std::coroutine_handle<> h) {
+      handle = h;
+      timer = event.m_loop.AddTimer(deadline, h);
+      event.m_waiters.push_back(this);
+    }
+    bool await_resume() {
+      if (!notified && handle) {
+        std::erase(event.m_waiters, this);
+      }
+      return notified;
+    }
+  };
+
+  EventLoop& m_loop;               ///< loop of the waiters
+  std::vector<Awaiter*> m_waiters;  ///< suspended waiters
+};
+
+/**
+ * @brief StopTimer whose expiry can be co_awaited
+ * @tparam TDuration - duration unit of the timer
+ */
+template <class TDuration = std::chrono::milliseconds>
+class AsyncTimer {
+ public:
+  explicit AsyncTimer(EventLoop& loop) : m_loop(loop) {}
+
+  /**
+   * @brief get reference to the underlying timer
+   */
+  [[nodiscard]] StopTimer<TDuration>& Timer() noexcept {
+    return m_timer;
+  }
+
+  /**
+   * @brief start timer with timeout
+   */
+  void Start(TDuration timeout) noexcept {
+    m_timer.Start(timeout);
+  }
+
+  /**
+   * @brief stop timer
+   */
+  void Stop() noexcept {
+    m_timer.Stop();
+  }
+
+  /**
+   * @brief wait until StopTimer::IsElapsed() turns true
+   * @details Returns at once if the timer is not running or the loop stops.
+   */
+  Task<> Expiry() {
+    while (!m_loop.IsStopping()) {
+      auto elapsed = m_timer.IsElapsed();
+      if (!elapsed.has_value() || elapsed.value()) {
+        break;
+      }
+      // IsElapsed() needs the elapsed time to exceed the timeout by one unit
+      co_await m_loop.SleepFor(m_timer.LeftTime() + TDuration(1));
+    }
+  }
+
+ private:
+  EventLoop& m_loop;             ///< loop to sleep in
+  StopTimer<TDuration> m_timer;  ///< timer
+};
+
+}  // namespace watch
+
+#endif /* SRC_INCLUDE_EVENT_LOOP_HPP */
@@ -0,0 +1,377 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Binary trace of raw inotify batches for offline replay.
+* @details A trace is a header followed by 8 byte aligned records. A roots
+* record keeps the root paths with the wd inotify gave them, a batch record
+* keeps the bytes of one read() of the inotify fd exactly as the kernel
+* returned them, plus the wds of the watches added while the batch was
+* decoded. A scan record has the layout of a batch record: the entries a
+* scan of a new directory found, as the watcher decoded them; a seed record
+* the same for the directories below the roots that existed at the start,
+* which only get their watches. With these
+* the replay rebuilds the same watch list and events without touching the
+* filesystem. Every record has the time since the start of the
+* recording. The reader maps the file and hands out views into it, a replay
+* copies nothing.
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_EVENT_TRACE_HPP
+#define SRC_INCLUDE_EVENT_TRACE_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace watch {
+
+namespace trace {
+
+inline constexpr char kMagic[8] = {'F', 'S', 'W', 'T', 'R', 'A', 'C', 'E'};
+inline constexpr uint32_t kVersion = 1;
+
+struct Header {
+  char magic[8];     ///< kMagic
+  uint32_t version;  ///< kVersion
+  uint32_t flags;    ///< 0
+};
+
+enum class Kind : uint32_t {
+  Roots = 1,  ///< uint32 count, per root: int32 wd, uint32 length, characters
+  Batch = 2,  ///< uint32 count, int32 wd of every added watch, raw inotify events
+  Scan = 3,   ///< as Batch, inotify events made up for the entries of a scanned directory
+  Seed = 4,   ///< as Scan, for a directory that existed below the roots at the start
+};
+
+struct Record {
+  Kind kind;         ///< payload type
+  uint32_t size;     ///< payload bytes, the next record starts 8 byte aligned
+  uint64_t time_ns;  ///< since the start of the recording
+};
+
+static_assert(sizeof(Header) == 16 && sizeof(Record) == 16, "trace layout must not depend on the compiler");
+
+[[nodiscard]] constexpr size_t Aligned(size_t size) noexcept {
+  return (size + 7) & ~size_t{7};
+}
+
+}  // namespace trace
+
+/**
+ * @brief appends records to a trace file
+ */
+class TraceWriter {
+ public:
+  explicit TraceWriter(const std::string& path) : m_path(path), m_start(std::chrono::steady_clock::now()) {
+    m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+      Fail("can't create");
+    }
+    trace::Header header{};
+    std::memcpy(header.magic, trace::kMagic, sizeof(header.magic));
+    header.version = trace::kVersion;
+    Put(&header, sizeof(header));
+  }
+
+  TraceWriter(const TraceWriter&) = delete;
+  TraceWriter& operator=(const TraceWriter&) = delete;
+
+  ~TraceWriter() {
+    try {
+      Flush();
+    } catch (...) {
+    }
+    ::close(m_fd);
+  }
+
+  /**
+   * @brief record the root paths and their wds, starts a new watch list on replay
+   */
+  void Roots(const std::vector<std::pair<std::string, int>>& roots) {
+    uint32_t size = sizeof(uint32_t);
+    for (auto& root : roots) {
+      size += 2 * sizeof(uint32_t) + static_cast<uint32_t>(root.first.size());
+    }
+    Begin(trace::Kind::Roots, size);
+    auto count = static_cast<uint32_t>(roots.size());
+    Put(&count, sizeof(count));
+    for (auto& [path, wd] : roots) {
+      auto length = static_cast<uint32_t>(path.size());
+      Put(&wd, sizeof(wd));
+      Put(&length, sizeof(length));
+      Put(path.data(), length);
+    }
+    End(size);
+  }
+
+  /**
+   * @brief record one read() of the inotify fd and the wds of the watches it added
+   */
+  void Batch(std::span<const char> events, std::span<const int> added) {
+    Events(trace::Kind::Batch, events, added);
+  }
+
+  /**
+   * @brief record the events made up for the entries of a scanned directory and the wds they added
+   */
+  void Scan(std::span<const char> events, std::span<const int> added) {
+    Events(trace::Kind::Scan, events, added);
+  }
+
+  /**
+   * @brief record the events made up for the entries of a directory below the roots at the start
+   */
+  void Seed(std::span<const char> events, std::span<const int> added) {
+    Events(trace::Kind::Seed, events, added);
+  }
+
+  /**
+   * @brief write the buffered records to the file
+   */
+  void Flush() {
+    for (size_t written = 0; written < m_buffer.size();) {
+      auto result = ::write(m_fd, m_buffer.data() + written, m_buffer.size() - written);
+      if (result < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        Fail("can't write");
+      }
+      written += static_cast<size_t>(result);
+    }
+    m_buffer.clear();
+  }
+
+  /**
+   * @brief batch, scan and seed records written
+   */
+  [[nodiscard]] uint64_t Batches() const noexcept {
+    return m_batches;
+  }
+
+ private:
+  static constexpr size_t kFlushSize = 1 << 20;
+
+  void Events(trace::Kind kind, std::span<const char> events, std::span<const int> added) {
+    auto size = static_cast<uint32_t>(sizeof(uint32_t) + added.size_bytes() + events.size());
+    Begin(kind, size);
+    auto count = static_cast<uint32_t>(added.size());
+    Put(&count, sizeof(count));
+    Put(added.data(), added.size_bytes());
+    Put(events.data(), events.size());
+    End(size);
+    m_batches++;
+  }
+
+  void Begin(trace::Kind kind, uint32_t size) {
+    trace::Record record{kind, size,
+                         static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                   std::chrono::steady_clock::now() - m_start)
+                                                   .count())};
+    Put(&record, sizeof(record));
+  }
+
+  void End(uint32_t size) {
+    static constexpr char kPadding[8] = {};
+    Put(kPadding, trace::Aligned(size) - size);
+    if (m_buffer.size() >= kFlushSize) {
+      Flush();
+    }
+  }
+
+  void Put(const void* data, size_t size) {
+    auto* bytes = static_cast<const char*>(data);
+    m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+  }
+
+  [[noreturn]] void Fail(const std::string& what) const {
+    throw std::runtime_error("trace: " + what + " " + m_path + ": " + std::strerror(errno));
+  }
+
+  std::string m_path;                            ///< file name for errors
+  int m_fd{-1};                                  ///< trace file
+  std::chrono::steady_clock::time_point m_start; ///< time 0 of the records
+  std::vector<char> m_buffer;                    ///< records not written yet
+  uint64_t m_batches{0};                         ///< batch, scan and seed records written
+};
+
+/**
+ * @brief maps a trace file and walks its records
+ */
+class TraceReader {
+ public:
+  struct Root {
+    std::string_view path;
+    int wd;
+  };
+
+  struct Record {
+    trace::Kind kind;
+    std::chrono::nanoseconds time;
+    std::span<const char> payload;
+  };
+
+  explicit TraceReader(const std::string& path) : m_path(path) {
+    try {
+      Map();
+    } catch (...) {
+      // no destructor runs for a throwing constructor
+      Release();
+      throw;
+    }
+  }
+
+  TraceReader(const TraceReader&) = delete;
+  TraceReader& operator=(const TraceReader&) = delete;
+
+  ~TraceReader() {
+    Release();
+  }
+
+  /**
+   * @brief call fn(record) for every record in file order until it returns false
+   * @details a record cut off at the end of the file, e.g. by a crash of
+   * the recorder, ends the walk
+   */
+  template <typename TFn>
+  void ForEach(TFn&& fn) const {
+    const auto* base = static_cast<const char*>(m_data);
+    for (size_t offset = sizeof(trace::Header); offset + sizeof(trace::Record) <= m_size;) {
+      trace::Record record;
+      std::memcpy(&record, base + offset, sizeof(record));
+      offset += sizeof(record);
+      if (record.size > m_size - offset) {
+        break;
+      }
+      if (!fn(Record{record.kind, std::chrono::nanoseconds(record.time_ns), {base + offset, record.size}})) {
+        break;
+      }
+      offset += trace::Aligned(record.size);
+    }
+  }
+
+  /**
+   * @brief roots of a roots record
+   */
+  [[nodiscard]] static std::vector<Root> Roots(const Record& record) {
+    std::vector<Root> roots;
+    auto payload = record.payload;
+    uint32_t count = Take<uint32_t>(payload);
+    for (uint32_t i = 0; i < count; ++i) {
+      auto wd = Take<int32_t>(payload);
+      auto length = Take<uint32_t>(payload);
+      if (length > payload.size()) {
+        throw std::runtime_error("trace: bad roots record");
+      }
+      roots.push_back(Root{{payload.data(), length}, wd});
+      payload = payload.subspan(length);
+    }
+    return roots;
+  }
+
+  /**
+   * @brief wds of the added watches and raw events of a batch, scan or seed record
+   */
+  [[nodiscard]] static std::pair<std::span<const int32_t>, std::span<const char>> Batch(const Record& record) {
+    auto payload = record.payload;
+    uint32_t count = Take<uint32_t>(payload);
+    if (count > payload.size() / sizeof(int32_t)) {
+      throw std::runtime_error("trace: bad batch record");
+    }
+    // records are 8 byte aligned, the wds follow a 4 byte count
+    std::span<const int32_t> added(reinterpret_cast<const int32_t*>(payload.data()), count);
+    return {added, payload.subspan(count * sizeof(int32_t))};
+  }
+
+ private:
+  /**
+   * @brief open, map and check the file
+   */
+  void Map() {
+    m_fd = ::open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0) {
+      Fail("can't open");
+    }
+    struct stat info {};
+    if (fstat(m_fd, &info) != 0) {
+      Fail("can't stat");
+    }
+    m_size = static_cast<size_t>(info.st_size);
+    if (m_size < sizeof(trace::Header)) {
+      throw std::runtime_error("trace: truncated " + m_path);
+    }
+    m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, m_fd, 0);
+    if (m_data == MAP_FAILED) {
+      Fail("can't map");
+    }
+    trace::Header header;
+    std::memcpy(&header, m_data, sizeof(header));
+    if (std::memcmp(header.magic, trace::kMagic, sizeof(header.magic)) != 0 || header.version != trace::kVersion) {
+      throw std::runtime_error("trace: not an event trace " + m_path);
+    }
+  }
+
+  /**
+   * @brief close and unmap what Map() got so far
+   */
+  void Release() noexcept {
+    if (m_data != MAP_FAILED) {
+      munmap(m_data, m_size);
+      m_data = MAP_FAILED;
+    }
+    if (m_fd >= 0) {
+      ::close(m_fd);
+      m_fd = -1;
+    }
+  }
+
+  template <typename T>
+  static T Take(std::span<const char>& payload) {
+    if (payload.size() < sizeof(T)) {
+      throw std::runtime_error("trace: record too short");
+    }
+    T value;
+    std::memcpy(&value, payload.data(), sizeof(T));
+    payload = payload.subspan(sizeof(T));
+    return value;
+  }
+
+  [[noreturn]] void Fail(const std::string& what) const {
+    throw std::runtime_error("trace: " + what + " " + m_path + ": " + std::strerror(errno));
+  }
+
+  std::string m_path;        ///< file name for errors
+  int m_fd{-1};              ///< trace file
+  void* m_data{MAP_FAILED};  ///< mapping of the whole file
+  size_t m_size{0};          ///< file size
+};
+
+}  // namespace watch
+
+#endif /* SRC_INCLUDE_EVENT_TRACE_HPP */
@@ -0,0 +1,321 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Tail of growing files, appended bytes handed out as mapped views.
+* @details Every followed file keeps its descriptor, inode, read offset and
+* a read-only shared mapping. The mapping is a window larger than the file,
+* it follows the file as it grows without a remap, so handing out appended
+* bytes is pointer arithmetic: no read(), no copy. The window is replaced
+* only when the file outgrows it. Modify events only mark a file, Flush()
+* delivers once per file for a whole batch of events: one fstat(), one
+* stat() of the path for rotation, one callback with all bytes appended
+* since the last one. A file shorter than the offset was truncated and is
+* read from the start again. A path that names another inode was rotated:
+* the rest of the old file is delivered first, then the new one from the
+* start.
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_FILE_TAIL_HPP
+#define SRC_INCLUDE_FILE_TAIL_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace watch {
+
+/**
+ * @brief follows files and hands the appended bytes to a callback
+ * @details all calls but GetCounters() come from one thread, the watcher's.
+ * The bytes are valid during the callback only; a file truncated by its
+ * writer while the callback reads the view raises SIGBUS, as with every
+ * mapping of a file.
+ */
+class FileTail {
+ public:
+  using Callback = std::function<void(std::string_view path, std::span<const char> bytes)>;
+
+  enum class Start {
+    Begin,  ///< deliver what the file holds already
+    End,    ///< deliver only what is appended from now on
+  };
+
+  struct Counters {
+    uint64_t bytes;        ///< delivered
+    uint64_t deliveries;   ///< callbacks
+    uint64_t truncations;  ///< files read from the start again
+    uint64_t rotations;    ///< paths that moved to another inode
+  };
+
+  /**
+   * @param callback - gets the appended bytes of a file
+   * @param unknown - where a file starts that is not followed yet when it is
+   * modified; with End the bytes of that first write are not delivered, so
+   * Follow() the files that exist before watching. Files created while
+   * watching start at the beginning.
+   */
+  explicit FileTail(Callback callback, Start unknown = Start::End)
+      : m_callback(std::move(callback)), m_unknown(unknown) {}
+
+  FileTail(const FileTail&) = delete;
+  FileTail& operator=(const FileTail&) = delete;
+
+  ~FileTail() {
+    for (auto& file : m_files) {
+      Close(file);
+    }
+  }
+
+  /**
+   * @brief follow a file before it has events
+   * @details the watcher watches every directory below its roots while a
+   * tail is set, the file may be anywhere in the tree
+   * @return false if it can not be opened
+   */
+  bool Follow(std::string_view path, Start start) {
+    if (m_index.contains(path)) {
+      return true;
+    }
+    return Add(path, start) != kNone;
+  }
+
+  /**
+   * @brief a file was created, it is followed from its beginning
+   */
+  void Created(std::string_view path) {
+    Mark(path, Start::Begin);
+  }
+
+  /**
+   * @brief a file was written to
+   */
+  void Modified(std::string_view path) {
+    Mark(path, m_unknown);
+  }
+
+  /**
+   * @brief a file was deleted, deliver what is left of it and stop following it
+   */
+  void Deleted(std::string_view path) {
+    auto found = m_index.find(path);
+    if (found == m_index.end()) {
+      return;
+    }
+    auto& file = m_files[found->second];
+    Deliver(file);
+    Close(file);
+    m_free.push_back(found->second);
+    m_index.erase(found);
+  }
+
+  /**
+   * @brief a file was renamed away, deliver what is left of it
+   * @details it stays followed, a file created at its path later is counted
+   * as a rotation
+   */
+  void Moved(std::string_view path) {
+    if (m_index.contains(path)) {
+      Mark(path, Start::End);
+    }
+  }
+
+  /**
+   * @brief deliver the bytes appended to the files marked since the last call
+   */
+  void Flush() {
+    for (auto index : m_dirty) {
+      auto& file = m_files[index];
+      file.dirty = false;
+      if (file.fd < 0) {
+        continue;
+      }
+      Deliver(file);
+      // rotated: the path names another file now, the old one is read up
+      struct stat status {};
+      if (stat(file.path.c_str(), &status) == 0 && (status.st_ino != file.inode || status.st_dev != file.device)) {
+        m_rotations.fetch_add(1, std::memory_order_relaxed);
+        Close(file);
+        if (Open(file, Start::Begin)) {
+          Deliver(file);
+        }
+      }
+    }
+    m_dirty.clear();
+  }
+
+  /**
+   * @brief number of followed files
+   */
+  [[nodiscard]] size_t Files() const noexcept {
+    return m_index.size();
+  }
+
+  /**
+   * @brief may be called from any thread
+   */
+  [[nodiscard]] Counters GetCounters() const noexcept {
+    return Counters{m_bytes.load(std::memory_order_relaxed), m_deliveries.load(std::memory_order_relaxed),
+                    m_truncations.load(std::memory_order_relaxed), m_rotations.load(std::memory_order_relaxed)};
+  }
+
+ private:
+  static constexpr uint32_t kNone = UINT32_MAX;
+  static constexpr size_t kMinWindow = 1 << 20;
+
+  // lookups by string_view, an event does not build a std::string
+  struct PathHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view path) const noexcept {
+      return std::hash<std::string_view>{}(path);
+    }
+  };
+
+  using PathIndex = std::unordered_map<std::string, uint32_t, PathHash, std::equal_to<>>;
+
+  struct File {
+    std::string path;
+    int fd{-1};
+    dev_t device{0};
+    ino_t inode{0};
+    uint64_t offset{0};         ///< bytes delivered
+    const char* map{nullptr};   ///< window mapping from offset 0
+    size_t window{0};           ///< mapped bytes, more than the file while it grows
+    bool dirty{false};          ///< in m_dirty
+  };
+
+  void Mark(std::string_view path, Start start) {
+    uint32_t index;
+    if (auto found = m_index.find(path); found != m_index.end()) {
+      index = found->second;
+    } else if (index = Add(path, start); index == kNone) {
+      return;
+    }
+    if (!m_files[index].dirty) {
+      m_files[index].dirty = true;
+      m_dirty.push_back(index);
+    }
+  }
+
+  uint32_t Add(std::string_view path, Start start) {
+    uint32_t index;
+    if (!m_free.empty()) {
+      index = m_free.back();
+      m_free.pop_back();
+    } else {
+      index = static_cast<uint32_t>(m_files.size());
+      m_files.emplace_back();
+    }
+    auto& file = m_files[index];
+    file = File{};
+    file.path = path;
+    if (!Open(file, start)) {
+      m_free.push_back(index);
+      return kNone;
+    }
+    m_index.emplace(file.path, index);
+    return index;
+  }
+
+  bool Open(File& file, Start start) {
+    file.fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat status {};
+    if (file.fd < 0 || fstat(file.fd, &status) != 0) {
+      Close(file);
+      return false;
+    }
+    file.device = status.st_dev;
+    file.inode = status.st_ino;
+    file.offset = start == Start::End ? static_cast<uint64_t>(status.st_size) : 0;
+    return true;
+  }
+
+  void Close(File& file) {
+    if (file.map) {
+      munmap(const_cast<char*>(file.map), file.window);
+      file.map = nullptr;
+      file.window = 0;
+    }
+    if (file.fd >= 0) {
+      close(file.fd);
+      file.fd = -1;
+    }
+  }
+
+  /**
+   * @brief hand out the bytes between the offset and the current end
+   */
+  void Deliver(File& file) {
+    struct stat status {};
+    if (fstat(file.fd, &status) != 0) {
+      return;
+    }
+    auto size = static_cast<uint64_t>(status.st_size);
+    if (size < file.offset) {
+      m_truncations.fetch_add(1, std::memory_order_relaxed);
+      file.offset = 0;
+    }
+    if (size == file.offset) {
+      return;
+    }
+    if (size > file.window) {
+      // the new window leaves room to grow, pages past the end are never read
+      auto window = std::max(kMinWindow, std::bit_ceil(size) * 2);
+      auto* map = mmap(nullptr, window, PROT_READ, MAP_SHARED, file.fd, 0);
+      if (map == MAP_FAILED) {
+        return;
+      }
+      if (file.map) {
+        munmap(const_cast<char*>(file.map), file.window);
+      }
+      file.map = static_cast<const char*>(map);
+      file.window = window;
+    }
+    std::span<const char> bytes(file.map + file.offset, size - file.offset);
+    file.offset = size;
+    m_bytes.fetch_add(bytes.size(), std::memory_order_relaxed);
+    m_deliveries.fetch_add(1, std::memory_order_relaxed);
+    m_callback(file.path, bytes);
+  }
+
+  Callback m_callback;                                 ///< gets the appended bytes
+  Start m_unknown;                                     ///< start of files first seen modified
+  std::vector<File> m_files;                           ///< followed files by index
+  std::vector<uint32_t> m_free;                        ///< unused entries of m_files
+  PathIndex m_index;                                   ///< path to index
+  std::vector<uint32_t> m_dirty;                       ///< files to deliver in Flush()
+  std::atomic<uint64_t> m_bytes{0};
+  std::atomic<uint64_t> m_deliveries{0};
+  std::atomic<uint64_t> m_truncations{0};
+  std::atomic<uint64_t> m_rotations{0};
+};
+
+}  // namespace watch
+
+#endif /* SRC_INCLUDE_FILE_TAIL_HPP */
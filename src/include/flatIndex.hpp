@@ -0,0 +1,193 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Flat open addressing hash index with integral keys.
+* @details Robin Hood hashing over one array of slots: an insert takes the
+* slot of an entry that is closer to its home, so probe lengths stay short
+* and even, and a lookup stops as soon as it meets an entry closer to home
+* than the probed key would be. Erase shifts the following entries one slot
+* back instead of leaving tombstones, so deletions do not degrade the
+* probing. The table grows at 7/8 load.
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_FLAT_INDEX_HPP
+#define SRC_INCLUDE_FLAT_INDEX_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace watch {
+
+/**
+ * @brief hash map of integral keys to small trivially copyable values
+ */
+template <typename TKey, typename TValue>
+  requires std::is_integral_v<TKey> && std::is_trivially_copyable_v<TValue>
+class FlatIndex {
+ public:
+  FlatIndex() = default;
+
+  /**
+   * @brief set the value of a key, insert it if new
+   */
+  void Insert(TKey key, const TValue& value) {
+    if (auto* found = Find(key)) {
+      *found = value;
+      return;
+    }
+    if ((m_count + 1) * 8 > m_slots.size() * 7) {
+      Grow();
+    }
+    Place(Slot{key, value, 1});
+    m_count++;
+  }
+
+  /**
+   * @brief pointer to the value of a key, nullptr if not present
+   * @details valid until the next insert or erase
+   */
+  [[nodiscard]] TValue* Find(TKey key) noexcept {
+    auto position = Position(key);
+    return position < 0 ? nullptr : &m_slots[position].value;
+  }
+
+  [[nodiscard]] const TValue* Find(TKey key) const noexcept {
+    auto position = Position(key);
+    return position < 0 ? nullptr : &m_slots[position].value;
+  }
+
+  /**
+   * @brief remove a key
+   * @return true if it was present
+   */
+  bool Erase(TKey key) noexcept {
+    auto position = Position(key);
+    if (position < 0) {
+      return false;
+    }
+    // backward shift: pull the following displaced entries one slot closer to home
+    auto mask = m_slots.size() - 1;
+    auto hole = static_cast<size_t>(position);
+    for (auto next = (hole + 1) & mask; m_slots[next].distance > 1; next = (next + 1) & mask) {
+      m_slots[hole] = m_slots[next];
+      m_slots[hole].distance--;
+      hole = next;
+    }
+    m_slots[hole].distance = 0;
+    m_count--;
+    return true;
+  }
+
+  /**
+   * @brief call fn(key, value) for every entry, in no particular order
+   */
+  template <typename TFn>
+  void ForEach(TFn&& fn) const {
+    for (const auto& slot : m_slots) {
+      if (slot.distance != 0) {
+        fn(slot.key, slot.value);
+      }
+    }
+  }
+
+  /**
+   * @brief remove all entries, the slots are kept
+   */
+  void Clear() noexcept {
+    for (auto& slot : m_slots) {
+      slot.distance = 0;
+    }
+    m_count = 0;
+  }
+
+  [[nodiscard]] size_t Size() const noexcept {
+    return m_count;
+  }
+
+  [[nodiscard]] size_t Capacity() const noexcept {
+    return m_slots.size();
+  }
+
+ private:
+  struct Slot {
+    TKey key;
+    TValue value;
+    uint32_t distance{0};  ///< 1 + distance from the home slot, 0 - empty
+  };
+
+  static size_t Hash(TKey key) noexcept {
+    // murmur3 finalizer, the keys are often dense or share high bits
+    auto h = static_cast<uint64_t>(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+  }
+
+  [[nodiscard]] ptrdiff_t Position(TKey key) const noexcept {
+    if (m_count == 0) {
+      return -1;
+    }
+    auto mask = m_slots.size() - 1;
+    auto position = Hash(key) & mask;
+    // an entry closer to its home than we are ends the probe
+    for (uint32_t distance = 1; m_slots[position].distance >= distance; ++distance) {
+      if (m_slots[position].key == key) {
+        return static_cast<ptrdiff_t>(position);
+      }
+      position = (position + 1) & mask;
+    }
+    return -1;
+  }
+
+  void Place(Slot incoming) noexcept {
+    auto mask = m_slots.size() - 1;
+    for (auto position = Hash(incoming.key) & mask;; position = (position + 1) & mask, incoming.distance++) {
+      auto& slot = m_slots[position];
+      if (slot.distance == 0) {
+        slot = incoming;
+        return;
+      }
+      if (slot.distance < incoming.distance) {
+        std::swap(slot, incoming);
+      }
+    }
+  }
+
+  void Grow() {
+    auto slots = std::move(m_slots);
+    m_slots.assign(slots.empty() ? 16 : slots.size() * 2, Slot{});
+    for (auto& slot : slots) {
+      if (slot.distance != 0) {
+        slot.distance = 1;
+        Place(slot);
+      }
+    }
+  }
+
+  std::vector<Slot> m_slots;  ///< power of two number of slots
+  size_t m_count{0};          ///< number of entries
+};
+
+}  // namespace watch
+
+#endif /* SRC_INCLUDE_FLAT_INDEX_HPP */
@@ -0,0 +1,361 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Always-on flight recorder of state transitions in shared memory.
+* @details The recorder maps a POSIX shared memory object with one ring of
+* fixed-size binary records per thread. A thread claims a ring on its first
+* record and is its only writer: a record is a few plain stores, a time
+* stamp counter read and two release stores, no lock, no syscall, no
+* formatting. The rings overwrite their oldest records. Another process, the
+* flightdump tool, maps the same object read-only and decodes the rings of a
+* live process, or of a crashed one since the object outlives the process
+* unless it is closed in order:
+*   header | ring header, records of ring 0 | ring header, records of ring 1 ...
+* Every record carries the ring index it was written at. The writer clears
+* it before and sets it after filling the slot, a reader copies the slot and
+* keeps it only if the index was the expected one before and after the copy.
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_FLIGHT_RECORDER_HPP
+#define SRC_INCLUDE_FLIGHT_RECORDER_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace logging {
+
+/**
+ * @brief shared memory layout of the flight recorder
+ */
+namespace flight {
+
+inline constexpr char kMagic[8] = {'F', 'L', 'I', 'G', 'H', 'T', 'R', 'C'};
+inline constexpr uint32_t kVersion = 1;
+
+inline constexpr uint32_t kTicksAreNanoseconds = 0x0001;  ///< no time stamp counter, ticks are steady ns
+
+enum class Kind : uint16_t {
+  Start = 1,       ///< context entered its first state, from is 0
+  Transition = 2,  ///< DoServe() returned a new state
+  TimerExpired = 3,  ///< the timer of the state elapsed, from == to
+  Restored = 4,    ///< context continued in a saved state, from is 0
+};
+
+struct Header {
+  char magic[8];             ///< kMagic
+  uint32_t version;          ///< kVersion
+  uint32_t flags;            ///< kTicksAreNanoseconds
+  uint32_t rings;            ///< number of rings
+  uint32_t slots;            ///< records per ring, power of two
+  uint64_t ring_bytes;       ///< ring header and records, offset of ring i is sizeof(Header) + i * ring_bytes
+  int64_t pid;               ///< recording process
+  uint64_t base_ticks;       ///< ticks at base_realtime_ns
+  int64_t base_realtime_ns;  ///< CLOCK_REALTIME when the recorder was opened
+  uint64_t dropped;          ///< threads that found no free ring, their records are lost
+  uint64_t reserved[2];
+};
+
+struct RingHeader {
+  uint64_t head;      ///< records written, the next one goes to head % slots
+  int32_t tid;        ///< thread owning the ring
+  uint32_t in_use;    ///< 1 while a thread owns the ring
+  uint64_t reserved[6];
+};
+
+struct Record {
+  uint32_t sequence;       ///< ring index + 1, truncated; 0 while written
+  Kind kind;               ///< record type
+  uint16_t from;           ///< state id left
+  uint64_t ticks;          ///< time stamp counter or steady ns
+  uint64_t context;        ///< context id
+  uint16_t to;             ///< state id entered
+  uint16_t reserved;
+  int32_t timer_left_ms;   ///< left time of the running timer, kNoTimer if not running
+};
+
+inline constexpr int32_t kNoTimer = INT32_MIN;
+
+static_assert(sizeof(Header) == 80 && sizeof(RingHeader) == 64 && sizeof(Record) == 32,
+              "flight recorder layout must not depend on the compiler");
+
+/**
+ * @brief current ticks of the recorder clock
+ */
+[[nodiscard]] inline uint64_t Ticks() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+inline constexpr uint32_t kClockFlags =
+#if defined(__x86_64__) || defined(__i386__)
+    0;
+#else
+    kTicksAreNanoseconds;
+#endif
+
+/**
+ * @brief shared memory name of the recorder of a process
+ */
+[[nodiscard]] inline std::string Name(int64_t pid) {
+  return "/state_flight." + std::to_string(pid);
+}
+
+/**
+ * @brief record copied out of a ring
+ */
+struct Entry {
+  Record record;
+  int32_t tid;  ///< thread owning the ring
+};
+
+/**
+ * @brief atomic load of a field of a mapping that may be read-only
+ */
+template <typename T>
+[[nodiscard]] inline T Load(const T& value, std::memory_order order) noexcept {
+  // an atomic load does not write on any target we build for
+  return std::atomic_ref<T>(const_cast<T&>(value)).load(order);
+}
+
+/**
+ * @brief check a header copied from a mapping of size bytes before its rings are read
+ * @details a ring holds its header and all its records, 8 byte aligned, and
+ * all rings fit into the mapping
+ */
+[[nodiscard]] inline bool Valid(const Header& header, size_t size) noexcept {
+  return size >= sizeof(Header) && std::memcmp(header.magic, kMagic, sizeof(header.magic)) == 0 &&
+         header.version == kVersion && header.slots != 0 && header.ring_bytes % 8 == 0 &&
+         header.ring_bytes >= sizeof(RingHeader) + uint64_t{header.slots} * sizeof(Record) &&
+         header.rings <= (size - sizeof(Header)) / header.ring_bytes;
+}
+
+/**
+ * @brief copy the consistent records of a ring, oldest first
+ * @param base - mapping of the recorder starting with its header
+ * @param index - ring index, less than header.rings of a Valid() header
+ */
+inline void CopyRing(const Header& header, const char* base, uint32_t index, std::vector<Entry>& entries) {
+  auto* ring = reinterpret_cast<const RingHeader*>(base + sizeof(Header) + index * header.ring_bytes);
+  auto* records = reinterpret_cast<const Record*>(ring + 1);
+  auto head = Load(ring->head, std::memory_order_acquire);
+  auto first = head > header.slots ? head - header.slots : 0;
+  for (auto position = first; position < head; ++position) {
+    const auto& slot = records[position % header.slots];
+    auto expected = static_cast<uint32_t>(position + 1);
+    if (Load(slot.sequence, std::memory_order_acquire) != expected) {
+      continue;
+    }
+    Entry entry{slot, ring->tid};
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // overwritten while it was copied
+    if (Load(slot.sequence, std::memory_order_relaxed) != expected) {
+      continue;
+    }
+    entries.push_back(entry);
+  }
+}
+
+}  // namespace flight
+
+/**
+ * @brief process wide recorder, a no-op until it is opened
+ */
+class FlightRecorder {
+ public:
+  static FlightRecorder& Instance() {
+    static FlightRecorder recorder;
+    return recorder;
+  }
+
+  FlightRecorder(const FlightRecorder&) = delete;
+  FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+  /**
+   * @brief create the shared memory object and start recording
+   * @param name - shared memory name, flight::Name(getpid()) by default
+   * @param rings - max. number of recording threads
+   * @param slots - records per ring, rounded up to a power of two
+   * @throw std::runtime_error if the object can not be created
+   */
+  void Open(std::string name = {}, uint32_t rings = 16, uint32_t slots = 8192) {
+    if (IsOpen()) {
+      return;
+    }
+    if (name.empty()) {
+      name = flight::Name(getpid());
+    }
+    slots = std::bit_ceil(std::max<uint32_t>(slots, 2));
+    auto ring_bytes = sizeof(flight::RingHeader) + uint64_t{slots} * sizeof(flight::Record);
+    auto size = sizeof(flight::Header) + rings * ring_bytes;
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+      throw std::runtime_error("flight recorder: can't create " + name + ": " + std::strerror(errno));
+    }
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      auto error = errno;
+      ::close(fd);
+      shm_unlink(name.c_str());
+      throw std::runtime_error("flight recorder: can't size " + name + ": " + std::strerror(error));
+    }
+    auto* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+      shm_unlink(name.c_str());
+      throw std::runtime_error("flight recorder: can't map " + name + ": " + std::strerror(errno));
+    }
+    auto* header = static_cast<flight::Header*>(base);
+    header->version = flight::kVersion;
+    header->flags = flight::kClockFlags;
+    header->rings = rings;
+    header->slots = slots;
+    header->ring_bytes = ring_bytes;
+    header->pid = getpid();
+    timespec now{};
+    clock_gettime(CLOCK_REALTIME, &now);
+    header->base_ticks = flight::Ticks();
+    header->base_realtime_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    // the magic last, a dump attaching meanwhile finds no recorder yet
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, flight::kMagic, sizeof(header->magic));
+    m_name = name;
+    m_mask = slots - 1;
+    m_header.store(header, std::memory_order_relaxed);
+    // threads check the generation before they use their cached ring
+    m_generation.fetch_add(1, std::memory_order_release);
+  }
+
+  /**
+   * @brief stop recording and remove the shared memory object
+   * @details the mapping stays, a thread still recording writes into it
+   */
+  void Close() {
+    if (!IsOpen()) {
+      return;
+    }
+    m_header.store(nullptr, std::memory_order_relaxed);
+    m_generation.fetch_add(1, std::memory_order_release);
+    shm_unlink(m_name.c_str());
+  }
+
+  [[nodiscard]] bool IsOpen() const noexcept {
+    return m_header.load(std::memory_order_relaxed) != nullptr;
+  }
+
+  [[nodiscard]] const std::string& Name() const noexcept {
+    return m_name;
+  }
+
+  /**
+   * @brief append a record to the ring of the calling thread
+   */
+  void Record(flight::Kind kind, uint64_t context, uint16_t from, uint16_t to, int32_t timer_left_ms) noexcept {
+    auto* ring = ThreadRing();
+    if (!ring) {
+      return;
+    }
+    auto head = std::atomic_ref<uint64_t>(ring->head).load(std::memory_order_relaxed);
+    auto* record = Records(ring) + (head & m_mask);
+    std::atomic_ref<uint32_t> sequence(record->sequence);
+    // a reader that sees the old index after the copy must also see this 0 before it
+    sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    record->kind = kind;
+    record->from = from;
+    record->ticks = flight::Ticks();
+    record->context = context;
+    record->to = to;
+    record->timer_left_ms = timer_left_ms;
+    sequence.store(static_cast<uint32_t>(head + 1), std::memory_order_release);
+    std::atomic_ref<uint64_t>(ring->head).store(head + 1, std::memory_order_release);
+  }
+
+ private:
+  struct Cache {
+    flight::RingHeader* ring{nullptr};  ///< ring of the thread
+    uint64_t generation{0};             ///< recorder generation the ring belongs to
+    ~Cache() {
+      if (ring && generation == Instance().m_generation.load(std::memory_order_acquire)) {
+        std::atomic_ref<uint32_t>(ring->in_use).store(0, std::memory_order_release);
+      }
+    }
+  };
+
+  FlightRecorder() = default;
+
+  static flight::Record* Records(flight::RingHeader* ring) noexcept {
+    return reinterpret_cast<flight::Record*>(ring + 1);
+  }
+
+  flight::RingHeader* ThreadRing() noexcept {
+    thread_local Cache cache;
+    auto generation = m_generation.load(std::memory_order_acquire);
+    if (cache.generation == generation) {
+      return cache.ring;
+    }
+    cache.generation = generation;
+    cache.ring = Claim();
+    return cache.ring;
+  }
+
+  flight::RingHeader* Claim() noexcept {
+    auto* header = m_header.load(std::memory_order_relaxed);
+    if (!header) {
+      return nullptr;
+    }
+    auto* rings = reinterpret_cast<char*>(header + 1);
+    for (uint32_t index = 0; index < header->rings; ++index) {
+      auto* ring = reinterpret_cast<flight::RingHeader*>(rings + index * header->ring_bytes);
+      uint32_t expected = 0;
+      if (std::atomic_ref<uint32_t>(ring->in_use).compare_exchange_strong(expected, 1, std::memory_order_acq_rel)) {
+        ring->tid = static_cast<int32_t>(syscall(SYS_gettid));
+        return ring;
+      }
+    }
+    std::atomic_ref<uint64_t>(header->dropped).fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  std::atomic<flight::Header*> m_header{nullptr};  ///< mapping, nullptr if not recording
+  std::atomic<uint64_t> m_generation{0};           ///< changed by Open() and Close()
+  uint64_t m_mask{0};                              ///< slots - 1
+  std::string m_name;                              ///< shared memory name
+};
+
+}  // namespace logging
+
+#endif /* SRC_INCLUDE_FLIGHT_RECORDER_HPP */
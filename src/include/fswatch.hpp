@@ -1,15 +1,44 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
+#include <cstring>
+#include <exception>
 #include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include "eventExecutor.hpp"
+#include "eventTrace.hpp"
+#include "fileTail.hpp"
+#include "flatIndex.hpp"
+#include "metrics.hpp"
+#include "pathIntern.hpp"
+#include "treeMirror.hpp"
 
 #ifdef __linux__
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <sys/eventfd.h>
 #include <sys/inotify.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #define MAX_EVENTS 1024 /*Max. number of events to process at one go*/
@@ -19,12 +48,15 @@
 #define EVENT_BUF_LEN                                                          \
   (MAX_EVENTS * (EVENT_SIZE + LEN_NAME)) /*buffer to store the data of         \
                                             events*/
-#define WATCH_FLAGS (IN_CREATE | IN_MODIFY | IN_DELETE | IN_OPEN | IN_CLOSE)
+// Always watched: new and moved in sub directories are followed, deleted and
+// moved out ones dropped. The other bits are derived from the registered
+// handlers.
+#define WATCH_FLAGS (IN_CREATE | IN_DELETE | IN_MOVE)
 
 // Keep going  while run == true, or, in other words, until user hits ctrl-c
 static bool run = true;
 
-void sig_callback([[maybe_unused]] int sig) { run = false; }
+static void sig_callback([[maybe_unused]] int sig) { run = false; }
 
 // Watch class keeps track of watch descriptors (wd), parent watch descriptors
 // (pd), and names (from event->name). The class provides some helpers for
@@ -33,67 +65,153 @@ void sig_callback([[maybe_unused]] int sig) { run = false; }
 // only provide file/dir name with no path.
 // 2. Delete events provide parent watch descriptor and file/dir name, but
 // removing the watch (infotify_rm_watch) needs a wd.
+// Names are interned: both maps refer to one copy by id.
 //
 class Watch {
+  using name_id = ::watch::InternPool::Id;
   struct wd_elem {
     int pd;
-    std::string name;
-    bool operator()(const wd_elem &l, const wd_elem &r) const {
-      return l.pd < r.pd ? true
-             : l.pd == r.pd && l.name < r.name ? true : false;
-    }
+    name_id name;
+    int root;  // index of the root path the watch belongs to
   };
-  std::map<int, wd_elem> watch;
-  std::map<wd_elem, int, wd_elem> rwatch;
+  // Reverse key: parent wd and name id. Ids of the pool are unique per name,
+  // so equal keys need no string compare.
+  static uint64_t rkey(int pd, name_id name) {
+    return static_cast<uint64_t>(static_cast<uint32_t>(pd)) << 32 | name;
+  }
+  ::watch::InternPool names;
+  ::watch::FlatIndex<int, wd_elem> watch;
+  ::watch::FlatIndex<uint64_t, int> rwatch;
 
  public:
   // Insert event information, used to create new watch, into Watch object.
-  void insert(int pd, const std::string &name, int wd) {
-    wd_elem elem = {pd, name};
-    watch[wd] = elem;
-    rwatch[elem] = wd;
+  void insert(int pd, std::string_view name, int wd, int root) {
+    wd_elem elem = {pd, names.Intern(name), root};
+    if (auto *old = watch.Find(wd)) {
+      // inotify hands out the same wd for the same inode
+      rwatch.Erase(rkey(old->pd, old->name));
+      names.Release(old->name);
+    }
+    watch.Insert(wd, elem);
+    rwatch.Insert(rkey(elem.pd, elem.name), wd);
   }
   // Erase watch specified by pd (parent watch descriptor) and name from watch
-  // list. Returns full name (for display etc), and wd, which is required for
-  // inotify_rm_watch.
-  std::string erase(int pd, const std::string &name, int *wd) {
-    wd_elem pelem = {pd, name};
-    *wd = rwatch[pelem];
-    rwatch.erase(pelem);
-    const wd_elem &elem = watch[*wd];
-    std::string dir = elem.name;
-    watch.erase(*wd);
-    return dir;
+  // list. Returns wd, which is required for inotify_rm_watch, -1 if there is
+  // no such watch.
+  int erase(int pd, std::string_view name) {
+    auto id = names.Find(name);
+    auto *found = rwatch.Find(rkey(pd, id));
+    if (found == nullptr) {
+      return -1;
+    }
+    int wd = *found;
+    rwatch.Erase(rkey(pd, id));
+    watch.Erase(wd);
+    names.Release(id);
+    return wd;
+  }
+  // Erase the watches of all directories below wd, wd itself stays. Calls
+  // fn(wd) for every erased watch, e.g. to remove it from the kernel. Takes a
+  // pass over the watch list per level, for moved directories only.
+  template <typename TFn>
+  void erase_below(int wd, TFn &&fn) {
+    ::watch::FlatIndex<int, int> below;
+    below.Insert(wd, wd);
+    std::vector<int> found;
+    for (size_t size = 0; below.Size() != size;) {
+      size = below.Size();
+      watch.ForEach([&](int child, const wd_elem &elem) {
+        if (below.Find(child) == nullptr && below.Find(elem.pd) != nullptr) {
+          found.push_back(child);
+        }
+      });
+      for (int child : found) {
+        below.Insert(child, child);
+      }
+      found.clear();
+    }
+    below.Erase(wd);
+    below.ForEach([&](int child, int) {
+      auto *elem = watch.Find(child);
+      rwatch.Erase(rkey(elem->pd, elem->name));
+      names.Release(elem->name);
+      watch.Erase(child);
+      fn(child);
+    });
+  }
+  // Given a watch descriptor, return the full directory name in one zero
+  // terminated string of the arena. Walks up parent WDs to assemble name, an
+  // idea borrowed from Windows change journals.
+  std::string_view path(int wd, ::watch::PathArena &arena) const {
+    size_t length = 0;
+    for (auto *elem = watch.Find(wd); elem != nullptr; elem = parent(elem)) {
+      length += names.View(elem->name).size() + (elem->pd == -1 ? 0 : 1);
+    }
+    char *text = arena.Allocate(length);
+    text[length] = '\0';
+    size_t end = length;
+    for (auto *elem = watch.Find(wd); elem != nullptr; elem = parent(elem)) {
+      auto name = names.View(elem->name);
+      end -= name.size();
+      std::memcpy(text + end, name.data(), name.size());
+      if (elem->pd != -1) {
+        text[--end] = '/';
+      }
+    }
+    return {text, length};
   }
   // Given a watch descriptor, return the full directory name as string.
-  // Recurses up parent WDs to assemble name, an idea borrowed from Windows
-  // change journals.
   std::string get(int wd) {
-    const wd_elem &elem = watch[wd];
-    return elem.pd == -1 ? elem.name : this->get(elem.pd) + "/" + elem.name;
+    ::watch::PathArena arena(PATH_MAX);
+    return std::string(path(wd, arena));
   }
   // Given a parent wd and name (provided in IN_DELETE events), return the watch
   // descriptor. Main purpose is to help remove directories from watch list.
-  int get(int pd, std::string name) {
-    wd_elem elem = {pd, name};
-    return rwatch[elem];
+  int get(int pd, std::string_view name) {
+    auto *found = rwatch.Find(rkey(pd, names.Find(name)));
+    return found == nullptr ? -1 : *found;
+  }
+  // Given a watch descriptor, return the index of its root path, -1 if the
+  // wd is unknown.
+  int root(int wd) const {
+    auto *elem = watch.Find(wd);
+    return elem == nullptr ? -1 : elem->root;
+  }
+  // Call fn(wd, root) for every watch.
+  template <typename TFn>
+  void for_each(TFn &&fn) const {
+    watch.ForEach([&fn](int wd, const wd_elem &elem) { fn(wd, elem.root); });
   }
+  // Reclaim the storage of erased names, invalidates views of the names.
+  void compact() { names.Compact(); }
+  // Remove all watches, from the kernel too unless fd is -1.
   void cleanup(int fd) {
-    for (auto wi = watch.begin(); wi != watch.end();) {
-      inotify_rm_watch(fd, wi->first);
-      wi = watch.erase(wi);
-    }
-    rwatch.clear();
+    watch.ForEach([this, fd](int wd, const wd_elem &elem) {
+      if (fd >= 0) {
+        inotify_rm_watch(fd, wd);
+      }
+      names.Release(elem.name);
+    });
+    watch.Clear();
+    rwatch.Clear();
+    names.Compact();
   }
   void stats() {
-    std::cout << "number of watches=" << watch.size()
-              << " & reverse watches=" << rwatch.size() << std::endl;
+    std::cout << "number of watches=" << watch.Size()
+              << " & reverse watches=" << rwatch.Size()
+              << " & names=" << names.Size() << " (" << names.Bytes()
+              << " bytes)" << std::endl;
+  }
+
+ private:
+  const wd_elem *parent(const wd_elem *elem) const {
+    return elem->pd == -1 ? nullptr : watch.Find(elem->pd);
   }
 };
 #endif
 
-class fswatch {
- public:
+// Types shared by fswatch and basic_fswatch.
+struct fswatch_types {
   enum class Event {
     FILE_CREATED,
     FILE_OPENED,
@@ -112,19 +230,95 @@ class fswatch {
     std::filesystem::path path;
   };
 
-  fswatch() {}
+  // Snapshot of the watcher counters. The live counters are updated by the
+  // thread running start() and may be read from any other thread.
+  struct Counters {
+    uint64_t events_read;     // raw inotify events taken from the fd
+    uint64_t file_events;     // file events dispatched to the decoder
+    uint64_t dir_events;      // directory events dispatched to the decoder
+    uint64_t callbacks;       // user callbacks invoked
+    uint64_t overflows;       // IN_Q_OVERFLOW seen
+    uint64_t watches;         // currently installed watches
+    uint64_t scanned;         // entries found by scanning new directories
+  };
+
+  // Event as passed to the handlers of basic_fswatch, the path is valid
+  // during the call only.
+  struct event_view {
+    Event type;
+    std::string_view path;
+  };
+
+  // Tag selecting the handler overload of one event, see basic_fswatch.
+  template <Event E>
+  using on_event = std::integral_constant<Event, E>;
+
+  static constexpr size_t kEventCount = 10;
+
+ protected:
+  static constexpr uint32_t kAllEvents = (1u << kEventCount) - 1;
+
+  static constexpr uint32_t event_bit(Event event) {
+    return 1u << static_cast<unsigned>(event);
+  }
+
+  // Process wide metrics of all watchers, exposed by metrics::Server
+  struct metric_handles {
+    std::array<metrics::Counter, kEventCount> events;  // by Event
+    metrics::Counter events_read;
+    metrics::Counter overflows;
+    metrics::Gauge watches;
+    metrics::Histogram callback_latency;
+  };
+
+  static const metric_handles &metric() {
+    static const metric_handles handles = [] {
+      static const char *names[] = {"file_created", "file_opened", "file_modified", "file_closed",
+                                    "file_deleted", "dir_created", "dir_opened",    "dir_modified",
+                                    "dir_closed",   "dir_deleted"};
+      auto &registry = metrics::Registry::Instance();
+      metric_handles result;
+      for (size_t i = 0; i < result.events.size(); ++i) {
+        result.events[i] = registry.AddCounter("fswatch_events_total", "Decoded inotify events by type.",
+                                               std::string("type=\"") + names[i] + "\"");
+      }
+      result.events_read = registry.AddCounter("fswatch_events_read_total", "Raw inotify events read from the fd.");
+      result.overflows = registry.AddCounter("fswatch_overflows_total", "Inotify queue overflows.");
+      result.watches = registry.AddGauge("fswatch_watches", "Installed inotify watches.");
+      result.callback_latency = registry.AddHistogram("fswatch_callback_duration_seconds",
+                                                      "Time spent in the event callbacks.");
+      return result;
+    }();
+    return handles;
+  }
+};
+
+// Roots, inotify instance, watch list, decoding and the start/stop loop,
+// shared by the watchers. TDerived decides what an event runs:
+//   uint32_t handled_events() const - bits by Event that have a handler
+//   void dispatch(on_event<E>, std::string_view path) - run the handlers of
+//     an event that passed the subscription of its root, on_event<E>
+//     converts to Event for a runtime dispatch
+//
+template <typename TDerived>
+class fswatch_engine : public fswatch_types {
+ public:
+  fswatch_engine() {}
+
+  ~fswatch_engine() { shutdown(); }
 
-  fswatch(const std::string &directory) {
+  fswatch_engine(const std::string &directory) {
     append_to_path(directory);
   }
 
   template <class... T>
-  fswatch(T... paths) {
+  fswatch_engine(T... paths) {
     append_to_path(paths...);
   }
 
   void append_to_path(const std::string& path) {
     paths.push_back(expand(std::filesystem::path(path)));
+    root_events.push_back(kAllEvents);
     if (path.length() == 0) {
       paths[paths.size() - 1] = expand(std::filesystem::path("."));
     }
@@ -136,175 +330,416 @@ class fswatch {
     append_to_path(tail...);
   }
 
-  void on(const Event &event,
-          const std::function<void(const EventInfo &)> &action) {
-    callbacks[event] = action;
-  }
-
-  void on(const std::vector<Event> &events,
-          const std::function<void(const EventInfo &)> &action) {
+  // Limit the events delivered for one root path and everything below it,
+  // the path is added to the roots if not there yet. By default a root gets
+  // every event with a handler. Call it from the watcher thread (e.g. in a
+  // handler) or while start() is not running; while watching, only the
+  // subscription of an existing root can be changed.
+  void subscribe(const std::string &path, const std::vector<Event> &events) {
+    auto root = std::find(paths.begin(), paths.end(), expand(std::filesystem::path(path)));
+    if (root == paths.end()) {
+#ifdef __linux__
+      if (counter_watches.load(std::memory_order_relaxed) != 0) {
+        throw std::runtime_error("subscribe: " + path + " is not a root, new roots are watched by the next init()");
+      }
+#endif
+      append_to_path(path);
+      root = paths.end() - 1;
+    }
+    uint32_t bits = 0;
     for (auto &event : events) {
-      callbacks[event] = action;
+      bits |= event_bit(event);
     }
+    root_events[root - paths.begin()] = bits;
+    update_masks();
   }
 
 #ifdef __linux__
-  void stop() { run = false; }
-
-  void start() {
-    // std::map used to keep track of wd (watch descriptors) and directory names
-    // As directory creation events arrive, they are added to the Watch map.
-    // Directory delete events should be (but currently aren't in this sample)
-    // handled the same way.
-    Watch watch;
-
-    // watch_set is used by select to wait until inotify returns some data to
-    // be read using non-blocking read.
-    fd_set watch_set;
-
-    char buffer[EVENT_BUF_LEN];
-    std::string current_dir, new_dir;
-    int total_file_events = 0;
-    int total_dir_events = 0;
-    [[maybe_unused]] Event current_event;
+  // Make start() return and clean up. May be called from any thread, also
+  // from a callback; the blocking wait is woken up at once.
+  void stop() {
+    stopping.store(true, std::memory_order_relaxed);
+    wake();
+  }
 
-    // Call sig_callback if user hits ctrl-c
-    signal(SIGINT, sig_callback);
+  Counters counters() const {
+    return Counters{counter_events_read.load(std::memory_order_relaxed),
+                    counter_file_events.load(std::memory_order_relaxed),
+                    counter_dir_events.load(std::memory_order_relaxed),
+                    counter_callbacks.load(std::memory_order_relaxed),
+                    counter_overflows.load(std::memory_order_relaxed),
+                    counter_watches.load(std::memory_order_relaxed),
+                    counter_scanned.load(std::memory_order_relaxed)};
+  }
 
+  // Create the inotify instance and watch the root paths. The returned fd is
+  // non-blocking: an external event loop may poll it and call read_events()
+  // whenever it becomes readable, start() does exactly that with poll().
+  int init() {
     // creating the INOTIFY instance
     // inotify_init1 not available with older kernels, consequently inotify
     // reads block. inotify_init1 allows directory events to complete
     // immediately, avoiding buffering delays. In practice, this significantly
     // improves monotiring of newly created subdirectories.
+    if (fd >= 0) {
+      // instance kept by a previous start(), drop what is left of its events
+      while (read(fd, buffer.data(), buffer.size()) > 0) {
+      }
+      clear_wake();
+    } else {
 #ifdef IN_NONBLOCK
-    int fd = inotify_init1(IN_NONBLOCK);
+      fd = inotify_init1(IN_NONBLOCK);
 #else
-    int fd = inotify_init();
+      fd = inotify_init();
 #endif
 
-    // checking for error
-    if (fd < 0) {
-      throw std::runtime_error("inotify_init failed");
+      // checking for error
+      if (fd < 0) {
+        throw std::runtime_error("inotify_init failed");
+      }
+      // woken up by stop() and stop requests
+      wake_fd.store(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), std::memory_order_release);
     }
 
-    // use select watch list for non-blocking inotify read
-    FD_ZERO(&watch_set);
-    FD_SET(fd, &watch_set);
-
-    int wd;
-    for (auto& path : paths) {
-      auto path_string = path.string();
+    root_masks.resize(paths.size());
+    std::vector<std::pair<std::string, int>> roots;
+    for (size_t i = 0; i < paths.size(); ++i) {
+      auto path_string = paths[i].string();
       const char *root = path_string.c_str();
-      wd = inotify_add_watch(fd, root, WATCH_FLAGS);
+      root_masks[i] = event_mask(i);
+      int wd = inotify_add_watch(fd, root, root_masks[i]);
       // add wd and directory name to Watch map
-      watch.insert(-1, root, wd);
+      watches.insert(-1, root, wd, static_cast<int>(i));
+      counter_watches.fetch_add(1, std::memory_order_relaxed);
+      metric().watches.Add();
+      roots.emplace_back(std::move(path_string), wd);
+    }
+    if (recorder) {
+      recorder->Roots(roots);
+    }
+    if (tree || follower) {
+      // the mirror and the tail cover the whole tree, the directories that
+      // exist already get their watches; the handlers see none of them
+      for (auto &root : roots) {
+        if (root.second >= 0) {
+          pending_scans.push_back(root.second);
+        }
+      }
+      seeding = true;
+      try {
+        attach_subtrees();
+      } catch (...) {
+        seeding = false;
+        throw;
+      }
+      seeding = false;
     }
+    if (tree) {
+      // watched first, so nothing created during the scan is missed
+      tree->Clear();
+      for (auto &root : roots) {
+        tree->AddRoot(root.first);
+      }
+    }
+    return fd;
+  }
 
-    // Continue until run == false. See signal and sig_callback above.
-    while (run) {
-      // select waits until inotify has 1 or more events.
-      // select syntax is beyond the scope of this sample but, don't worry, the
-      // fd+1 is correct: select needs the the highest fd (+1) as the first
-      // parameter.
-      select(fd + 1, &watch_set, NULL, NULL, NULL);
+  // Keep a mirror of the watched tree up to date: init() watches every
+  // directory below the roots and scans them into it, every batch applies
+  // its events, whether they have a handler or not, and stat()s the modified
+  // entries once. nullptr stops mirroring. Set it while start() is not
+  // running. The mirror must outlive the watching.
+  void mirror(watch::TreeMirror *mirror_tree) {
+    tree = mirror_tree;
+    update_masks();
+  }
 
-      // Read event(s) from non-blocking inotify fd (non-blocking specified in
-      // inotify_init1 above).
-      int length = read(fd, buffer, EVENT_BUF_LEN);
-      if (run && length < 0) {
-        throw std::runtime_error("failed to read event(s) from inotify fd");
-      }
+  // Follow the files of the tree: init() watches every directory below the
+  // roots, created and modified files are marked, after every batch the tail
+  // hands each marked file's appended bytes to its callback, on this thread.
+  // A deleted file is read up and dropped, a renamed one is read up under
+  // its old name and followed under the new one from its next write.
+  // nullptr stops following. Set it while start() is not running. The tail
+  // must outlive the watching.
+  void tail(watch::FileTail *file_tail) {
+    follower = file_tail;
+    update_masks();
+  }
 
-      // Loop through event buffer
-      for (int i = 0; i < length;) {
-        struct inotify_event *event = (struct inotify_event *)&buffer[i];
-        // Never actually seen this
-        if (event->wd == -1) {
-          throw std::runtime_error(
-              "inotify IN_Q_OVERFLOW - Event queue overflowed");
+  // Write every batch read from the inotify fd, and the roots of every
+  // init(), to a trace; nullptr stops recording. Set it while start() is
+  // not running. The writer must outlive the recording.
+  void record(watch::TraceWriter *writer) { recorder = writer; }
+
+  // Feed the batches of a trace through the same decoding, watch list and
+  // dispatch as events of the inotify fd, instead of watching. The watches
+  // the trace added are taken over from it, nothing touches the filesystem.
+  // paced = true keeps the time between the batches as recorded, otherwise
+  // they are replayed as fast as possible. Returns the number of batches,
+  // stops early on a stop request. The watcher must have as many roots as
+  // the trace and must not be watching.
+  size_t replay(const watch::TraceReader &trace, bool paced = false, std::stop_token token = {}) {
+    if (fd >= 0) {
+      throw std::runtime_error("replay while watching");
+    }
+    size_t batches = 0;
+    replaying = true;
+    try {
+      auto start = std::chrono::steady_clock::now();
+      trace.ForEach([&](const watch::TraceReader::Record &record) {
+        if (token.stop_requested()) {
+          return false;
         }
-        // Never seen this either
-        if (event->mask & IN_Q_OVERFLOW) {
-          throw std::runtime_error(
-              "inotify IN_Q_OVERFLOW - Event queue overflowed");
+        if (paced) {
+          std::this_thread::sleep_until(start + record.time);
         }
-        if (event->len) {
-          if (event->mask & IN_IGNORED) {
-            // Watch was removed explicitly (inotify_rm_watch) or automatically
-            // (file was deleted, or filesystem was unmounted)
-            throw std::runtime_error(
-                "inotify IN_IGNORED - Watch was removed explicitly "
-                "(inotify_rm_watch) or automatically (file was deleted, or "
-                "filesystem was unmounted)");
-          }
-          if (event->mask & IN_CREATE) {
-            current_dir = watch.get(event->wd);
-            if (event->mask & IN_ISDIR) {
-              new_dir = current_dir + "/" + event->name;
-              wd = inotify_add_watch(fd, new_dir.c_str(), WATCH_FLAGS);
-              watch.insert(event->wd, event->name, wd);
-              total_dir_events++;
-              run_callback(Event::DIR_CREATED, current_dir, event->name);
-            } else {
-              total_file_events++;
-              run_callback(Event::FILE_CREATED, current_dir, event->name);
-            }
-          } else if (event->mask & IN_MODIFY) {
-            if (event->mask & IN_ISDIR) {
-              run_callback(Event::DIR_MODIFIED, current_dir, event->name);
-            } else {
-              run_callback(Event::FILE_MODIFIED, current_dir, event->name);
-            }
-          } else if (event->mask & IN_DELETE) {
-            if (event->mask & IN_ISDIR) {
-              // Directory was deleted
-              new_dir = watch.erase(event->wd, event->name, &wd);
-              inotify_rm_watch(fd, wd);
-              total_dir_events--;
-              run_callback(Event::DIR_DELETED, current_dir, event->name);
-            } else {
-              // File was deleted
-              current_dir = watch.get(event->wd);
-              total_file_events--;
-              run_callback(Event::FILE_DELETED, current_dir, event->name);
-            }
-          } else if (event->mask & IN_OPEN) {
-            current_dir = watch.get(event->wd);
-            if (event->mask & IN_ISDIR) {
-              // Directory was opened
-              run_callback(Event::DIR_OPENED, current_dir, event->name);
-            } else {
-              // File was opened
-              run_callback(Event::FILE_OPENED, current_dir, event->name);
-            }
-          } else if (event->mask & IN_CLOSE) {
-            current_dir = watch.get(event->wd);
-            if (event->mask & IN_ISDIR) {
-              // Directory was closed
-              run_callback(Event::DIR_CLOSED, current_dir, event->name);
-            } else {
-              // File was closed
-              run_callback(Event::FILE_CLOSED, current_dir, event->name);
-            }
-          }
+        if (record.kind == watch::trace::Kind::Roots) {
+          replay_roots(watch::TraceReader::Roots(record));
+        } else if (record.kind == watch::trace::Kind::Batch || record.kind == watch::trace::Kind::Scan ||
+                   record.kind == watch::trace::Kind::Seed) {
+          auto [added, events] = watch::TraceReader::Batch(record);
+          replay_added = added;
+          scanning = record.kind != watch::trace::Kind::Batch;
+          seeding = record.kind == watch::trace::Kind::Seed;
+          process_events(events.data(), events.size());
+          scanning = false;
+          seeding = false;
+          batches++;
         }
-        i += EVENT_SIZE + event->len;
+        return true;
+      });
+    } catch (...) {
+      remove_watches();
+      replaying = false;
+      scanning = false;
+      seeding = false;
+      throw;
+    }
+    remove_watches();
+    replaying = false;
+    return batches;
+  }
+
+  // Adaptive busy polling for start(): after a batch the fd is read without
+  // blocking until no event came for `spin`, with a growing pause between
+  // empty reads; then start() blocks in poll() again. An idle watcher costs
+  // no CPU, a burst is picked up without a scheduler wakeup per event.
+  // cpu >= 0 pins the thread running start() to that core until start()
+  // returns, then the thread has its previous affinity again. spin = 0, the
+  // default, always blocks. Set it while start() is not running.
+  void busy_poll(std::chrono::microseconds spin, int cpu = -1) {
+    spin_budget = spin;
+    pinned_cpu = cpu;
+  }
+
+  // inotify fd created by init(), -1 if not initialized
+  int native_handle() const { return fd; }
+
+  // Read one batch of events from the inotify fd and dispatch them. Returns
+  // the number of bytes handled, 0 if nothing was available.
+  size_t read_events() {
+    // Read event(s) from non-blocking inotify fd (non-blocking specified in
+    // inotify_init1 above).
+    ssize_t length = read(fd, buffer.data(), buffer.size());
+    if (length < 0) {
+      if (!run || errno == EAGAIN || errno == EINTR) {
+        return 0;
       }
+      throw std::runtime_error("failed to read event(s) from inotify fd");
+    }
+    decode(static_cast<size_t>(length));
+    if (!pending_scans.empty()) {
+      attach_subtrees();
+    }
+    return static_cast<size_t>(length);
+  }
+
+  // Remove all watches and close the inotify fd.
+  void cleanup() {
+    remove_watches();
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
     }
+    if (int wfd = wake_fd.exchange(-1, std::memory_order_acq_rel); wfd >= 0) {
+      ::close(wfd);
+    }
+  }
 
-    // Cleanup
-    watch.cleanup(fd);
-    close(fd);
+  // Watch until stop() is called or the user hits ctrl-c.
+  void start() {
+    // Call sig_callback if user hits ctrl-c
+    signal(SIGINT, sig_callback);
+
+    start(std::stop_token{});
     fflush(stdout);
   }
+
+  // Watch until a stop is requested on token or stop() is called. The stop
+  // request wakes the wait for events directly, no helper thread or file
+  // system event is needed.
+  void start(std::stop_token token) {
+    init();
+    // the caller's thread gets its affinity back when start() returns or throws
+    std::optional<thread_pin> pin;
+    if (pinned_cpu >= 0) {
+      pin.emplace(pinned_cpu);
+    }
+    std::stop_callback on_stop(token, [this]() { wake(); });
+
+    // poll waits until inotify has 1 or more events or a stop wakes it up
+    pollfd fds[2] = {{fd, POLLIN, 0}, {wake_fd.load(std::memory_order_acquire), POLLIN, 0}};
+
+    // Continue until stopped. See signal and sig_callback above.
+    while (run && !token.stop_requested() && !stopping.load(std::memory_order_relaxed)) {
+      if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+        throw std::runtime_error("failed to poll inotify fd");
+      }
+      if (fds[0].revents & POLLIN) {
+        read_events();
+        if (spin_budget.count() > 0) {
+          spin(token);
+        }
+      }
+      if (fds[1].revents & POLLIN) {
+        clear_wake();
+      }
+    }
+
+    // Closing the inotify fd waits for the kernel to retire the instance,
+    // which takes milliseconds. Only the watches are removed here, the fd is
+    // reused by the next start() and closed by cleanup() or the destructor.
+    remove_watches();
+  }
+
+  // Run start() on a std::jthread owned by the watcher. join() or the
+  // destructor requests the stop and waits for the thread.
+  void run_async() {
+    worker = std::jthread([this](std::stop_token token) {
+      try {
+        start(token);
+      } catch (...) {
+        async_error = std::current_exception();
+      }
+    });
+  }
+
+  // Stop run_async() and wait for its thread. Rethrows the exception that
+  // ended the watcher, if any.
+  void join() {
+    if (worker.joinable()) {
+      worker.request_stop();
+      worker.join();
+    }
+    if (auto error = std::exchange(async_error, nullptr)) {
+      std::rethrow_exception(error);
+    }
+  }
 #endif
 
- private:
+ protected:
+  TDerived &derived() { return static_cast<TDerived &>(*this); }
+  const TDerived &derived() const { return static_cast<const TDerived &>(*this); }
+
+  // Join the run_async() thread and close the instance. The derived watcher
+  // calls it first thing in its destructor, the thread runs its handlers.
+  void shutdown() {
+#ifdef __linux__
+    if (worker.joinable()) {
+      worker.request_stop();
+      worker.join();
+    }
+    cleanup();
+#endif
+  }
+
   // Root directory of the file watcher
   std::vector<std::filesystem::path> paths;
 
-  // Callback functions based on file status
-  std::map<Event, std::function<void(const EventInfo &)>> callbacks;
+  // Events subscribed per root, bits by Event
+  std::vector<uint32_t> root_events;
+
+  // Inotify mask installed per root
+  std::vector<uint32_t> root_masks;
+
+  // Directory of the events being decoded
+  struct event_dir {
+    int wd = -1;
+    int root = -1;  // index in paths
+    std::string_view path;
+  };
+
+#ifdef __linux__
+  // inotify instance, created by init()
+  int fd = -1;
+
+  // eventfd waking up start(), created by init()
+  std::atomic<int> wake_fd{-1};
+  std::atomic<bool> stopping{false};
+
+  // Index used to keep track of wd (watch descriptors) and directory names
+  // As directory creation events arrive, they are added to the Watch map.
+  Watch watches;
+
+  // Buffer for one read() of the inotify fd
+  std::array<char, EVENT_BUF_LEN> buffer;
+
+  // Trace written by read_events(), wds added by the batch being recorded
+  watch::TraceWriter *recorder = nullptr;
+  std::vector<int> recorded_added;
+
+  // Set by replay(), wds of the trace the batch being replayed still adds
+  bool replaying = false;
+  std::span<const int32_t> replay_added;
+
+  // Watches of new directories added by the last batch, scanned after it
+  std::vector<int> pending_scans;
+
+  // Set while the events of a scan are decoded
+  bool scanning = false;
+
+  // Set while init() scans the directories below the roots, the events only
+  // add watches
+  bool seeding = false;
+
+  // Set while an IN_MOVED_FROM/IN_MOVED_TO is decoded as a delete/create
+  bool moving = false;
+
+  // Entries announced by a scan, keyed by the wd of their directory and the
+  // id of their name in announced_names, the value is the name id. An entry
+  // created after the watch of its directory was added is reported by the
+  // kernel as well, that second create is dropped. Cleared once a read found
+  // the queue empty, see process_events().
+  ::watch::InternPool announced_names;
+  ::watch::FlatIndex<uint64_t, ::watch::InternPool::Id> announced;
+
+  // getdents64() buffer of attach_subtrees(), allocated by its first scan
+  std::unique_ptr<char[]> dirents;
+  static constexpr size_t kDirentsSize = 64 * 1024;
+
+  // Busy polling after a batch, see busy_poll()
+  std::chrono::nanoseconds spin_budget{0};
+  int pinned_cpu = -1;
+#endif
+
+  // Paths of the batch being dispatched, small until a batch needs more;
+  // thousands of watchers may share one loop
+  watch::PathArena arena{16 * 1024};
+
+  // Mirror of the watched tree, see mirror()
+  watch::TreeMirror *tree = nullptr;
+
+  // Files followed for appended bytes, see tail()
+  watch::FileTail *follower = nullptr;
+
+  // Counters, written only by the thread running start()
+  std::atomic<uint64_t> counter_events_read{0};
+  std::atomic<uint64_t> counter_file_events{0};
+  std::atomic<uint64_t> counter_dir_events{0};
+  std::atomic<uint64_t> counter_callbacks{0};
+  std::atomic<uint64_t> counter_overflows{0};
+  std::atomic<uint64_t> counter_watches{0};
+  std::atomic<uint64_t> counter_scanned{0};
 
   std::filesystem::path expand(std::filesystem::path in) {
     const char *home = getenv("HOME");
@@ -319,15 +754,637 @@ class fswatch {
     return in;
   }
 
-  bool is_callback_registered(const Event &event) {
-    return (callbacks.find(event) != callbacks.end());
+#ifdef __linux__
+  // Decode a buffer of raw inotify events, keep the watch list up to date
+  // and run the callbacks. Paths of the batch are built in the arena, which
+  // is reset once they are dispatched.
+  void process_events(const char *data, size_t length) {
+    event_dir dir;
+    int wd;
+
+    // no name views are held between batches
+    watches.compact();
+
+    // Loop through event buffer
+    for (size_t i = 0; i < length;) {
+      const struct inotify_event *event = (const struct inotify_event *)&data[i];
+      if (scanning) {
+        counter_scanned.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        counter_events_read.fetch_add(1, std::memory_order_relaxed);
+        metric().events_read.Inc();
+      }
+      // Never actually seen this
+      if (event->wd == -1) {
+        counter_overflows.fetch_add(1, std::memory_order_relaxed);
+        metric().overflows.Inc();
+        throw std::runtime_error(
+            "inotify IN_Q_OVERFLOW - Event queue overflowed");
+      }
+      // Never seen this either
+      if (event->mask & IN_Q_OVERFLOW) {
+        counter_overflows.fetch_add(1, std::memory_order_relaxed);
+        metric().overflows.Inc();
+        throw std::runtime_error(
+            "inotify IN_Q_OVERFLOW - Event queue overflowed");
+      }
+      if (event->len) {
+        if (event->mask & IN_IGNORED) {
+          // Watch was removed explicitly (inotify_rm_watch) or automatically
+          // (file was deleted, or filesystem was unmounted)
+          throw std::runtime_error(
+              "inotify IN_IGNORED - Watch was removed explicitly "
+              "(inotify_rm_watch) or automatically (file was deleted, or "
+              "filesystem was unmounted)");
+        }
+        // a rename is decoded as the delete of the old name and the create of
+        // the new one, either may be outside the watched tree
+        moving = (event->mask & IN_MOVE) != 0;
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+          directory(event->wd, dir);
+          // an entry announced by a scan already is dropped
+          if (first_create(event->wd, event->name)) {
+            if (event->mask & IN_ISDIR) {
+              auto new_dir = arena.Join(dir.path, '/', event->name);
+              // a sub directory gets the mask of its root
+              wd = add_watch(new_dir.data(), dir_mask(dir.root));
+              if (wd >= 0) {
+                watches.insert(event->wd, event->name, wd, dir.root);
+                counter_watches.fetch_add(1, std::memory_order_relaxed);
+                metric().watches.Add();
+                // what was created in it before the watch, see attach_subtrees()
+                if (!replaying) {
+                  pending_scans.push_back(wd);
+                }
+              }
+              counter_dir_events.fetch_add(1, std::memory_order_relaxed);
+              emit<Event::DIR_CREATED>(dir, event->name);
+            } else {
+              counter_file_events.fetch_add(1, std::memory_order_relaxed);
+              emit<Event::FILE_CREATED>(dir, event->name);
+            }
+          }
+        } else if (event->mask & IN_MODIFY) {
+          directory(event->wd, dir);
+          if (event->mask & IN_ISDIR) {
+            counter_dir_events.fetch_add(1, std::memory_order_relaxed);
+            emit<Event::DIR_MODIFIED>(dir, event->name);
+          } else {
+            counter_file_events.fetch_add(1, std::memory_order_relaxed);
+            emit<Event::FILE_MODIFIED>(dir, event->name);
+          }
+        } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+          directory(event->wd, dir);
+          // a new entry of the same name is created anew
+          forget(event->wd, event->name);
+          if (event->mask & IN_ISDIR) {
+            // Directory was deleted
+            wd = watches.erase(event->wd, event->name);
+            if (wd >= 0) {
+              // a deleted directory is empty, a moved one takes its subtree
+              // along, which is watched anew under the new name
+              if (moving) {
+                watches.erase_below(wd, [this](int below) { drop_watch(below); });
+              }
+              drop_watch(wd);
+            }
+            counter_dir_events.fetch_add(1, std::memory_order_relaxed);
+            emit<Event::DIR_DELETED>(dir, event->name);
+          } else {
+            // File was deleted
+            counter_file_events.fetch_add(1, std::memory_order_relaxed);
+            emit<Event::FILE_DELETED>(dir, event->name);
+          }
+        } else if (event->mask & IN_OPEN) {
+          directory(event->wd, dir);
+          if (event->mask & IN_ISDIR) {
+            // Directory was opened
+            counter_dir_events.fetch_add(1, std::memory_order_relaxed);
+            emit<Event::DIR_OPENED>(dir, event->name);
+          } else {
+            // File was opened
+            counter_file_events.fetch_add(1, std::memory_order_relaxed);
+            emit<Event::FILE_OPENED>(dir, event->name);
+          }
+        } else if (event->mask & IN_CLOSE) {
+          directory(event->wd, dir);
+          if (event->mask & IN_ISDIR) {
+            // Directory was closed
+            counter_dir_events.fetch_add(1, std::memory_order_relaxed);
+            emit<Event::DIR_CLOSED>(dir, event->name);
+          } else {
+            // File was closed
+            counter_file_events.fetch_add(1, std::memory_order_relaxed);
+            emit<Event::FILE_CLOSED>(dir, event->name);
+          }
+        }
+      }
+      i += EVENT_SIZE + event->len;
+    }
+    moving = false;
+    // A read with room left for the longest event found the queue empty:
+    // every create that raced with an earlier scan was in it or before it.
+    if (!scanning && announced.Size() != 0 && length + EVENT_SIZE + NAME_MAX + 1 <= EVENT_BUF_LEN) {
+      forget_announced();
+    }
+    if (tree) {
+      tree->Flush();
+    }
+    if (follower) {
+      follower->Flush();
+    }
+    arena.Reset();
+  }
+
+  // inotify_add_watch() for a new sub directory. A replay takes the wd the
+  // recorded run got, a recording notes it.
+  int add_watch(const char *path, uint32_t mask) {
+    if (replaying) {
+      if (replay_added.empty()) {
+        return -1;
+      }
+      int wd = replay_added.front();
+      replay_added = replay_added.subspan(1);
+      return wd;
+    }
+    int wd = inotify_add_watch(fd, path, mask);
+    if (recorder) {
+      recorded_added.push_back(wd);
+    }
+    return wd;
+  }
+
+  void rm_watch(int wd) {
+    if (!replaying) {
+      inotify_rm_watch(fd, wd);
+    }
+  }
+
+  // rm_watch() a watch erased from the watch list and count it
+  void drop_watch(int wd) {
+    rm_watch(wd);
+    counter_watches.fetch_sub(1, std::memory_order_relaxed);
+    metric().watches.Sub();
+  }
+
+  // Decode length bytes of the buffer, a read of the fd or the events of a
+  // scan. A recording writes them with the watches they added, also if the
+  // decoding fails.
+  void decode(size_t length) {
+    if (!recorder) {
+      process_events(buffer.data(), length);
+      return;
+    }
+    recorded_added.clear();
+    auto write = [this, length]() {
+      if (seeding) {
+        recorder->Seed({buffer.data(), length}, recorded_added);
+      } else if (scanning) {
+        recorder->Scan({buffer.data(), length}, recorded_added);
+      } else {
+        recorder->Batch({buffer.data(), length}, recorded_added);
+      }
+    };
+    try {
+      process_events(buffer.data(), length);
+    } catch (...) {
+      write();
+      throw;
+    }
+    write();
+  }
+
+  // Attach the directories created by the last batch with all they hold.
+  // Their watches are in place, but whatever was created in them before,
+  // e.g. by mkdir -p or an unpacking archive, has no event. Each one is read
+  // with getdents64() in large batches, its entries are made up as create
+  // events and decoded like a read of the fd: sub directories get a watch
+  // and are scanned in turn, the handlers, mirror and tail see every entry.
+  // An entry also reported by the kernel is announced once, see announced.
+  void attach_subtrees() {
+    if (!dirents) {
+      dirents = std::make_unique_for_overwrite<char[]>(kDirentsSize);
+    }
+    size_t used = 0;
+    auto flush = [this, &used]() {
+      if (used == 0) {
+        return;
+      }
+      scanning = true;
+      try {
+        decode(used);
+      } catch (...) {
+        scanning = false;
+        throw;
+      }
+      scanning = false;
+      used = 0;
+    };
+    for (;;) {
+      if (pending_scans.empty()) {
+        // the sub directories found so far get their watches
+        flush();
+        if (pending_scans.empty()) {
+          break;
+        }
+      }
+      int wd = pending_scans.back();
+      pending_scans.pop_back();
+      int dir_fd = ::open(watches.path(wd, arena).data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (dir_fd < 0) {
+        // gone again, its delete event follows
+        continue;
+      }
+      for (ssize_t length; (length = getdents64(dir_fd, dirents.get(), kDirentsSize)) > 0;) {
+        for (ssize_t offset = 0; offset < length;) {
+          auto *entry = reinterpret_cast<const dirent64 *>(dirents.get() + offset);
+          offset += entry->d_reclen;
+          std::string_view name(entry->d_name);
+          if (name == "." || name == "..") {
+            continue;
+          }
+          bool is_dir = entry->d_type == DT_DIR;
+          if (entry->d_type == DT_UNKNOWN) {
+            struct stat status {};
+            is_dir = fstatat(dir_fd, entry->d_name, &status, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(status.st_mode);
+          }
+          // names padded to the event size, as the kernel does
+          auto padded = (name.size() + EVENT_SIZE) / EVENT_SIZE * EVENT_SIZE;
+          if (used + EVENT_SIZE + padded > buffer.size()) {
+            flush();
+          }
+          auto *event = reinterpret_cast<struct inotify_event *>(buffer.data() + used);
+          event->wd = wd;
+          event->mask = IN_CREATE | (is_dir ? IN_ISDIR : 0);
+          event->cookie = 0;
+          event->len = static_cast<uint32_t>(padded);
+          std::memset(event->name, 0, padded);
+          std::memcpy(event->name, name.data(), name.size());
+          used += EVENT_SIZE + padded;
+        }
+      }
+      ::close(dir_fd);
+    }
+    arena.Reset();
+  }
+
+  static uint64_t announced_key(int wd, ::watch::InternPool::Id name) {
+    return static_cast<uint64_t>(static_cast<uint32_t>(wd)) << 32 | name;
+  }
+
+  // Remember a create announced by a scan; false for the kernel's own event
+  // of an announced entry, which is dropped. The seed announces nothing, the
+  // handlers see the kernel's event of an entry created while it runs.
+  bool first_create(int wd, std::string_view name) {
+    if (seeding) {
+      return true;
+    }
+    if (scanning) {
+      auto id = announced_names.Intern(name);
+      if (announced.Find(announced_key(wd, id)) != nullptr) {
+        // announced twice, one reference per entry
+        announced_names.Release(id);
+      } else {
+        announced.Insert(announced_key(wd, id), id);
+      }
+      return true;
+    }
+    return !forget(wd, name);
+  }
+
+  // Drop an announced entry, true if it was announced.
+  bool forget(int wd, std::string_view name) {
+    if (announced.Size() == 0) {
+      return false;
+    }
+    auto id = announced_names.Find(name);
+    if (id == ::watch::InternPool::kNone || !announced.Erase(announced_key(wd, id))) {
+      return false;
+    }
+    announced_names.Release(id);
+    return true;
+  }
+
+  void forget_announced() {
+    announced.ForEach([this](uint64_t, ::watch::InternPool::Id id) { announced_names.Release(id); });
+    announced.Clear();
+    announced_names.Compact();
+  }
+
+  // Start the watch list of a replay over with the roots of the trace.
+  void replay_roots(const std::vector<watch::TraceReader::Root> &roots) {
+    if (roots.size() != paths.size()) {
+      throw std::runtime_error("replay: the trace has " + std::to_string(roots.size()) + " roots, the watcher " +
+                               std::to_string(paths.size()));
+    }
+    remove_watches();
+    root_masks.resize(paths.size());
+    for (size_t i = 0; i < roots.size(); ++i) {
+      root_masks[i] = event_mask(i);
+      watches.insert(-1, roots[i].path, roots[i].wd, static_cast<int>(i));
+      counter_watches.fetch_add(1, std::memory_order_relaxed);
+      metric().watches.Add();
+    }
+  }
+
+  void remove_watches() {
+    pending_scans.clear();
+    forget_announced();
+    watches.cleanup(fd);
+    metric().watches.Sub(static_cast<int64_t>(counter_watches.exchange(0, std::memory_order_relaxed)));
+    stopping.store(false, std::memory_order_relaxed);
+  }
+
+  void clear_wake() {
+    uint64_t count;
+    [[maybe_unused]] auto got = ::read(wake_fd.load(std::memory_order_acquire), &count, sizeof(count));
+  }
+
+  void wake() {
+    if (int wfd = wake_fd.load(std::memory_order_acquire); wfd >= 0) {
+      uint64_t one = 1;
+      [[maybe_unused]] auto written = ::write(wfd, &one, sizeof(one));
+    }
+  }
+
+  // Keep reading without blocking until no event came for spin_budget. The
+  // pauses between empty reads double up to 64, events reset them and the
+  // budget; a stop ends the spin at once.
+  void spin(const std::stop_token &token) {
+    auto idle_since = std::chrono::steady_clock::now();
+    unsigned pauses = 1;
+    while (run && !token.stop_requested() && !stopping.load(std::memory_order_relaxed)) {
+      if (read_events() > 0) {
+        idle_since = std::chrono::steady_clock::now();
+        pauses = 1;
+        continue;
+      }
+      if (std::chrono::steady_clock::now() - idle_since >= spin_budget) {
+        return;
+      }
+      for (unsigned i = 0; i < pauses; ++i) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+      }
+      pauses = std::min(pauses * 2, 64u);
+    }
+  }
+
+  // Pins the calling thread to a cpu while it lives and restores the
+  // affinity the thread had before.
+  class thread_pin {
+   public:
+    explicit thread_pin(int cpu) {
+      if (int error = pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved); error != 0) {
+        throw std::runtime_error(std::string("failed to get the watcher affinity: ") + std::strerror(error));
+      }
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      if (int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set); error != 0) {
+        throw std::runtime_error("failed to pin the watcher to cpu " + std::to_string(cpu) + ": " +
+                                 std::strerror(error));
+      }
+    }
+    thread_pin(const thread_pin &) = delete;
+    thread_pin &operator=(const thread_pin &) = delete;
+    ~thread_pin() { pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved); }
+
+   private:
+    cpu_set_t saved;
+  };
+
+  // Full directory name and root of wd, consecutive events of one directory
+  // share them.
+  void directory(int wd, event_dir &dir) {
+    if (wd != dir.wd) {
+      dir.path = watches.path(wd, arena);
+      dir.root = watches.root(wd);
+      dir.wd = wd;
+    }
+  }
+
+  // Mask for a new sub directory of root. IN_MASK_CREATE keeps the mask of
+  // an inode that is watched already instead of replacing it.
+  uint32_t dir_mask(int root) const {
+    uint32_t mask = root < 0 ? WATCH_FLAGS : root_masks[root];
+#ifdef IN_MASK_CREATE
+    mask |= IN_MASK_CREATE;
+#endif
+    return mask;
+  }
+#endif
+
+  // Inotify mask of a root: the fixed flags and the events that have a
+  // handler and are subscribed for the root.
+  uint32_t event_mask(size_t root) const {
+    uint32_t events = derived().handled_events() & root_events[root];
+    uint32_t mask = WATCH_FLAGS;
+    // the mirror keeps sizes and mtimes, the tail reads appended bytes
+    if (tree || follower || (events & (event_bit(Event::FILE_MODIFIED) | event_bit(Event::DIR_MODIFIED)))) {
+      mask |= IN_MODIFY;
+    }
+    if (events & (event_bit(Event::FILE_OPENED) | event_bit(Event::DIR_OPENED))) {
+      mask |= IN_OPEN;
+    }
+    if (events & (event_bit(Event::FILE_CLOSED) | event_bit(Event::DIR_CLOSED))) {
+      mask |= IN_CLOSE;
+    }
+    return mask;
+  }
+
+  // Bring the installed watches in line with the handlers and subscriptions.
+  // Added bits are merged with IN_MASK_ADD, a removed bit needs the mask to be
+  // replaced.
+  void update_masks() {
+#ifdef __linux__
+    if (fd < 0) {
+      return;
+    }
+    std::vector<uint32_t> flags(root_masks.size(), 0);
+    bool changed = false;
+    for (size_t root = 0; root < root_masks.size(); ++root) {
+      auto mask = event_mask(root);
+      if (mask != root_masks[root]) {
+        flags[root] = (root_masks[root] & ~mask) == 0 ? (mask & ~root_masks[root]) | IN_MASK_ADD : mask;
+        root_masks[root] = mask;
+        changed = true;
+      }
+    }
+    if (!changed) {
+      return;
+    }
+    // own arena, this may run in a callback while a batch is dispatched
+    watch::PathArena paths_arena(PATH_MAX);
+    watches.for_each([&](int wd, int root) {
+      if (root >= 0 && flags[root] != 0) {
+        inotify_add_watch(fd, watches.path(wd, paths_arena).data(), flags[root]);
+        paths_arena.Reset();
+      }
+    });
+#endif
+  }
+
+  // Count an event and hand it to the derived watcher if it has a handler
+  // and the root of the event subscribed it. The event is a template
+  // argument, a watcher with static handlers resolves them per event.
+  template <Event E>
+  void emit(const event_dir &dir, std::string_view filename) {
+    if (seeding) {
+      return;
+    }
+    metric().events[static_cast<size_t>(E)].Inc();
+    std::string_view path;
+    if (tree || follower) {
+      path = arena.Join(dir.path, '/', filename);
+      if (tree) {
+        update_mirror(E, path);
+      }
+      if (follower) {
+        update_tail(E, path);
+      }
+    }
+    if ((derived().handled_events() & event_bit(E)) == 0) {
+      return;
+    }
+    // IN_CREATE and IN_DELETE come for every root, drop the unsubscribed ones
+    if (dir.root >= 0 && (root_events[dir.root] & event_bit(E)) == 0) {
+      return;
+    }
+    counter_callbacks.fetch_add(1, std::memory_order_relaxed);
+    derived().dispatch(on_event<E>{}, path.empty() ? arena.Join(dir.path, '/', filename) : path);
+  }
+
+  void update_mirror(Event event, std::string_view path) {
+    switch (event) {
+      case Event::FILE_CREATED:
+      case Event::DIR_CREATED:
+        tree->Created(path, event == Event::DIR_CREATED);
+        break;
+      case Event::FILE_MODIFIED:
+      case Event::DIR_MODIFIED:
+        tree->Modified(path);
+        break;
+      case Event::FILE_DELETED:
+      case Event::DIR_DELETED:
+        tree->Deleted(path);
+        break;
+      default:
+        break;
+    }
   }
 
-  void run_callback(const Event &event, const std::string &current_dir,
-                    const std::string &filename) {
-    if (is_callback_registered(event)) {
-      callbacks[event](EventInfo{
-          event, std::filesystem::path(current_dir + "/" + filename)});
+  void update_tail(Event event, std::string_view path) {
+    switch (event) {
+      case Event::FILE_CREATED:
+        // a moved in file has bytes already, it is followed once written to
+        if (!moving) {
+          follower->Created(path);
+        }
+        break;
+      case Event::FILE_MODIFIED:
+        follower->Modified(path);
+        break;
+      case Event::FILE_DELETED:
+        // renamed away: the path may be created anew for a rotation
+        if (moving) {
+          follower->Moved(path);
+        } else {
+          follower->Deleted(path);
+        }
+        break;
+      default:
+        break;
     }
   }
+
+#ifdef __linux__
+  // Error that ended the run_async() thread
+  std::exception_ptr async_error;
+
+  // Thread of run_async(), joined by join() or the destructor
+  std::jthread worker;
+#endif
+};
+
+// Watcher with callbacks registered at runtime.
+class fswatch : public fswatch_engine<fswatch> {
+  friend class fswatch_engine<fswatch>;
+
+ public:
+  using fswatch_engine<fswatch>::fswatch_engine;
+
+  // The run_async() thread runs the callbacks, it ends before they go.
+  ~fswatch() { shutdown(); }
+
+  // Register a callback. The kernel is asked only for the events that have a
+  // callback; while watching, the installed watches are updated. Call it from
+  // the watcher thread (e.g. in a callback) or while start() is not running.
+  void on(const Event &event,
+          const std::function<void(const EventInfo &)> &action) {
+    callbacks[event] = std::make_shared<const Callback>(action);
+    handled |= event_bit(event);
+    update_masks();
+  }
+
+  void on(const std::vector<Event> &events,
+          const std::function<void(const EventInfo &)> &action) {
+    auto shared = std::make_shared<const Callback>(action);
+    for (auto &event : events) {
+      callbacks[event] = shared;
+      handled |= event_bit(event);
+    }
+    update_masks();
+  }
+
+  // Run callbacks on an executor instead of the reading thread. Events of the
+  // same path keep their order, different paths are handled in parallel.
+  // Pass nullptr to go back to synchronous callbacks. Must not be changed
+  // while start() is running.
+  void set_executor(std::shared_ptr<watch::EventExecutor> executor) {
+    this->executor = std::move(executor);
+  }
+
+ private:
+  uint32_t handled_events() const { return handled; }
+
+  void dispatch(Event event, std::string_view path) {
+    auto &callback = callbacks.find(event)->second;
+    if (executor) {
+      // key by path to keep per path order, coalesce identical events only
+      auto key = std::hash<std::string_view>{}(path);
+      auto coalesce_key = key ^ (static_cast<uint64_t>(event) + 1) * 0x9e3779b97f4a7c15ull;
+      executor->Post(key, coalesce_key,
+                     // the task holds the callback, on() may replace it before the task runs
+                     [action = callback, event, path = std::string(path)]() {
+                       auto start = std::chrono::steady_clock::now();
+                       (*action)(EventInfo{event, std::filesystem::path(path)});
+                       metric().callback_latency.ObserveSince(start);
+                     });
+    } else {
+      // the path keeps its capacity, steady state dispatch does not allocate
+      scratch.type = event;
+      scratch.path.assign(path);
+      auto start = std::chrono::steady_clock::now();
+      (*callback)(scratch);
+      metric().callback_latency.ObserveSince(start);
+    }
+  }
+
+  using Callback = std::function<void(const EventInfo &)>;
+
+  // Callback functions based on file status, shared with the queued executor tasks
+  std::map<Event, std::shared_ptr<const Callback>> callbacks;
+
+  // Events that have a callback, bits by Event
+  uint32_t handled = 0;
+
+  // Optional executor running the callbacks
+  std::shared_ptr<watch::EventExecutor> executor;
+
+  // Event passed to synchronous callbacks, reused for every event
+  EventInfo scratch;
 };
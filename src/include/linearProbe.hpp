@@ -0,0 +1,75 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Insert and erase of a linear probing index.
+* @details The index is a power of two vector of slots which refer to
+* entries stored elsewhere; the owner of the index knows how to tell an
+* empty slot and the home slot of an entry. Erase does not leave tombstones:
+* the following entries of the cluster are shifted back into the hole when
+* it lies between their home and their slot, so lookups may stop at the first
+* empty slot.
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_LINEAR_PROBE_HPP
+#define SRC_INCLUDE_LINEAR_PROBE_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <cstddef>
+#include <vector>
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace watch::probe {
+
+/**
+ * @brief store a slot in the first empty slot from home on
+ * @param is_empty - is_empty(slot), the index has at least one empty slot
+ */
+template <typename TSlot, typename TEmpty>
+void Place(std::vector<TSlot>& slots, size_t home, const TSlot& value, TEmpty&& is_empty) {
+  auto mask = slots.size() - 1;
+  auto slot = home;
+  while (!is_empty(slots[slot])) {
+    slot = (slot + 1) & mask;
+  }
+  slots[slot] = value;
+}
+
+/**
+ * @brief remove the slot matching is_target, searched from home on
+ * @param empty - value of an empty slot
+ * @param home_of - home_of(slot), the home slot of an occupied slot
+ */
+template <typename TSlot, typename TTarget, typename TEmpty, typename THome>
+void Erase(std::vector<TSlot>& slots, size_t home, TTarget&& is_target, const TSlot& empty, TEmpty&& is_empty,
+           THome&& home_of) {
+  auto mask = slots.size() - 1;
+  auto hole = home;
+  while (!is_target(slots[hole])) {
+    hole = (hole + 1) & mask;
+  }
+  // backward shift: move up every following entry that may fill the hole
+  for (auto slot = (hole + 1) & mask; !is_empty(slots[slot]); slot = (slot + 1) & mask) {
+    auto entry_home = home_of(slots[slot]);
+    if (((slot - entry_home) & mask) >= ((slot - hole) & mask)) {
+      slots[hole] = slots[slot];
+      hole = slot;
+    }
+  }
+  slots[hole] = empty;
+}
+
+}  // namespace watch::probe
+
+#endif /* SRC_INCLUDE_LINEAR_PROBE_HPP */
@@ -0,0 +1,531 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Process wide metrics registry with Prometheus text exposition.
+* @details Counters and histograms are split per thread: every thread owns a
+* block of slots and only this thread writes it (a relaxed load and store,
+* no lock prefix, no shared cache line). A scrape sums the blocks of all
+* threads plus the values left by exited threads. Gauges are single relaxed
+* atomics. Registration and scraping lock the registry, the hot path never
+* does.
+* @code
+* static const auto events = metrics::Registry::Instance().AddCounter("events_total", "handled events");
+* events.Inc();
+* metrics::Server server;
+* server.ListenTcp(9100);
+* server.Start();  // curl http://127.0.0.1:9100/metrics
+* @endcode
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_METRICS_HPP
+#define SRC_INCLUDE_METRICS_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace metrics {
+
+inline constexpr size_t kMaxSlots = 4096;       ///< counter slots per thread
+inline constexpr size_t kHistogramBuckets = 40;  ///< log2 buckets, the last one is +Inf
+
+/**
+ * @brief counter and histogram values written by one thread
+ */
+class ThreadSlots {
+ public:
+  /**
+   * @brief add to a slot, only the owner thread calls this
+   */
+  void Add(size_t slot, uint64_t value) noexcept {
+    auto& target = m_values[slot];
+    target.store(target.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] uint64_t Get(size_t slot) const noexcept {
+    return m_values[slot].load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::array<std::atomic<uint64_t>, kMaxSlots> m_values{};  ///< values by slot
+};
+
+class Registry;
+
+/**
+ * @brief monotonic counter handle, cheap to copy
+ */
+class Counter {
+ public:
+  Counter() = default;
+  void Inc(uint64_t value = 1) const noexcept;
+
+ private:
+  friend class Registry;
+  explicit Counter(uint32_t slot) noexcept : m_slot(slot) {}
+  uint32_t m_slot{0};  ///< slot in the thread blocks
+};
+
+/**
+ * @brief gauge handle, a value that can go up and down
+ */
+class Gauge {
+ public:
+  Gauge() = default;
+  void Set(int64_t value) const noexcept {
+    m_value->store(value, std::memory_order_relaxed);
+  }
+  void Add(int64_t value = 1) const noexcept {
+    m_value->fetch_add(value, std::memory_order_relaxed);
+  }
+  void Sub(int64_t value = 1) const noexcept {
+    m_value->fetch_sub(value, std::memory_order_relaxed);
+  }
+
+ private:
+  friend class Registry;
+  explicit Gauge(std::atomic<int64_t>* value) noexcept : m_value(value) {}
+  std::atomic<int64_t>* m_value{nullptr};  ///< owned by the registry
+};
+
+/**
+ * @brief histogram handle with power of two buckets
+ * @details values are integers (e.g. nanoseconds), the registry scales them for the exposition
+ */
+class Histogram {
+ public:
+  Histogram() = default;
+  void Observe(uint64_t value) const noexcept;
+
+  /**
+   * @brief observe the time since start in nanoseconds
+   */
+  void ObserveSince(std::chrono::steady_clock::time_point start) const noexcept {
+    Observe(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+  }
+
+ private:
+  friend class Registry;
+  explicit Histogram(uint32_t slot) noexcept : m_slot(slot) {}
+  uint32_t m_slot{0};  ///< first slot: buckets, then sum and count
+};
+
+/**
+ * @brief registry of all metrics of the process
+ */
+class Registry {
+ public:
+  /**
+   * @brief get the process wide registry
+   */
+  static Registry& Instance() {
+    static Registry registry;
+    return registry;
+  }
+
+  /**
+   * @brief register a counter, an already registered name and labels return the same counter
+   * @param name - metric name, e.g. fswatch_events_total
+   * @param help - description
+   * @param labels - label list without braces, e.g. type="file_created"
+   */
+  Counter AddCounter(const std::string& name, const std::string& help, const std::string& labels = {}) {
+    std::lock_guard lck(m_mutex);
+    return Counter(static_cast<uint32_t>(Find(Kind::Counter, name, help, labels, 1).slot));
+  }
+
+  Gauge AddGauge(const std::string& name, const std::string& help, const std::string& labels = {}) {
+    std::lock_guard lck(m_mutex);
+    return Gauge(Find(Kind::Gauge, name, help, labels, 0).gauge);
+  }
+
+  /**
+   * @brief register a histogram
+   * @param scale - factor from the observed unit to the exposed one, 1e-9 for nanoseconds exposed as seconds
+   */
+  Histogram AddHistogram(const std::string& name, const std::string& help, const std::string& labels = {},
+                         double scale = 1e-9) {
+    std::lock_guard lck(m_mutex);
+    auto& series = Find(Kind::Histogram, name, help, labels, kHistogramBuckets + 2);
+    series.scale = scale;
+    return Histogram(static_cast<uint32_t>(series.slot));
+  }
+
+  /**
+   * @brief slots of the calling thread, created on first use
+   */
+  ThreadSlots& Slots() {
+    thread_local SlotsOwner owner(*this);
+    return *owner.slots;
+  }
+
+  /**
+   * @brief Prometheus text exposition format 0.0.4 of all metrics
+   */
+  std::string Expose() {
+    std::lock_guard lck(m_mutex);
+    std::string text;
+    std::vector<bool> written(m_series.size(), false);
+    for (size_t i = 0; i < m_series.size(); ++i) {
+      if (written[i]) {
+        continue;
+      }
+      const auto& family = m_series[i];
+      text += "# HELP " + family.name + " " + family.help + "\n";
+      text += "# TYPE " + family.name + " " + TypeName(family.kind) + "\n";
+      // all series of a family follow its header
+      for (size_t j = i; j < m_series.size(); ++j) {
+        if (!written[j] && m_series[j].name == family.name) {
+          written[j] = true;
+          ExposeSeries(m_series[j], text);
+        }
+      }
+    }
+    return text;
+  }
+
+ private:
+  enum class Kind : uint8_t { Counter, Gauge, Histogram };
+
+  struct Series {
+    Kind kind;
+    std::string name;
+    std::string help;
+    std::string labels;
+    size_t slot{0};                        ///< first slot of counters and histograms
+    std::atomic<int64_t>* gauge{nullptr};  ///< value of gauges
+    double scale{1.0};                     ///< histogram unit scale
+  };
+
+  /**
+   * @brief registers the thread slots and keeps the values when the thread exits
+   */
+  struct SlotsOwner {
+    Registry& registry;
+    std::unique_ptr<ThreadSlots> slots{std::make_unique<ThreadSlots>()};
+
+    explicit SlotsOwner(Registry& registry) : registry(registry) {
+      std::lock_guard lck(registry.m_mutex);
+      registry.m_threads.push_back(slots.get());
+    }
+    ~SlotsOwner() {
+      std::lock_guard lck(registry.m_mutex);
+      for (size_t slot = 0; slot < registry.m_next_slot; ++slot) {
+        registry.m_retired[slot] += slots->Get(slot);
+      }
+      std::erase(registry.m_threads, slots.get());
+    }
+  };
+
+  Registry() = default;
+
+  Series& Find(Kind kind, const std::string& name, const std::string& help, const std::string& labels,
+               size_t slots) {
+    for (auto& series : m_series) {
+      if (series.name == name && series.labels == labels) {
+        if (series.kind != kind) {
+          throw std::invalid_argument("metrics: " + name + " registered with another type");
+        }
+        return series;
+      }
+    }
+    if (m_next_slot + slots > kMaxSlots) {
+      throw std::length_error("metrics: out of slots for " + name);
+    }
+    auto& series = m_series.emplace_back(Series{kind, name, help, labels});
+    series.slot = m_next_slot;
+    m_next_slot += slots;
+    if (kind == Kind::Gauge) {
+      series.gauge = &m_gauges.emplace_back(0);
+    }
+    return series;
+  }
+
+  [[nodiscard]] uint64_t Sum(size_t slot) const noexcept {
+    auto value = m_retired[slot];
+    for (const auto* thread : m_threads) {
+      value += thread->Get(slot);
+    }
+    return value;
+  }
+
+  static const char* TypeName(Kind kind) noexcept {
+    switch (kind) {
+      case Kind::Counter:
+        return "counter";
+      case Kind::Gauge:
+        return "gauge";
+      default:
+        return "histogram";
+    }
+  }
+
+  static std::string Labels(const std::string& labels, const std::string& extra = {}) {
+    if (labels.empty() && extra.empty()) {
+      return {};
+    }
+    return "{" + labels + (labels.empty() || extra.empty() ? "" : ",") + extra + "}";
+  }
+
+  static std::string Number(double value) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.9g", value);
+    return text;
+  }
+
+  void ExposeSeries(const Series& series, std::string& text) const {
+    switch (series.kind) {
+      case Kind::Counter:
+        text += series.name + Labels(series.labels) + " " + std::to_string(Sum(series.slot)) + "\n";
+        break;
+      case Kind::Gauge:
+        text += series.name + Labels(series.labels) + " " +
+                std::to_string(series.gauge->load(std::memory_order_relaxed)) + "\n";
+        break;
+      case Kind::Histogram: {
+        uint64_t cumulative = 0;
+        for (size_t bucket = 0; bucket < kHistogramBuckets; ++bucket) {
+          cumulative += Sum(series.slot + bucket);
+          auto le = bucket + 1 == kHistogramBuckets ? std::string("+Inf")
+                                                    : Number(static_cast<double>(1ULL << bucket) * series.scale);
+          text += series.name + "_bucket" + Labels(series.labels, "le=\"" + le + "\"") + " " +
+                  std::to_string(cumulative) + "\n";
+        }
+        text += series.name + "_sum" + Labels(series.labels) + " " +
+                Number(static_cast<double>(Sum(series.slot + kHistogramBuckets)) * series.scale) + "\n";
+        text += series.name + "_count" + Labels(series.labels) + " " +
+                std::to_string(Sum(series.slot + kHistogramBuckets + 1)) + "\n";
+        break;
+      }
+    }
+  }
+
+  std::mutex m_mutex;                               ///< registration, scraping, thread lifetime
+  std::vector<Series> m_series;                     ///< registered metrics in registration order
+  std::deque<std::atomic<int64_t>> m_gauges;        ///< gauge values, stable addresses
+  std::vector<ThreadSlots*> m_threads;              ///< slots of the running threads
+  std::array<uint64_t, kMaxSlots> m_retired{};      ///< values of exited threads
+  size_t m_next_slot{0};                            ///< first free slot
+};
+
+inline void Counter::Inc(uint64_t value) const noexcept {
+  Registry::Instance().Slots().Add(m_slot, value);
+}
+
+inline void Histogram::Observe(uint64_t value) const noexcept {
+  // bucket i counts values <= 2^i
+  auto bucket = std::min<size_t>(value <= 1 ? 0 : std::bit_width(value - 1), kHistogramBuckets - 1);
+  auto& slots = Registry::Instance().Slots();
+  slots.Add(m_slot + bucket, 1);
+  slots.Add(m_slot + kHistogramBuckets, value);
+  slots.Add(m_slot + kHistogramBuckets + 1, 1);
+}
+
+/**
+ * @brief minimal HTTP/1.0 server for the exposition on localhost TCP and/or a unix socket
+ * @details every request gets the metrics (GET /metrics, also GET /), everything else 404. One thread
+ * serves the listeners one connection after the other, this is enough for scrapers.
+ */
+class Server {
+ public:
+  explicit Server(Registry& registry = Registry::Instance()) : m_registry(registry) {}
+
+  Server(const Server&) = delete;
+  Server& operator=(const Server&) = delete;
+
+  ~Server() {
+    Stop();
+    for (auto fd : m_listeners) {
+      ::close(fd);
+    }
+    if (!m_unix_path.empty()) {
+      ::unlink(m_unix_path.c_str());
+    }
+  }
+
+  /**
+   * @brief listen on a TCP port
+   * @param port - port, 0 for any free port
+   * @param address - IPv4 address, localhost by default
+   * @return bound port
+   */
+  uint16_t ListenTcp(uint16_t port, const std::string& address = "127.0.0.1") {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      throw std::system_error(errno, std::generic_category(), "metrics: socket");
+    }
+    int reuse = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in socket_address{};
+    socket_address.sin_family = AF_INET;
+    socket_address.sin_port = htons(port);
+    if (::inet_pton(AF_INET, address.c_str(), &socket_address.sin_addr) != 1) {
+      ::close(fd);
+      throw std::invalid_argument("metrics: invalid address " + address);
+    }
+    Listen(fd, reinterpret_cast<sockaddr*>(&socket_address), sizeof(socket_address));
+    socklen_t length = sizeof(socket_address);
+    ::getsockname(fd, reinterpret_cast<sockaddr*>(&socket_address), &length);
+    return ntohs(socket_address.sin_port);
+  }
+
+  /**
+   * @brief listen on a unix socket, an existing socket file is replaced
+   */
+  void ListenUnix(const std::string& path) {
+    sockaddr_un socket_address{};
+    if (path.size() >= sizeof(socket_address.sun_path)) {
+      throw std::invalid_argument("metrics: socket path too long " + path);
+    }
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      throw std::system_error(errno, std::generic_category(), "metrics: socket");
+    }
+    socket_address.sun_family = AF_UNIX;
+    std::strncpy(socket_address.sun_path, path.c_str(), sizeof(socket_address.sun_path) - 1);
+    ::unlink(path.c_str());
+    Listen(fd, reinterpret_cast<sockaddr*>(&socket_address), sizeof(socket_address));
+    m_unix_path = path;
+  }
+
+  /**
+   * @brief serve the listeners in a background thread
+   */
+  void Start() {
+    if (m_thread.joinable()) {
+      return;
+    }
+    m_wakeup = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_wakeup < 0) {
+      throw std::system_error(errno, std::generic_category(), "metrics: eventfd");
+    }
+    m_thread = std::jthread([this](std::stop_token token) { Serve(token); });
+  }
+
+  void Stop() {
+    if (!m_thread.joinable()) {
+      return;
+    }
+    m_thread.request_stop();
+    uint64_t one = 1;
+    [[maybe_unused]] auto written = ::write(m_wakeup, &one, sizeof(one));
+    m_thread.join();
+    ::close(m_wakeup);
+    m_wakeup = -1;
+  }
+
+ private:
+  void Listen(int fd, const sockaddr* address, socklen_t length) {
+    if (::bind(fd, address, length) != 0 || ::listen(fd, 16) != 0) {
+      auto error = errno;
+      ::close(fd);
+      throw std::system_error(error, std::generic_category(), "metrics: bind");
+    }
+    m_listeners.push_back(fd);
+  }
+
+  void Serve(std::stop_token token) {
+    std::vector<pollfd> fds;
+    fds.push_back({m_wakeup, POLLIN, 0});
+    for (auto fd : m_listeners) {
+      fds.push_back({fd, POLLIN, 0});
+    }
+    while (!token.stop_requested()) {
+      if (::poll(fds.data(), fds.size(), -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+      for (size_t i = 1; i < fds.size(); ++i) {
+        if (fds[i].revents & POLLIN) {
+          if (int client = ::accept4(fds[i].fd, nullptr, nullptr, SOCK_CLOEXEC); client >= 0) {
+            Respond(client);
+            ::close(client);
+          }
+        }
+      }
+    }
+  }
+
+  void Respond(int client) {
+    // read the request head, give up on slow clients
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+      pollfd fd{client, POLLIN, 0};
+      if (::poll(&fd, 1, 1000) <= 0) {
+        return;
+      }
+      auto length = ::read(client, buffer, sizeof(buffer));
+      if (length <= 0) {
+        break;
+      }
+      request.append(buffer, static_cast<size_t>(length));
+    }
+    std::string status = "200 OK";
+    std::string body;
+    if (request.starts_with("GET /metrics") || request.starts_with("GET / ")) {
+      body = m_registry.Expose();
+    } else {
+      status = "404 Not Found";
+      body = "not found\n";
+    }
+    auto response = "HTTP/1.0 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                    std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    for (size_t sent = 0; sent < response.size();) {
+      auto length = ::send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+      if (length <= 0) {
+        return;
+      }
+      sent += static_cast<size_t>(length);
+    }
+  }
+
+  Registry& m_registry;             ///< exposed registry
+  std::vector<int> m_listeners;     ///< listening sockets
+  std::string m_unix_path;          ///< unix socket file, removed on destruction
+  int m_wakeup{-1};                 ///< eventfd stopping the server thread
+  std::jthread m_thread;            ///< server thread
+};
+
+}  // namespace metrics
+
+#endif /* SRC_INCLUDE_METRICS_HPP */
@@ -0,0 +1,266 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "fswatch.hpp"
+
+#ifdef __linux__
+// Splits the watched trees over several fswatch instances, each with its own
+// inotify fd and reader thread, so decoding and dispatch use more than one
+// core:
+//
+//   parallel_fswatch watcher({"/srv/build"}, 4);
+//   watcher.on(fswatch::Event::FILE_MODIFIED, handler);
+//   watcher.run_async();
+//
+// The sub directories of every root are scanned once and assigned to the
+// instances by subtree size, largest first to the least loaded instance.
+// A root itself goes to the least loaded instance as well, it follows the
+// sub directories created later. All events of one path come from one
+// instance, so they keep their order.
+// By default the callbacks run on the reader threads and must be thread
+// safe. With ordered = true the readers only queue the events and the thread
+// running start() calls the callbacks from one merged stream: events of a
+// path in order, events of different paths in arrival order.
+//
+class parallel_fswatch {
+ public:
+  parallel_fswatch(const std::vector<std::string> &roots, size_t instances,
+                   bool ordered = false)
+      : ordered(ordered) {
+    partition(roots, std::max<size_t>(1, instances));
+  }
+
+  parallel_fswatch(const parallel_fswatch &) = delete;
+  parallel_fswatch &operator=(const parallel_fswatch &) = delete;
+
+  ~parallel_fswatch() {
+    if (worker.joinable()) {
+      worker.request_stop();
+      worker.join();
+    }
+    join_threads();
+  }
+
+  // Register a callback on every instance. Call before start().
+  void on(const fswatch::Event &event,
+          const std::function<void(const fswatch::EventInfo &)> &action) {
+    callbacks[event] = action;
+    for (auto &watcher : watchers) {
+      if (ordered) {
+        watcher->on(event, [this](const fswatch::EventInfo &info) { push(info); });
+      } else {
+        watcher->on(event, action);
+      }
+    }
+  }
+
+  void on(const std::vector<fswatch::Event> &events,
+          const std::function<void(const fswatch::EventInfo &)> &action) {
+    for (auto &event : events) {
+      on(event, action);
+    }
+  }
+
+  // number of inotify instances and reader threads
+  size_t instances() const { return watchers.size(); }
+
+  // roots watched by one instance
+  const std::vector<std::filesystem::path> &roots(size_t instance) const {
+    return partitions[instance];
+  }
+
+  // scanned size of the subtrees of one instance
+  uint64_t load(size_t instance) const { return loads[instance]; }
+
+  // Sum of the counters of all instances.
+  fswatch::Counters counters() const {
+    fswatch::Counters sum{};
+    for (auto &watcher : watchers) {
+      auto counters = watcher->counters();
+      sum.events_read += counters.events_read;
+      sum.file_events += counters.file_events;
+      sum.dir_events += counters.dir_events;
+      sum.callbacks += counters.callbacks;
+      sum.overflows += counters.overflows;
+      sum.watches += counters.watches;
+      sum.scanned += counters.scanned;
+    }
+    return sum;
+  }
+
+  // Run the readers until a stop is requested on token or one of them
+  // fails; the error is rethrown. In ordered mode this thread runs the
+  // callbacks, one that throws ends it like a failed reader; otherwise it
+  // only waits.
+  void start(std::stop_token token) {
+    std::stop_source stop;
+    std::stop_callback forward(token, [&stop]() { stop.request_stop(); });
+    error = nullptr;
+    for (auto &watcher : watchers) {
+      readers.emplace_back([this, &stop, watcher = watcher.get()](std::stop_token reader) {
+        try {
+          watcher->start(reader);
+        } catch (...) {
+          std::lock_guard lock(mutex);
+          if (!error) {
+            error = std::current_exception();
+          }
+          stop.request_stop();
+        }
+      });
+    }
+
+    std::unique_lock lock(mutex);
+    while (!stop.stop_requested()) {
+      if (!ready.wait(lock, stop.get_token(), [this]() { return !merged.empty(); })) {
+        break;
+      }
+      // run the callbacks outside of the lock, readers keep queueing
+      auto batch = std::move(merged);
+      merged.clear();
+      lock.unlock();
+      try {
+        for (auto &event : batch) {
+          if (auto callback = callbacks.find(event.type); callback != callbacks.end()) {
+            callback->second(event);
+          }
+        }
+      } catch (...) {
+        // the readers refer to stop, they are joined before leaving
+        lock.lock();
+        if (!error) {
+          error = std::current_exception();
+        }
+        stop.request_stop();
+        break;
+      }
+      lock.lock();
+    }
+    lock.unlock();
+
+    join_threads();
+    if (auto failed = std::exchange(error, nullptr)) {
+      std::rethrow_exception(failed);
+    }
+  }
+
+  // Run start() on an owned std::jthread, see fswatch::run_async().
+  void run_async() {
+    worker = std::jthread([this](std::stop_token token) {
+      try {
+        start(token);
+      } catch (...) {
+        async_error = std::current_exception();
+      }
+    });
+  }
+
+  // Stop run_async() and wait for it. Rethrows the error of a reader.
+  void join() {
+    if (worker.joinable()) {
+      worker.request_stop();
+      worker.join();
+    }
+    if (auto failed = std::exchange(async_error, nullptr)) {
+      std::rethrow_exception(failed);
+    }
+  }
+
+ private:
+  // Count the entries below a directory, the weight of its subtree.
+  static uint64_t subtree_size(const std::filesystem::path &dir) {
+    uint64_t size = 1;
+    std::error_code ec;
+    for (auto it = std::filesystem::recursive_directory_iterator(
+             dir, std::filesystem::directory_options::skip_permission_denied, ec);
+         !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+      size++;
+    }
+    return size;
+  }
+
+  void partition(const std::vector<std::string> &paths, size_t instances) {
+    struct unit {
+      std::filesystem::path path;
+      uint64_t size;
+    };
+    std::vector<unit> units;
+    for (auto &path : paths) {
+      std::error_code ec;
+      uint64_t files = 1;
+      std::vector<unit> subtrees;
+      for (auto &entry : std::filesystem::directory_iterator(path, ec)) {
+        if (entry.is_directory(ec) && !entry.is_symlink(ec)) {
+          subtrees.push_back({entry.path(), subtree_size(entry.path())});
+        } else {
+          files++;
+        }
+      }
+      units.push_back({path, files});
+      units.insert(units.end(), subtrees.begin(), subtrees.end());
+    }
+    // largest subtree first onto the least loaded instance
+    std::stable_sort(units.begin(), units.end(),
+                     [](const unit &l, const unit &r) { return l.size > r.size; });
+    instances = std::min(instances, units.size());
+    partitions.assign(instances, {});
+    loads.assign(instances, 0);
+    for (auto &unit : units) {
+      auto least = std::min_element(loads.begin(), loads.end()) - loads.begin();
+      partitions[least].push_back(unit.path);
+      loads[least] += unit.size;
+    }
+    for (auto &roots : partitions) {
+      auto watcher = std::make_unique<fswatch>();
+      for (auto &root : roots) {
+        watcher->append_to_path(root.string());
+      }
+      watchers.push_back(std::move(watcher));
+    }
+  }
+
+  void push(const fswatch::EventInfo &event) {
+    {
+      std::lock_guard lock(mutex);
+      merged.push_back(event);
+    }
+    ready.notify_one();
+  }
+
+  void join_threads() {
+    for (auto &reader : readers) {
+      reader.request_stop();
+    }
+    readers.clear();
+  }
+
+  bool ordered;
+  std::vector<std::vector<std::filesystem::path>> partitions;
+  std::vector<uint64_t> loads;
+  std::vector<std::unique_ptr<fswatch>> watchers;
+  std::map<fswatch::Event, std::function<void(const fswatch::EventInfo &)>> callbacks;
+
+  // Merged stream of the ordered mode
+  std::mutex mutex;
+  std::condition_variable_any ready;
+  std::deque<fswatch::EventInfo> merged;
+  std::exception_ptr error;
+
+  std::vector<std::jthread> readers;
+  std::exception_ptr async_error;
+  std::jthread worker;
+};
+#endif
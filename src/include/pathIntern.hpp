@@ -0,0 +1,302 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief String interning pool and per-batch arena for watcher paths.
+* @details InternPool keeps every distinct name once, reference counted, and
+* hands out small ids. The characters live in large chunks, so a name costs
+* its length plus a table entry instead of a heap string per copy. Released
+* names are reclaimed by Compact(), which the owner calls at a point where
+* no views are held.
+* PathArena is a monotonic buffer for strings that only live while one read
+* batch is dispatched. Reset() makes the whole buffer available again without
+* freeing it; a batch that overflowed it to the heap grows it, so it starts
+* small and settles at the largest batch.
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_PATH_INTERN_HPP
+#define SRC_INCLUDE_PATH_INTERN_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "linearProbe.hpp"
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace watch {
+
+/**
+ * @brief reference counted pool of distinct strings
+ */
+class InternPool {
+ public:
+  using Id = uint32_t;
+  static constexpr Id kNone = UINT32_MAX;
+
+  InternPool() = default;
+  InternPool(const InternPool&) = delete;
+  InternPool& operator=(const InternPool&) = delete;
+
+  /**
+   * @brief get the id of a string, add it if new, and take a reference
+   */
+  Id Intern(std::string_view text) {
+    auto hash = Hash(text);
+    if (auto id = Find(text, hash); id != kNone) {
+      m_entries[id].references++;
+      return id;
+    }
+    Id id;
+    if (!m_free.empty()) {
+      id = m_free.back();
+      m_free.pop_back();
+    } else {
+      id = static_cast<Id>(m_entries.size());
+      m_entries.emplace_back();
+    }
+    if ((m_count + 1) * 2 > m_slots.size()) {
+      Rehash(std::max<size_t>(16, m_slots.size() * 2));
+    }
+    m_entries[id] = Entry{Store(text), hash, 1};
+    Place(id);
+    m_count++;
+    m_live_bytes += text.size();
+    return id;
+  }
+
+  /**
+   * @brief id of a string without taking a reference, kNone if it is not in the pool
+   */
+  [[nodiscard]] Id Find(std::string_view text) const {
+    return Find(text, Hash(text));
+  }
+
+  /**
+   * @brief drop a reference, the string is removed with the last one
+   */
+  void Release(Id id) {
+    auto& entry = m_entries[id];
+    if (--entry.references == 0) {
+      Remove(id);
+      m_count--;
+      m_live_bytes -= entry.text.size();
+      m_dead_bytes += entry.text.size();
+      entry.text = {};
+      m_free.push_back(id);
+    }
+  }
+
+  /**
+   * @brief the string of an id, valid until it is released or the pool is compacted
+   */
+  [[nodiscard]] std::string_view View(Id id) const noexcept {
+    return m_entries[id].text;
+  }
+
+  /**
+   * @brief number of distinct strings
+   */
+  [[nodiscard]] size_t Size() const noexcept {
+    return m_count;
+  }
+
+  /**
+   * @brief bytes of the live strings
+   */
+  [[nodiscard]] size_t Bytes() const noexcept {
+    return m_live_bytes;
+  }
+
+  /**
+   * @brief copy the live strings into fresh chunks if most of the stored bytes are released
+   * @details ids stay the same, views taken before are invalidated
+   * @return true if compacted
+   */
+  bool Compact() {
+    if (m_dead_bytes < kChunkSize || m_dead_bytes < m_live_bytes) {
+      return false;
+    }
+    auto chunks = std::move(m_chunks);
+    auto large = std::move(m_large);
+    m_chunks.clear();
+    m_large.clear();
+    m_used = kChunkSize;
+    m_dead_bytes = 0;
+    // the index holds ids and hashes only, it stays valid
+    for (auto& entry : m_entries) {
+      if (entry.references > 0) {
+        entry.text = Store(entry.text);
+      }
+    }
+    return true;
+  }
+
+ private:
+  static constexpr size_t kChunkSize = 64 * 1024;
+
+  struct Entry {
+    std::string_view text;   ///< characters in a chunk
+    uint32_t hash{0};        ///< hash of text, the index is rebuilt from it
+    uint32_t references{0};  ///< 0 - free slot
+  };
+
+  static uint32_t Hash(std::string_view text) noexcept {
+    return static_cast<uint32_t>(std::hash<std::string_view>{}(text));
+  }
+
+  [[nodiscard]] size_t Home(Id id) const noexcept {
+    return m_entries[id].hash & (m_slots.size() - 1);
+  }
+
+  [[nodiscard]] Id Find(std::string_view text, uint32_t hash) const {
+    if (m_slots.empty()) {
+      return kNone;
+    }
+    auto mask = m_slots.size() - 1;
+    for (auto slot = hash & mask; m_slots[slot] != kNone; slot = (slot + 1) & mask) {
+      const auto& entry = m_entries[m_slots[slot]];
+      if (entry.hash == hash && entry.text == text) {
+        return m_slots[slot];
+      }
+    }
+    return kNone;
+  }
+
+  static bool IsEmpty(Id slot) noexcept {
+    return slot == kNone;
+  }
+
+  void Place(Id id) {
+    probe::Place(m_slots, Home(id), id, IsEmpty);
+  }
+
+  void Remove(Id id) {
+    probe::Erase(
+        m_slots, Home(id), [id](Id slot) { return slot == id; }, kNone, IsEmpty,
+        [this](Id slot) { return Home(slot); });
+  }
+
+  void Rehash(size_t slots) {
+    m_slots.assign(slots, kNone);
+    for (Id id = 0; id < m_entries.size(); ++id) {
+      if (m_entries[id].references > 0) {
+        Place(id);
+      }
+    }
+  }
+
+  std::string_view Store(std::string_view text) {
+    // oversized strings get a chunk of their own, the current one stays open
+    if (text.size() > kChunkSize / 4) {
+      auto& chunk = m_large.emplace_back(std::make_unique<char[]>(text.size()));
+      std::memcpy(chunk.get(), text.data(), text.size());
+      return {chunk.get(), text.size()};
+    }
+    if (text.size() > kChunkSize - m_used) {
+      m_chunks.emplace_back(std::make_unique<char[]>(kChunkSize));
+      m_used = 0;
+    }
+    auto* target = m_chunks.back().get() + m_used;
+    std::memcpy(target, text.data(), text.size());
+    m_used += text.size();
+    return {target, text.size()};
+  }
+
+  std::vector<std::unique_ptr<char[]>> m_chunks;  ///< character storage, the last one is filled
+  std::vector<std::unique_ptr<char[]>> m_large;   ///< storage of oversized strings
+  size_t m_used{kChunkSize};                      ///< bytes used in the last chunk
+  std::vector<Entry> m_entries;                   ///< strings by id
+  std::vector<Id> m_free;                         ///< released ids
+  std::vector<Id> m_slots;                        ///< open addressing index of the ids, linear probing
+  size_t m_count{0};                              ///< number of live strings
+  size_t m_live_bytes{0};                         ///< bytes of referenced strings
+  size_t m_dead_bytes{0};                         ///< bytes of released strings still in chunks
+};
+
+/**
+ * @brief monotonic arena for the strings of one read batch
+ */
+class PathArena {
+ public:
+  /**
+   * @param initial - buffer bytes, allocated but not touched until used
+   */
+  explicit PathArena(size_t initial = 64 * 1024)
+      : m_size(initial), m_buffer(std::make_unique_for_overwrite<std::byte[]>(initial)) {
+    m_resource.emplace(m_buffer.get(), m_size);
+  }
+
+  PathArena(const PathArena&) = delete;
+  PathArena& operator=(const PathArena&) = delete;
+
+  /**
+   * @brief reserve characters for a string of size length plus a terminating zero
+   */
+  [[nodiscard]] char* Allocate(size_t length) {
+    m_used += length + 1;
+    return static_cast<char*>(m_resource->allocate(length + 1, 1));
+  }
+
+  /**
+   * @brief join parts with a separator into one zero terminated string
+   */
+  [[nodiscard]] std::string_view Join(std::string_view head, char separator, std::string_view tail) {
+    auto length = head.size() + 1 + tail.size();
+    auto* text = Allocate(length);
+    std::memcpy(text, head.data(), head.size());
+    text[head.size()] = separator;
+    std::memcpy(text + head.size() + 1, tail.data(), tail.size());
+    text[length] = '\0';
+    return {text, length};
+  }
+
+  /**
+   * @brief release all strings at once, the buffer is kept or grown to what they needed
+   */
+  void Reset() {
+    m_resource->release();
+    if (m_used > m_size) {
+      m_resource.reset();
+      m_size = std::bit_ceil(m_used);
+      m_buffer = std::make_unique_for_overwrite<std::byte[]>(m_size);
+      m_resource.emplace(m_buffer.get(), m_size);
+    }
+    m_used = 0;
+  }
+
+  /**
+   * @brief bytes of the buffer
+   */
+  [[nodiscard]] size_t Capacity() const noexcept {
+    return m_size;
+  }
+
+ private:
+  size_t m_size;                                                 ///< bytes of the buffer
+  size_t m_used{0};                                              ///< bytes allocated since the last Reset()
+  std::unique_ptr<std::byte[]> m_buffer;                         ///< buffer, overflow goes to the heap
+  std::optional<std::pmr::monotonic_buffer_resource> m_resource;  ///< bump allocator on the buffer
+};
+
+}  // namespace watch
+
+#endif /* SRC_INCLUDE_PATH_INTERN_HPP */
@@ -0,0 +1,312 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Routing index from path prefixes to the contexts owning the subtrees.
+* @details A context registers the directory it owns, it gets the events of
+* the directory and of everything below it. The prefixes are kept in one
+* open addressing table keyed by a hash of the whole prefix. A lookup walks
+* the event path once: the FNV-1a hash is extended character by character,
+* so at every '/' the hash of the prefix up to it is at hand and one probe
+* tells whether somebody owns it. Prefix lengths nobody registered are not
+* probed at all. A lookup costs O(depth) probes and allocates nothing.
+* Registration and removal take the lock exclusively, lookups share it, so
+* contexts may come and go while events are routed.
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_PATH_ROUTER_HPP
+#define SRC_INCLUDE_PATH_ROUTER_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "linearProbe.hpp"
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace watch {
+
+/**
+ * @brief maps directories to the ids of the contexts owning them
+ * @details paths are compared as given, without resolving links or "..";
+ * trailing slashes of a registered directory are ignored, "/" owns every path.
+ */
+class PathRouter {
+ public:
+  using ContextId = uint32_t;
+
+  PathRouter() = default;
+  PathRouter(const PathRouter&) = delete;
+  PathRouter& operator=(const PathRouter&) = delete;
+
+  /**
+   * @brief route the events of a directory and its subtree to a context
+   * @return false if the context owns the directory already
+   */
+  bool Add(std::string_view directory, ContextId context) {
+    auto prefix = Normalize(directory);
+    auto hash = Hash(prefix);
+    std::unique_lock lock(m_mutex);
+    if (auto index = Find(prefix, hash); index != kNone) {
+      auto& entry = m_entries[index];
+      if (entry.owner == context || std::find(entry.more.begin(), entry.more.end(), context) != entry.more.end()) {
+        return false;
+      }
+      entry.more.push_back(context);
+      m_routes++;
+      return true;
+    }
+    if ((m_count + 1) * 4 > m_slots.size() * 3) {
+      Rehash(std::max<size_t>(64, m_slots.size() * 2));
+    }
+    uint32_t index;
+    if (!m_free.empty()) {
+      index = m_free.back();
+      m_free.pop_back();
+    } else {
+      index = static_cast<uint32_t>(m_entries.size());
+      m_entries.emplace_back();
+    }
+    auto& entry = m_entries[index];
+    entry.hash = hash;
+    entry.offset = static_cast<uint32_t>(m_chars.size());
+    entry.length = static_cast<uint32_t>(prefix.size());
+    entry.owner = context;
+    m_chars.append(prefix);
+    Place(index);
+    if (prefix.size() >= m_lengths.size()) {
+      m_lengths.resize(prefix.size() + 1, 0);
+    }
+    m_lengths[prefix.size()]++;
+    m_count++;
+    m_routes++;
+    return true;
+  }
+
+  /**
+   * @brief stop routing the events of a directory to a context
+   * @return false if the context did not own the directory
+   */
+  bool Remove(std::string_view directory, ContextId context) {
+    auto prefix = Normalize(directory);
+    auto hash = Hash(prefix);
+    std::unique_lock lock(m_mutex);
+    auto index = Find(prefix, hash);
+    if (index == kNone) {
+      return false;
+    }
+    auto& entry = m_entries[index];
+    if (entry.owner != context) {
+      auto owner = std::find(entry.more.begin(), entry.more.end(), context);
+      if (owner == entry.more.end()) {
+        return false;
+      }
+      entry.more.erase(owner);
+    } else if (!entry.more.empty()) {
+      entry.owner = entry.more.front();
+      entry.more.erase(entry.more.begin());
+    } else {
+      Erase(index);
+      entry.owner = kNone;
+      m_lengths[prefix.size()]--;
+      m_free.push_back(index);
+      m_count--;
+      m_dead_chars += prefix.size();
+      if (m_dead_chars > 64 * 1024 && m_dead_chars * 2 > m_chars.size()) {
+        Compact();
+      }
+    }
+    m_routes--;
+    return true;
+  }
+
+  /**
+   * @brief call fn(context) for every context owning the path, the owners of
+   * the outer directories first
+   * @details fn runs under the shared lock and must not call Add() or Remove()
+   * @return number of calls
+   */
+  template <typename TFn>
+  size_t Route(std::string_view path, TFn&& fn) const {
+    std::shared_lock lock(m_mutex);
+    if (m_count == 0) {
+      return 0;
+    }
+    size_t routed = 0;
+    auto visit = [&](size_t length, uint64_t hash) {
+      if (length < m_lengths.size() && m_lengths[length] != 0) {
+        if (auto index = Find(path.substr(0, length), hash); index != kNone) {
+          const auto& entry = m_entries[index];
+          fn(entry.owner);
+          for (auto context : entry.more) {
+            fn(context);
+          }
+          routed += 1 + entry.more.size();
+        }
+      }
+    };
+    // "/" is stored as the empty prefix
+    visit(0, kOffset);
+    auto hash = kOffset;
+    for (size_t i = 0; i < path.size(); ++i) {
+      if (path[i] == '/' && i > 0) {
+        visit(i, hash);
+      }
+      hash = Step(hash, path[i]);
+    }
+    if (!path.empty() && path.back() != '/') {
+      visit(path.size(), hash);
+    }
+    return routed;
+  }
+
+  /**
+   * @brief number of registered directories
+   */
+  [[nodiscard]] size_t Size() const {
+    std::shared_lock lock(m_mutex);
+    return m_count;
+  }
+
+  /**
+   * @brief number of directory and context pairs
+   */
+  [[nodiscard]] size_t Routes() const {
+    std::shared_lock lock(m_mutex);
+    return m_routes;
+  }
+
+ private:
+  static constexpr uint32_t kNone = UINT32_MAX;
+  static constexpr uint64_t kOffset = 14695981039346656037ull;
+  static constexpr uint64_t kPrime = 1099511628211ull;
+
+  struct Slot {
+    uint32_t tag{0};       ///< high half of the hash, most mismatches end here
+    uint32_t index{kNone}; ///< entry, kNone - empty slot
+  };
+
+  struct Entry {
+    uint64_t hash{0};               ///< Hash(prefix)
+    uint32_t offset{0};             ///< prefix characters in m_chars
+    uint32_t length{0};             ///< prefix length
+    ContextId owner{kNone};         ///< first owner, kNone - free entry
+    std::vector<ContextId> more;    ///< further owners, usually none
+  };
+
+  static constexpr uint64_t Step(uint64_t hash, char c) noexcept {
+    return (hash ^ static_cast<unsigned char>(c)) * kPrime;
+  }
+
+  static uint64_t Hash(std::string_view text) noexcept {
+    auto hash = kOffset;
+    for (auto c : text) {
+      hash = Step(hash, c);
+    }
+    return hash;
+  }
+
+  static std::string_view Normalize(std::string_view directory) noexcept {
+    while (!directory.empty() && directory.back() == '/') {
+      directory.remove_suffix(1);
+    }
+    return directory;
+  }
+
+  [[nodiscard]] size_t Home(uint64_t hash) const noexcept {
+    // the low bits of FNV-1a are weak for short common prefixes, fold them
+    return (hash ^ (hash >> 32)) & (m_slots.size() - 1);
+  }
+
+  static constexpr uint32_t Tag(uint64_t hash) noexcept {
+    return static_cast<uint32_t>(hash >> 32);
+  }
+
+  [[nodiscard]] uint32_t Find(std::string_view prefix, uint64_t hash) const {
+    if (m_slots.empty()) {
+      return kNone;
+    }
+    auto mask = m_slots.size() - 1;
+    for (auto slot = Home(hash); m_slots[slot].index != kNone; slot = (slot + 1) & mask) {
+      if (m_slots[slot].tag != Tag(hash)) {
+        continue;
+      }
+      const auto& entry = m_entries[m_slots[slot].index];
+      if (entry.hash == hash && std::string_view(m_chars).substr(entry.offset, entry.length) == prefix) {
+        return m_slots[slot].index;
+      }
+    }
+    return kNone;
+  }
+
+  static bool IsEmpty(const Slot& slot) noexcept {
+    return slot.index == kNone;
+  }
+
+  void Place(uint32_t index) {
+    auto hash = m_entries[index].hash;
+    probe::Place(m_slots, Home(hash), Slot{Tag(hash), index}, IsEmpty);
+  }
+
+  void Erase(uint32_t index) {
+    probe::Erase(
+        m_slots, Home(m_entries[index].hash), [index](const Slot& slot) { return slot.index == index; }, Slot{},
+        IsEmpty, [this](const Slot& slot) { return Home(m_entries[slot.index].hash); });
+  }
+
+  void Rehash(size_t slots) {
+    m_slots.assign(slots, Slot{});
+    for (uint32_t index = 0; index < m_entries.size(); ++index) {
+      if (m_entries[index].owner != kNone) {
+        Place(index);
+      }
+    }
+  }
+
+  /**
+   * @brief drop the characters of removed directories
+   */
+  void Compact() {
+    std::string chars;
+    chars.reserve(m_chars.size() - m_dead_chars);
+    for (auto& entry : m_entries) {
+      if (entry.owner != kNone) {
+        auto offset = static_cast<uint32_t>(chars.size());
+        chars.append(m_chars, entry.offset, entry.length);
+        entry.offset = offset;
+      }
+    }
+    m_chars = std::move(chars);
+    m_dead_chars = 0;
+  }
+
+  mutable std::shared_mutex m_mutex;  ///< exclusive for Add() and Remove()
+  std::vector<Entry> m_entries;       ///< directories by index
+  std::vector<uint32_t> m_free;       ///< free entries
+  std::vector<Slot> m_slots;          ///< open addressing index of the entries, linear probing
+  std::string m_chars;                ///< characters of the directories, back to back
+  size_t m_dead_chars{0};             ///< characters of removed directories in m_chars
+  std::vector<uint32_t> m_lengths;    ///< registered directories by prefix length
+  size_t m_count{0};                  ///< registered directories
+  size_t m_routes{0};                 ///< directory and context pairs
+};
+
+}  // namespace watch
+
+#endif /* SRC_INCLUDE_PATH_ROUTER_HPP */
@@ -24,13 +24,15 @@ namespace watch {
 /**
 * \brief This is a easy stop timer wrapper class.
 * Timer allows to set timeout and to check elapsed of timer
+* The clock is a policy: steady_clock by default, a VirtualClock (virtualClock.hpp)
+* lets tests and simulations decide when time passes.
 *
 */
-template <class TDuration = std::chrono::milliseconds>
+template <class TDuration = std::chrono::milliseconds, class TClock = std::chrono::steady_clock>
 class StopTimer {
  public:
   /** types */
-  using Clock = std::chrono::steady_clock;
+  using Clock = TClock;
   using TimePoint = std::chrono::time_point<StopTimer::Clock, TDuration>;
 
   /**
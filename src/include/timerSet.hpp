@@ -0,0 +1,573 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Set of many stop timers scanned with SIMD kernels.
+* @details The deadlines of all timers are one array of 64 bit values, a
+* stopped timer has the deadline kNever. Expired timers and the nearest
+* deadline are found by one pass over the array. The scalar, SSE4.2 and AVX2
+* kernels return the same results, the best one of the CPU is selected at
+* runtime.
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_TIMER_SET_HPP
+#define SRC_INCLUDE_TIMER_SET_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define WATCH_TIMER_SET_X86 1
+#endif
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace watch {
+
+/**
+ * @brief scan kernels over arrays of 64 bit deadlines
+ * @details every kernel has a scalar, a SSE4.2 and an AVX2 version, the best one supported by the CPU is
+ * selected at runtime. The vector versions are compiled with target attributes, the rest of the program
+ * needs no special compiler flags.
+ */
+namespace simd {
+
+enum class Isa : uint8_t { Scalar, Sse42, Avx2 };
+
+/**
+ * @brief best instruction set of this CPU, detected once
+ */
+[[nodiscard]] inline Isa Detect() noexcept {
+#ifdef WATCH_TIMER_SET_X86
+  static const Isa isa = __builtin_cpu_supports("avx2")     ? Isa::Avx2
+                         : __builtin_cpu_supports("sse4.2") ? Isa::Sse42
+                                                            : Isa::Scalar;
+  return isa;
+#else
+  return Isa::Scalar;
+#endif
+}
+
+[[nodiscard]] constexpr const char* Name(Isa isa) noexcept {
+  switch (isa) {
+    case Isa::Avx2:
+      return "avx2";
+    case Isa::Sse42:
+      return "sse4.2";
+    default:
+      return "scalar";
+  }
+}
+
+namespace detail {
+
+inline int64_t MinScalar(const int64_t* data, size_t begin, size_t size) noexcept {
+  auto result = std::numeric_limits<int64_t>::max();
+  for (size_t i = begin; i < size; ++i) {
+    result = std::min(result, data[i]);
+  }
+  return result;
+}
+
+inline void LessScalar(const int64_t* data, size_t begin, size_t size, int64_t bound,
+                       std::vector<uint32_t>& out) {
+  for (size_t i = begin; i < size; ++i) {
+    if (data[i] < bound) {
+      out.push_back(static_cast<uint32_t>(i));
+    }
+  }
+}
+
+inline int64_t LessMinScalar(const int64_t* data, size_t begin, size_t size, int64_t bound,
+                             std::vector<uint32_t>& out) {
+  LessScalar(data, begin, size, bound, out);
+  return MinScalar(data, begin, size);
+}
+
+#ifdef WATCH_TIMER_SET_X86
+__attribute__((target("sse4.2"))) inline int64_t MinSse42(const int64_t* data, size_t size) noexcept {
+  auto first = _mm_set1_epi64x(std::numeric_limits<int64_t>::max());
+  auto second = first;
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 2));
+    first = _mm_blendv_epi8(first, a, _mm_cmpgt_epi64(first, a));
+    second = _mm_blendv_epi8(second, b, _mm_cmpgt_epi64(second, b));
+  }
+  first = _mm_blendv_epi8(first, second, _mm_cmpgt_epi64(first, second));
+  alignas(16) int64_t lanes[2];
+  _mm_store_si128(reinterpret_cast<__m128i*>(lanes), first);
+  return std::min({lanes[0], lanes[1], MinScalar(data, i, size)});
+}
+
+__attribute__((target("sse4.2"))) inline void LessSse42(const int64_t* data, size_t size, int64_t bound,
+                                                        std::vector<uint32_t>& out) {
+  auto limit = _mm_set1_epi64x(bound);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    auto a = _mm_cmpgt_epi64(limit, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+    auto b = _mm_cmpgt_epi64(limit, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 2)));
+    if (_mm_testz_si128(_mm_or_si128(a, b), _mm_or_si128(a, b))) {
+      continue;
+    }
+    auto mask = static_cast<unsigned>(_mm_movemask_pd(_mm_castsi128_pd(a)) |
+                                      (_mm_movemask_pd(_mm_castsi128_pd(b)) << 2));
+    for (; mask != 0; mask &= mask - 1) {
+      out.push_back(static_cast<uint32_t>(i + std::countr_zero(mask)));
+    }
+  }
+  LessScalar(data, i, size, bound, out);
+}
+
+__attribute__((target("sse4.2"))) inline int64_t LessMinSse42(const int64_t* data, size_t size, int64_t bound,
+                                                              std::vector<uint32_t>& out) {
+  auto limit = _mm_set1_epi64x(bound);
+  auto first = _mm_set1_epi64x(std::numeric_limits<int64_t>::max());
+  auto second = first;
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 2));
+    first = _mm_blendv_epi8(first, a, _mm_cmpgt_epi64(first, a));
+    second = _mm_blendv_epi8(second, b, _mm_cmpgt_epi64(second, b));
+    auto less_a = _mm_cmpgt_epi64(limit, a);
+    auto less_b = _mm_cmpgt_epi64(limit, b);
+    if (_mm_testz_si128(_mm_or_si128(less_a, less_b), _mm_or_si128(less_a, less_b))) {
+      continue;
+    }
+    auto mask = static_cast<unsigned>(_mm_movemask_pd(_mm_castsi128_pd(less_a)) |
+                                      (_mm_movemask_pd(_mm_castsi128_pd(less_b)) << 2));
+    for (; mask != 0; mask &= mask - 1) {
+      out.push_back(static_cast<uint32_t>(i + std::countr_zero(mask)));
+    }
+  }
+  first = _mm_blendv_epi8(first, second, _mm_cmpgt_epi64(first, second));
+  alignas(16) int64_t lanes[2];
+  _mm_store_si128(reinterpret_cast<__m128i*>(lanes), first);
+  return std::min({lanes[0], lanes[1], LessMinScalar(data, i, size, bound, out)});
+}
+
+__attribute__((target("avx2"))) inline int64_t MinAvx2(const int64_t* data, size_t size) noexcept {
+  auto first = _mm256_set1_epi64x(std::numeric_limits<int64_t>::max());
+  auto second = first;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 4));
+    first = _mm256_blendv_epi8(first, a, _mm256_cmpgt_epi64(first, a));
+    second = _mm256_blendv_epi8(second, b, _mm256_cmpgt_epi64(second, b));
+  }
+  first = _mm256_blendv_epi8(first, second, _mm256_cmpgt_epi64(first, second));
+  alignas(32) int64_t lanes[4];
+  _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), first);
+  return std::min({lanes[0], lanes[1], lanes[2], lanes[3], MinScalar(data, i, size)});
+}
+
+__attribute__((target("avx2"))) inline void LessAvx2(const int64_t* data, size_t size, int64_t bound,
+                                                     std::vector<uint32_t>& out) {
+  auto limit = _mm256_set1_epi64x(bound);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    auto a = _mm256_cmpgt_epi64(limit, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)));
+    auto b = _mm256_cmpgt_epi64(limit, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 4)));
+    // mostly nothing is expired, test both vectors at once
+    if (_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_or_si256(a, b))) {
+      continue;
+    }
+    auto mask = static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(a)) |
+                                      (_mm256_movemask_pd(_mm256_castsi256_pd(b)) << 4));
+    for (; mask != 0; mask &= mask - 1) {
+      out.push_back(static_cast<uint32_t>(i + std::countr_zero(mask)));
+    }
+  }
+  LessScalar(data, i, size, bound, out);
+}
+
+__attribute__((target("avx2"))) inline int64_t LessMinAvx2(const int64_t* data, size_t size, int64_t bound,
+                                                           std::vector<uint32_t>& out) {
+  auto limit = _mm256_set1_epi64x(bound);
+  auto first = _mm256_set1_epi64x(std::numeric_limits<int64_t>::max());
+  auto second = first;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 4));
+    first = _mm256_blendv_epi8(first, a, _mm256_cmpgt_epi64(first, a));
+    second = _mm256_blendv_epi8(second, b, _mm256_cmpgt_epi64(second, b));
+    auto less_a = _mm256_cmpgt_epi64(limit, a);
+    auto less_b = _mm256_cmpgt_epi64(limit, b);
+    if (_mm256_testz_si256(_mm256_or_si256(less_a, less_b), _mm256_or_si256(less_a, less_b))) {
+      continue;
+    }
+    auto mask = static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(less_a)) |
+                                      (_mm256_movemask_pd(_mm256_castsi256_pd(less_b)) << 4));
+    for (; mask != 0; mask &= mask - 1) {
+      out.push_back(static_cast<uint32_t>(i + std::countr_zero(mask)));
+    }
+  }
+  first = _mm256_blendv_epi8(first, second, _mm256_cmpgt_epi64(first, second));
+  alignas(32) int64_t lanes[4];
+  _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), first);
+  return std::min({lanes[0], lanes[1], lanes[2], lanes[3], LessMinScalar(data, i, size, bound, out)});
+}
+#endif
+
+}  // namespace detail
+
+/**
+ * @brief minimum of the values, INT64_MAX if empty
+ */
+[[nodiscard]] inline int64_t Min(const int64_t* data, size_t size, Isa isa = Detect()) noexcept {
+#ifdef WATCH_TIMER_SET_X86
+  if (isa == Isa::Avx2) {
+    return detail::MinAvx2(data, size);
+  }
+  if (isa == Isa::Sse42) {
+    return detail::MinSse42(data, size);
+  }
+#endif
+  return detail::MinScalar(data, 0, size);
+}
+
+/**
+ * @brief append the indexes of all values less than bound
+ */
+inline void Less(const int64_t* data, size_t size, int64_t bound, std::vector<uint32_t>& out,
+                 Isa isa = Detect()) {
+#ifdef WATCH_TIMER_SET_X86
+  if (isa == Isa::Avx2) {
+    return detail::LessAvx2(data, size, bound, out);
+  }
+  if (isa == Isa::Sse42) {
+    return detail::LessSse42(data, size, bound, out);
+  }
+#endif
+  detail::LessScalar(data, 0, size, bound, out);
+}
+
+/**
+ * @brief Less() and Min() in one pass
+ * @return minimum of the values, INT64_MAX if empty
+ */
+inline int64_t LessMin(const int64_t* data, size_t size, int64_t bound, std::vector<uint32_t>& out,
+                       Isa isa = Detect()) {
+#ifdef WATCH_TIMER_SET_X86
+  if (isa == Isa::Avx2) {
+    return detail::LessMinAvx2(data, size, bound, out);
+  }
+  if (isa == Isa::Sse42) {
+    return detail::LessMinSse42(data, size, bound, out);
+  }
+#endif
+  return detail::LessMinScalar(data, 0, size, bound, out);
+}
+
+}  // namespace simd
+
+/**
+ * \brief Set of many stop timers stored as structure of arrays.
+ * Deadlines, start points and timeouts live in contiguous arrays, the running flags in a bitmask.
+ * A timer which is not running has the deadline INT64_MAX, so expiry checks and the nearest deadline
+ * are a single SIMD pass over one array without branches per timer.
+ * Every timer is owned by a TimerSet::Timer handle with the interface of StopTimer.
+ *
+ * TimerMsSet timers;
+ * auto timer = timers.Make();
+ * timer.Start(500ms);
+ * timers.Expired(ids);
+ */
+template <class TDuration = std::chrono::milliseconds, class TClock = std::chrono::steady_clock>
+class TimerSet {
+ public:
+  /** types */
+  using Clock = TClock;
+  using TimePoint = std::chrono::time_point<Clock, TDuration>;
+
+  static constexpr int64_t kNever = std::numeric_limits<int64_t>::max();
+
+  /**
+   * @brief handle of one timer in the set, compatible with StopTimer
+   * @details move only, the timer is released with the handle. The set must outlive its handles.
+   */
+  class Timer {
+   public:
+    Timer() = default;
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+    Timer(Timer&& other) noexcept : m_set(std::exchange(other.m_set, nullptr)), m_id(other.m_id) {}
+    Timer& operator=(Timer&& other) noexcept {
+      if (this != &other) {
+        Release();
+        m_set = std::exchange(other.m_set, nullptr);
+        m_id = other.m_id;
+      }
+      return *this;
+    }
+    ~Timer() {
+      Release();
+    }
+
+    /**
+     * @brief index of the timer in the set, reported by TimerSet::Expired()
+     */
+    [[nodiscard]] uint32_t Id() const noexcept {
+      return m_id;
+    }
+
+    template <typename TUnit = TDuration>
+    [[nodiscard]] TUnit Timeout() const noexcept {
+      return std::chrono::duration_cast<TUnit>(TDuration(m_set->m_timeout[m_id]));
+    }
+
+    template <typename TUnit = TDuration>
+    void SetTimeout(const TUnit& timeout) noexcept {
+      m_set->m_timeout[m_id] = std::chrono::duration_cast<TDuration>(timeout).count();
+      m_set->UpdateDeadline(m_id);
+    }
+
+    [[nodiscard]] bool IsRunning() const noexcept {
+      return m_set->IsRunning(m_id);
+    }
+
+    void Reset() noexcept {
+      m_set->SetRunning(m_id, false);
+      m_set->m_start[m_id] = 0;
+    }
+
+    void Stop() noexcept {
+      m_set->SetRunning(m_id, false);
+    }
+
+    TimePoint Start() noexcept {
+      auto now = CurrentTime();
+      m_set->m_start[m_id] = now.time_since_epoch().count();
+      m_set->SetRunning(m_id, true);
+      return now;
+    }
+
+    template <typename TUnit = TDuration>
+    TimePoint Start(TUnit new_timeout) noexcept {
+      m_set->m_timeout[m_id] = std::chrono::duration_cast<TDuration>(new_timeout).count();
+      return Start();
+    }
+
+    /**
+     * @brief same semantic as StopTimer::IsElapsed()
+     */
+    [[nodiscard]] std::optional<bool> IsElapsed() const noexcept {
+      if (!IsRunning()) {
+        return std::nullopt;
+      }
+      return CurrentTime().time_since_epoch().count() > m_set->m_deadline[m_id];
+    }
+
+    template <typename TUnit = TDuration>
+    [[nodiscard]] TUnit ElapsedTime() const noexcept {
+      if (!IsRunning()) {
+        return TUnit{};
+      }
+      return std::chrono::duration_cast<TUnit>(TDuration(CurrentTime().time_since_epoch().count() -
+                                                         m_set->m_start[m_id]));
+    }
+
+    template <typename TUnit = TDuration>
+    [[nodiscard]] TUnit LeftTime() const noexcept {
+      if (!IsRunning()) {
+        return TUnit{};
+      }
+      return std::chrono::duration_cast<TUnit>(TDuration(m_set->m_timeout[m_id]) - ElapsedTime());
+    }
+
+   private:
+    friend class TimerSet;
+    Timer(TimerSet* set, uint32_t id) noexcept : m_set(set), m_id(id) {}
+
+    void Release() noexcept {
+      if (m_set != nullptr) {
+        m_set->Free(m_id);
+        m_set = nullptr;
+      }
+    }
+
+    TimerSet* m_set{nullptr};  ///< owning set
+    uint32_t m_id{0};          ///< index in the set
+  };
+
+  /**
+   * @brief constructor
+   * @param capacity - number of timers to reserve
+   */
+  explicit TimerSet(size_t capacity = 0) {
+    m_deadline.reserve(capacity);
+    m_start.reserve(capacity);
+    m_timeout.reserve(capacity);
+    m_running.reserve((capacity + 63) / 64);
+  }
+
+  TimerSet(const TimerSet&) = delete;
+  TimerSet& operator=(const TimerSet&) = delete;
+
+  /**
+   * @brief create a stopped timer
+   * @param timeout - initial timeout
+   * @return handle
+   */
+  [[nodiscard]] Timer Make(TDuration timeout = {}) {
+    uint32_t id;
+    if (!m_free.empty()) {
+      id = m_free.back();
+      m_free.pop_back();
+    } else {
+      id = static_cast<uint32_t>(m_deadline.size());
+      m_deadline.push_back(kNever);
+      m_start.push_back(0);
+      m_timeout.push_back(0);
+      if (id % 64 == 0) {
+        m_running.push_back(0);
+      }
+    }
+    m_start[id] = 0;
+    m_timeout[id] = timeout.count();
+    m_deadline[id] = kNever;
+    return Timer(this, id);
+  }
+
+  /**
+   * @brief number of timer slots, used or free
+   */
+  [[nodiscard]] size_t Capacity() const noexcept {
+    return m_deadline.size();
+  }
+
+  /**
+   * @brief number of running timers
+   */
+  [[nodiscard]] size_t Running() const noexcept {
+    size_t count = 0;
+    for (auto word : m_running) {
+      count += std::popcount(word);
+    }
+    return count;
+  }
+
+  /**
+   * @brief nearest deadline of the running timers
+   * @return deadline or std::nullopt if nothing runs
+   */
+  [[nodiscard]] std::optional<TimePoint> NextDeadline(simd::Isa isa = simd::Detect()) const noexcept {
+    auto deadline = simd::Min(m_deadline.data(), m_deadline.size(), isa);
+    if (deadline == kNever) {
+      return std::nullopt;
+    }
+    return TimePoint(TDuration(deadline));
+  }
+
+  /**
+   * @brief left time up to the nearest deadline, the counterpart of StopTimer::LeftTime() for the set
+   * @return left time, zero if overdue, std::nullopt if nothing runs
+   */
+  [[nodiscard]] std::optional<TDuration> LeftTime(simd::Isa isa = simd::Detect()) const noexcept {
+    auto deadline = NextDeadline(isa);
+    if (!deadline) {
+      return std::nullopt;
+    }
+    return std::max(*deadline - CurrentTime() + TDuration(1), TDuration::zero());
+  }
+
+  /**
+   * @brief collect the ids of the elapsed running timers
+   * @param now - time point to check against
+   * @param ids - output, appended
+   * @return number of appended ids
+   */
+  size_t Expired(TimePoint now, std::vector<uint32_t>& ids, simd::Isa isa = simd::Detect()) const {
+    auto before = ids.size();
+    simd::Less(m_deadline.data(), m_deadline.size(), now.time_since_epoch().count(), ids, isa);
+    return ids.size() - before;
+  }
+
+  size_t Expired(std::vector<uint32_t>& ids, simd::Isa isa = simd::Detect()) const {
+    return Expired(CurrentTime(), ids, isa);
+  }
+
+  /**
+   * @brief Expired() and NextDeadline() in one pass over the deadlines, for a scheduler loop
+   * @param now - time point to check against
+   * @param ids - output, appended with the elapsed running timers
+   * @return nearest deadline of all running timers, the elapsed ones included
+   */
+  std::optional<TimePoint> Poll(TimePoint now, std::vector<uint32_t>& ids, simd::Isa isa = simd::Detect()) const {
+    auto deadline =
+        simd::LessMin(m_deadline.data(), m_deadline.size(), now.time_since_epoch().count(), ids, isa);
+    if (deadline == kNever) {
+      return std::nullopt;
+    }
+    return TimePoint(TDuration(deadline));
+  }
+
+ private:
+  [[nodiscard]] static TimePoint CurrentTime() noexcept {
+    return std::chrono::time_point_cast<TDuration>(Clock::now());
+  }
+
+  [[nodiscard]] bool IsRunning(uint32_t id) const noexcept {
+    return (m_running[id / 64] >> (id % 64)) & 1U;
+  }
+
+  void SetRunning(uint32_t id, bool running) noexcept {
+    auto bit = uint64_t{1} << (id % 64);
+    m_running[id / 64] = running ? (m_running[id / 64] | bit) : (m_running[id / 64] & ~bit);
+    UpdateDeadline(id);
+  }
+
+  // expired means now > deadline, like StopTimer a zero timeout is elapsed at once
+  void UpdateDeadline(uint32_t id) noexcept {
+    if (!IsRunning(id)) {
+      m_deadline[id] = kNever;
+    } else if (m_timeout[id] == 0) {
+      m_deadline[id] = m_start[id] - 1;
+    } else {
+      m_deadline[id] = m_start[id] + m_timeout[id];
+    }
+  }
+
+  void Free(uint32_t id) {
+    SetRunning(id, false);
+    m_free.push_back(id);
+  }
+
+  std::vector<int64_t> m_deadline;  ///< start + timeout per timer, kNever if not running
+  std::vector<int64_t> m_start;     ///< start point per timer
+  std::vector<int64_t> m_timeout;   ///< timeout per timer
+  std::vector<uint64_t> m_running;  ///< running flags, one bit per timer
+  std::vector<uint32_t> m_free;     ///< released ids
+};
+
+/**
+ * @brief useful types for replace template type like standard library std::string
+ * TimerMsSet timers;
+ */
+using TimerMsSet = watch::TimerSet<std::chrono::milliseconds>;
+
+}  // namespace watch
+
+#endif /* SRC_INCLUDE_TIMER_SET_HPP */
@@ -0,0 +1,557 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief In-memory mirror of a watched tree, kept up to date from events.
+* @details The watcher scans its roots once and then applies every created,
+* modified and deleted entry, so consumers ask the mirror instead of listing
+* directories on every event. Entries are fixed-size nodes in one vector,
+* linked to their parent and siblings by index; names are interned, a child
+* is found by (parent, name id) in a flat index. Every change takes the next
+* sequence number and moves the node to the head of a change list, deleted
+* entries stay in the list as tombstones for a while, so "what changed since
+* N" walks only the changes. Directories count the regular files below them.
+* Queries take a shared lock and make no syscalls. Updates come from one
+* thread, the watcher's; modifications are collected and stat()ed once per
+* batch in Flush().
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_TREE_MIRROR_HPP
+#define SRC_INCLUDE_TREE_MIRROR_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "flatIndex.hpp"
+#include "pathIntern.hpp"
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace watch {
+
+/**
+ * @brief entries, types, sizes and mtimes of the watched tree
+ * @details paths are absolute as the watcher reports them, each below one of
+ * the roots; trailing slashes are ignored.
+ */
+class TreeMirror {
+ public:
+  enum class Type : uint8_t {
+    File,       ///< regular file
+    Directory,  ///< directory
+    Other,      ///< link, fifo, socket, device
+    Deleted,    ///< removed, reported by ChangedSince() only
+  };
+
+  struct Info {
+    Type type{Type::Other};
+    uint64_t size{0};      ///< bytes, as of the last Flush()
+    int64_t mtime_ns{0};   ///< modification time, ns since the epoch
+    uint64_t sequence{0};  ///< change that touched the entry last
+  };
+
+  TreeMirror() = default;
+  TreeMirror(const TreeMirror&) = delete;
+  TreeMirror& operator=(const TreeMirror&) = delete;
+
+  //--------------------------------------------------------------------------
+  // updates, from the watcher thread
+  //--------------------------------------------------------------------------
+
+  /**
+   * @brief forget all entries, changes before are no longer reported
+   */
+  void Clear() {
+    std::unique_lock lock(m_mutex);
+    for (auto& node : m_nodes) {
+      if (node.name != InternPool::kNone) {
+        m_names.Release(node.name);
+      }
+    }
+    m_nodes.clear();
+    m_free.clear();
+    m_children.Clear();
+    m_roots.clear();
+    m_dirty.clear();
+    m_tombstones.clear();
+    m_names.Compact();
+    m_newest = kNone;
+    m_live = 0;
+    m_horizon = m_sequence;
+  }
+
+  /**
+   * @brief mirror a root and everything below it
+   */
+  void AddRoot(std::string_view root) {
+    root = Trim(root);
+    if (Find(root) != kNone) {
+      return;
+    }
+    Info info;
+    Lstat(std::string(root).c_str(), info);
+    uint32_t id;
+    {
+      std::unique_lock lock(m_mutex);
+      id = Insert(kNone, root, info);
+      m_roots.push_back(id);
+    }
+    if (info.type == Type::Directory) {
+      Scan(id, std::string(root));
+    }
+  }
+
+  /**
+   * @brief an entry was created, a new directory is scanned at once
+   */
+  void Created(std::string_view path, bool directory) {
+    path = Trim(path);
+    auto type = directory ? Type::Directory : Type::File;
+    if (auto id = Find(path); id != kNone) {
+      if (m_nodes[id].info.type == type) {
+        MarkDirty(id);
+        return;
+      }
+      // replaced by an entry of another type before we saw the delete
+      std::unique_lock lock(m_mutex);
+      Remove(id);
+    }
+    auto slash = path.rfind('/');
+    if (slash == std::string_view::npos) {
+      return;
+    }
+    auto parent = Find(path.substr(0, slash));
+    if (parent == kNone || m_nodes[parent].info.type != Type::Directory) {
+      return;
+    }
+    uint32_t id;
+    {
+      std::unique_lock lock(m_mutex);
+      id = Insert(parent, path.substr(slash + 1), Info{type});
+    }
+    MarkDirty(id);
+    if (directory) {
+      // entries created before the directory was watched have no events
+      Scan(id, std::string(path));
+    }
+  }
+
+  /**
+   * @brief the content or the attributes of an entry changed
+   */
+  void Modified(std::string_view path) {
+    if (auto id = Find(Trim(path)); id != kNone) {
+      MarkDirty(id);
+    }
+  }
+
+  /**
+   * @brief an entry was deleted, with everything below it
+   */
+  void Deleted(std::string_view path) {
+    auto id = Find(Trim(path));
+    if (id == kNone) {
+      return;
+    }
+    std::unique_lock lock(m_mutex);
+    Remove(id);
+    Reclaim();
+  }
+
+  /**
+   * @brief stat() the entries created or modified since the last call
+   */
+  void Flush() {
+    if (m_dirty.empty()) {
+      return;
+    }
+    std::vector<std::pair<uint32_t, Info>> updates;
+    updates.reserve(m_dirty.size());
+    std::string path;
+    for (auto id : m_dirty) {
+      m_nodes[id].dirty = false;
+      if (m_nodes[id].info.type == Type::Deleted) {
+        continue;
+      }
+      PathOf(id, path);
+      // gone already, its delete event follows
+      if (Info info; Lstat(path.c_str(), info)) {
+        updates.emplace_back(id, info);
+      }
+    }
+    m_dirty.clear();
+    std::unique_lock lock(m_mutex);
+    for (auto& [id, info] : updates) {
+      auto& node = m_nodes[id];
+      if (node.info.type != Type::Directory && info.type != Type::Directory && node.info.type != info.type) {
+        AddFiles(node.parent, info.type == Type::File ? 1 : -1);
+        node.info.type = info.type;
+      }
+      node.info.size = info.size;
+      node.info.mtime_ns = info.mtime_ns;
+      Touch(id);
+    }
+  }
+
+  //--------------------------------------------------------------------------
+  // queries, from any thread
+  //--------------------------------------------------------------------------
+
+  /**
+   * @brief attributes of an entry
+   * @return false if the path is not mirrored
+   */
+  bool Stat(std::string_view path, Info& info) const {
+    std::shared_lock lock(m_mutex);
+    auto id = Find(Trim(path));
+    if (id == kNone) {
+      return false;
+    }
+    info = m_nodes[id].info;
+    return true;
+  }
+
+  /**
+   * @brief call fn(name, info) for every entry of a directory, in no order
+   * @details fn runs under the shared lock, the name is valid during the call
+   * @return false if the path is not a mirrored directory
+   */
+  template <typename TFn>
+  bool List(std::string_view directory, TFn&& fn) const {
+    std::shared_lock lock(m_mutex);
+    auto id = Find(Trim(directory));
+    if (id == kNone || m_nodes[id].info.type != Type::Directory) {
+      return false;
+    }
+    for (auto child = m_nodes[id].first_child; child != kNone; child = m_nodes[child].next_sibling) {
+      fn(m_names.View(m_nodes[child].name), m_nodes[child].info);
+    }
+    return true;
+  }
+
+  /**
+   * @brief number of regular files at or below a path
+   */
+  [[nodiscard]] uint64_t CountFiles(std::string_view prefix) const {
+    std::shared_lock lock(m_mutex);
+    auto id = Find(Trim(prefix));
+    if (id == kNone) {
+      return 0;
+    }
+    const auto& node = m_nodes[id];
+    return node.info.type == Type::Directory ? node.files : node.info.type == Type::File ? 1 : 0;
+  }
+
+  /**
+   * @brief call fn(path, info) for every entry changed after a sequence
+   * number, the newest first; deleted entries have the type Deleted
+   * @details fn runs under the shared lock, the path is valid during the call
+   * @return false if changes after the sequence number were dropped already,
+   * the caller has to start over from List(); fn is not called then
+   */
+  template <typename TFn>
+  bool ChangedSince(uint64_t sequence, TFn&& fn) const {
+    std::shared_lock lock(m_mutex);
+    if (sequence < m_horizon) {
+      return false;
+    }
+    std::string path;
+    for (auto id = m_newest; id != kNone && m_nodes[id].info.sequence > sequence; id = m_nodes[id].older) {
+      PathOf(id, path);
+      fn(std::string_view(path), m_nodes[id].info);
+    }
+    return true;
+  }
+
+  /**
+   * @brief sequence number of the last change
+   */
+  [[nodiscard]] uint64_t Sequence() const {
+    std::shared_lock lock(m_mutex);
+    return m_sequence;
+  }
+
+  /**
+   * @brief number of mirrored entries, roots included
+   */
+  [[nodiscard]] size_t Size() const {
+    std::shared_lock lock(m_mutex);
+    return m_live;
+  }
+
+ private:
+  static constexpr uint32_t kNone = UINT32_MAX;
+  static constexpr size_t kMinTombstones = 4096;
+
+  struct Node {
+    Info info;
+    uint64_t files{0};                       ///< regular files in the subtree, directories only
+    InternPool::Id name{InternPool::kNone};  ///< full path for a root
+    uint32_t parent{kNone};
+    uint32_t first_child{kNone};
+    uint32_t next_sibling{kNone};
+    uint32_t prev_sibling{kNone};
+    uint32_t newer{kNone};  ///< change list
+    uint32_t older{kNone};
+    bool dirty{false};      ///< in m_dirty
+  };
+
+  static uint64_t Key(uint32_t parent, InternPool::Id name) noexcept {
+    return (uint64_t{parent} << 32) | name;
+  }
+
+  static std::string_view Trim(std::string_view path) noexcept {
+    while (path.size() > 1 && path.back() == '/') {
+      path.remove_suffix(1);
+    }
+    return path;
+  }
+
+  static bool Lstat(const char* path, Info& info) {
+    struct stat status {};
+    if (lstat(path, &status) != 0) {
+      return false;
+    }
+    info.type = S_ISREG(status.st_mode) ? Type::File : S_ISDIR(status.st_mode) ? Type::Directory : Type::Other;
+    info.size = static_cast<uint64_t>(status.st_size);
+    info.mtime_ns = status.st_mtim.tv_sec * 1000000000LL + status.st_mtim.tv_nsec;
+    return true;
+  }
+
+  /**
+   * @brief node of a path, under a lock or from the updating thread
+   */
+  [[nodiscard]] uint32_t Find(std::string_view path) const {
+    for (auto root : m_roots) {
+      auto root_path = m_names.View(m_nodes[root].name);
+      if (!path.starts_with(root_path)) {
+        continue;
+      }
+      auto rest = path.substr(root_path.size());
+      if (!rest.empty() && rest.front() != '/' && root_path.back() != '/') {
+        continue;
+      }
+      auto id = root;
+      while (!rest.empty() && id != kNone) {
+        auto begin = rest.find_first_not_of('/');
+        if (begin == std::string_view::npos) {
+          break;
+        }
+        rest.remove_prefix(begin);
+        auto name = rest.substr(0, rest.find('/'));
+        rest.remove_prefix(name.size());
+        auto name_id = m_names.Find(name);
+        auto* child = name_id == InternPool::kNone ? nullptr : m_children.Find(Key(id, name_id));
+        id = child ? *child : kNone;
+      }
+      if (id != kNone) {
+        return id;
+      }
+    }
+    return kNone;
+  }
+
+  void PathOf(uint32_t id, std::string& path) const {
+    const auto& node = m_nodes[id];
+    if (node.parent == kNone) {
+      path.assign(m_names.View(node.name));
+      return;
+    }
+    PathOf(node.parent, path);
+    if (path.back() != '/') {
+      path += '/';
+    }
+    path += m_names.View(node.name);
+  }
+
+  void MarkDirty(uint32_t id) {
+    if (!m_nodes[id].dirty) {
+      m_nodes[id].dirty = true;
+      m_dirty.push_back(id);
+    }
+  }
+
+  /**
+   * @brief read one directory and mirror its entries, then the subdirectories
+   */
+  void Scan(uint32_t directory, const std::string& path) {
+    std::vector<std::pair<std::string, Info>> entries;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(path, ec)) {
+      if (Info info; Lstat(entry.path().c_str(), info)) {
+        entries.emplace_back(entry.path().filename().string(), info);
+      }
+    }
+    std::vector<std::pair<uint32_t, std::string>> subdirectories;
+    {
+      std::unique_lock lock(m_mutex);
+      for (auto& [name, info] : entries) {
+        auto name_id = m_names.Find(name);
+        if (name_id != InternPool::kNone && m_children.Find(Key(directory, name_id))) {
+          continue;
+        }
+        auto id = Insert(directory, name, info);
+        if (info.type == Type::Directory) {
+          subdirectories.emplace_back(id, path + "/" + name);
+        }
+      }
+    }
+    for (auto& [id, subdirectory] : subdirectories) {
+      Scan(id, subdirectory);
+    }
+  }
+
+  uint32_t Insert(uint32_t parent, std::string_view name, const Info& info) {
+    uint32_t id;
+    if (!m_free.empty()) {
+      id = m_free.back();
+      m_free.pop_back();
+      m_nodes[id] = Node{};
+    } else {
+      id = static_cast<uint32_t>(m_nodes.size());
+      m_nodes.emplace_back();
+    }
+    auto& node = m_nodes[id];
+    node.info = info;
+    node.name = m_names.Intern(name);
+    node.parent = parent;
+    if (parent != kNone) {
+      node.next_sibling = m_nodes[parent].first_child;
+      if (node.next_sibling != kNone) {
+        m_nodes[node.next_sibling].prev_sibling = id;
+      }
+      m_nodes[parent].first_child = id;
+      m_children.Insert(Key(parent, node.name), id);
+    }
+    if (info.type == Type::File) {
+      AddFiles(parent, 1);
+    }
+    m_live++;
+    Touch(id);
+    return id;
+  }
+
+  /**
+   * @brief turn a node and its subtree into tombstones, children first
+   */
+  void Remove(uint32_t id) {
+    while (m_nodes[id].first_child != kNone) {
+      Remove(m_nodes[id].first_child);
+    }
+    auto& node = m_nodes[id];
+    if (node.parent != kNone) {
+      if (node.prev_sibling != kNone) {
+        m_nodes[node.prev_sibling].next_sibling = node.next_sibling;
+      } else {
+        m_nodes[node.parent].first_child = node.next_sibling;
+      }
+      if (node.next_sibling != kNone) {
+        m_nodes[node.next_sibling].prev_sibling = node.prev_sibling;
+      }
+      m_children.Erase(Key(node.parent, node.name));
+    } else {
+      std::erase(m_roots, id);
+    }
+    if (node.info.type == Type::File) {
+      AddFiles(node.parent, -1);
+    }
+    node.info.type = Type::Deleted;
+    node.info.size = 0;
+    m_live--;
+    Touch(id);
+    m_tombstones.push_back(id);
+  }
+
+  /**
+   * @brief free the oldest tombstones, parents are deleted after their children
+   */
+  void Reclaim() {
+    auto keep = std::max(kMinTombstones, m_live / 4);
+    if (m_tombstones.size() <= keep * 2) {
+      return;
+    }
+    while (m_tombstones.size() > keep) {
+      auto id = m_tombstones.front();
+      m_tombstones.pop_front();
+      auto& node = m_nodes[id];
+      m_horizon = node.info.sequence;
+      Unlink(id);
+      m_names.Release(node.name);
+      node.name = InternPool::kNone;
+      m_free.push_back(id);
+    }
+    m_names.Compact();
+  }
+
+  void AddFiles(uint32_t id, int64_t files) {
+    for (; id != kNone; id = m_nodes[id].parent) {
+      m_nodes[id].files += static_cast<uint64_t>(files);
+    }
+  }
+
+  void Unlink(uint32_t id) {
+    auto& node = m_nodes[id];
+    if (node.older != kNone) {
+      m_nodes[node.older].newer = node.newer;
+    }
+    if (node.newer != kNone) {
+      m_nodes[node.newer].older = node.older;
+    } else if (m_newest == id) {
+      m_newest = node.older;
+    }
+    node.newer = node.older = kNone;
+  }
+
+  /**
+   * @brief give a node the next sequence number and make it the newest change
+   */
+  void Touch(uint32_t id) {
+    if (id != m_newest) {
+      Unlink(id);
+      m_nodes[id].older = m_newest;
+      if (m_newest != kNone) {
+        m_nodes[m_newest].newer = id;
+      }
+      m_newest = id;
+    }
+    m_nodes[id].info.sequence = ++m_sequence;
+  }
+
+  mutable std::shared_mutex m_mutex;                ///< exclusive for changes of the nodes
+  std::vector<Node> m_nodes;                        ///< entries and tombstones by index
+  std::vector<uint32_t> m_free;                     ///< reclaimed nodes
+  FlatIndex<uint64_t, uint32_t> m_children;         ///< Key(parent, name) to node
+  InternPool m_names;                               ///< names of the nodes
+  std::vector<uint32_t> m_roots;                    ///< nodes of the roots
+  std::vector<uint32_t> m_dirty;                    ///< nodes to stat() in Flush()
+  std::deque<uint32_t> m_tombstones;                ///< deleted nodes, oldest first
+  uint32_t m_newest{kNone};                         ///< head of the change list
+  size_t m_live{0};                                 ///< nodes that are not tombstones
+  uint64_t m_sequence{0};                           ///< last change
+  uint64_t m_horizon{0};                            ///< changes up to it may be dropped
+};
+
+}  // namespace watch
+
+#endif /* SRC_INCLUDE_TREE_MIRROR_HPP */
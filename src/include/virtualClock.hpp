@@ -0,0 +1,139 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Clock policies for StopTimer, TimerSet and the context loop.
+* @details BasicVirtualClock is a std::chrono clock that stands still until
+* it is advanced, so hours of timer driven behaviour run in the time the
+* code needs and every run sees the same times. SwitchableClock reads the
+* steady clock unless a simulation switches it to a virtual clock; code that
+* is compiled once, like the concrete contexts, uses it and still runs in
+* simulated time.
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_VIRTUAL_CLOCK_HPP
+#define SRC_INCLUDE_VIRTUAL_CLOCK_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace watch {
+
+/**
+ * @brief manually advanced clock
+ * @details the time is process wide per tag type, simulations that must not
+ * see each other use tags of their own. Advance() may be called from any
+ * thread, now() is one atomic load. The clock starts at the epoch.
+ * @tparam TTag - distinguishes independent clocks
+ */
+template <class TTag = void>
+class BasicVirtualClock {
+ public:
+  /** types, as required of a std::chrono clock */
+  using duration = std::chrono::nanoseconds;
+  using rep = duration::rep;
+  using period = duration::period;
+  using time_point = std::chrono::time_point<BasicVirtualClock>;
+
+  static constexpr bool is_steady = true;  ///< only Set() may move it back, for test setup
+
+  [[nodiscard]] static time_point now() noexcept {
+    return time_point(duration(m_now.load(std::memory_order_acquire)));
+  }
+
+  /**
+   * @brief move the time forward
+   * @return new time
+   */
+  template <class TRep, class TPeriod>
+  static time_point Advance(std::chrono::duration<TRep, TPeriod> step) noexcept {
+    auto ticks = std::chrono::duration_cast<duration>(step).count();
+    return time_point(duration(m_now.fetch_add(ticks, std::memory_order_acq_rel) + ticks));
+  }
+
+  /**
+   * @brief move the time forward to a point, a point in the past is ignored
+   * @return new time
+   */
+  static time_point AdvanceTo(time_point point) noexcept {
+    auto ticks = point.time_since_epoch().count();
+    auto now = m_now.load(std::memory_order_relaxed);
+    while (now < ticks && !m_now.compare_exchange_weak(now, ticks, std::memory_order_acq_rel)) {
+    }
+    return time_point(duration(std::max(now, ticks)));
+  }
+
+  /**
+   * @brief set the time, also backwards; while no timer runs
+   */
+  static void Set(time_point point) noexcept {
+    m_now.store(point.time_since_epoch().count(), std::memory_order_release);
+  }
+
+  static void Reset() noexcept {
+    Set(time_point{});
+  }
+
+ private:
+  static inline std::atomic<rep> m_now{0};  ///< nanoseconds since the epoch
+};
+
+using VirtualClock = BasicVirtualClock<>;
+
+/**
+ * @brief steady clock, or a virtual clock while a simulation runs
+ * @details switch before the timers using the clock start: the two clocks
+ * have unrelated epochs, a timer running across a switch sees a jump.
+ * now() costs one relaxed load more than the clock it reads.
+ * @tparam TVirtual - virtual clock used when switched
+ */
+template <class TVirtual = VirtualClock>
+class SwitchableClock {
+ public:
+  /** types, as required of a std::chrono clock */
+  using duration = std::chrono::nanoseconds;
+  using rep = duration::rep;
+  using period = duration::period;
+  using time_point = std::chrono::time_point<SwitchableClock>;
+
+  static constexpr bool is_steady = true;
+
+  [[nodiscard]] static time_point now() noexcept {
+    if (m_virtual.load(std::memory_order_relaxed)) {
+      return time_point(std::chrono::duration_cast<duration>(TVirtual::now().time_since_epoch()));
+    }
+    return time_point(std::chrono::duration_cast<duration>(std::chrono::steady_clock::now().time_since_epoch()));
+  }
+
+  /**
+   * @brief read the virtual clock (true) or the steady clock (false)
+   */
+  static void UseVirtual(bool on) noexcept {
+    m_virtual.store(on, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] static bool IsVirtual() noexcept {
+    return m_virtual.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static inline std::atomic<bool> m_virtual{false};  ///< reads TVirtual
+};
+
+}  // namespace watch
+
+#endif /* SRC_INCLUDE_VIRTUAL_CLOCK_HPP */
@@ -0,0 +1,171 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Routes event sources to the tasks waiting for them.
+* @details Every task owns a futex word instead of sharing one condition
+* variable, and subscribes to the sources it cares about. Notify(source) wakes
+* only the subscribed tasks. A task that is already pending is not woken
+* again: the notification is coalesced into the one it has not consumed yet,
+* so a burst of events costs at most one context switch per task.
+****************************************************************************/
+
+#ifndef SRC_INCLUDE_WAKEUP_ROUTER_HPP
+#define SRC_INCLUDE_WAKEUP_ROUTER_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace watch {
+
+/**
+ * @brief wakes the tasks subscribed to an event source
+ * @details AddTask() and Subscribe() set up the routes before the tasks run,
+ * Notify(), Wake() and Wait() are thread safe. Each task is waited on by one
+ * thread.
+ */
+class WakeupRouter {
+ public:
+  using Task = uint32_t;
+  using Source = uint32_t;
+
+  struct Counters {
+    uint64_t notified;   ///< notifications of a task
+    uint64_t woken;      ///< futex wakes of a sleeping task
+    uint64_t coalesced;  ///< notifications of an already pending task
+  };
+
+  WakeupRouter() = default;
+  WakeupRouter(const WakeupRouter&) = delete;
+  WakeupRouter& operator=(const WakeupRouter&) = delete;
+
+  /**
+   * @brief add a task with its own wait word
+   */
+  Task AddTask() {
+    m_waiters.emplace_back();
+    return static_cast<Task>(m_waiters.size() - 1);
+  }
+
+  /**
+   * @brief route the notifications of a source to a task
+   */
+  void Subscribe(Task task, Source source) {
+    if (source >= m_routes.size()) {
+      m_routes.resize(source + 1);
+    }
+    m_routes[source].push_back(task);
+  }
+
+  /**
+   * @brief wake the tasks subscribed to a source
+   */
+  void Notify(Source source) noexcept {
+    if (source < m_routes.size()) {
+      for (auto task : m_routes[source]) {
+        Wake(task);
+      }
+    }
+  }
+
+  /**
+   * @brief wake every task, e.g. on a stop request
+   */
+  void NotifyAll() noexcept {
+    for (Task task = 0; task < m_waiters.size(); ++task) {
+      Wake(task);
+    }
+  }
+
+  /**
+   * @brief make a task pending, issue the futex wake only if it sleeps
+   */
+  void Wake(Task task) noexcept {
+    auto& waiter = m_waiters[task];
+    m_notified.fetch_add(1, std::memory_order_relaxed);
+    auto state = waiter.state.exchange(kPending, std::memory_order_release);
+    if (state == kSleeping) {
+      m_woken.fetch_add(1, std::memory_order_relaxed);
+      Futex(&waiter.state, FUTEX_WAKE_PRIVATE, 1, nullptr);
+    } else if (state == kPending) {
+      m_coalesced.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief block until the task is notified or the timeout expires
+   * @return true if notified, a pending notification returns at once
+   */
+  bool Wait(Task task, std::chrono::nanoseconds timeout) noexcept {
+    auto& waiter = m_waiters[task];
+    if (waiter.state.exchange(kIdle, std::memory_order_acquire) == kPending) {
+      return true;
+    }
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    auto expected = kIdle;
+    // a failed exchange means a notification came in between
+    if (waiter.state.compare_exchange_strong(expected, kSleeping, std::memory_order_acquire)) {
+      // woken, timed out or spurious: only the state word decides
+      while (waiter.state.load(std::memory_order_acquire) == kSleeping) {
+        auto left = deadline - std::chrono::steady_clock::now();
+        if (left <= std::chrono::nanoseconds::zero()) {
+          break;
+        }
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(left);
+        timespec relative{static_cast<time_t>(seconds.count()),
+                          static_cast<long>(std::chrono::nanoseconds(left - seconds).count())};
+        Futex(&waiter.state, FUTEX_WAIT_PRIVATE, kSleeping, &relative);
+      }
+    }
+    return waiter.state.exchange(kIdle, std::memory_order_acquire) == kPending;
+  }
+
+  [[nodiscard]] Counters GetCounters() const noexcept {
+    return Counters{m_notified.load(std::memory_order_relaxed), m_woken.load(std::memory_order_relaxed),
+                    m_coalesced.load(std::memory_order_relaxed)};
+  }
+
+ private:
+  static constexpr uint32_t kIdle = 0;      ///< running, nothing pending
+  static constexpr uint32_t kPending = 1;   ///< notified, not consumed yet
+  static constexpr uint32_t kSleeping = 2;  ///< blocked in the futex
+
+  struct Waiter {
+    alignas(64) std::atomic<uint32_t> state{kIdle};  ///< own cache line, the word of the futex
+  };
+
+  static void Futex(std::atomic<uint32_t>* word, int op, uint32_t value, const timespec* timeout) noexcept {
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value, timeout, nullptr, 0);
+  }
+
+  std::deque<Waiter> m_waiters;               ///< wait words by task, stable addresses
+  std::vector<std::vector<Task>> m_routes;    ///< subscribed tasks by source
+  std::atomic<uint64_t> m_notified{0};
+  std::atomic<uint64_t> m_woken{0};
+  std::atomic<uint64_t> m_coalesced{0};
+};
+
+}  // namespace watch
+
+#endif /* SRC_INCLUDE_WAKEUP_ROUTER_HPP */
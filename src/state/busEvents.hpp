@@ -0,0 +1,58 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Event types published on the event bus.
+* @details Each type is one topic of watch::EventBus: the filesystem watcher
+* publishes FsChanged, the contexts publish TimerExpired and StateChanged.
+****************************************************************************/
+
+#ifndef SRC_STATE_BUS_EVENTS_HPP
+#define SRC_STATE_BUS_EVENTS_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <cstdint>
+#include <string>
+
+#include <fswatch.hpp>
+
+//----------------------------------------------------------------------------
+// Public Prototypes
+//----------------------------------------------------------------------------
+
+namespace state {
+
+/**
+ * @brief a filesystem event of the watcher
+ */
+struct FsChanged {
+  fswatch::Event type{};  ///< event type
+  std::string path;       ///< full path, the slot keeps its capacity
+};
+
+/**
+ * @brief the timer of a context elapsed
+ */
+struct TimerExpired {
+  uint16_t state{0};  ///< state id which started the timer
+};
+
+/**
+ * @brief a context left a state
+ */
+struct StateChanged {
+  uint16_t from{0};  ///< state id left
+  uint16_t to{0};    ///< state id entered
+};
+
+}  // namespace state
+
+#endif /* SRC_STATE_BUS_EVENTS_HPP */
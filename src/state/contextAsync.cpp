@@ -0,0 +1,35 @@
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include "contextAsync.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include <metrics.hpp>
+
+//----------------------------------------------------------------------------
+// Public Function Prototypes
+//----------------------------------------------------------------------------
+
+namespace state {
+
+watch::Task<> ServeAsync(watch::EventLoop& loop, ConcreteContext& context, watch::AsyncEvent& wakeup,
+                         std::chrono::milliseconds wait_default) {
+  static const auto by_timer = metrics::Registry::Instance().AddCounter(
+      "state_wakeups_total", "Wakeups of the context workers by reason.", "reason=\"timer\"");
+  static const auto by_event = metrics::Registry::Instance().AddCounter(
+      "state_wakeups_total", "Wakeups of the context workers by reason.", "reason=\"event\"");
+  while (!loop.IsStopping()) {
+    // observe serves states; never spin, other coroutines share the thread
+    auto sooner = context.Serve(wait_default);
+    if (co_await wakeup.Wait(std::max(sooner, std::chrono::milliseconds(1)))) {
+      by_event.Inc();
+    } else {
+      by_timer.Inc();
+    }
+  }
+}
+
+}  // end of namespace state
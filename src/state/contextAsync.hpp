@@ -0,0 +1,47 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Awaitable serve loop of a concrete context.
+* @details The coroutine counterpart of a context worker thread: the context
+* is served, then the coroutine suspends until the nearest timer expiry or a
+* wakeup notification, without blocking the event loop thread.
+****************************************************************************/
+
+#ifndef SRC_STATE_CONTEXT_ASYNC_HPP
+#define SRC_STATE_CONTEXT_ASYNC_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <chrono>
+#include <eventLoop.hpp>
+
+#include "contextConcrete.hpp"
+
+//----------------------------------------------------------------------------
+// Public Function Prototypes
+//----------------------------------------------------------------------------
+
+namespace state {
+
+/**
+ * @brief serve a context on an event loop until the loop stops
+ * @param loop - event loop running the coroutine
+ * @param context - context to serve
+ * @param wakeup - event which wakes the context before its timer expires
+ * @param wait_default - max. interval between two services
+ * @return task finishing when the loop stops
+ */
+watch::Task<> ServeAsync(watch::EventLoop& loop, ConcreteContext& context, watch::AsyncEvent& wakeup,
+                         std::chrono::milliseconds wait_default);
+
+}  // namespace state
+
+#endif /* SRC_STATE_CONTEXT_ASYNC_HPP */
@@ -4,17 +4,55 @@
 //-----------------------------------------------------------------------------
 #include "contextConcrete.hpp"
 
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <spdlog/spdlog.h>
 
+#include <flightRecorder.hpp>
+#include <metrics.hpp>
+
+#include "busEvents.hpp"
 #include "stateConcreteOne.hpp"
+#include "stateConcreteTwo.hpp"
 
 using namespace state;
 using state::State;
 
+namespace {
+
+/**
+ * @brief transition counter of the state that is left, registered on the first transition
+ */
+const metrics::Counter& TransitionsFrom(uint16_t id) {
+  static std::array<metrics::Counter, 16> counters;
+  static std::array<std::once_flag, 16> registered;
+  auto index = std::min<size_t>(id, counters.size() - 1);
+  std::call_once(registered[index], [index] {
+    counters[index] = metrics::Registry::Instance().AddCounter(
+        "state_transitions_total", "State transitions by the state that is left.",
+        "state=\"" + std::to_string(index) + "\"");
+  });
+  return counters[index];
+}
+
+/**
+ * @brief left time of a timer for the flight recorder
+ */
+int32_t TimerLeft(state::ContextTimer& timer) {
+  if (!timer.IsRunning()) {
+    return logging::flight::kNoTimer;
+  }
+  return static_cast<int32_t>(std::clamp<int64_t>(timer.LeftTime().count(), INT32_MIN + 1, INT32_MAX));
+}
+
+}  // namespace
+
 //----------------------------------------------------------------------------
 // Public Function Prototypes
 //----------------------------------------------------------------------------
@@ -29,11 +67,33 @@ std::chrono::milliseconds ConcreteContext::Serve(const std::chrono::milliseconds
   // once started
   if (!m_state) {
     m_state.reset(new StateConcreteOne(this));
+    logging::FlightRecorder::Instance().Record(logging::flight::Kind::Start, m_id, 0, m_state->Id(),
+                                               TimerLeft(m_timer));
+  }
+
+  // an elapsed timer is recorded and published once per start
+  if (!m_timer_published && m_timer.IsRunning() && m_timer.LeftTime() <= 0ms) {
+    m_timer_published = true;
+    logging::FlightRecorder::Instance().Record(logging::flight::Kind::TimerExpired, m_id, m_state->Id(),
+                                               m_state->Id(), TimerLeft(m_timer));
+    if (m_expirations) {
+      m_expirations->Publish(TimerExpired{m_state->Id()});
+    }
   }
 
   // handle state
-  if (auto result = m_state->DoServe(); result.has_value()) {
-    m_state = std::move(result.value());
+  if (auto next = m_state->DoServe(); next.has_value()) {
+    auto from = m_state->Id();
+    TransitionsFrom(from).Inc();
+    // leave before the next state is constructed, its constructor executes the entry action
+    m_state->DoExit();
+    m_state.reset();
+    m_state = (*next)(this);
+    logging::FlightRecorder::Instance().Record(logging::flight::Kind::Transition, m_id, from, m_state->Id(),
+                                               TimerLeft(m_timer));
+    if (m_changes) {
+      m_changes->Publish(StateChanged{from, m_state->Id()});
+    }
   }
 
   // estimate next sooner for timer
@@ -46,4 +106,50 @@ std::chrono::milliseconds ConcreteContext::Serve(const std::chrono::milliseconds
   return res_sooner;
 }
 
+uint16_t ConcreteContext::StateId() const {
+  return m_state ? m_state->Id() : 0;
+}
+
+void ConcreteContext::Attach(watch::EventBus& bus) {
+  m_expirations = &bus.Topic<TimerExpired>();
+  m_changes = &bus.Topic<StateChanged>();
+}
+
+ConcreteContext::Snapshot ConcreteContext::Save() {
+  Snapshot snapshot;
+  if (m_state) {
+    snapshot.state = m_state->Id();
+  }
+  if (m_timer.IsRunning()) {
+    snapshot.timer_running = true;
+    snapshot.timer_left = std::max(m_timer.LeftTime(), std::chrono::milliseconds::zero());
+  }
+  return snapshot;
+}
+
+bool ConcreteContext::Restore(const Snapshot& snapshot) {
+  switch (snapshot.state) {
+    case StateConcreteOne::kId:
+      m_state = std::make_unique<StateConcreteOne>(this, Restored{});
+      break;
+    case StateConcreteTwo::kId:
+      m_state = std::make_unique<StateConcreteTwo>(this, Restored{});
+      break;
+    default:
+      m_state.reset();
+      m_timer.Reset();
+      return snapshot.state == 0;
+  }
+  // the left time becomes the timeout, the timer elapses at the same point as before
+  if (snapshot.timer_running) {
+    m_timer.Start(snapshot.timer_left);
+    m_timer_published = false;
+  } else {
+    m_timer.Reset();
+  }
+  logging::FlightRecorder::Instance().Record(logging::flight::Kind::Restored, m_id, 0, m_state->Id(),
+                                             TimerLeft(m_timer));
+  return true;
+}
+
 }  // end of namespace state
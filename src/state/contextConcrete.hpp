@@ -10,9 +10,12 @@
 //-----------------------------------------------------------------------------
 // includes
 //-----------------------------------------------------------------------------
+#include <cstdint>
+#include <eventBus.hpp>
 #include <filesystem>
 #include <optional>
 #include <stopTimer.hpp>
+#include <virtualClock.hpp>
 
 #include "context.hpp"
 
@@ -22,6 +25,19 @@
 
 namespace state {
 
+struct TimerExpired;
+struct StateChanged;
+
+/**
+ * @brief clock of the context timers, steady unless a simulation switches it to watch::VirtualClock
+ */
+using ContextClock = watch::SwitchableClock<watch::VirtualClock>;
+
+/**
+ * @brief timer of a context
+ */
+using ContextTimer = watch::StopTimer<std::chrono::milliseconds, ContextClock>;
+
 /**
 * @class Concrete Context
 */
@@ -31,8 +47,16 @@ class ConcreteContext : public Context {
  public:
   /**
    * @brief constructor
+   * @param id - context id in the flight recorder, e.g. the registry key
+   */
+  explicit ConcreteContext(uint64_t id = 0) : Context(), m_id(id) {}
+
+  /**
+   * @brief context id
    */
-  ConcreteContext() : Context() {}
+  [[nodiscard]] uint64_t ContextId() const noexcept {
+    return m_id;
+  }
 
   /**
    * @brief Serves some work.
@@ -46,7 +70,7 @@ class ConcreteContext : public Context {
    * @brief get reference to timer
    * @return timer reference
    */
-  [[nodiscard]] watch::TimerMs& Timer() {
+  [[nodiscard]] ContextTimer& Timer() {
     return m_timer;
   }
 
@@ -55,6 +79,7 @@ class ConcreteContext : public Context {
    */
   void TimerRestart(const std::chrono::milliseconds timeout) {
     m_timer.Start(timeout);
+    m_timer_published = false;
   }
 
   /**
@@ -64,9 +89,45 @@ class ConcreteContext : public Context {
     m_timer.Reset();
   }
 
+  /**
+   * @brief id of the current state, 0 - not started
+   */
+  [[nodiscard]] uint16_t StateId() const;
+
+  /**
+   * @brief publish the timer expirations and state changes on a bus
+   * @param bus - event bus, must outlive the context
+   */
+  void Attach(watch::EventBus& bus);
+
+  /**
+   * @brief persistent part of the context
+   */
+  struct Snapshot {
+    uint16_t state{0};                    ///< state id, 0 - not started
+    bool timer_running{false};            ///< timer is running
+    std::chrono::milliseconds timer_left{};  ///< left time of the running timer
+  };
+
+  /**
+   * @brief current state id and timer
+   */
+  [[nodiscard]] Snapshot Save();
+
+  /**
+   * @brief continue in the saved state without executing its entry action
+   * @param snapshot - saved state, the left time is already corrected by the down time
+   * @return false if the state id is unknown, the context starts from scratch then
+   */
+  bool Restore(const Snapshot& snapshot);
+
  private:
+  uint64_t m_id{0};                                 ///< context id
   std::unique_ptr<State<ConcreteContext>> m_state;  ///< current state
-  watch::TimerMs m_timer;                           ///< timer
+  ContextTimer m_timer;                             ///< timer
+  bool m_timer_published{false};                    ///< expiry of the running timer is recorded and published
+  watch::BroadcastRing<TimerExpired>* m_expirations{nullptr};  ///< topic of the timer expirations
+  watch::BroadcastRing<StateChanged>* m_changes{nullptr};      ///< topic of the state changes
 };
 
 }  // end of namespace state
@@ -0,0 +1,271 @@
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include "contextRegistry.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+//----------------------------------------------------------------------------
+// Private helpers
+//----------------------------------------------------------------------------
+
+namespace {
+
+/**
+ * @brief run function(index) for index in [0, count) on up to threads threads
+ */
+template <class TFunction>
+void Parallel(size_t count, size_t threads, TFunction&& function) {
+  if (threads == 0) {
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  threads = std::min(threads, count);
+  std::atomic<size_t> next{0};
+  auto worker = [&] {
+    for (size_t index; (index = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+      function(index);
+    }
+  };
+  std::vector<std::jthread> pool;
+  for (size_t i = 1; i < threads; ++i) {
+    pool.emplace_back(worker);
+  }
+  worker();
+}
+
+/**
+ * @brief mapped file, unmapped and closed on scope exit
+ */
+struct Mapping {
+  int fd{-1};
+  void* data{MAP_FAILED};
+  size_t size{0};
+
+  ~Mapping() {
+    if (data != MAP_FAILED) {
+      munmap(data, size);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+};
+
+[[noreturn]] void Fail(const std::string& what, const std::filesystem::path& path) {
+  throw std::runtime_error("snapshot: " + what + " " + path.string() + ": " + std::strerror(errno));
+}
+
+int64_t NowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+// Public Function Prototypes
+//----------------------------------------------------------------------------
+
+namespace state {
+
+ContextRegistry::ContextRegistry(size_t shards) : m_shards(std::bit_ceil(std::max<size_t>(shards, 1))) {}
+
+size_t ContextRegistry::ShardOf(uint64_t key) const noexcept {
+  // keys are often sequential, mix them before masking; a change needs a new snapshot::kSharding
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  return key & (m_shards.size() - 1);
+}
+
+ConcreteContext& ContextRegistry::Emplace(uint64_t key) {
+  auto& shard = m_shards[ShardOf(key)];
+  std::lock_guard lck(shard.mutex);
+  auto& context = shard.contexts[key];
+  if (!context) {
+    context = std::make_unique<ConcreteContext>(key);
+  }
+  return *context;
+}
+
+ConcreteContext* ContextRegistry::Find(uint64_t key) {
+  auto& shard = m_shards[ShardOf(key)];
+  std::lock_guard lck(shard.mutex);
+  auto it = shard.contexts.find(key);
+  return it == shard.contexts.end() ? nullptr : it->second.get();
+}
+
+bool ContextRegistry::Erase(uint64_t key) {
+  auto& shard = m_shards[ShardOf(key)];
+  std::lock_guard lck(shard.mutex);
+  return shard.contexts.erase(key) > 0;
+}
+
+size_t ContextRegistry::Size() const {
+  size_t size = 0;
+  for (const auto& shard : m_shards) {
+    std::lock_guard lck(shard.mutex);
+    size += shard.contexts.size();
+  }
+  return size;
+}
+
+void ContextRegistry::Save(const std::filesystem::path& path, size_t threads) {
+  // the whole registry is frozen while the records are written
+  std::vector<std::unique_lock<std::mutex>> locks;
+  locks.reserve(m_shards.size());
+  std::vector<uint64_t> offsets(m_shards.size() + 1, 0);
+  for (size_t i = 0; i < m_shards.size(); ++i) {
+    locks.emplace_back(m_shards[i].mutex);
+    offsets[i + 1] = offsets[i] + m_shards[i].contexts.size();
+  }
+  auto count = offsets.back();
+  auto records_at = sizeof(snapshot::Header) + offsets.size() * sizeof(uint64_t);
+
+  auto temporary = path;
+  temporary += ".tmp";
+  Mapping file;
+  file.size = records_at + count * sizeof(snapshot::Record);
+  file.fd = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (file.fd < 0) {
+    Fail("can't create", temporary);
+  }
+  if (ftruncate(file.fd, static_cast<off_t>(file.size)) != 0) {
+    Fail("can't resize", temporary);
+  }
+  file.data = mmap(nullptr, file.size, PROT_READ | PROT_WRITE, MAP_SHARED, file.fd, 0);
+  if (file.data == MAP_FAILED) {
+    Fail("can't map", temporary);
+  }
+  auto* base = static_cast<std::byte*>(file.data);
+
+  snapshot::Header header{};
+  std::memcpy(header.magic, snapshot::kMagic, sizeof(header.magic));
+  header.version = snapshot::kVersion;
+  header.shards = static_cast<uint32_t>(m_shards.size());
+  header.count = count;
+  header.saved_at_ms = NowMs();
+  header.sharding = snapshot::kSharding;
+  std::memcpy(base, &header, sizeof(header));
+  std::memcpy(base + sizeof(header), offsets.data(), offsets.size() * sizeof(uint64_t));
+
+  auto* records = reinterpret_cast<snapshot::Record*>(base + records_at);
+  Parallel(m_shards.size(), threads, [&](size_t index) {
+    auto* record = records + offsets[index];
+    for (auto& [key, context] : m_shards[index].contexts) {
+      auto saved = context->Save();
+      auto left = std::min<int64_t>(saved.timer_left.count(), UINT32_MAX);
+      *record++ = {key, static_cast<uint32_t>(left), saved.state,
+                   static_cast<uint16_t>(saved.timer_running ? snapshot::kTimerRunning : 0)};
+    }
+  });
+  locks.clear();
+
+  if (munmap(file.data, file.size) != 0 || fsync(file.fd) != 0) {
+    Fail("can't write", temporary);
+  }
+  file.data = MAP_FAILED;
+  std::filesystem::rename(temporary, path);
+  // the rename is durable only with the directory entry
+  auto directory = path.parent_path().empty() ? std::filesystem::path(".") : path.parent_path();
+  Mapping parent;
+  parent.fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (parent.fd < 0 || fsync(parent.fd) != 0) {
+    Fail("can't sync", directory);
+  }
+  spdlog::debug("snapshot: saved {} contexts to {}", count, path.string());
+}
+
+size_t ContextRegistry::Restore(const std::filesystem::path& path, size_t threads) {
+  Mapping file;
+  file.fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file.fd < 0) {
+    Fail("can't open", path);
+  }
+  struct stat info {};
+  if (fstat(file.fd, &info) != 0) {
+    Fail("can't stat", path);
+  }
+  file.size = static_cast<size_t>(info.st_size);
+  if (file.size < sizeof(snapshot::Header)) {
+    throw std::runtime_error("snapshot: truncated " + path.string());
+  }
+  file.data = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, file.fd, 0);
+  if (file.data == MAP_FAILED) {
+    Fail("can't map", path);
+  }
+  const auto* base = static_cast<const std::byte*>(file.data);
+
+  snapshot::Header header{};
+  std::memcpy(&header, base, sizeof(header));
+  if (std::memcmp(header.magic, snapshot::kMagic, sizeof(header.magic)) != 0 || header.version != snapshot::kVersion ||
+      header.shards == 0) {
+    throw std::runtime_error("snapshot: not a context snapshot " + path.string());
+  }
+  auto records_at = sizeof(header) + (header.shards + 1ULL) * sizeof(uint64_t);
+  if (file.size < records_at || (file.size - records_at) / sizeof(snapshot::Record) < header.count) {
+    throw std::runtime_error("snapshot: truncated " + path.string());
+  }
+  std::vector<uint64_t> offsets(header.shards + 1);
+  std::memcpy(offsets.data(), base + sizeof(header), offsets.size() * sizeof(uint64_t));
+  if (offsets.front() != 0 || offsets.back() != header.count || !std::is_sorted(offsets.begin(), offsets.end())) {
+    throw std::runtime_error("snapshot: corrupted offsets " + path.string());
+  }
+  const auto* records = reinterpret_cast<const snapshot::Record*>(base + records_at);
+
+  // the steady clock does not survive a restart, the down time is measured by the system clock
+  auto down = std::chrono::milliseconds(std::max<int64_t>(NowMs() - header.saved_at_ms, 0));
+  auto restore = [down](ConcreteContext& context, const snapshot::Record& record) {
+    ConcreteContext::Snapshot saved;
+    saved.state = record.state;
+    saved.timer_running = (record.flags & snapshot::kTimerRunning) != 0;
+    saved.timer_left = std::max(std::chrono::milliseconds(record.timer_left) - down, std::chrono::milliseconds::zero());
+    if (!context.Restore(saved)) {
+      spdlog::warn("snapshot: unknown state {} of context {}", record.state, record.key);
+    }
+  };
+
+  // with the same sharding every saved shard goes to exactly one shard, restored under one lock
+  bool same_shards = header.shards == m_shards.size() && header.sharding == snapshot::kSharding;
+  Parallel(header.shards, threads, [&](size_t index) {
+    auto begin = records + offsets[index];
+    auto end = records + offsets[index + 1];
+    if (begin == end) {
+      return;
+    }
+    if (same_shards) {
+      auto& shard = m_shards[ShardOf(begin->key)];
+      std::lock_guard lck(shard.mutex);
+      shard.contexts.reserve(shard.contexts.size() + (end - begin));
+      for (auto record = begin; record != end; ++record) {
+        auto& context = shard.contexts[record->key];
+        if (!context) {
+          context = std::make_unique<ConcreteContext>(record->key);
+        }
+        restore(*context, *record);
+      }
+    } else {
+      for (auto record = begin; record != end; ++record) {
+        restore(Emplace(record->key), *record);
+      }
+    }
+  });
+  spdlog::debug("snapshot: restored {} contexts from {}", header.count, path.string());
+  return header.count;
+}
+
+}  // end of namespace state
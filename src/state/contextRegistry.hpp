@@ -0,0 +1,182 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Sharded registry of concrete contexts with snapshot and restore.
+* @details Contexts are addressed by a 64 bit key and spread over shards by
+* key, every shard has its own lock. A snapshot is one binary file:
+*   header | record offset per shard | records of shard 0 | records of shard 1 ...
+* Every record is 16 bytes (key, left timer time, state id, flags), so the
+* file can be mapped and read in place. It is written to a temporary file
+* and renamed, a crash never leaves a torn snapshot behind.
+* Restore maps the file and rebuilds the shards in parallel, the timers are
+* corrected by the time the process was down. A saved shard is moved as a
+* whole only if the snapshot was written with the same shard count and shard
+* function, else every context is placed by its key.
+* Save() reads the contexts under the shard locks: contexts served while a
+* snapshot can be taken must be served through ForEach() or Visit().
+****************************************************************************/
+
+#ifndef SRC_STATE_CONTEXT_REGISTRY_HPP
+#define SRC_STATE_CONTEXT_REGISTRY_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "contextConcrete.hpp"
+
+//----------------------------------------------------------------------------
+// Public Function Prototypes
+//----------------------------------------------------------------------------
+
+namespace state {
+
+/**
+ * @brief on-disk layout of a context snapshot
+ */
+namespace snapshot {
+
+inline constexpr char kMagic[8] = {'C', 'T', 'X', 'S', 'N', 'A', 'P', '\0'};
+inline constexpr uint32_t kVersion = 1;
+inline constexpr uint32_t kSharding = 1;  ///< shard function of ContextRegistry, changed with it
+
+struct Header {
+  char magic[8];         ///< kMagic
+  uint32_t version;      ///< kVersion
+  uint32_t shards;       ///< number of shards, followed by shards + 1 record offsets
+  uint64_t count;        ///< number of records
+  int64_t saved_at_ms;   ///< system clock at save, used to correct the timers
+  uint32_t sharding;     ///< kSharding of the writer
+  uint32_t reserved;     ///< 0
+};
+
+struct Record {
+  uint64_t key;          ///< context key
+  uint32_t timer_left;   ///< left timer time in ms, saturated
+  uint16_t state;        ///< state id
+  uint16_t flags;        ///< kTimerRunning
+};
+
+inline constexpr uint16_t kTimerRunning = 0x0001;
+
+static_assert(sizeof(Header) == 40 && sizeof(Record) == 16, "snapshot layout must not depend on the compiler");
+
+}  // namespace snapshot
+
+/**
+ * @class Context registry
+ * @brief owns the contexts of a process, keyed and sharded
+ */
+class ContextRegistry {
+ public:
+  /**
+   * @brief constructor
+   * @param shards - number of shards, rounded up to a power of two
+   */
+  explicit ContextRegistry(size_t shards = 64);
+
+  ContextRegistry(const ContextRegistry&) = delete;
+  ContextRegistry& operator=(const ContextRegistry&) = delete;
+
+  /**
+   * @brief get or create the context
+   * @details the context is used without a lock, not while Save() runs
+   * @param key - context key
+   * @return context, stays valid until it is erased
+   */
+  ConcreteContext& Emplace(uint64_t key);
+
+  /**
+   * @brief find a context
+   * @details the context is used without a lock, not while Save() runs
+   * @return context or nullptr
+   */
+  [[nodiscard]] ConcreteContext* Find(uint64_t key);
+
+  /**
+   * @brief remove a context
+   * @return true if it existed
+   */
+  bool Erase(uint64_t key);
+
+  /**
+   * @brief number of contexts
+   */
+  [[nodiscard]] size_t Size() const;
+
+  /**
+   * @brief call a function for every context, shard by shard under the shard lock
+   */
+  template <class TFunction>
+  void ForEach(TFunction&& function) {
+    for (auto& shard : m_shards) {
+      std::lock_guard lck(shard.mutex);
+      for (auto& [key, context] : shard.contexts) {
+        function(key, *context);
+      }
+    }
+  }
+
+  /**
+   * @brief call a function for one context under its shard lock
+   * @return false if there is no such context
+   */
+  template <class TFunction>
+  bool Visit(uint64_t key, TFunction&& function) {
+    auto& shard = m_shards[ShardOf(key)];
+    std::lock_guard lck(shard.mutex);
+    auto it = shard.contexts.find(key);
+    if (it == shard.contexts.end()) {
+      return false;
+    }
+    function(*it->second);
+    return true;
+  }
+
+  /**
+   * @brief write the snapshot of all contexts
+   * @details holds all shard locks while the contexts are read, so it is safe against contexts served through
+   * ForEach() or Visit(); references from Emplace() or Find() must not be used concurrently
+   * @param path - snapshot file, replaced atomically
+   * @param threads - number of threads filling the records, 0 - hardware concurrency
+   * @throw std::runtime_error on I/O errors
+   */
+  void Save(const std::filesystem::path& path, size_t threads = 0);
+
+  /**
+   * @brief add the contexts of a snapshot
+   * @param path - snapshot file
+   * @param threads - number of threads rebuilding the shards, 0 - hardware concurrency
+   * @return number of restored contexts
+   * @throw std::runtime_error if the file can not be read or is not a snapshot
+   */
+  size_t Restore(const std::filesystem::path& path, size_t threads = 0);
+
+ private:
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, std::unique_ptr<ConcreteContext>> contexts;
+  };
+
+  [[nodiscard]] size_t ShardOf(uint64_t key) const noexcept;
+
+  std::vector<Shard> m_shards;  ///< shards, power of two
+};
+
+}  // end of namespace state
+
+#endif /* SRC_STATE_CONTEXT_REGISTRY_HPP */
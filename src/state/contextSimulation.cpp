@@ -0,0 +1,59 @@
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include "contextSimulation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+//----------------------------------------------------------------------------
+// Public Function Prototypes
+//----------------------------------------------------------------------------
+
+namespace state {
+
+ContextSimulation::ContextSimulation(size_t contexts, std::chrono::milliseconds wait_default)
+    : m_wait_default(wait_default) {
+  ContextClock::UseVirtual(true);
+  watch::VirtualClock::Reset();
+  m_contexts.reserve(contexts);
+  m_due.reserve(contexts);
+  for (size_t index = 0; index < contexts; ++index) {
+    m_contexts.push_back(std::make_unique<ConcreteContext>(index));
+    m_due.emplace_back(0, static_cast<uint32_t>(index));
+  }
+}
+
+ContextSimulation::~ContextSimulation() {
+  ContextClock::UseVirtual(false);
+}
+
+ContextSimulation::Result ContextSimulation::Run(std::chrono::milliseconds duration) {
+  Result result;
+  auto end = (Now() + duration).count();
+  while (!m_due.empty() && m_due.front().first <= end) {
+    std::pop_heap(m_due.begin(), m_due.end(), std::greater<>{});
+    auto [due, index] = m_due.back();
+    watch::VirtualClock::AdvanceTo(watch::VirtualClock::time_point(std::chrono::milliseconds(due)));
+    auto& context = *m_contexts[index];
+    auto before = context.StateId();
+    // never spin: a timer at its deadline is elapsed one tick later
+    auto sooner = std::max(context.Serve(m_wait_default), std::chrono::milliseconds(1));
+    result.serves++;
+    if (before != 0 && context.StateId() != before) {
+      result.transitions++;
+    }
+    m_due.back().first = due + sooner.count();
+    std::push_heap(m_due.begin(), m_due.end(), std::greater<>{});
+  }
+  watch::VirtualClock::AdvanceTo(watch::VirtualClock::time_point(std::chrono::milliseconds(end)));
+  return result;
+}
+
+std::chrono::milliseconds ContextSimulation::Now() const {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(watch::VirtualClock::now().time_since_epoch());
+}
+
+}  // end of namespace state
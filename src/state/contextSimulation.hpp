@@ -0,0 +1,96 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Serve loop of many contexts in simulated time.
+* @details The counterpart of the context worker threads on the virtual
+* clock: instead of sleeping until the nearest timer expiry, the clock jumps
+* to it. Every context is served at the time its previous Serve() asked for,
+* the contexts due next come from a min heap. A run is deterministic and
+* takes as long as the serves need, not the simulated time.
+****************************************************************************/
+
+#ifndef SRC_STATE_CONTEXT_SIMULATION_HPP
+#define SRC_STATE_CONTEXT_SIMULATION_HPP
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "contextConcrete.hpp"
+
+//----------------------------------------------------------------------------
+// Public Function Prototypes
+//----------------------------------------------------------------------------
+
+namespace state {
+
+/**
+ * @class Context simulation
+ * @brief owns contexts and serves them on watch::VirtualClock
+ * @details switches ContextClock to the virtual clock for its lifetime and
+ * starts the virtual clock at 0, one simulation at a time per process.
+ */
+class ContextSimulation {
+ public:
+  /**
+   * @brief counts of a run
+   */
+  struct Result {
+    uint64_t serves{0};       ///< calls of Serve()
+    uint64_t transitions{0};  ///< state changes, the start of a context not counted
+  };
+
+  /**
+   * @brief constructor
+   * @param contexts - number of contexts, all due at time 0
+   * @param wait_default - max. interval between two services, as in the worker
+   */
+  explicit ContextSimulation(size_t contexts,
+                             std::chrono::milliseconds wait_default = std::chrono::milliseconds(4000));
+  ~ContextSimulation();
+
+  ContextSimulation(const ContextSimulation&) = delete;
+  ContextSimulation& operator=(const ContextSimulation&) = delete;
+
+  /**
+   * @brief serve the contexts until the simulated time has advanced by duration
+   * @return serves and transitions of this run
+   */
+  Result Run(std::chrono::milliseconds duration);
+
+  /**
+   * @brief simulated time since the start
+   */
+  [[nodiscard]] std::chrono::milliseconds Now() const;
+
+  [[nodiscard]] ConcreteContext& Context(size_t index) {
+    return *m_contexts[index];
+  }
+
+  [[nodiscard]] size_t Size() const {
+    return m_contexts.size();
+  }
+
+ private:
+  using Due = std::pair<int64_t, uint32_t>;  ///< ms of the next serve, context index
+
+  std::vector<std::unique_ptr<ConcreteContext>> m_contexts;  ///< simulated contexts
+  std::vector<Due> m_due;                                    ///< min heap of the next serves
+  std::chrono::milliseconds m_wait_default;                  ///< max. interval between two services
+};
+
+}  // namespace state
+
+#endif /* SRC_STATE_CONTEXT_SIMULATION_HPP */
@@ -0,0 +1,233 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Dump of the flight recorder of a state process.
+* @details Maps the shared memory object of the recorder read-only, copies
+* the records of all rings, merges them by time and prints them decoded.
+* The process may be running or gone: its object stays in /dev/shm unless
+* it closed the recorder on an orderly exit. Time stamp counter ticks are
+* converted with a frequency measured by this tool, the counter is the same
+* on the whole machine.
+****************************************************************************/
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "flightRecorder.hpp"
+
+using namespace logging;
+
+//-----------------------------------------------------------------------------
+// local Typedefs, Enums, Unions
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief command line configuration
+ */
+struct Config {
+  std::string name;                 ///< shared memory name, empty - newest recorder
+  size_t last{0};                   ///< print the last records only, 0 - all
+  std::optional<uint64_t> context;  ///< print the records of one context only
+};
+
+//-----------------------------------------------------------------------------
+// local Function Definitions
+//-----------------------------------------------------------------------------
+
+/************************************************************************/ /**
+* @fn      void ViewHelp(const char* prog)
+* @brief   view help
+****************************************************************************/
+static void ViewHelp(const char* prog) {
+  printf("Usage: %s [OPTION]\n"
+         "  -p, --pid=PID            dump the recorder of a process, default the newest one\n"
+         "  -n, --name=NAME          shared memory name of the recorder, e.g. /state_flight.1234\n"
+         "  -l, --last=N             print the last N records only\n"
+         "  -c, --context=ID         print the records of one context only\n"
+         "  -h, --help               this message\n\n",
+         prog);
+}
+
+/************************************************************************/ /**
+* @fn      void ProcessOptions(int argc, char* argv[], Config& config)
+* @brief   parse command line parameters
+****************************************************************************/
+static void ProcessOptions(int argc, char* argv[], Config& config) {
+  static const struct option long_options[] = {
+      {"pid", required_argument, 0, 'p'},
+      {"name", required_argument, 0, 'n'},
+      {"last", required_argument, 0, 'l'},
+      {"context", required_argument, 0, 'c'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "p:n:l:c:h", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'p':
+        config.name = flight::Name(std::stoll(optarg));
+        break;
+      case 'n':
+        config.name = optarg;
+        break;
+      case 'l':
+        config.last = std::stoul(optarg);
+        break;
+      case 'c':
+        config.context = std::stoull(optarg);
+        break;
+      default:
+        ViewHelp(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/**
+ * @brief name of the most recently written recorder in /dev/shm
+ */
+static std::string NewestRecorder() {
+  std::string newest;
+  auto newest_time = std::filesystem::file_time_type::min();
+  std::error_code ec;
+  for (auto& entry : std::filesystem::directory_iterator("/dev/shm", ec)) {
+    auto file = entry.path().filename().string();
+    if (file.starts_with("state_flight.") && entry.last_write_time(ec) >= newest_time) {
+      newest = "/" + file;
+      newest_time = entry.last_write_time(ec);
+    }
+  }
+  return newest;
+}
+
+/**
+ * @brief time stamp counter ticks per nanosecond
+ */
+static double TicksPerNanosecond(const flight::Header& header) {
+  if (header.flags & flight::kTicksAreNanoseconds) {
+    return 1.0;
+  }
+  auto start = std::chrono::steady_clock::now();
+  auto ticks = flight::Ticks();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  return static_cast<double>(flight::Ticks() - ticks) / elapsed;
+}
+
+/**
+ * @brief printed name of a record type
+ */
+static const char* KindName(flight::Kind kind) {
+  switch (kind) {
+    case flight::Kind::Start:
+      return "start";
+    case flight::Kind::Transition:
+      return "transition";
+    case flight::Kind::TimerExpired:
+      return "timer";
+    case flight::Kind::Restored:
+      return "restored";
+  }
+  return "?";
+}
+
+/************************************************************************/ /**
+* @fn      int main()
+* @brief   dump the flight recorder
+* @return EXIT_SUCCESS if successfully, otherwise - EXIT_FAILURE
+****************************************************************************/
+int main(int argc, char** argv) {
+  Config config;
+  ProcessOptions(argc, argv, config);
+  if (config.name.empty()) {
+    config.name = NewestRecorder();
+    if (config.name.empty()) {
+      fprintf(stderr, "no flight recorder in /dev/shm\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  int fd = shm_open(config.name.c_str(), O_RDONLY, 0);
+  struct stat info {};
+  if (fd < 0 || fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(flight::Header)) {
+    fprintf(stderr, "can't open the flight recorder %s\n", config.name.c_str());
+    return EXIT_FAILURE;
+  }
+  auto size = static_cast<size_t>(info.st_size);
+  auto* base = static_cast<const char*>(mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0));
+  close(fd);
+  if (base == MAP_FAILED) {
+    fprintf(stderr, "can't map the flight recorder %s\n", config.name.c_str());
+    return EXIT_FAILURE;
+  }
+  // the magic first, the recorder writes it after the rest of the header
+  flight::Header header;
+  std::memcpy(header.magic, base, sizeof(header.magic));
+  std::atomic_thread_fence(std::memory_order_acquire);
+  std::memcpy(&header, base, sizeof(header));
+  if (!flight::Valid(header, size)) {
+    fprintf(stderr, "%s is not a flight recorder\n", config.name.c_str());
+    return EXIT_FAILURE;
+  }
+
+  std::vector<flight::Entry> entries;
+  for (uint32_t ring = 0; ring < header.rings; ++ring) {
+    flight::CopyRing(header, base, ring, entries);
+  }
+  if (config.context) {
+    std::erase_if(entries, [&config](const flight::Entry& entry) { return entry.record.context != *config.context; });
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const flight::Entry& a, const flight::Entry& b) { return a.record.ticks < b.record.ticks; });
+  if (config.last && entries.size() > config.last) {
+    entries.erase(entries.begin(), entries.end() - static_cast<ptrdiff_t>(config.last));
+  }
+
+  auto ticks_per_ns = TicksPerNanosecond(header);
+  printf("%s: pid %lld, %u rings of %u records, %llu threads without a ring, %zu records\n", config.name.c_str(),
+         static_cast<long long>(header.pid), header.rings, header.slots,
+         static_cast<unsigned long long>(header.dropped), entries.size());
+  for (const auto& [record, tid] : entries) {
+    auto since_base = static_cast<double>(static_cast<int64_t>(record.ticks - header.base_ticks)) / ticks_per_ns;
+    auto realtime = header.base_realtime_ns + static_cast<int64_t>(since_base);
+    time_t seconds = realtime / 1000000000;
+    tm local{};
+    localtime_r(&seconds, &local);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%F %T", &local);
+    printf("%s.%06lld tid %-7d context %-10llu %-10s %u -> %u", stamp,
+           static_cast<long long>(realtime % 1000000000 / 1000), tid, static_cast<unsigned long long>(record.context),
+           KindName(record.kind), record.from, record.to);
+    if (record.timer_left_ms != flight::kNoTimer) {
+      printf("  timer left %d ms", record.timer_left_ms);
+    }
+    printf("\n");
+  }
+  munmap(const_cast<char*>(base), size);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,400 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Hierarchical (nested) state machine on top of state::State.
+* @details A StateChart describes the hierarchy once: parent, initial child,
+* depth and history flag of every state, stored as flat arrays indexed by a
+* small StateId. Any number of StateMachine objects (one per context) share
+* the chart. A machine constructs all its state objects in one contiguous
+* block and keeps only the active leaf and the shallow history per
+* composite state.
+* An event is offered to the active leaf first and bubbles up to the
+* superstates until one handles it. A transition exits the states up to the
+* least common ancestor with the target (DoExit, innermost first) and enters
+* the states down to the target (DoEnter, outermost first). A composite
+* target is then refined by its history (if enabled and recorded) or its
+* initial child until a leaf is reached.
+****************************************************************************/
+
+#ifndef SRC_STATE_HSM_HPP
+#define SRC_STATE_HSM_HPP
+
+//------------------------------------------------------------------------------
+// includes
+//------------------------------------------------------------------------------
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "state.hpp"
+
+//------------------------------------------------------------------------------
+// Declarations
+//------------------------------------------------------------------------------
+
+namespace state {
+
+using StateId = uint16_t;
+inline constexpr StateId kNoState = UINT16_MAX;  ///< no state / the top of the hierarchy
+
+/**
+ * @brief result of handling an event in a hierarchical state
+ */
+struct Reaction {
+  enum class Kind : uint8_t { Unhandled, Handled, Transition };
+  Kind kind;
+  StateId target;
+};
+
+/**
+ * @class Template for a hierarchical state
+ * @brief state which can be a superstate of other states and handles events
+ * @details Unlike flat states, DoEnter() is not called by the constructor but by
+ * the state machine, which also calls DoExit(). DoServe() of the flat pattern is
+ * not used, events are passed to DoHandle().
+ */
+template <class TContext, class TEvent>
+class HierarchicalState : public State<TContext> {
+ public:
+  using State<TContext>::State;
+
+  /**
+   * @brief handle an event
+   * @param event - dispatched event
+   * @return Unhandled() to bubble the event to the superstate, Handled() or TransitionTo()
+   */
+  [[nodiscard]] virtual Reaction DoHandle([[maybe_unused]] const TEvent& event) {
+    return Unhandled();
+  }
+
+  [[nodiscard]] std::optional<typename State<TContext>::Transition> DoServe() override {
+    return std::nullopt;
+  }
+
+  /**
+   * @brief entry action, called by the state machine
+   */
+  void Enter() {
+    this->DoEnter();
+  }
+
+  /**
+   * @brief exit action, called by the state machine
+   */
+  void Exit() {
+    this->DoExit();
+  }
+
+ protected:
+  void DoEnter() override {}
+
+  [[nodiscard]] static constexpr Reaction Unhandled() noexcept {
+    return {Reaction::Kind::Unhandled, kNoState};
+  }
+  [[nodiscard]] static constexpr Reaction Handled() noexcept {
+    return {Reaction::Kind::Handled, kNoState};
+  }
+  [[nodiscard]] static constexpr Reaction TransitionTo(StateId target) noexcept {
+    return {Reaction::Kind::Transition, target};
+  }
+};
+
+/**
+ * @brief hierarchy of states, shared by all machines of one kind
+ */
+template <class TContext, class TEvent>
+class StateChart {
+ public:
+  using StateBase = HierarchicalState<TContext, TEvent>;
+  static constexpr size_t kMaxDepth = 16;
+
+  /**
+   * @brief add a state
+   * @tparam TState - state type, constructible from TContext*
+   * @param parent - superstate or kNoState for a top level state
+   * @param history - re-entering this superstate resumes its last active child
+   * @return id of the new state
+   */
+  template <class TState>
+  StateId Add(StateId parent = kNoState, bool history = false) {
+    static_assert(std::is_base_of_v<StateBase, TState>, "state must derive from HierarchicalState");
+    if (m_parent.size() >= kNoState || (parent != kNoState && parent >= m_parent.size())) {
+      throw std::invalid_argument("state chart: invalid parent");
+    }
+    auto depth = static_cast<uint8_t>(parent == kNoState ? 0 : m_depth[parent] + 1);
+    if (depth >= kMaxDepth) {
+      throw std::invalid_argument("state chart: hierarchy too deep");
+    }
+    auto id = static_cast<StateId>(m_parent.size());
+    m_parent.push_back(parent);
+    m_initial.push_back(kNoState);
+    m_depth.push_back(depth);
+    m_history.push_back(history);
+
+    // states are constructed in one block, keep every slot aligned
+    m_size = (m_size + alignof(TState) - 1) / alignof(TState) * alignof(TState);
+    m_offset.push_back(m_size);
+    m_size += sizeof(TState);
+    m_align = std::max(m_align, alignof(TState));
+    m_construct.push_back([](void* where, TContext* context) -> StateBase* { return new (where) TState(context); });
+
+    // the first child becomes the initial one
+    if (parent == kNoState) {
+      if (m_root_initial == kNoState) {
+        m_root_initial = id;
+      }
+    } else if (m_initial[parent] == kNoState) {
+      m_initial[parent] = id;
+    }
+    return id;
+  }
+
+  /**
+   * @brief set the initial child of a superstate (kNoState - the top level)
+   */
+  void SetInitial(StateId composite, StateId child) {
+    if (child >= m_parent.size() || m_parent[child] != composite) {
+      throw std::invalid_argument("state chart: initial state must be a direct child");
+    }
+    (composite == kNoState ? m_root_initial : m_initial[composite]) = child;
+  }
+
+  [[nodiscard]] size_t Size() const noexcept {
+    return m_parent.size();
+  }
+  [[nodiscard]] StateId Parent(StateId id) const noexcept {
+    return m_parent[id];
+  }
+  [[nodiscard]] StateId Initial(StateId id) const noexcept {
+    return id == kNoState ? m_root_initial : m_initial[id];
+  }
+  [[nodiscard]] uint8_t Depth(StateId id) const noexcept {
+    return m_depth[id];
+  }
+  [[nodiscard]] bool HasHistory(StateId id) const noexcept {
+    return id != kNoState && m_history[id];
+  }
+
+ private:
+  template <class, class>
+  friend class StateMachine;
+
+  using Construct = StateBase* (*)(void*, TContext*);
+
+  std::vector<StateId> m_parent;     ///< superstate per state
+  std::vector<StateId> m_initial;    ///< initial child per state
+  std::vector<uint8_t> m_depth;      ///< nesting depth per state
+  std::vector<bool> m_history;       ///< shallow history enabled per state
+  std::vector<size_t> m_offset;      ///< offset of the state object in a machine block
+  std::vector<Construct> m_construct;  ///< placement constructors
+  StateId m_root_initial{kNoState};  ///< initial top level state
+  size_t m_size{0};                  ///< size of a machine block
+  size_t m_align{alignof(StateBase*)};        ///< alignment of a machine block
+};
+
+/**
+ * @brief one running hierarchical state machine, e.g. per context
+ */
+template <class TContext, class TEvent>
+class StateMachine {
+ public:
+  using Chart = StateChart<TContext, TEvent>;
+  using StateBase = typename Chart::StateBase;
+
+  /**
+   * @brief construct all states of the chart for the context
+   * @param chart - shared hierarchy, must not change anymore
+   * @param context - context passed to the states
+   */
+  StateMachine(std::shared_ptr<const Chart> chart, TContext* context)
+      : m_chart(std::move(chart)),
+        m_block(static_cast<std::byte*>(::operator new(BlockSize(), std::align_val_t(m_chart->m_align)))) {
+    std::fill_n(HistoryData(), m_chart->Size(), kNoState);
+    size_t built = 0;
+    try {
+      for (; built < m_chart->Size(); ++built) {
+        StatesData()[built] = m_chart->m_construct[built](m_block + ObjectsOffset() + m_chart->m_offset[built], context);
+      }
+    } catch (...) {
+      Destroy(built);
+      throw;
+    }
+  }
+
+  StateMachine(const StateMachine&) = delete;
+  StateMachine& operator=(const StateMachine&) = delete;
+
+  ~StateMachine() {
+    Destroy(m_chart->Size());
+  }
+
+  /**
+   * @brief enter the initial configuration
+   */
+  void Start() {
+    m_current = kNoState;
+    EnterDown(kNoState, m_chart->Initial(kNoState));
+  }
+
+  /**
+   * @brief offer an event to the active leaf and its superstates
+   * @return true if a state handled the event
+   */
+  bool Dispatch(const TEvent& event) {
+    if (m_leaf == nullptr) {
+      return false;
+    }
+    // the leaf is cached in the machine, so handling in the leaf costs the same as a flat state
+    auto reaction = m_leaf->DoHandle(event);
+    for (auto id = m_chart->m_parent[m_current]; reaction.kind == Reaction::Kind::Unhandled && id != kNoState;
+         id = m_chart->m_parent[id]) {
+      reaction = Get(id).DoHandle(event);
+    }
+    if (reaction.kind == Reaction::Kind::Transition) {
+      Transit(reaction.target);
+    }
+    return reaction.kind != Reaction::Kind::Unhandled;
+  }
+
+  /**
+   * @brief go to target, exiting and entering the states in between
+   */
+  void Transit(StateId target) {
+    const auto& parent = m_chart->m_parent;
+    auto lca = CommonAncestor(m_current, target);
+    if (lca == target) {
+      // target is the active state or one of its superstates: leave and re-enter it
+      lca = parent[target];
+    }
+    for (auto id = m_current; id != lca; id = parent[id]) {
+      if (m_chart->HasHistory(parent[id])) {
+        HistoryData()[parent[id]] = id;
+      }
+      Get(id).Exit();
+    }
+    EnterDown(lca, target);
+  }
+
+  /**
+   * @brief active leaf state
+   */
+  [[nodiscard]] StateId Current() const noexcept {
+    return m_current;
+  }
+
+  /**
+   * @brief is the state active, either as leaf or as one of its superstates
+   */
+  [[nodiscard]] bool IsIn(StateId id) const noexcept {
+    for (auto active = m_current; active != kNoState; active = m_chart->m_parent[active]) {
+      if (active == id) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * @brief last active child of a superstate with history
+   */
+  [[nodiscard]] StateId History(StateId composite) const noexcept {
+    return const_cast<StateMachine*>(this)->HistoryData()[composite];
+  }
+
+  /**
+   * @brief state object by id
+   */
+  [[nodiscard]] StateBase& Get(StateId id) noexcept {
+    return *StatesData()[id];
+  }
+
+ private:
+  [[nodiscard]] StateId CommonAncestor(StateId a, StateId b) const noexcept {
+    if (a == kNoState || b == kNoState) {
+      return kNoState;
+    }
+    const auto& parent = m_chart->m_parent;
+    const auto& depth = m_chart->m_depth;
+    while (depth[a] > depth[b]) {
+      a = parent[a];
+    }
+    while (depth[b] > depth[a]) {
+      b = parent[b];
+    }
+    while (a != b) {
+      a = parent[a];
+      b = parent[b];
+    }
+    return a;
+  }
+
+  /**
+   * @brief enter the states from below ancestor down to target, then refine to a leaf
+   */
+  void EnterDown(StateId ancestor, StateId target) {
+    std::array<StateId, Chart::kMaxDepth> path;
+    size_t length = 0;
+    for (auto id = target; id != ancestor && id != kNoState; id = m_chart->m_parent[id]) {
+      path[length++] = id;
+    }
+    while (length > 0) {
+      Get(path[--length]).Enter();
+    }
+    auto id = target;
+    for (auto child = m_chart->m_initial[id]; child != kNoState; child = m_chart->m_initial[id]) {
+      if (m_chart->HasHistory(id) && HistoryData()[id] != kNoState) {
+        child = HistoryData()[id];
+      }
+      id = child;
+      Get(id).Enter();
+    }
+    m_current = id;
+    m_leaf = &Get(id);
+  }
+
+  // the block holds the pointers to the states and the history per state, followed by the state objects
+  [[nodiscard]] size_t ObjectsOffset() const noexcept {
+    auto size = m_chart->Size() * (sizeof(StateBase*) + sizeof(StateId));
+    return (size + m_chart->m_align - 1) / m_chart->m_align * m_chart->m_align;
+  }
+  [[nodiscard]] size_t BlockSize() const noexcept {
+    return ObjectsOffset() + m_chart->m_size;
+  }
+  [[nodiscard]] StateBase** StatesData() noexcept {
+    return reinterpret_cast<StateBase**>(m_block);
+  }
+  [[nodiscard]] StateId* HistoryData() noexcept {
+    return reinterpret_cast<StateId*>(m_block + m_chart->Size() * sizeof(StateBase*));
+  }
+
+  void Destroy(size_t count) noexcept {
+    for (size_t i = count; i-- > 0;) {
+      Get(static_cast<StateId>(i)).~StateBase();
+    }
+    ::operator delete(m_block, std::align_val_t(m_chart->m_align));
+    m_block = nullptr;
+  }
+
+  std::shared_ptr<const Chart> m_chart;  ///< shared hierarchy
+  std::byte* m_block;                    ///< state objects and history, one allocation per machine
+  StateId m_current{kNoState};           ///< active leaf
+  StateBase* m_leaf{nullptr};            ///< active leaf object
+};
+
+}  // end of namespace state
+
+#endif /* SRC_STATE_HSM_HPP */
@@ -0,0 +1,592 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Synthetic filesystem churn generator for fswatch stress tests.
+* @details Drives a target directory (preferably on tmpfs) with a reproducible
+* mix of file creates, `mkdir -p` cascades, rename storms and large appends
+* at a given rate, while an in-process fswatch observes the same directory.
+* At the end the generated operations are correlated with the watcher
+* counters to report dropped events, per-event latency and CPU per event.
+****************************************************************************/
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/magic.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <spdlog/sinks/basic_file_sink.h>
+
+#include "asyncLog.hpp"
+#include "fswatch.hpp"
+
+using namespace std::chrono_literals;
+
+//-----------------------------------------------------------------------------
+// local Typedefs, Enums, Unions
+//-----------------------------------------------------------------------------
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief kinds of generated filesystem operations
+ */
+enum class Operation : size_t { Create = 0, Mkdir, Rename, Append, Read, Count };
+
+/**
+ * @brief how the watcher callback logs every observed event
+ */
+enum class LogMode { None, Sync, Async };
+
+static constexpr std::array<const char*, static_cast<size_t>(Operation::Count)> kOperationNames{
+    "create", "mkdir", "rename", "append", "read"};
+
+/**
+ * @brief load generator configuration
+ */
+struct Config {
+  std::filesystem::path target{"/dev/shm/fsload"};  ///< directory holding the run directory
+  std::filesystem::path work;                       ///< fsload.XXXXXX below target, the only tree removed
+  uint64_t rate{1000};                              ///< operations per second, 0 - unthrottled
+  uint64_t operations{10000};                       ///< total number of operations
+  unsigned depth{4};                                ///< depth of a mkdir cascade
+  unsigned fanout{8};                               ///< number of working sub directories
+  size_t append_size{64 * 1024};                    ///< bytes written by one append
+  std::array<unsigned, static_cast<size_t>(Operation::Count)> mix{60, 10, 15, 15, 0};  ///< operation weights
+  uint64_t seed{1};                                 ///< random seed
+  std::chrono::milliseconds drain{500ms};           ///< idle time which ends the drain phase
+  LogMode log{LogMode::None};                       ///< logging per event
+  size_t executor_threads{0};                       ///< run callbacks on an executor, 0 - synchronous
+  watch::Backpressure policy{watch::Backpressure::Block};  ///< executor backpressure
+  std::chrono::microseconds handler_time{0};        ///< simulated handler work
+  std::string trace;                                ///< record the inotify batches to this file
+};
+
+/**
+ * @brief event expected from an issued operation
+ */
+struct Pending {
+  Clock::time_point issued;
+  fswatch::Event expected;
+  Operation operation;
+};
+
+/**
+ * @brief per operation statistic
+ */
+struct OperationStat {
+  uint64_t issued{0};
+  uint64_t expected{0};
+  uint64_t observed{0};
+};
+
+//-----------------------------------------------------------------------------
+// local/global Variables Definitions
+//-----------------------------------------------------------------------------
+static std::mutex pending_mutex;
+static std::unordered_map<std::string, Pending> pending;
+static std::vector<Clock::duration> latencies;
+static std::array<OperationStat, static_cast<size_t>(Operation::Count)> statistic;
+
+//-----------------------------------------------------------------------------
+// local Function Definitions
+//-----------------------------------------------------------------------------
+
+/************************************************************************/ /**
+* @fn      void ViewHelp(const char* prog)
+* @brief   view help
+****************************************************************************/
+static void ViewHelp(const char* prog) {
+  std::cout << "Usage: " << prog << " [OPTION]\n"
+            << "  -d, --dir=PATH           run in a fresh fsload.XXXXXX below PATH, default /dev/shm/fsload\n"
+            << "  -r, --rate=N             operations per second, 0 - unthrottled, default 1000\n"
+            << "  -n, --operations=N       total number of operations, default 10000\n"
+            << "  -D, --depth=N            depth of one mkdir cascade, default 4\n"
+            << "  -f, --fanout=N           number of working sub directories, default 8\n"
+            << "  -a, --append-size=BYTES  bytes written by one append, default 65536\n"
+            << "  -m, --mix=C,M,R,A,D      weights of create,mkdir,rename,append,read, default 60,10,15,15,0\n"
+            << "  -s, --seed=N             random seed, default 1\n"
+            << "  -l, --log=MODE           log every event to <run dir>.log: none, sync or async, default none\n"
+            << "  -e, --executor=N         run callbacks on an executor with N threads, default 0 - inline\n"
+            << "  -p, --policy=POLICY      executor backpressure: block, drop or coalesce, default block\n"
+            << "  -w, --handler-us=N       simulated handler work in microseconds, default 0\n"
+            << "  -t, --trace=PATH         record the inotify batches for bench_tracereplay\n"
+            << "  -h, --help               this message\n\n";
+}
+
+/************************************************************************/ /**
+* @fn      void ProcessOptions(int argc, char* argv[], Config& config)
+* @brief   parse command line parameters
+* @param argc - number parameters in command line
+* @param argv - command line parameters as array
+* @param config - configuration to fill
+****************************************************************************/
+static void ProcessOptions(int argc, char* argv[], Config& config) {
+  for (;;) {
+    int option_index = 0;
+    static const char* short_options = "h?d:r:n:D:f:a:m:s:l:e:p:w:t:";
+    static const struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"dir", required_argument, 0, 'd'},
+        {"rate", required_argument, 0, 'r'},
+        {"operations", required_argument, 0, 'n'},
+        {"depth", required_argument, 0, 'D'},
+        {"fanout", required_argument, 0, 'f'},
+        {"append-size", required_argument, 0, 'a'},
+        {"mix", required_argument, 0, 'm'},
+        {"seed", required_argument, 0, 's'},
+        {"log", required_argument, 0, 'l'},
+        {"executor", required_argument, 0, 'e'},
+        {"policy", required_argument, 0, 'p'},
+        {"handler-us", required_argument, 0, 'w'},
+        {"trace", required_argument, 0, 't'},
+        {0, 0, 0, 0},
+    };
+
+    int var = getopt_long(argc, argv, short_options, long_options, &option_index);
+
+    if (var == EOF) {
+      break;
+    }
+    switch (var) {
+      case 'd':
+        config.target = optarg;
+        break;
+      case 'r':
+        config.rate = std::stoull(optarg);
+        break;
+      case 'n':
+        config.operations = std::stoull(optarg);
+        break;
+      case 'D':
+        config.depth = std::max(1ul, std::stoul(optarg));
+        break;
+      case 'f':
+        config.fanout = std::max(1ul, std::stoul(optarg));
+        break;
+      case 'a':
+        config.append_size = std::stoull(optarg);
+        break;
+      case 'm': {
+        std::stringstream ss(optarg);
+        std::string item;
+        for (auto& weight : config.mix) {
+          weight = std::getline(ss, item, ',') ? std::stoul(item) : 0;
+        }
+        if (std::all_of(config.mix.begin(), config.mix.end(), [](auto weight) { return weight == 0; })) {
+          std::cerr << "At least one weight of --mix must not be 0" << std::endl;
+          ViewHelp(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      }
+      case 's':
+        config.seed = std::stoull(optarg);
+        break;
+      case 'l': {
+        std::string_view mode(optarg);
+        if (mode != "none" && mode != "sync" && mode != "async") {
+          std::cerr << "Unknown log mode " << mode << std::endl;
+          ViewHelp(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        config.log = mode == "sync" ? LogMode::Sync : mode == "async" ? LogMode::Async : LogMode::None;
+        break;
+      }
+      case 'e':
+        config.executor_threads = std::stoul(optarg);
+        break;
+      case 'p': {
+        std::string_view policy(optarg);
+        if (policy != "block" && policy != "drop" && policy != "coalesce") {
+          std::cerr << "Unknown backpressure policy " << policy << std::endl;
+          ViewHelp(argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        config.policy = policy == "drop"       ? watch::Backpressure::DropOldest
+                        : policy == "coalesce" ? watch::Backpressure::Coalesce
+                                               : watch::Backpressure::Block;
+        break;
+      }
+      case 'w':
+        config.handler_time = std::chrono::microseconds(std::stoul(optarg));
+        break;
+      case 't':
+        config.trace = optarg;
+        break;
+      case '?':
+      case 'h': {
+        ViewHelp(argv[0]);
+        exit(EXIT_SUCCESS);
+      }
+      default: {
+        ViewHelp(argv[0]);
+        exit(-1);
+      }
+    }
+  }
+}
+
+/**
+ * @brief key of a pending event
+ */
+static std::string PendingKey(const std::filesystem::path& path, fswatch::Event event) {
+  auto key = path.string();
+  key.push_back(static_cast<char>('0' + static_cast<int>(event)));
+  return key;
+}
+
+/**
+ * @brief remember an operation whose event is expected from the watcher
+ * @param path - full path of the expected event
+ * @param expected - expected event
+ * @param operation - issued operation
+ */
+static void Expect(const std::filesystem::path& path, fswatch::Event expected, Operation operation) {
+  std::lock_guard lck(pending_mutex);
+  // the same event on a path still pending is merged with it like the kernel does
+  if (pending.try_emplace(PendingKey(path, expected), Pending{Clock::now(), expected, operation}).second) {
+    statistic[static_cast<size_t>(operation)].expected++;
+  }
+}
+
+/**
+ * @brief match an event received from the watcher with its operation
+ * @param event - received event
+ */
+static void Observe(const fswatch::EventInfo& event) {
+  auto now = Clock::now();
+  std::lock_guard lck(pending_mutex);
+  if (auto it = pending.find(PendingKey(event.path, event.type)); it != pending.end()) {
+    latencies.push_back(now - it->second.issued);
+    statistic[static_cast<size_t>(it->second.operation)].observed++;
+    pending.erase(it);
+  }
+}
+
+/**
+ * @brief write a buffer to the end of file
+ */
+static void Append(const std::filesystem::path& path, const std::vector<char>& data) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    return;
+  }
+  for (size_t done = 0; done < data.size();) {
+    auto written = write(fd, data.data() + done, data.size() - done);
+    if (written <= 0) {
+      break;
+    }
+    done += static_cast<size_t>(written);
+  }
+  close(fd);
+}
+
+/**
+ * @brief get thread CPU time
+ */
+static std::chrono::nanoseconds ThreadCpuTime() {
+  timespec ts{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+/**
+ * @brief generate the filesystem churn
+ * @param config - configuration
+ */
+static void Generate(const Config& config) {
+  std::mt19937_64 rng(config.seed);
+  std::discrete_distribution<size_t> pick_operation(config.mix.begin(), config.mix.end());
+  std::uniform_int_distribution<unsigned> pick_dir(0, config.fanout - 1);
+  std::vector<char> data(config.append_size, 'x');
+  std::vector<std::vector<std::string>> files(config.fanout);
+  uint64_t sequence = 0;
+
+  auto start = Clock::now();
+  for (uint64_t n = 0; n < config.operations; ++n) {
+    if (config.rate) {
+      std::this_thread::sleep_until(start + std::chrono::nanoseconds(n * 1'000'000'000ull / config.rate));
+    }
+
+    auto operation = static_cast<Operation>(pick_operation(rng));
+    auto slot = pick_dir(rng);
+    auto dir = config.work / ("d" + std::to_string(slot));
+    auto& names = files[slot];
+
+    // rename, append and read need a file to work on
+    if ((operation == Operation::Rename || operation == Operation::Append || operation == Operation::Read) &&
+        names.empty()) {
+      operation = Operation::Create;
+    }
+    statistic[static_cast<size_t>(operation)].issued++;
+
+    switch (operation) {
+      case Operation::Create: {
+        auto name = "f" + std::to_string(sequence++);
+        Expect(dir / name, fswatch::Event::FILE_CREATED, operation);
+        Append(dir / name, {});
+        names.push_back(name);
+        break;
+      }
+      case Operation::Mkdir: {
+        auto path = dir / ("c" + std::to_string(sequence++));
+        auto level = path;
+        for (unsigned i = 0; i < config.depth; ++i) {
+          Expect(level, fswatch::Event::DIR_CREATED, operation);
+          level /= "l" + std::to_string(i + 1);
+        }
+        std::error_code ec;
+        std::filesystem::create_directories(level.parent_path(), ec);
+        break;
+      }
+      case Operation::Rename: {
+        // reported as the delete of the old name and the create of the new one
+        auto& name = names[rng() % names.size()];
+        auto renamed = "r" + std::to_string(sequence++);
+        Expect(dir / renamed, fswatch::Event::FILE_CREATED, operation);
+        std::error_code ec;
+        std::filesystem::rename(dir / name, dir / renamed, ec);
+        name = renamed;
+        break;
+      }
+      case Operation::Append: {
+        auto& name = names[rng() % names.size()];
+        Expect(dir / name, fswatch::Event::FILE_MODIFIED, operation);
+        Append(dir / name, data);
+        break;
+      }
+      case Operation::Read: {
+        // like a build reading headers: open and close only, no callback wants them
+        auto& name = names[rng() % names.size()];
+        char buffer[4096];
+        if (int fd = open((dir / name).c_str(), O_RDONLY); fd >= 0) {
+          [[maybe_unused]] auto got = read(fd, buffer, sizeof(buffer));
+          close(fd);
+        }
+        break;
+      }
+      default:
+        break;
+    }
+  }
+}
+
+/**
+ * @brief print the correlation report
+ */
+static void Report(const Config& config, const fswatch::Counters& counters, std::chrono::nanoseconds generate_time,
+                   std::chrono::nanoseconds watcher_cpu, const watch::EventExecutor* executor) {
+  std::lock_guard lck(pending_mutex);
+  uint64_t issued = 0, expected = 0, observed = 0;
+
+  static constexpr std::array<const char*, 3> kLogModeNames{"none", "sync", "async"};
+  printf("target %s, rate %lu/s, operations %lu, depth %u, fanout %u, log %s\n", config.work.c_str(), config.rate,
+         config.operations, config.depth, config.fanout, kLogModeNames[static_cast<size_t>(config.log)]);
+  printf("%-8s %10s %10s %10s %10s\n", "op", "issued", "expected", "observed", "dropped");
+  for (size_t i = 0; i < statistic.size(); ++i) {
+    const auto& stat = statistic[i];
+    printf("%-8s %10lu %10lu %10lu %10lu\n", kOperationNames[i], stat.issued, stat.expected, stat.observed,
+           stat.expected - stat.observed);
+    issued += stat.issued;
+    expected += stat.expected;
+    observed += stat.observed;
+  }
+  printf("%-8s %10lu %10lu %10lu %10lu\n", "total", issued, expected, observed, expected - observed);
+
+  auto seconds = std::chrono::duration<double>(generate_time).count();
+  printf("generated %.0f op/s in %.3f s\n", seconds > 0 ? issued / seconds : 0.0, seconds);
+  printf("fswatch: events read %lu (%.2f/op), file %lu, dir %lu, callbacks %lu, overflows %lu, watches %lu\n",
+         counters.events_read, issued ? static_cast<double>(counters.events_read) / issued : 0.0, counters.file_events,
+         counters.dir_events, counters.callbacks, counters.overflows, counters.watches);
+
+  if (!latencies.empty()) {
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [](double p) {
+      auto index = std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()));
+      return std::chrono::duration<double, std::micro>(latencies[index]).count();
+    };
+    printf("latency us: p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n", percentile(0.50), percentile(0.90),
+           percentile(0.99), percentile(1.0));
+  }
+  if (counters.events_read) {
+    printf("watcher cpu %.3f ms, %.0f ns/event\n", std::chrono::duration<double, std::milli>(watcher_cpu).count(),
+           static_cast<double>(watcher_cpu.count()) / counters.events_read);
+  }
+  if (executor) {
+    auto metrics = executor->Metrics();
+    printf("executor %zu threads: posted %lu, executed %lu, failed %lu, dropped %lu, coalesced %lu, blocked %lu, "
+           "max depth %lu, steals %lu\n",
+           executor->Options().threads, metrics.posted, metrics.executed, metrics.failed, metrics.dropped,
+           metrics.coalesced, metrics.blocked, metrics.max_depth, metrics.steals);
+    printf("executor us: handler p50 <%.1f p99 <%.1f, queue wait p50 <%.1f p99 <%.1f\n",
+           watch::ExecutorMetrics::Percentile(metrics.handler_latency, 0.5) / 1e3,
+           watch::ExecutorMetrics::Percentile(metrics.handler_latency, 0.99) / 1e3,
+           watch::ExecutorMetrics::Percentile(metrics.queue_latency, 0.5) / 1e3,
+           watch::ExecutorMetrics::Percentile(metrics.queue_latency, 0.99) / 1e3);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// global Function Definitions
+//-----------------------------------------------------------------------------
+
+/************************************************************************/ /**
+* @fn      int main()
+* @brief   generates load and reports what the watcher saw.
+* @param   argc will be the number of strings pointed to by argv.
+* @param   argv array of command line parameters.
+*
+* @return EXIT_SUCCESS if successfully, otherwise - EXIT_FAILURE
+****************************************************************************/
+int main(int argc, char** argv) {
+  Config config;
+  ProcessOptions(argc, argv, config);
+
+  // never touch what is already in the target, work in a directory of our own
+  std::error_code ec;
+  bool created_target = std::filesystem::create_directories(config.target, ec);
+  auto work_template = (config.target / "fsload.XXXXXX").string();
+  if (!mkdtemp(work_template.data())) {
+    std::cerr << "Cannot create a run directory in " << config.target << ": " << strerror(errno) << std::endl;
+    return EXIT_FAILURE;
+  }
+  config.work = work_template;
+  auto log_path = config.work.string() + ".log";
+  if (struct statfs fs{}; statfs(config.work.c_str(), &fs) == 0 && fs.f_type != TMPFS_MAGIC) {
+    std::cerr << "Warning: " << config.target << " is not on tmpfs, results include disk I/O" << std::endl;
+  }
+
+  if (config.log != LogMode::None) {
+    spdlog::set_default_logger(spdlog::basic_logger_mt("fsload", log_path, true));
+  }
+  if (config.log == LogMode::Async) {
+    logging::AsyncLogger::Instance().Start();
+  }
+  auto log_event = [&config](const fswatch::EventInfo& event) {
+    if (config.log == LogMode::Sync) {
+      spdlog::info("event {} {}", static_cast<int>(event.type), event.path.c_str());
+    } else if (config.log == LogMode::Async) {
+      ALOG_INFO("event {} {}", event.type, event.path.c_str());
+    }
+  };
+
+  fswatch watcher(config.work.string());
+  std::unique_ptr<watch::TraceWriter> trace;
+  if (!config.trace.empty()) {
+    trace = std::make_unique<watch::TraceWriter>(config.trace);
+    watcher.record(trace.get());
+  }
+  std::shared_ptr<watch::EventExecutor> executor;
+  if (config.executor_threads) {
+    executor = std::make_shared<watch::EventExecutor>(
+        watch::ExecutorOptions{.threads = config.executor_threads, .policy = config.policy});
+    watcher.set_executor(executor);
+  }
+  std::atomic<Clock::rep> last_event{Clock::now().time_since_epoch().count()};
+  std::atomic<uint64_t> dirs_seen{0};
+
+  watcher.on({fswatch::Event::FILE_CREATED, fswatch::Event::FILE_MODIFIED},
+             [&](const fswatch::EventInfo& event) {
+               last_event = Clock::now().time_since_epoch().count();
+               Observe(event);
+               log_event(event);
+               if (config.handler_time.count()) {
+                 std::this_thread::sleep_for(config.handler_time);
+               }
+             });
+  watcher.on(fswatch::Event::DIR_CREATED, [&](const fswatch::EventInfo& event) {
+    last_event = Clock::now().time_since_epoch().count();
+    dirs_seen++;
+    Observe(event);
+    log_event(event);
+  });
+
+  std::chrono::nanoseconds watcher_cpu{};
+  std::thread watcher_task([&]() {
+    try {
+      watcher.start();
+    } catch (std::exception& error) {
+      std::cerr << "Watcher stopped: " << error.what() << std::endl;
+    }
+    watcher_cpu = ThreadCpuTime();
+  });
+
+  // wait for the root watch, then create the working directories and wait
+  // until the watcher has attached them
+  while (watcher.counters().watches == 0) {
+    std::this_thread::sleep_for(1ms);
+  }
+  for (unsigned i = 0; i < config.fanout; ++i) {
+    std::filesystem::create_directory(config.work / ("d" + std::to_string(i)), ec);
+  }
+  for (auto deadline = Clock::now() + 5s; dirs_seen < config.fanout && Clock::now() < deadline;) {
+    std::this_thread::sleep_for(1ms);
+  }
+
+  auto generate_start = Clock::now();
+  Generate(config);
+  auto generate_time = Clock::now() - generate_start;
+
+  // drain until the watcher is idle
+  while (Clock::now() - Clock::time_point(Clock::duration(last_event.load())) < config.drain) {
+    std::this_thread::sleep_for(10ms);
+  }
+  auto counters = watcher.counters();
+
+  // wakes up the blocking wait of the watcher
+  watcher.stop();
+  watcher_task.join();
+
+  if (executor) {
+    executor->Drain();
+  }
+  logging::AsyncLogger::Instance().Stop();
+  Report(config, counters, generate_time, watcher_cpu, executor.get());
+  if (auto dropped = logging::AsyncLogger::Instance().Dropped()) {
+    printf("async log records dropped %lu\n", dropped);
+  }
+  if (trace) {
+    trace->Flush();
+    printf("trace %s: %lu batches\n", config.trace.c_str(), trace->Batches());
+  }
+
+  std::filesystem::remove_all(config.work, ec);
+  if (config.log != LogMode::None) {
+    std::filesystem::remove(log_path, ec);
+  }
+  if (created_target) {
+    std::filesystem::remove(config.target, ec);
+  }
+  return EXIT_SUCCESS;
+}
@@ -13,17 +13,24 @@
 #include <syslog.h>
 
 #include <chrono>
-#include <condition_variable>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
-#include <mutex>
 #include <string>
 #include <thread>
 
+#include "asyncFswatch.hpp"
+#include "asyncLog.hpp"
+#include "busEvents.hpp"
+#include "contextAsync.hpp"
 #include "contextConcrete.hpp"
+#include "eventBus.hpp"
+#include "eventLoop.hpp"
+#include "flightRecorder.hpp"
 #include "fswatch.hpp"
+#include "metrics.hpp"
+#include "pathRouter.hpp"
 #include "spdlog/spdlog.h"
+#include "wakeupRouter.hpp"
 
 using namespace std::chrono_literals;
 
@@ -35,20 +42,16 @@ using namespace std::chrono_literals;
 // local Typedefs, Enums, Unions
 //-----------------------------------------------------------------------------
 
-/**
- * @brief event plan structure
- */
-struct Event {
- public:
-  std::mutex event_mutex;
-  std::condition_variable event_condition;
-};
-
 //-----------------------------------------------------------------------------
 // local/global Variables Definitions
 //-----------------------------------------------------------------------------
-Event task_event_concrete;
-Event task_event_filesystem;
+watch::EventBus event_bus;                         ///< filesystem events, timer expirations and state changes
+watch::WakeupRouter wakeup_router;                 ///< wakes the tasks interested in a filesystem event
+watch::PathRouter path_router;                     ///< wait words of the contexts by the directory they own
+static watch::WakeupRouter::Task context_task;    ///< wait word of the concrete context worker
+static const char* watched_directory = "/home/tmp";  ///< directory of the filesystem watcher
+static bool run_on_event_loop = false;  ///< run all tasks as coroutines on one thread
+static std::string metrics_endpoint;    ///< TCP port or unix:PATH of the metrics listener
 
 //-----------------------------------------------------------------------------
 // local/global Function Prototypes
@@ -76,6 +79,8 @@ static void ViewVersion(const char* prog) {
 static void ViewHelp(const char* prog) {
   std::cout << "Usage: " << prog << " [OPTION]\n"
             << "  -v, --version            version\n"
+            << "  -c, --coroutine          run watcher and context as coroutines on one thread\n"
+            << "  -m, --metrics=ENDPOINT   serve metrics on localhost PORT or unix:PATH\n"
             << "  -h, --help               this message\n\n";
 }
 
@@ -88,10 +93,12 @@ static void ViewHelp(const char* prog) {
 static void ProcessOptions(int argc, char* argv[]) {
   for (;;) {
     int option_index = 0;
-    static const char* short_options = "h?v";
+    static const char* short_options = "h?vcm:";
     static const struct option long_options[] = {
         {"help", no_argument, 0, 0},
         {"version", no_argument, 0, 'v'},
+        {"coroutine", no_argument, 0, 'c'},
+        {"metrics", required_argument, 0, 'm'},
         {0, 0, 0, 0},
     };
 
@@ -113,6 +120,12 @@ static void ProcessOptions(int argc, char* argv[]) {
         ViewVersion(argv[0]);
         exit(EXIT_SUCCESS);
       }
+      case 'c':
+        run_on_event_loop = true;
+        break;
+      case 'm':
+        metrics_endpoint = optarg;
+        break;
       default: {
         ViewHelp(argv[0]);
         exit(-1);
@@ -155,21 +168,32 @@ static bool HandleGetChar() {
 // global Function Definitions
 //-----------------------------------------------------------------------------
 
+/**
+ * @brief Route the filesystem events to the tasks waiting for them
+ * @desc  Call before the tasks are started. Every context owns a directory
+ * and is woken by the events of its subtree only; contexts may be added to
+ * and removed from the path router while the watcher runs.
+ */
+static void SetupWakeups() {
+  context_task = wakeup_router.AddTask();
+  path_router.Add(watched_directory, context_task);
+}
+
+/**
+ * @brief Waking up the contexts owning the path of an event
+ * @desc  A context which is already pending is not woken twice
+ * @param event - filesystem event
+ */
+void WakeUpRunningTasks(const fswatch::EventInfo& event) {
+  path_router.Route(event.path.native(), [](watch::PathRouter::ContextId task) { wakeup_router.Wake(task); });
+}
+
 /**
  * @brief Waking up all running tasks
  * @desc  This wakes up all task
- * @param config - configuration the manager
- * @param all_tasks_wakeup - wakeup all tasks but not only file system event driving tasks
  */
-void WakeUpRunningTasks(bool all_tasks_wakeup = true) {
-  if (all_tasks_wakeup) {
-    std::unique_lock lck(task_event_filesystem.event_mutex);
-    task_event_filesystem.event_condition.notify_all();  // Wakes up stop a file system watcher
-  }
-  {
-    std::unique_lock lck(task_event_concrete.event_mutex);
-    task_event_concrete.event_condition.notify_all();  // Wakes up a displacement task
-  }
+void WakeUpRunningTasks() {
+  wakeup_router.NotifyAll();
 }
 
 /**
@@ -178,59 +202,33 @@ void WakeUpRunningTasks(bool all_tasks_wakeup = true) {
  */
 void TaskWorkerFsWatcher(std::stop_token token) {
   using namespace std::chrono_literals;
-  auto watcher = fswatch("/home/tmp");
+  auto watcher = fswatch(watched_directory);
+  auto& changes = event_bus.Topic<state::FsChanged>();
 
   // add watching events
-  watcher.on(fswatch::Event::FILE_CREATED, [&]([[maybe_unused]] auto& event) {
-    spdlog::info("Filesystem event FILE_MODIFIED");
-    WakeUpRunningTasks(false);  // Wake up sleeping tasks by an event in the file system
+  watcher.on(fswatch::Event::FILE_CREATED, [&](auto& event) {
+    ALOG_INFO("Filesystem event FILE_CREATED");
+    changes.Publish(state::FsChanged{event.type, event.path.string()});
+    WakeUpRunningTasks(event);  // Wake up the contexts owning the path of the event
   });
 
-  watcher.on(fswatch::Event::FILE_MODIFIED, [&]([[maybe_unused]] auto& event) {
-    spdlog::info("Filesystem event FILE_MODIFIED");
-    WakeUpRunningTasks(false);  // Wake up sleeping tasks by an event in the file system
+  watcher.on(fswatch::Event::FILE_MODIFIED, [&](auto& event) {
+    ALOG_INFO("Filesystem event FILE_MODIFIED");
+    changes.Publish(state::FsChanged{event.type, event.path.string()});
+    WakeUpRunningTasks(event);  // Wake up the contexts owning the path of the event
   });
 
-  watcher.on(fswatch::Event::FILE_DELETED, [&]([[maybe_unused]] auto& event) {
-    spdlog::info("Filesystem event FILE_DELETED");
-    WakeUpRunningTasks(false);  // Wake up sleeping tasks by an event in the file system
-  });
-
-  // Register a stop callback for stop task
-  std::stop_callback stop_cb(token, [&]() {
-    // Wake up thread on stop request
-    task_event_filesystem.event_condition.notify_all();
-  });
-
-  // start thread with stop fs-watcher task
-  std::thread stop_watching_task([&]() {
-    // create context
-    while (true) {
-      // Start of locked block
-      std::unique_lock lck(task_event_filesystem.event_mutex);
-      task_event_filesystem.event_condition.wait_for(lck, 5000ms /*[&, token]() {
-        return token.stop_requested();
-      }*/);
-
-      //Stop if requested to stop
-      if (token.stop_requested()) {
-        spdlog::info("Stop requested for a stop watcher task");
-        break;
-      }
-    }  // End of while loop
-    watcher.stop();
-    // wakeup watcher via event in file system
-    std::ofstream tmpfile;
-    tmpfile.open("/home/tmp/~watcher_wakeup", std::ios_base::trunc);
-    tmpfile << "Wakeup\n";
-    tmpfile.close();
-    spdlog::info("Stop filesystem watcher task stopped.");
+  watcher.on(fswatch::Event::FILE_DELETED, [&](auto& event) {
+    ALOG_INFO("Filesystem event FILE_DELETED");
+    changes.Publish(state::FsChanged{event.type, event.path.string()});
+    WakeUpRunningTasks(event);  // Wake up the contexts owning the path of the event
   });
 
   spdlog::info("Filesystem watcher started");
 
   try {
-    watcher.start();
+    // a stop request wakes the blocking wait of the watcher directly
+    watcher.start(token);
   } catch (std::filesystem::filesystem_error& error) {
     spdlog::warn("Filesystem exception was caught: {}", error.what());
   } catch (std::exception& error) {
@@ -239,8 +237,6 @@ void TaskWorkerFsWatcher(std::stop_token token) {
     spdlog::warn("Unknown exception was caught");
   }
 
-  stop_watching_task.join();
-
   spdlog::info("Filesystem watcher task stopped.");
 }
 
@@ -251,7 +247,7 @@ void TaskWorkerFsWatcher(std::stop_token token) {
  * For that reason, a callback mechanism is provided through std::stop_callback.
  * A std::stop_callback instance registers a callback function for a given stop token.
  * The callback is invoked when the token receives a stop request.
- * The following shows how to use std::stop_callback to signal a thread waiting on a std::condition_variable
+ * The following shows how to use std::stop_callback to signal a thread waiting on its wakeup word
  * on a stop request:
  * @param token - stop task token
  */
@@ -262,36 +258,85 @@ void TaskWorker_Context(std::stop_token token) {
   // Register a stop callback
   std::stop_callback stop_cb(token, [&]() {
     // Wake thread on stop request
-    task_event_concrete.event_condition.notify_all();
+    wakeup_router.Wake(context_task);
   });
 
-  // create context
+  static const auto by_timer = metrics::Registry::Instance().AddCounter(
+      "state_wakeups_total", "Wakeups of the context workers by reason.", "reason=\"timer\"");
+  static const auto by_event = metrics::Registry::Instance().AddCounter(
+      "state_wakeups_total", "Wakeups of the context workers by reason.", "reason=\"event\"");
+
+  // create context, its timer expirations and state changes go to the bus
   state::ConcreteContext context;
+  context.Attach(event_bus);
+  auto changes = event_bus.Subscribe<state::FsChanged>();
   std::chrono::milliseconds sooner = waitDurationDef;
 
   while (true) {
     // observe serves states
     sooner = context.Serve(waitDurationDef);
     if( sooner.count() > 0 ) {
-      spdlog::info("condition waits for is {} ms", sooner.count());
-      // Start of locked block
-      std::unique_lock lck(task_event_concrete.event_mutex);
-      task_event_concrete.event_condition.wait_for(lck, sooner/*, [&, token]() {
-        // Condition for wake up
-        return token.stop_requested();
-      }*/);
+      ALOG_INFO("condition waits for is {} ms", sooner.count());
+      // events which came in while serving are pending and return at once
+      auto notified = wakeup_router.Wait(context_task, sooner);
+      (notified ? by_event : by_timer).Inc();
+
+      // take all changes published meanwhile in one batch
+      std::string last;
+      if (auto count = changes.Poll([&](const state::FsChanged& change, uint64_t) { last = change.path; })) {
+        ALOG_INFO("{} filesystem changes, last {}", count, last);
+      }
 
       //Stop if requested to stop
       if (token.stop_requested()) {
         spdlog::info("Stop requested for a displacement connection task");
         break;
       }
-    }  // End of locked block
+    }
   }    // End of while loop
 
   spdlog::info("Displacement connection task stopped.");
 }
 
+/**
+ * @brief File system watcher coroutine
+ * @param loop - event loop
+ * @param wakeup - event waking the context
+ */
+watch::Task<> WatchFileSystem(watch::EventLoop& loop, watch::AsyncEvent& wakeup) {
+  async_fswatch watcher(
+      loop, watched_directory,
+      {fswatch::Event::FILE_CREATED, fswatch::Event::FILE_MODIFIED, fswatch::Event::FILE_DELETED});
+  spdlog::info("Filesystem watcher coroutine started");
+  while (auto event = co_await watcher.next_event()) {
+    ALOG_INFO("Filesystem event {}", event->type);
+    wakeup.Notify();  // Wake up the context by an event in the file system
+  }
+  spdlog::info("Filesystem watcher coroutine stopped.");
+}
+
+/**
+ * @brief Event loop main function
+ * @desc Serves the file system watcher and the concrete context as coroutines
+ * on one thread. No helper thread is needed to stop the watcher: a stop
+ * request makes every pending co_await return.
+ * @param loop - event loop
+ */
+void TaskWorkerEventLoop(watch::EventLoop& loop) {
+  using namespace std::chrono_literals;
+  watch::AsyncEvent wakeup(loop);
+  state::ConcreteContext context;
+
+  loop.Spawn(state::ServeAsync(loop, context, wakeup, 4000ms));
+  loop.Spawn(WatchFileSystem(loop, wakeup));
+  try {
+    loop.Run();
+  } catch (std::exception& error) {
+    spdlog::warn("Exception was caught: {}", error.what());
+  }
+  spdlog::info("Event loop task stopped.");
+}
+
 /************************************************************************/ /**
 * @fn      int main()
 * @brief   initializes and run stuff.
@@ -318,15 +363,50 @@ int main(int argc, char** argv) {
   // show information
   ViewVersion(argv[0]);
 
+  // hot paths log through the asynchronous sink
+  logging::AsyncLogger::Instance().Start();
+
+  // state transitions of the last minutes for flightdump, also after a crash
+  try {
+    logging::FlightRecorder::Instance().Open();
+    spdlog::info("Flight recorder in {}", logging::FlightRecorder::Instance().Name());
+  } catch (std::exception& error) {
+    spdlog::warn("Flight recorder off: {}", error.what());
+  }
+
+  // metrics of the watcher and the state workers for scrapers
+  metrics::Server metrics_server;
+  if (!metrics_endpoint.empty()) {
+    try {
+      if (metrics_endpoint.starts_with("unix:")) {
+        metrics_server.ListenUnix(metrics_endpoint.substr(5));
+        spdlog::info("Metrics served on {}", metrics_endpoint);
+      } else {
+        auto port = metrics_server.ListenTcp(static_cast<uint16_t>(std::stoul(metrics_endpoint)));
+        spdlog::info("Metrics served on http://127.0.0.1:{}/metrics", port);
+      }
+      metrics_server.Start();
+    } catch (std::exception& error) {
+      spdlog::warn("Metrics endpoint {} failed: {}", metrics_endpoint, error.what());
+    }
+  }
+
   //----------------------------------------------------------
   // go to idle in main
   //----------------------------------------------------------
   std::cout << " (type '?' for help)" << std::endl;
 
-  // Create all workers and pass stop tokens
-  task_worker_context = std::move(std::thread(TaskWorker_Context, stop_src.get_token()));
-  // start task filesystem watcher
-  task_worker_file_system = std::move(std::thread(TaskWorkerFsWatcher, stop_src.get_token()));
+  SetupWakeups();
+
+  watch::EventLoop loop;
+  if (run_on_event_loop) {
+    task_worker_context = std::thread(TaskWorkerEventLoop, std::ref(loop));
+  } else {
+    // Create all workers and pass stop tokens
+    task_worker_context = std::move(std::thread(TaskWorker_Context, stop_src.get_token()));
+    // start task filesystem watcher
+    task_worker_file_system = std::move(std::thread(TaskWorkerFsWatcher, stop_src.get_token()));
+  }
 
   // main loop or sleep
   while (true) {
@@ -341,14 +421,19 @@ int main(int argc, char** argv) {
 
   spdlog::info("Wakeup all tasks");
   // wakeup all tasks
-  WakeUpRunningTasks(true);
+  WakeUpRunningTasks();
+  loop.Stop();
 
   // Join threads
-  task_worker_file_system.join();
+  if (task_worker_file_system.joinable()) {
+    task_worker_file_system.join();
+  }
   task_worker_context.join();
 
   // Close all before to  exit
   CloseAll();
+  logging::FlightRecorder::Instance().Close();
+  logging::AsyncLogger::Instance().Stop();
 
   return EXIT_SUCCESS;
 }
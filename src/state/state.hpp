@@ -12,6 +12,7 @@
 //------------------------------------------------------------------------------
 // includes
 //------------------------------------------------------------------------------
+#include <cstdint>
 #include <memory>
 #include <optional>
 
@@ -21,13 +22,20 @@
 
 namespace state {
 
+/**
+ * @brief tag for constructing a state restored from a snapshot
+ * @details the entry action is not executed again, the context restores its timer itself
+ */
+struct Restored {};
+
 /**
  * @class Template for state
  * @brief describes interface for state in state pattern
  * @details Context stores a reference to one of the concrete state objects and delegates to it all state-specific work.
  * The context communicates with the state object via the state interface. The context exposes a setter for passing
- * it a new state object as unique pointer (smart pointer). New state should be return only with move 
- * std::make_unique<State>(context).
+ * it a new state object as unique pointer (smart pointer). DoServe() returns the next state as a Transition,
+ * e.g. GoTo<State>(); the context executes DoExit() of the current state first and constructs the next one
+ * afterwards, so the entry action of the next state runs after the exit action of the current one.
  * The State interface declares the state-specific methods. These methods should make sense for all concrete states
  * because you don’t want some of your states to have useless methods that will never be called.
  */
@@ -40,13 +48,42 @@ class State {
    */
   State(TContext* context) : m_contextPtr(context) {}
 
+  /**
+   * @brief constructs the next state, its constructor executes the entry action
+   */
+  using Transition = std::unique_ptr<State<TContext>> (*)(TContext* context);
+
+  /**
+   * @brief transition to TState, constructed by the context after DoExit() of the current state
+   */
+  template <class TState>
+  [[nodiscard]] static constexpr Transition GoTo() noexcept {
+    return [](TContext* context) -> std::unique_ptr<State<TContext>> { return std::make_unique<TState>(context); };
+  }
+
   /**
    * @brief performs main operations in state.
    * @details performs any operation relates to timer or immediately
    * @param context reference
-   * @return optional new state
+   * @return optional transition to the next state
+   */
+  [[nodiscard]] virtual std::optional<Transition> DoServe() = 0;
+
+  virtual ~State() = default;
+
+  /**
+   * @brief this method is executed once when the state is left
+   * @details the counterpart of DoEnter(), called by the context before the next state is entered
+   */
+  virtual void DoExit() {}
+
+  /**
+   * @brief identifier of the concrete state
+   * @details stored in context snapshots, 0 - the state can not be restored
    */
-  [[nodiscard]] virtual std::optional<std::unique_ptr<State<TContext>>> DoServe() = 0;
+  [[nodiscard]] virtual uint16_t Id() const noexcept {
+    return 0;
+  }
 
  protected:
   TContext* m_contextPtr;
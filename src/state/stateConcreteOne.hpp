@@ -30,12 +30,24 @@ class StateConcreteOne : public State<ConcreteContext> {
     DoEnter();
   }
 
+  /**
+   * @brief constructor without Entry method for restoring from a snapshot
+   * @param context - context object
+   */
+  StateConcreteOne(ConcreteContext* context, Restored) : State(context) {}
+
+  static constexpr uint16_t kId = 1;  ///< snapshot identifier
+
+  [[nodiscard]] uint16_t Id() const noexcept override {
+    return kId;
+  }
+
   /**
    * @brief performs main operations in state.
    * @param context reference
-   * @return optional new state
+   * @return optional transition to the next state
    */
-  [[nodiscard]] std::optional<std::unique_ptr<State<ConcreteContext>>> DoServe();
+  [[nodiscard]] std::optional<Transition> DoServe();
 
  protected:
   /**
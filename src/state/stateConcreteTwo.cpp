@@ -4,7 +4,8 @@
 #include <chrono>
 #include <memory>
 #include <optional>
-#include <spdlog/spdlog.h>
+
+#include <asyncLog.hpp>
 
 #include "contextConcrete.hpp"
 #include "stateConcreteOne.hpp"
@@ -18,16 +19,16 @@ using namespace std::chrono_literals;
 namespace state {
 
 void StateConcreteTwo::DoEnter() {
-  spdlog::info("enter to  state 2. Wait 6 sec");
+  ALOG_INFO("enter to  state 2. Wait 6 sec");
   // start timer for recreating the file
   m_contextPtr->TimerRestart(6s);
 }
 
-std::optional<std::unique_ptr<State<ConcreteContext>>> state::StateConcreteTwo::DoServe() {
+std::optional<State<ConcreteContext>::Transition> state::StateConcreteTwo::DoServe() {
   if (auto is_elapsed = m_contextPtr->Timer().IsElapsed(); is_elapsed.has_value() && is_elapsed.value()) {
-    spdlog::info("goto state 1");
+    ALOG_INFO("goto state 1");
     // go to Idle mode
-    return std::make_unique<StateConcreteOne>(m_contextPtr);
+    return GoTo<StateConcreteOne>();
   }
   return std::nullopt;
 }
@@ -27,12 +27,24 @@ class StateConcreteTwo : public State<ConcreteContext> {
     DoEnter();
   }
 
+  /**
+   * @brief constructor without Entry method for restoring from a snapshot
+   * @param context - context object
+   */
+  StateConcreteTwo(ConcreteContext* context, Restored) : State(context) {}
+
+  static constexpr uint16_t kId = 2;  ///< snapshot identifier
+
+  [[nodiscard]] uint16_t Id() const noexcept override {
+    return kId;
+  }
+
   /**
    * @brief performs main operations in state.
    * @param context reference
-   * @return optional new state
+   * @return optional transition to the next state
    */
-  [[nodiscard]] std::optional<std::unique_ptr<State<ConcreteContext>>> DoServe();
+  [[nodiscard]] std::optional<Transition> DoServe();
 
  protected:
   /**
@@ -0,0 +1,221 @@
+//
+// Copyright (c) 2022 Alexander Sacharov <a.sacharov@gmx.de>
+//               All rights reserved.
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+//
+
+/************************************************************************/ /**
+* @file
+* @brief Watcher daemon publishing its events to other processes.
+* @details One inotify instance for the whole machine: the daemon watches
+* the roots and publishes every create, modify and delete into the shared
+* memory event feed. With --follow the same binary is a client that
+* subscribes to a running daemon and prints the events; processes use
+* watch::FeedSubscriber directly. Once a second the daemon reports the
+* consumers that fall behind or were overrun.
+****************************************************************************/
+
+//-----------------------------------------------------------------------------
+// includes
+//-----------------------------------------------------------------------------
+#include <getopt.h>
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "basicFswatch.hpp"
+#include "eventFeed.hpp"
+
+using namespace std::chrono_literals;
+
+//-----------------------------------------------------------------------------
+// local Typedefs, Enums, Unions
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief command line configuration
+ */
+struct Config {
+  std::string name{watch::feed::kDefaultName};  ///< shared memory name of the feed
+  uint32_t slots{65536};                        ///< events kept for slow consumers
+  bool follow{false};                           ///< subscribe and print instead of watching
+  std::vector<std::string> roots;               ///< directories to watch
+};
+
+/**
+ * @brief publishes the events that change the tree, opens and closes stay out of the kernel
+ */
+struct Publish {
+  watch::FeedPublisher* feed;
+
+  template <fswatch_types::Event E>
+    requires(E != fswatch_types::Event::FILE_OPENED && E != fswatch_types::Event::FILE_CLOSED &&
+             E != fswatch_types::Event::DIR_OPENED && E != fswatch_types::Event::DIR_CLOSED)
+  void operator()(fswatch_types::on_event<E>, const fswatch_types::event_view& event) {
+    feed->Publish(E, event.path);
+  }
+};
+
+//-----------------------------------------------------------------------------
+// local Variables
+//-----------------------------------------------------------------------------
+
+static std::atomic<bool> g_stop{false};
+
+//-----------------------------------------------------------------------------
+// local Function Definitions
+//-----------------------------------------------------------------------------
+
+/************************************************************************/ /**
+* @fn      void ViewHelp(const char* prog)
+* @brief   view help
+****************************************************************************/
+static void ViewHelp(const char* prog) {
+  printf("Usage: %s [OPTION] [DIRECTORY]...\n"
+         "  -n, --name=NAME          shared memory name of the feed, default %s\n"
+         "  -s, --slots=N            events kept for slow consumers, default 65536\n"
+         "  -f, --follow             subscribe to a running daemon and print its events\n"
+         "  -h, --help               this message\n\n",
+         prog, watch::feed::kDefaultName);
+}
+
+/************************************************************************/ /**
+* @fn      void ProcessOptions(int argc, char* argv[], Config& config)
+* @brief   parse command line parameters
+****************************************************************************/
+static void ProcessOptions(int argc, char* argv[], Config& config) {
+  static const struct option long_options[] = {
+      {"name", required_argument, 0, 'n'},
+      {"slots", required_argument, 0, 's'},
+      {"follow", no_argument, 0, 'f'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0},
+  };
+  for (int var; (var = getopt_long(argc, argv, "n:s:fh", long_options, nullptr)) != EOF;) {
+    switch (var) {
+      case 'n':
+        config.name = optarg;
+        break;
+      case 's':
+        config.slots = static_cast<uint32_t>(std::stoul(optarg));
+        break;
+      case 'f':
+        config.follow = true;
+        break;
+      default:
+        ViewHelp(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+  for (int index = optind; index < argc; ++index) {
+    config.roots.emplace_back(argv[index]);
+  }
+  if (!config.follow && config.roots.empty()) {
+    config.roots.emplace_back(".");
+  }
+}
+
+static void OnSignal(int) {
+  g_stop.store(true, std::memory_order_relaxed);
+}
+
+/**
+ * @brief printed name of an event
+ */
+static const char* EventName(fswatch_types::Event event) {
+  static const char* names[] = {"file_created", "file_opened", "file_modified", "file_closed",
+                                "file_deleted", "dir_created", "dir_opened",    "dir_modified",
+                                "dir_closed",   "dir_deleted"};
+  auto index = static_cast<size_t>(event);
+  return index < fswatch_types::kEventCount ? names[index] : "?";
+}
+
+/**
+ * @brief client: print the events of the feed until it closes
+ */
+static int Follow(const Config& config) {
+  watch::FeedSubscriber subscriber(config.name);
+  watch::FeedSubscriber::Record record{};
+  while (!g_stop.load(std::memory_order_relaxed)) {
+    switch (subscriber.Next(record, 200ms)) {
+      case watch::FeedSubscriber::Status::Event:
+        printf("%-14s %.*s%s\n", EventName(record.type), static_cast<int>(record.path.size()), record.path.data(),
+               record.truncated ? "..." : "");
+        break;
+      case watch::FeedSubscriber::Status::Resync:
+        // a real client rescans the tree here
+        printf("resync: %llu events lost\n", static_cast<unsigned long long>(subscriber.Lost()));
+        break;
+      case watch::FeedSubscriber::Status::Closed:
+        printf("feed closed\n");
+        return EXIT_SUCCESS;
+      case watch::FeedSubscriber::Status::Timeout:
+        fflush(stdout);
+        break;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+/**
+ * @brief daemon: watch the roots and publish, report consumers that fall behind
+ */
+static int Serve(const Config& config) {
+  watch::FeedPublisher feed(config.name, config.slots);
+  basic_fswatch<Publish> watcher({Publish{&feed}});
+  for (const auto& root : config.roots) {
+    watcher.append_to_path(root);
+  }
+  watcher.run_async();
+  printf("publishing %zu roots to %s\n", config.roots.size(), feed.Name().c_str());
+
+  struct Seen {
+    uint64_t resyncs;
+    uint64_t lost;
+  };
+  std::unordered_map<int64_t, Seen> seen;
+  while (!g_stop.load(std::memory_order_relaxed)) {
+    std::this_thread::sleep_for(1s);
+    feed.ForEachConsumer([&seen](int64_t pid, uint64_t lag, uint64_t lost, uint64_t resyncs) {
+      auto& last = seen[pid];
+      if (resyncs != last.resyncs) {
+        fprintf(stderr, "consumer %lld overrun: %llu events lost, %llu resyncs\n", static_cast<long long>(pid),
+                static_cast<unsigned long long>(lost - last.lost), static_cast<unsigned long long>(resyncs));
+      } else if (lag != 0) {
+        fprintf(stderr, "consumer %lld behind by %llu events\n", static_cast<long long>(pid),
+                static_cast<unsigned long long>(lag));
+      }
+      last = Seen{resyncs, lost};
+    });
+  }
+  watcher.join();
+  printf("%llu events published\n", static_cast<unsigned long long>(feed.Published()));
+  return EXIT_SUCCESS;
+}
+
+/************************************************************************/ /**
+* @fn      int main()
+* @brief   run the daemon or a client
+* @return EXIT_SUCCESS if successfully, otherwise - EXIT_FAILURE
+****************************************************************************/
+int main(int argc, char** argv) {
+  Config config;
+  ProcessOptions(argc, argv, config);
+  std::signal(SIGINT, OnSignal);
+  std::signal(SIGTERM, OnSignal);
+  try {
+    return config.follow ? Follow(config) : Serve(config);
+  } catch (const std::exception& error) {
+    fprintf(stderr, "%s\n", error.what());
+    return EXIT_FAILURE;
+  }
+}
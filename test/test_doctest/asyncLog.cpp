@@ -0,0 +1,190 @@
+#include <doctest/doctest.h>
+#include <spdlog/sinks/base_sink.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// info and below are removed from this file at compile time
+#define ALOG_ACTIVE_LEVEL ALOG_LEVEL_WARN
+#include "asyncLog.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// keeps the messages spdlog hands to it
+class CaptureSink : public spdlog::sinks::base_sink<std::mutex> {
+ public:
+  struct Message {
+    spdlog::log_clock::time_point time;
+    spdlog::level::level_enum level;
+    std::string text;
+    std::thread::id thread;  ///< logging thread, the flusher's for records of the rings
+  };
+  std::vector<Message> Messages() {
+    std::lock_guard lck(mutex_);
+    return messages;
+  }
+
+ protected:
+  void sink_it_(const spdlog::details::log_msg& msg) override {
+    messages.push_back(
+        {msg.time, msg.level, std::string(msg.payload.data(), msg.payload.size()), std::this_thread::get_id()});
+  }
+  void flush_() override {}
+
+ private:
+  std::vector<Message> messages;
+};
+
+// default logger writing to a capture sink while it lives
+struct Capture {
+  std::shared_ptr<CaptureSink> sink = std::make_shared<CaptureSink>();
+  std::shared_ptr<spdlog::logger> previous = spdlog::default_logger();
+  Capture() {
+    auto logger = std::make_shared<spdlog::logger>("capture", sink);
+    logger->set_level(spdlog::level::trace);
+    spdlog::set_default_logger(logger);
+  }
+  ~Capture() {
+    logging::AsyncLogger::Instance().Stop();
+    spdlog::set_default_logger(previous);
+  }
+  std::vector<CaptureSink::Message> Messages() { return sink->Messages(); }
+};
+
+}  // namespace
+
+TEST_CASE("AsyncLogger removes levels below ALOG_ACTIVE_LEVEL and filters by the logger level") {
+  Capture capture;
+  int evaluated = 0;
+  ALOG_TRACE("trace {}", ++evaluated);
+  ALOG_DEBUG("debug {}", ++evaluated);
+  ALOG_INFO("info {}", ++evaluated);
+  // elided calls do not even evaluate their arguments
+  CHECK(evaluated == 0);
+  ALOG_WARN("warn {}", 1);
+  spdlog::default_logger_raw()->set_level(spdlog::level::err);
+  ALOG_WARN("warn {}", 2);
+  ALOG_ERROR("error {}", 3);
+
+  auto messages = capture.Messages();
+  REQUIRE(messages.size() == 2);
+  CHECK(messages[0].text == "warn 1");
+  CHECK(messages[0].level == spdlog::level::warn);
+  CHECK(messages[1].text == "error 3");
+}
+
+TEST_CASE("AsyncLogger writes the records of all threads ordered by time") {
+  Capture capture;
+  // no flush before Stop(), all records are sorted in one batch
+  logging::AsyncLogger::Instance().Start(1h);
+  constexpr int kThreads = 4;
+  constexpr int kRecords = 500;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([t] {
+      for (int i = 0; i < kRecords; ++i) {
+        ALOG_WARN("thread {} record {}", t, i);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  CHECK(capture.Messages().empty());
+  logging::AsyncLogger::Instance().Stop();
+
+  auto messages = capture.Messages();
+  REQUIRE(messages.size() == kThreads * kRecords);
+  CHECK(std::is_sorted(messages.begin(), messages.end(),
+                       [](const auto& l, const auto& r) { return l.time < r.time; }));
+  // every thread in its own order
+  std::vector<int> next(kThreads, 0);
+  for (auto& message : messages) {
+    int t = message.text[7] - '0';
+    CHECK(message.text == "thread " + std::to_string(t) + " record " + std::to_string(next[t]++));
+  }
+}
+
+TEST_CASE("AsyncLogger counts the records dropped on a full ring") {
+  Capture capture;
+  auto& logger = logging::AsyncLogger::Instance();
+  auto dropped = logger.Dropped();
+  logger.Start(1h);
+  constexpr size_t kExtra = 100;
+  std::thread producer([] {
+    for (size_t i = 0; i < logging::ThreadRing::kCapacity + kExtra; ++i) {
+      ALOG_WARN("record {}", i);
+    }
+  });
+  producer.join();
+  CHECK(logger.Dropped() - dropped == kExtra);
+  logger.Stop();
+
+  auto messages = capture.Messages();
+  REQUIRE(messages.size() == logging::ThreadRing::kCapacity);
+  CHECK(messages.back().text == "record " + std::to_string(logging::ThreadRing::kCapacity - 1));
+}
+
+TEST_CASE("AsyncLogger marks text cut to the room of a record") {
+  Capture capture;
+  std::string path(logging::Record::kTextSize - 6, 'p');
+  ALOG_WARN("{} {}", path, std::string("short"));
+  ALOG_WARN("{} {}", path, std::string("longer"));
+  ALOG_WARN("{}", std::string(logging::Record::kTextSize + 1, 'x'));
+
+  auto messages = capture.Messages();
+  REQUIRE(messages.size() == 3);
+  CHECK(messages[0].text == path + " short");
+  CHECK(messages[1].text == path + " longer");
+  CHECK(messages[2].text == std::string(logging::Record::kTextSize, 'x') + "...");
+
+  // the same in the asynchronous mode
+  logging::AsyncLogger::Instance().Start(1h);
+  ALOG_WARN("{} {}", path, std::string("longer!"));
+  logging::AsyncLogger::Instance().Stop();
+  messages = capture.Messages();
+  REQUIRE(messages.size() == 4);
+  CHECK(messages[3].text == path + " longer...");
+}
+
+TEST_CASE("AsyncLogger::Stop leaves no record of threads logging while it runs in the rings") {
+  Capture capture;
+  auto& logger = logging::AsyncLogger::Instance();
+  std::atomic<bool> done{false};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&done] {
+      while (!done.load()) {
+        ALOG_WARN("record {}", 1);
+        std::this_thread::yield();
+      }
+    });
+  }
+  size_t stranded = 0;
+  for (int round = 0; round < 100; ++round) {
+    logger.Start(1ms);
+    std::this_thread::sleep_for(100us);
+    logger.Stop();
+    // the threads log synchronously now, a record this thread flushes was
+    // published after the final flush of Stop()
+    auto before = capture.Messages().size();
+    logger.Flush();
+    auto messages = capture.Messages();
+    stranded += std::count_if(messages.begin() + static_cast<ptrdiff_t>(before), messages.end(),
+                              [](const auto& message) { return message.thread == std::this_thread::get_id(); });
+  }
+  done = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  CHECK(stranded == 0);
+}
@@ -0,0 +1,95 @@
+#include <doctest/doctest.h>
+#include <spdlog/spdlog.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "contextRegistry.hpp"
+#include "stateConcreteOne.hpp"
+#include "stateConcreteTwo.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr uint64_t kContexts = 1000;
+
+std::filesystem::path SnapshotPath() {
+  return std::filesystem::temp_directory_path() / ("test_registry." + std::to_string(getpid()) + ".snap");
+}
+
+// every third context is in the second state, every fifth one has no running timer
+void Fill(state::ContextRegistry& registry) {
+  for (uint64_t key = 0; key < kContexts; ++key) {
+    auto& context = registry.Emplace(key);
+    (void)context.Serve(4000ms);
+    if (key % 3 == 0) {
+      context.Restore({state::StateConcreteTwo::kId, key % 5 != 0, 6s});
+    } else if (key % 5 == 0) {
+      context.Restore({state::StateConcreteOne::kId, false, {}});
+    }
+  }
+}
+
+void CheckRestored(state::ContextRegistry& saved, state::ContextRegistry& restored) {
+  CHECK(restored.Size() == kContexts);
+  size_t mismatches = 0;
+  saved.ForEach([&](uint64_t key, state::ConcreteContext& context) {
+    auto expected = context.Save();
+    bool found = restored.Visit(key, [&](state::ConcreteContext& other) {
+      auto actual = other.Save();
+      // the timers went on running while the snapshot was written and read
+      if (actual.state != expected.state || actual.timer_running != expected.timer_running ||
+          actual.timer_left > expected.timer_left + 10ms || actual.timer_left + 1s < expected.timer_left) {
+        mismatches++;
+      }
+    });
+    if (!found) {
+      mismatches++;
+    }
+  });
+  CHECK(mismatches == 0);
+}
+
+}  // namespace
+
+TEST_CASE("ContextRegistry snapshot round trip with the same shard count") {
+  spdlog::set_level(spdlog::level::warn);
+  auto path = SnapshotPath();
+  state::ContextRegistry saved(16);
+  Fill(saved);
+  saved.Save(path, 4);
+
+  state::ContextRegistry restored(16);
+  CHECK(restored.Restore(path, 4) == kContexts);
+  CheckRestored(saved, restored);
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("ContextRegistry snapshot round trip with a different shard count") {
+  spdlog::set_level(spdlog::level::warn);
+  auto path = SnapshotPath();
+  state::ContextRegistry saved(16);
+  Fill(saved);
+  saved.Save(path, 4);
+
+  state::ContextRegistry fewer(4);
+  CHECK(fewer.Restore(path, 4) == kContexts);
+  CheckRestored(saved, fewer);
+
+  state::ContextRegistry more(64);
+  CHECK(more.Restore(path, 4) == kContexts);
+  CheckRestored(saved, more);
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("ContextRegistry rejects a file that is not a snapshot") {
+  auto path = SnapshotPath();
+  std::ofstream(path) << "not a snapshot, but long enough for a header";
+  state::ContextRegistry registry;
+  CHECK_THROWS_AS(registry.Restore(path), std::runtime_error);
+  std::filesystem::remove(path);
+}
@@ -0,0 +1,141 @@
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "eventBus.hpp"
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Value {
+  uint32_t producer;
+  uint32_t number;
+};
+
+// read until count values came, checks the order per producer
+size_t ReadAll(watch::BroadcastRing<Value>::Subscriber& subscriber, size_t count, uint32_t producers,
+               std::chrono::microseconds pause = 0us) {
+  std::vector<uint32_t> next(producers, 0);
+  size_t read = 0;
+  size_t disorder = 0;
+  while (read < count) {
+    if (!subscriber.Wait(5s)) {
+      break;
+    }
+    read += subscriber.Poll(
+        [&](const Value& value, uint64_t) {
+          if (value.number != next[value.producer]++) {
+            disorder++;
+          }
+        },
+        pause == 0us ? SIZE_MAX : 1);
+    if (pause != 0us) {
+      std::this_thread::sleep_for(pause);
+    }
+  }
+  CHECK(disorder == 0);
+  return read;
+}
+
+}  // namespace
+
+TEST_CASE("BroadcastRing producer waits while the slowest subscriber is a full ring behind") {
+  watch::BroadcastRing<Value> ring(4);
+  auto subscriber = ring.Subscribe();
+  std::atomic<uint32_t> published{0};
+  std::jthread producer([&] {
+    for (uint32_t number = 0; number < 10; ++number) {
+      ring.Publish(Value{0, number});
+      published++;
+    }
+  });
+  std::this_thread::sleep_for(50ms);
+  // the ring is full, nothing was overwritten
+  CHECK(published == 4);
+  CHECK(subscriber.Backlog() == 5);
+
+  CHECK(ReadAll(subscriber, 10, 1) == 10);
+  producer.join();
+  CHECK(published == 10);
+  CHECK(subscriber.Backlog() == 0);
+}
+
+TEST_CASE("BroadcastRing hands every value to a slow and a fast subscriber across wraparound") {
+  watch::BroadcastRing<Value> ring(8);
+  auto fast = ring.Subscribe();
+  auto slow = ring.Subscribe();
+  constexpr uint32_t kProducers = 2;
+  constexpr uint32_t kValues = 200;
+  size_t fast_read = 0;
+  size_t slow_read = 0;
+  {
+    std::jthread fast_reader([&] { fast_read = ReadAll(fast, kProducers * kValues, kProducers); });
+    std::jthread slow_reader([&] { slow_read = ReadAll(slow, kProducers * kValues, kProducers, 100us); });
+    std::vector<std::jthread> producers;
+    for (uint32_t producer = 0; producer < kProducers; ++producer) {
+      producers.emplace_back([&ring, producer] {
+        for (uint32_t number = 0; number < kValues; ++number) {
+          ring.Publish(Value{producer, number});
+        }
+      });
+    }
+  }
+  CHECK(fast_read == kProducers * kValues);
+  CHECK(slow_read == kProducers * kValues);
+  CHECK(ring.Published() == kProducers * kValues);
+}
+
+TEST_CASE("BroadcastRing subscribers come and go while a producer is blocked") {
+  watch::BroadcastRing<Value> ring(4);
+  auto stuck = ring.Subscribe();
+  std::atomic<uint32_t> published{0};
+  std::jthread producer([&] {
+    for (uint32_t number = 0; number < 100; ++number) {
+      ring.Publish(Value{0, number});
+      published++;
+    }
+  });
+  std::this_thread::sleep_for(20ms);
+  CHECK(published == 4);
+
+  // joins at the next claimed sequence, the blocked producer holds the one before
+  auto late = ring.Subscribe();
+  std::this_thread::sleep_for(20ms);
+  CHECK(published == 4);
+
+  // the stuck subscriber leaves, the producer goes on gated by the late one only
+  stuck.Reset();
+  std::vector<uint32_t> numbers;
+  while (numbers.size() < 95 && late.Wait(5s)) {
+    late.Poll([&numbers](const Value& value, uint64_t) { numbers.push_back(value.number); });
+  }
+  producer.join();
+  CHECK(published == 100);
+  REQUIRE(numbers.size() == 95);
+  CHECK(numbers.front() == 5);
+  CHECK(numbers.back() == 99);
+}
+
+TEST_CASE("BroadcastRing timed wait of a subscriber") {
+  watch::EventBus bus(16);
+  auto subscriber = bus.Subscribe<Value>();
+  auto start = Clock::now();
+  CHECK_FALSE(subscriber.Wait(20ms));
+  CHECK(Clock::now() - start >= 20ms);
+
+  // a sleeping subscriber is woken by the publish
+  std::jthread producer([&bus] {
+    std::this_thread::sleep_for(20ms);
+    bus.Publish(Value{0, 1});
+  });
+  start = Clock::now();
+  CHECK(subscriber.Wait(10s));
+  CHECK(Clock::now() - start < 5s);
+  CHECK(subscriber.Poll([](const Value& value, uint64_t) { CHECK(value.number == 1); }) == 1);
+}
@@ -0,0 +1,182 @@
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "eventExecutor.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// post a task on key ~0 that runs until release is set, return once it runs
+void HoldWorker(watch::EventExecutor& executor, std::atomic<bool>& release) {
+  std::atomic<bool> running{false};
+  REQUIRE(executor.Post(~uint64_t{0}, 0, [&running, &release] {
+    running = true;
+    while (!release.load()) {
+      std::this_thread::sleep_for(1ms);
+    }
+  }));
+  while (!running.load()) {
+    std::this_thread::sleep_for(1ms);
+  }
+}
+
+}  // namespace
+
+TEST_CASE("EventExecutor coalesces a task on a full queue only with the last one queued in its strand") {
+  watch::EventExecutor executor({.threads = 1, .strands = 1, .capacity = 3, .policy = watch::Backpressure::Coalesce});
+  std::atomic<bool> release{false};
+  std::mutex mutex;
+  std::vector<int> order;
+  auto record = [&](int value) {
+    return [&, value] {
+      std::lock_guard lck(mutex);
+      order.push_back(value);
+    };
+  };
+
+  // holds the worker, the tasks below stay queued
+  HoldWorker(executor, release);
+  CHECK(executor.Post(0, 1, record(1)));
+  CHECK(executor.Post(0, 2, record(2)));
+  // room left: queued although the same as the last task
+  CHECK(executor.Post(0, 2, record(2)));
+  // full, a merge with the first task would run it before the tasks 2, the oldest is dropped instead
+  CHECK(executor.Post(0, 1, record(1)));
+  // full and the same as the last queued task: merged
+  CHECK_FALSE(executor.Post(0, 1, record(1)));
+  release = true;
+  executor.Drain();
+
+  CHECK(order == std::vector<int>{2, 2, 1});
+  auto metrics = executor.Metrics();
+  CHECK(metrics.coalesced == 1);
+  CHECK(metrics.dropped == 1);
+  CHECK(metrics.executed == 4);
+}
+
+TEST_CASE("EventExecutor counts the tasks that throw and keeps running") {
+  watch::EventExecutor executor({.threads = 2, .strands = 4});
+  std::atomic<int> done{0};
+  for (uint64_t key = 0; key < 10; ++key) {
+    executor.Post(key, key, [&done, key] {
+      if (key % 2 == 0) {
+        throw std::runtime_error("handler failed");
+      }
+      done++;
+    });
+  }
+  executor.Drain();
+
+  CHECK(done == 5);
+  auto metrics = executor.Metrics();
+  CHECK(metrics.executed == 10);
+  CHECK(metrics.failed == 5);
+}
+
+TEST_CASE("EventExecutor Block keeps the queue at its capacity with several posters") {
+  constexpr size_t kCapacity = 4;
+  watch::EventExecutor executor({.threads = 1, .strands = 4, .capacity = kCapacity});
+  std::atomic<bool> release{false};
+  HoldWorker(executor, release);
+  std::atomic<int> done{0};
+  std::vector<std::thread> posters;
+  for (uint64_t t = 0; t < 4; ++t) {
+    posters.emplace_back([&executor, &done, t] {
+      for (uint64_t i = 0; i < 10; ++i) {
+        CHECK(executor.Post(t + i, i, [&done] { done++; }));
+      }
+    });
+  }
+  // all posters but the ones that fit wait
+  for (auto deadline = std::chrono::steady_clock::now() + 2s;
+       executor.Metrics().blocked < 4 && std::chrono::steady_clock::now() < deadline;) {
+    std::this_thread::sleep_for(1ms);
+  }
+  CHECK(executor.Metrics().depth == kCapacity);
+  release = true;
+  for (auto& poster : posters) {
+    poster.join();
+  }
+  executor.Drain();
+
+  CHECK(done == 40);
+  auto metrics = executor.Metrics();
+  CHECK(metrics.max_depth == kCapacity);
+  CHECK(metrics.blocked >= 4);
+  CHECK(metrics.dropped == 0);
+}
+
+TEST_CASE("EventExecutor DropOldest drops the oldest task of the same key only") {
+  watch::EventExecutor executor({.threads = 1, .strands = 1, .capacity = 2, .policy = watch::Backpressure::DropOldest});
+  std::atomic<bool> release{false};
+  std::vector<int> order;
+  auto record = [&order](int value) { return [&order, value] { order.push_back(value); }; };
+  HoldWorker(executor, release);
+  CHECK(executor.Post(1, 1, record(1)));
+  CHECK(executor.Post(2, 2, record(2)));
+  // full, replaces task 1 and not task 2 of another key in the same strand
+  CHECK(executor.Post(1, 3, record(3)));
+  // full and nothing of key 3 queued, the new task is dropped
+  CHECK_FALSE(executor.Post(3, 4, record(4)));
+  release = true;
+  executor.Drain();
+
+  CHECK(order == std::vector<int>{2, 3});
+  auto metrics = executor.Metrics();
+  CHECK(metrics.dropped == 2);
+  CHECK(metrics.posted == 4);
+  CHECK(metrics.max_depth == 2);
+}
+
+TEST_CASE("EventExecutor runs the tasks of a key in posting order") {
+  constexpr uint64_t kKeys = 8;
+  constexpr int kTasks = 200;
+  watch::EventExecutor executor({.threads = 4, .strands = 2, .batch = 3});
+  std::mutex mutex;
+  std::vector<std::vector<int>> seen(kKeys);
+  for (int i = 0; i < kTasks; ++i) {
+    for (uint64_t key = 0; key < kKeys; ++key) {
+      executor.Post(key, static_cast<uint64_t>(i), [&, key, i] {
+        std::lock_guard lck(mutex);
+        seen[key].push_back(i);
+      });
+    }
+  }
+  executor.Drain();
+
+  std::vector<int> expected(kTasks);
+  for (int i = 0; i < kTasks; ++i) {
+    expected[i] = i;
+  }
+  for (auto& tasks : seen) {
+    CHECK(tasks == expected);
+  }
+}
+
+TEST_CASE("EventExecutor runs the tasks of different keys in parallel") {
+  watch::EventExecutor executor({.threads = 2, .strands = 2});
+  // each task waits for the other one, run one after another the first gives up
+  std::atomic<int> arrived{0};
+  std::atomic<int> met{0};
+  auto task = [&] {
+    arrived++;
+    for (auto deadline = std::chrono::steady_clock::now() + 2s;
+         arrived.load() < 2 && std::chrono::steady_clock::now() < deadline;) {
+      std::this_thread::sleep_for(1ms);
+    }
+    if (arrived.load() == 2) {
+      met++;
+    }
+  };
+  executor.Post(0, 0, task);
+  executor.Post(1, 1, task);
+  executor.Drain();
+
+  CHECK(met == 2);
+}
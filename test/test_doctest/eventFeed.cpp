@@ -0,0 +1,125 @@
+#include <doctest/doctest.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "eventFeed.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// feed object with a header as a broken or foreign publisher would leave it
+struct RawFeed {
+  std::string name = "/fswatch_feed_raw." + std::to_string(getpid());
+  RawFeed(uint32_t slots, uint32_t slot_bytes) {
+    auto size = watch::feed::Bytes(8, 64);
+    int fd = shm_open(name.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0600);
+    REQUIRE(fd >= 0);
+    REQUIRE(ftruncate(fd, static_cast<off_t>(size)) == 0);
+    auto* header = static_cast<watch::feed::Header*>(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    close(fd);
+    REQUIRE(header != MAP_FAILED);
+    std::memcpy(header->magic, watch::feed::kMagic, sizeof(header->magic));
+    header->version = watch::feed::kVersion;
+    header->slots = slots;
+    header->slot_bytes = slot_bytes;
+    munmap(header, size);
+  }
+  ~RawFeed() { shm_unlink(name.c_str()); }
+};
+
+}  // namespace
+
+TEST_CASE("event feed hands events to a subscriber and resyncs it when overrun") {
+  auto name = "/fswatch_feed_test." + std::to_string(getpid());
+  std::optional<watch::FeedPublisher> feed(std::in_place, name, 8, 64);
+  watch::FeedSubscriber subscriber(name);
+  watch::FeedSubscriber::Record record{};
+  CHECK(subscriber.Next(record, 1ms) == watch::FeedSubscriber::Status::Timeout);
+
+  feed->Publish(fswatch::Event::FILE_CREATED, "/tmp/a");
+  feed->Publish(fswatch::Event::FILE_DELETED, std::string(100, 'x'));
+  REQUIRE(subscriber.Next(record, 1ms) == watch::FeedSubscriber::Status::Event);
+  CHECK(record.type == fswatch::Event::FILE_CREATED);
+  CHECK(record.path == "/tmp/a");
+  CHECK_FALSE(record.truncated);
+  REQUIRE(subscriber.Next(record, 1ms) == watch::FeedSubscriber::Status::Event);
+  CHECK(record.type == fswatch::Event::FILE_DELETED);
+  CHECK(record.path == std::string(48, 'x'));
+  CHECK(record.truncated);
+
+  // the producer does not wait: 20 events overwrite the ring of 8
+  for (int i = 0; i < 20; ++i) {
+    feed->Publish(fswatch::Event::FILE_MODIFIED, "/tmp/" + std::to_string(i));
+  }
+  int64_t lagging = 0;
+  feed->ForEachConsumer([&lagging](int64_t pid, uint64_t lag, uint64_t, uint64_t) {
+    CHECK(lag == 20);
+    lagging = pid;
+  });
+  CHECK(lagging == getpid());
+  CHECK(subscriber.Next(record, 1ms) == watch::FeedSubscriber::Status::Resync);
+  CHECK(subscriber.Lost() == 20);
+
+  // a waiting subscriber is woken by the next event
+  std::jthread producer([&feed] {
+    std::this_thread::sleep_for(20ms);
+    feed->Publish(fswatch::Event::DIR_CREATED, "/tmp/d");
+  });
+  REQUIRE(subscriber.Next(record, 2s) == watch::FeedSubscriber::Status::Event);
+  CHECK(record.path == "/tmp/d");
+  producer.join();
+
+  feed.reset();
+  CHECK(subscriber.Next(record, 1s) == watch::FeedSubscriber::Status::Closed);
+}
+
+TEST_CASE("event feed is not replaced while its publisher runs") {
+  auto name = "/fswatch_feed_test." + std::to_string(getpid());
+  std::optional<watch::FeedPublisher> feed(std::in_place, name, 8, 64);
+  CHECK_THROWS_AS(watch::FeedPublisher(name, 8, 64), std::runtime_error);
+  feed.reset();
+  feed.emplace(name, 8, 64);
+
+  // a feed left behind by a process that is gone is replaced
+  auto child = fork();
+  REQUIRE(child >= 0);
+  if (child == 0) {
+    _exit(0);
+  }
+  waitpid(child, nullptr, 0);
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  REQUIRE(fd >= 0);
+  auto* header = static_cast<watch::feed::Header*>(
+      mmap(nullptr, sizeof(watch::feed::Header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+  close(fd);
+  REQUIRE(header != MAP_FAILED);
+  header->pid = child;
+  munmap(header, sizeof(watch::feed::Header));
+  std::optional<watch::FeedPublisher> next;
+  CHECK_NOTHROW(next.emplace(name, 8, 64));
+  watch::FeedSubscriber subscriber(name);
+  next.reset();
+  watch::FeedSubscriber::Record record{};
+  CHECK(subscriber.Next(record, 1s) == watch::FeedSubscriber::Status::Closed);
+}
+
+TEST_CASE("event feed subscriber rejects a header with a bad ring geometry") {
+  CHECK_NOTHROW(watch::FeedSubscriber(RawFeed(8, 64).name));
+  // no slots, slots not a power of two, slots smaller than their header, unaligned slots
+  CHECK_THROWS_AS(watch::FeedSubscriber(RawFeed(0, 64).name), std::runtime_error);
+  CHECK_THROWS_AS(watch::FeedSubscriber(RawFeed(6, 64).name), std::runtime_error);
+  CHECK_THROWS_AS(watch::FeedSubscriber(RawFeed(8, 8).name), std::runtime_error);
+  CHECK_THROWS_AS(watch::FeedSubscriber(RawFeed(8, 60).name), std::runtime_error);
+  // larger than the object
+  CHECK_THROWS_AS(watch::FeedSubscriber(RawFeed(16, 64).name), std::runtime_error);
+}
@@ -0,0 +1,199 @@
+#include <doctest/doctest.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "asyncFswatch.hpp"
+#include "contextAsync.hpp"
+#include "eventLoop.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+struct Waited {
+  int resumes = 0;
+  bool notified = false;
+};
+
+watch::Task<> WaitFor(watch::AsyncEvent& event, std::chrono::milliseconds timeout, Waited& waited) {
+  waited.notified = co_await event.Wait(timeout);
+  waited.resumes++;
+}
+
+}  // namespace
+
+TEST_CASE("AsyncEvent notified in the pass that runs its timeout resumes the waiter once") {
+  watch::EventLoop loop;
+  watch::AsyncEvent event(loop);
+  Waited waited;
+  // keeps the loop busy until both timers below are due, they fire in one pass
+  loop.Spawn([](watch::EventLoop& loop) -> watch::Task<> {
+    co_await loop.SleepFor(1ms);
+    std::this_thread::sleep_for(60ms);
+  }(loop));
+  // due before the waiter's timeout, runs first in the pass
+  loop.Spawn([](watch::EventLoop& loop, watch::AsyncEvent& event) -> watch::Task<> {
+    co_await loop.SleepFor(20ms);
+    event.Notify();
+  }(loop, event));
+  loop.Spawn(WaitFor(event, 21ms, waited));
+  loop.Run();
+
+  CHECK(waited.resumes == 1);
+  CHECK_FALSE(waited.notified);
+}
+
+TEST_CASE("AsyncEvent waiters still suspended at a stop are resumed once") {
+  watch::EventLoop loop;
+  watch::AsyncEvent event(loop);
+  std::vector<Waited> waited(3);
+  for (auto& one : waited) {
+    loop.Spawn(WaitFor(event, 1h, one));
+  }
+  // resumed by the stop in the same pass as the waiters
+  loop.Spawn([](watch::EventLoop& loop, watch::AsyncEvent& event) -> watch::Task<> {
+    co_await loop.SleepFor(1h);
+    event.Notify();
+  }(loop, event));
+  std::jthread stopper([&loop] {
+    std::this_thread::sleep_for(20ms);
+    loop.Stop();
+  });
+  loop.Run();
+
+  for (auto& one : waited) {
+    CHECK(one.resumes == 1);
+    CHECK_FALSE(one.notified);
+  }
+}
+
+TEST_CASE("AsyncEvent Notify resumes a waiter before its timeout") {
+  watch::EventLoop loop;
+  watch::AsyncEvent event(loop);
+  Waited waited;
+  loop.Spawn(WaitFor(event, 1h, waited));
+  loop.Spawn([](watch::EventLoop& loop, watch::AsyncEvent& event) -> watch::Task<> {
+    co_await loop.SleepFor(1ms);
+    event.Notify();
+  }(loop, event));
+  loop.Run();
+
+  CHECK(waited.resumes == 1);
+  CHECK(waited.notified);
+}
+
+TEST_CASE("AsyncTimer Expiry resumes once the timer elapsed") {
+  watch::EventLoop loop;
+  watch::AsyncTimer<> timer(loop);
+  std::optional<bool> elapsed;
+  std::chrono::steady_clock::duration waited{};
+  timer.Start(20ms);
+  loop.Spawn([](watch::AsyncTimer<>& timer, std::optional<bool>& elapsed,
+                std::chrono::steady_clock::duration& waited) -> watch::Task<> {
+    auto start = std::chrono::steady_clock::now();
+    co_await timer.Expiry();
+    waited = std::chrono::steady_clock::now() - start;
+    elapsed = timer.Timer().IsElapsed();
+  }(timer, elapsed, waited));
+  loop.Run();
+
+  CHECK(elapsed == true);
+  CHECK(waited >= 20ms);
+  CHECK(waited < 1s);
+}
+
+TEST_CASE("AsyncTimer Expiry returns at once for a stopped timer and at a loop stop") {
+  watch::EventLoop loop;
+  watch::AsyncTimer<> stopped(loop);
+  watch::AsyncTimer<> running(loop);
+  stopped.Start(1h);
+  stopped.Stop();
+  running.Start(1h);
+  int resumed = 0;
+  auto expiry = [](watch::AsyncTimer<>& timer, int& resumed) -> watch::Task<> {
+    co_await timer.Expiry();
+    resumed++;
+  };
+  loop.Spawn(expiry(stopped, resumed));
+  CHECK(resumed == 1);
+  loop.Spawn(expiry(running, resumed));
+  CHECK(resumed == 1);
+  std::jthread stopper([&loop] {
+    std::this_thread::sleep_for(20ms);
+    loop.Stop();
+  });
+  loop.Run();
+
+  CHECK(resumed == 2);
+  CHECK(running.Timer().IsElapsed() == false);
+}
+
+TEST_CASE("async_fswatch next_event hands out the events and ends at a loop stop") {
+  auto dir = std::filesystem::temp_directory_path() / ("test_async_fswatch_" + std::to_string(::getpid()));
+  std::filesystem::create_directories(dir);
+  std::vector<std::string> created;
+  bool ended = false;
+  {
+    watch::EventLoop loop;
+    async_fswatch watcher(loop, dir.string(), {fswatch::Event::FILE_CREATED});
+    loop.Spawn([](async_fswatch& watcher, std::vector<std::string>& created, bool& ended) -> watch::Task<> {
+      while (auto event = co_await watcher.next_event()) {
+        created.push_back(event->path.filename().string());
+      }
+      ended = true;
+    }(watcher, created, ended));
+    // the consumer waits for the inotify fd now, the files come in one read
+    { std::ofstream(dir / "a"); }
+    { std::ofstream(dir / "b"); }
+    loop.Spawn([](watch::EventLoop& loop, std::vector<std::string>& created) -> watch::Task<> {
+      for (auto deadline = std::chrono::steady_clock::now() + 2s;
+           created.size() < 2 && std::chrono::steady_clock::now() < deadline;) {
+        co_await loop.SleepFor(1ms);
+      }
+      loop.Stop();
+    }(loop, created));
+    loop.Run();
+  }
+  std::filesystem::remove_all(dir);
+
+  CHECK(created == std::vector<std::string>{"a", "b"});
+  CHECK(ended);
+}
+
+TEST_CASE("ServeAsync serves a context on the virtual clock and is woken by its event") {
+  state::ContextClock::UseVirtual(true);
+  watch::VirtualClock::Reset();
+  {
+    watch::EventLoop loop;
+    watch::AsyncEvent wakeup(loop);
+    state::ConcreteContext context;
+    std::vector<uint16_t> states;
+    loop.Spawn(state::ServeAsync(loop, context, wakeup, 4000ms));
+    // state 1 waits 500 ms of virtual time, the serve loop waits for the wakeup meanwhile
+    loop.Spawn([](watch::EventLoop& loop, watch::AsyncEvent& wakeup, state::ConcreteContext& context,
+                  std::vector<uint16_t>& states) -> watch::Task<> {
+      co_await loop.SleepFor(5ms);
+      states.push_back(context.StateId());
+      watch::VirtualClock::Advance(400ms);
+      wakeup.Notify();
+      co_await loop.SleepFor(5ms);
+      states.push_back(context.StateId());
+      watch::VirtualClock::Advance(101ms);
+      wakeup.Notify();
+      co_await loop.SleepFor(5ms);
+      states.push_back(context.StateId());
+      loop.Stop();
+    }(loop, wakeup, context, states));
+    loop.Run();
+
+    CHECK(states == std::vector<uint16_t>{1, 1, 2});
+  }
+  state::ContextClock::UseVirtual(false);
+}
@@ -0,0 +1,142 @@
+#include <doctest/doctest.h>
+
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "flatIndex.hpp"
+
+namespace {
+
+// home slot of a key, the hash of FlatIndex
+size_t Home(uint64_t key, size_t slots) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdull;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ull;
+  key ^= key >> 33;
+  return static_cast<size_t>(key) & (slots - 1);
+}
+
+// the first count keys homed in a slot
+std::vector<uint64_t> KeysAt(size_t home, size_t slots, size_t count) {
+  std::vector<uint64_t> keys;
+  for (uint64_t key = 0; keys.size() < count; ++key) {
+    if (Home(key, slots) == home) {
+      keys.push_back(key);
+    }
+  }
+  return keys;
+}
+
+}  // namespace
+
+TEST_CASE("FlatIndex behaves like std::unordered_map under insert and erase churn") {
+  watch::FlatIndex<uint32_t, uint32_t> index;
+  std::unordered_map<uint32_t, uint32_t> reference;
+  std::mt19937 random(42);
+  // few distinct keys, most operations hit long clusters and shift them back
+  std::uniform_int_distribution<uint32_t> keys(0, 2047);
+  size_t mismatches = 0;
+  for (uint32_t step = 0; step < 200000; ++step) {
+    auto key = keys(random);
+    switch (random() % 3) {
+      case 0:
+        index.Insert(key, step);
+        reference[key] = step;
+        break;
+      case 1:
+        if (index.Erase(key) != (reference.erase(key) == 1)) {
+          mismatches++;
+        }
+        break;
+      default: {
+        auto* found = index.Find(key);
+        auto it = reference.find(key);
+        if ((found == nullptr) != (it == reference.end()) || (found != nullptr && *found != it->second)) {
+          mismatches++;
+        }
+      }
+    }
+    if (index.Size() != reference.size()) {
+      mismatches++;
+    }
+  }
+  CHECK(mismatches == 0);
+
+  size_t visited = 0;
+  index.ForEach([&](uint32_t key, uint32_t value) {
+    auto it = reference.find(key);
+    if (it == reference.end() || it->second != value) {
+      mismatches++;
+    }
+    visited++;
+  });
+  CHECK(mismatches == 0);
+  CHECK(visited == reference.size());
+}
+
+TEST_CASE("FlatIndex erase keeps a cluster that wraps around the end of the table") {
+  watch::FlatIndex<uint64_t, int> index;
+  // 16 slots: three keys homed in the last slot fill it and the first two
+  auto last = KeysAt(15, 16, 3);
+  auto first = KeysAt(0, 16, 1);
+  for (size_t i = 0; i < last.size(); ++i) {
+    index.Insert(last[i], static_cast<int>(i));
+  }
+  // homed in slot 0 but displaced behind the wrapped cluster
+  index.Insert(first[0], 100);
+  REQUIRE(index.Capacity() == 16);
+
+  // the entry at the end of the wrapped cluster
+  CHECK(index.Erase(first[0]));
+  CHECK(index.Find(first[0]) == nullptr);
+  for (size_t i = 0; i < last.size(); ++i) {
+    REQUIRE(index.Find(last[i]) != nullptr);
+    CHECK(*index.Find(last[i]) == static_cast<int>(i));
+  }
+
+  // the entry in the last slot, the others shift back across the end
+  index.Insert(first[0], 100);
+  CHECK(index.Erase(last[0]));
+  CHECK_FALSE(index.Erase(last[0]));
+  CHECK(*index.Find(last[1]) == 1);
+  CHECK(*index.Find(last[2]) == 2);
+  CHECK(*index.Find(first[0]) == 100);
+  CHECK(index.Size() == 3);
+
+  CHECK(index.Erase(last[1]));
+  CHECK(index.Erase(last[2]));
+  CHECK(*index.Find(first[0]) == 100);
+  CHECK(index.Erase(first[0]));
+  CHECK(index.Size() == 0);
+}
+
+TEST_CASE("FlatIndex grows when an insert crosses 7/8 load and keeps every entry") {
+  watch::FlatIndex<int, int> index;
+  for (int key = 0; key < 14; ++key) {
+    index.Insert(key, -key);
+  }
+  CHECK(index.Capacity() == 16);
+  // updating a present key is no insert
+  index.Insert(13, 13);
+  CHECK(index.Capacity() == 16);
+  CHECK(*index.Find(13) == 13);
+
+  index.Insert(14, -14);
+  CHECK(index.Capacity() == 32);
+  CHECK(index.Size() == 15);
+  for (int key = 0; key < 13; ++key) {
+    REQUIRE(index.Find(key) != nullptr);
+    CHECK(*index.Find(key) == -key);
+  }
+  CHECK(*index.Find(14) == -14);
+
+  for (int key = 15; key < 1000; ++key) {
+    index.Insert(key, -key);
+    CHECK(index.Size() * 8 <= index.Capacity() * 7);
+  }
+  CHECK(index.Capacity() == 2048);
+  CHECK(*index.Find(999) == -999);
+}
@@ -0,0 +1,251 @@
+#include <doctest/doctest.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <latch>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "flightRecorder.hpp"
+
+namespace flight = logging::flight;
+
+namespace {
+
+// read-only mapping of a recorder, as the dump tool has it
+class Mapping {
+ public:
+  explicit Mapping(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    struct stat info {};
+    if (fd >= 0 && fstat(fd, &info) == 0) {
+      m_size = static_cast<size_t>(info.st_size);
+      auto* base = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+      m_base = base == MAP_FAILED ? nullptr : static_cast<const char*>(base);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  Mapping(const Mapping&) = delete;
+  Mapping& operator=(const Mapping&) = delete;
+  ~Mapping() {
+    if (m_base) {
+      munmap(const_cast<char*>(m_base), m_size);
+    }
+  }
+
+  [[nodiscard]] const char* Base() const noexcept {
+    return m_base;
+  }
+  [[nodiscard]] size_t Size() const noexcept {
+    return m_size;
+  }
+  [[nodiscard]] const flight::Header& Header() const noexcept {
+    return *reinterpret_cast<const flight::Header*>(m_base);
+  }
+  [[nodiscard]] std::vector<flight::Entry> Entries() const {
+    std::vector<flight::Entry> entries;
+    for (uint32_t ring = 0; ring < Header().rings; ++ring) {
+      flight::CopyRing(Header(), m_base, ring, entries);
+    }
+    return entries;
+  }
+
+ private:
+  const char* m_base{nullptr};
+  size_t m_size{0};
+};
+
+std::string TestName() {
+  return "/state_flight_test." + std::to_string(getpid());
+}
+
+// the fields of a record derived from one number, a torn copy mixes two numbers
+void RecordNumber(uint64_t number) {
+  logging::FlightRecorder::Instance().Record(flight::Kind::Transition, number, static_cast<uint16_t>(number),
+                                             static_cast<uint16_t>(number >> 16), static_cast<int32_t>(number));
+}
+
+bool IsWhole(const flight::Record& record) {
+  auto number = record.context;
+  return record.kind == flight::Kind::Transition && record.from == static_cast<uint16_t>(number) &&
+         record.to == static_cast<uint16_t>(number >> 16) && record.timer_left_ms == static_cast<int32_t>(number);
+}
+
+}  // namespace
+
+TEST_CASE("FlightRecorder records of two threads decode from the mapping") {
+  auto& recorder = logging::FlightRecorder::Instance();
+  recorder.Open(TestName(), 4, 64);
+  REQUIRE(recorder.IsOpen());
+  constexpr uint64_t kRecords = 100;
+  // a finished thread frees its ring for the next one, both hold theirs until the other recorded
+  std::latch recorded(2);
+  std::vector<std::jthread> threads;
+  for (uint64_t thread = 0; thread < 2; ++thread) {
+    threads.emplace_back([&recorded, thread] {
+      for (uint64_t index = 0; index < kRecords; ++index) {
+        RecordNumber(thread << 32 | index);
+      }
+      recorded.arrive_and_wait();
+    });
+  }
+  threads.clear();
+
+  Mapping mapping(recorder.Name());
+  REQUIRE(mapping.Base() != nullptr);
+  const auto& header = mapping.Header();
+  CHECK(std::memcmp(header.magic, flight::kMagic, sizeof(header.magic)) == 0);
+  CHECK(header.version == flight::kVersion);
+  CHECK(header.pid == getpid());
+  CHECK(header.slots == 64);
+  CHECK(header.dropped == 0);
+
+  // each ring keeps the last 64 records of its thread, oldest first
+  auto entries = mapping.Entries();
+  CHECK(entries.size() == 2 * 64);
+  size_t mismatches = 0;
+  uint64_t next[2] = {kRecords - 64, kRecords - 64};
+  int32_t tids[2] = {0, 0};
+  for (const auto& [record, tid] : entries) {
+    auto thread = record.context >> 32;
+    if (thread > 1 || !IsWhole(record) || (record.context & 0xffffffff) != next[thread]++) {
+      mismatches++;
+      continue;
+    }
+    if (tids[thread] == 0) {
+      tids[thread] = tid;
+    }
+    if (tids[thread] != tid) {
+      mismatches++;
+    }
+  }
+  CHECK(mismatches == 0);
+  CHECK(tids[0] != tids[1]);
+  recorder.Close();
+  CHECK_FALSE(recorder.IsOpen());
+}
+
+TEST_CASE("FlightRecorder reader drops the slots that are written or were overwritten") {
+  constexpr uint32_t kSlots = 4;
+  std::vector<uint64_t> memory((sizeof(flight::Header) + sizeof(flight::RingHeader) + kSlots * sizeof(flight::Record)) /
+                               sizeof(uint64_t));
+  auto* base = reinterpret_cast<char*>(memory.data());
+  auto& header = *reinterpret_cast<flight::Header*>(base);
+  header.rings = 1;
+  header.slots = kSlots;
+  header.ring_bytes = sizeof(flight::RingHeader) + kSlots * sizeof(flight::Record);
+  auto& ring = *reinterpret_cast<flight::RingHeader*>(&header + 1);
+  auto* records = reinterpret_cast<flight::Record*>(&ring + 1);
+  // positions 2..5 are in the ring, 6 in slot 2 is being written
+  ring.head = 6;
+  for (uint32_t position = 2; position < 6; ++position) {
+    records[position % kSlots].sequence = position + 1;
+    records[position % kSlots].context = position;
+  }
+  records[3].sequence = 0;
+
+  std::vector<flight::Entry> entries;
+  flight::CopyRing(header, base, 0, entries);
+  REQUIRE(entries.size() == 3);
+  CHECK(entries[0].record.context == 2);
+  CHECK(entries[1].record.context == 4);
+  CHECK(entries[2].record.context == 5);
+
+  // the writer lapped the reader: slot 2 holds position 6 instead of 2
+  records[2].sequence = 7;
+  records[2].context = 6;
+  entries.clear();
+  flight::CopyRing(header, base, 0, entries);
+  REQUIRE(entries.size() == 2);
+  CHECK(entries[0].record.context == 4);
+  CHECK(entries[1].record.context == 5);
+}
+
+TEST_CASE("FlightRecorder reader never keeps a record torn by a writer lapping it") {
+  auto& recorder = logging::FlightRecorder::Instance();
+  recorder.Open(TestName(), 1, 8);
+  Mapping mapping(recorder.Name());
+  REQUIRE(mapping.Base() != nullptr);
+  std::atomic<bool> stop{false};
+  std::latch started(1);
+  std::jthread writer([&stop, &started] {
+    RecordNumber(0);
+    started.count_down();
+    for (uint64_t number = 1; !stop.load(std::memory_order_relaxed); ++number) {
+      RecordNumber(number);
+    }
+  });
+  started.wait();
+  size_t torn = 0;
+  size_t copied = 0;
+  for (int round = 0; round < 20000 || copied == 0; ++round) {
+    for (const auto& entry : mapping.Entries()) {
+      if (!IsWhole(entry.record) || entry.record.sequence != static_cast<uint32_t>(entry.record.context + 1)) {
+        torn++;
+      }
+      copied++;
+    }
+  }
+  stop = true;
+  writer.join();
+  CHECK(torn == 0);
+  CHECK(copied > 0);
+  recorder.Close();
+}
+
+TEST_CASE("FlightRecorder counts the threads that find every ring claimed") {
+  auto& recorder = logging::FlightRecorder::Instance();
+  recorder.Open(TestName(), 2, 8);
+  Mapping mapping(recorder.Name());
+  REQUIRE(mapping.Base() != nullptr);
+  // the threads hold their rings until all of them recorded
+  std::latch recorded(3);
+  {
+    std::vector<std::jthread> threads;
+    for (uint64_t thread = 0; thread < 3; ++thread) {
+      threads.emplace_back([&recorded, thread] {
+        RecordNumber(thread);
+        recorded.arrive_and_wait();
+      });
+    }
+  }
+  CHECK(flight::Load(mapping.Header().dropped, std::memory_order_relaxed) == 1);
+  CHECK(mapping.Entries().size() == 2);
+
+  // the rings of finished threads are free again
+  std::jthread([] { RecordNumber(3); }).join();
+  CHECK(flight::Load(mapping.Header().dropped, std::memory_order_relaxed) == 1);
+  CHECK(mapping.Entries().size() == 3);
+  recorder.Close();
+}
+
+TEST_CASE("FlightRecorder header check rejects a ring geometry that reads outside the mapping") {
+  auto& recorder = logging::FlightRecorder::Instance();
+  recorder.Open(TestName(), 2, 8);
+  Mapping mapping(recorder.Name());
+  REQUIRE(mapping.Base() != nullptr);
+  auto header = mapping.Header();
+  CHECK(flight::Valid(header, mapping.Size()));
+  CHECK_FALSE(flight::Valid(header, sizeof(flight::Header) - 1));
+  auto bad = [&header](auto change) {
+    auto copy = header;
+    change(copy);
+    return copy;
+  };
+  CHECK_FALSE(flight::Valid(bad([](auto& h) { h.magic[0] = 'X'; }), mapping.Size()));
+  CHECK_FALSE(flight::Valid(bad([](auto& h) { h.version++; }), mapping.Size()));
+  CHECK_FALSE(flight::Valid(bad([](auto& h) { h.slots = 0; }), mapping.Size()));
+  CHECK_FALSE(flight::Valid(bad([](auto& h) { h.slots *= 2; }), mapping.Size()));
+  CHECK_FALSE(flight::Valid(bad([](auto& h) { h.ring_bytes -= 4; }), mapping.Size()));
+  CHECK_FALSE(flight::Valid(bad([](auto& h) { h.rings++; }), mapping.Size()));
+  recorder.Close();
+}
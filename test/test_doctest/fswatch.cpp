@@ -0,0 +1,521 @@
+#include <doctest/doctest.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "basicFswatch.hpp"
+#include "fswatch.hpp"
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// directory with a watcher that is blocked waiting for events
+struct WatchedDir {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() / ("test_fswatch_" + std::to_string(::getpid()));
+  WatchedDir() { std::filesystem::create_directories(path); }
+  ~WatchedDir() { std::filesystem::remove_all(path); }
+};
+
+bool WaitWatching(const fswatch& watcher) {
+  for (auto deadline = Clock::now() + 2s; Clock::now() < deadline; std::this_thread::sleep_for(1ms)) {
+    if (watcher.counters().watches > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+TEST_CASE("fswatch run_async stops within 10 ms") {
+  WatchedDir dir;
+  fswatch watcher(dir.path.string());
+  watcher.run_async();
+  REQUIRE(WaitWatching(watcher));
+  std::this_thread::sleep_for(20ms);
+
+  auto start = Clock::now();
+  watcher.join();
+  CHECK(Clock::now() - start < 10ms);
+}
+
+TEST_CASE("fswatch start(stop_token) stops within 10 ms") {
+  WatchedDir dir;
+  fswatch watcher(dir.path.string());
+  std::stop_source stop;
+  std::thread worker([&]() { watcher.start(stop.get_token()); });
+  REQUIRE(WaitWatching(watcher));
+  std::this_thread::sleep_for(20ms);
+
+  auto start = Clock::now();
+  stop.request_stop();
+  worker.join();
+  CHECK(Clock::now() - start < 10ms);
+  CHECK(watcher.counters().watches == 0);
+}
+
+TEST_CASE("fswatch stop() wakes up start()") {
+  WatchedDir dir;
+  fswatch watcher(dir.path.string());
+  std::thread worker([&]() { watcher.start(std::stop_token{}); });
+  REQUIRE(WaitWatching(watcher));
+  std::this_thread::sleep_for(20ms);
+
+  auto start = Clock::now();
+  watcher.stop();
+  worker.join();
+  CHECK(Clock::now() - start < 10ms);
+}
+
+TEST_CASE("fswatch busy polling sees every event and stops while spinning") {
+  WatchedDir dir;
+  fswatch watcher(dir.path.string());
+  std::atomic<int> created{0};
+  watcher.on(fswatch::Event::FILE_CREATED, [&](const fswatch::EventInfo&) { created++; });
+  // a budget far above the test time, the watcher never goes back to poll()
+  watcher.busy_poll(10s);
+  watcher.run_async();
+  REQUIRE(WaitWatching(watcher));
+
+  for (int file = 0; file < 20; ++file) {
+    std::ofstream(dir.path / ("f" + std::to_string(file)));
+  }
+  for (auto deadline = Clock::now() + 2s; created < 20 && Clock::now() < deadline;) {
+    std::this_thread::sleep_for(1ms);
+  }
+  CHECK(created == 20);
+
+  auto start = Clock::now();
+  watcher.join();
+  CHECK(Clock::now() - start < 10ms);
+}
+
+TEST_CASE("fswatch start() pins the calling thread only while it runs") {
+  WatchedDir dir;
+  cpu_set_t before;
+  REQUIRE(pthread_getaffinity_np(pthread_self(), sizeof(before), &before) == 0);
+  int cpu = 0;
+  while (!CPU_ISSET(cpu, &before)) {
+    cpu++;
+  }
+
+  fswatch watcher(dir.path.string());
+  std::atomic<int> cpus{0};
+  watcher.on(fswatch::Event::FILE_CREATED, [&cpus](const fswatch::EventInfo&) {
+    cpu_set_t set;
+    pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+    cpus = CPU_COUNT(&set);
+  });
+  watcher.busy_poll(0us, cpu);
+  std::stop_source stop;
+  bool restored = false;
+  // the thread of the caller, not one owned by the watcher
+  std::thread worker([&] {
+    watcher.start(stop.get_token());
+    cpu_set_t after;
+    pthread_getaffinity_np(pthread_self(), sizeof(after), &after);
+    restored = CPU_EQUAL(&after, &before);
+  });
+  REQUIRE(WaitWatching(watcher));
+  std::ofstream(dir.path / "a");
+  for (auto deadline = Clock::now() + 2s; cpus == 0 && Clock::now() < deadline;) {
+    std::this_thread::sleep_for(1ms);
+  }
+  stop.request_stop();
+  worker.join();
+
+  CHECK(cpus == 1);
+  CHECK(restored);
+}
+
+namespace {
+
+struct OnCreated {
+  std::vector<std::string> paths;
+  void operator()(fswatch::on_event<fswatch::Event::FILE_CREATED>, const fswatch::event_view& event) {
+    paths.emplace_back(event.path);
+  }
+};
+
+struct OnAnyFile {
+  int count = 0;
+  void operator()(fswatch::on_event<fswatch::Event::FILE_CREATED>, const fswatch::event_view&) { count++; }
+  void operator()(fswatch::on_event<fswatch::Event::FILE_DELETED>, const fswatch::event_view&) { count++; }
+};
+
+}  // namespace
+
+TEST_CASE("basic_fswatch derives the handled events from the handler overloads") {
+  using watcher_type = basic_fswatch<OnCreated, OnAnyFile>;
+  auto bit = [](fswatch::Event event) { return 1u << static_cast<unsigned>(event); };
+  CHECK(watcher_type::kHandled == (bit(fswatch::Event::FILE_CREATED) | bit(fswatch::Event::FILE_DELETED)));
+  CHECK(basic_fswatch<OnCreated>::kHandled == bit(fswatch::Event::FILE_CREATED));
+}
+
+TEST_CASE("basic_fswatch dispatches an event to every handler of it") {
+  WatchedDir dir;
+  basic_fswatch<OnCreated, OnAnyFile> watcher({OnCreated{}, OnAnyFile{}}, dir.path.string());
+  watcher.init();
+  { std::ofstream(dir.path / "a"); }
+  std::filesystem::remove(dir.path / "a");
+  for (auto deadline = Clock::now() + 2s; watcher.handler<OnAnyFile>().count < 2 && Clock::now() < deadline;) {
+    watcher.read_events();
+  }
+  watcher.cleanup();
+
+  REQUIRE(watcher.handler<OnCreated>().paths.size() == 1);
+  CHECK(watcher.handler<OnCreated>().paths[0] == (dir.path / "a").string());
+  CHECK(watcher.handler<OnAnyFile>().count == 2);
+}
+
+TEST_CASE("fswatch asks the kernel only for the events that have a handler") {
+  WatchedDir dir;
+  auto root = dir.path.string();
+  auto file = dir.path / "a";
+  std::vector<fswatch::Event> seen;
+  fswatch watcher(root);
+  watcher.on(fswatch::Event::FILE_CREATED, [&seen](const fswatch::EventInfo &event) { seen.push_back(event.type); });
+  auto touch = [&file] {
+    std::ifstream in(file);
+  };
+  auto read_for = [&watcher](std::chrono::milliseconds time) {
+    for (auto until = Clock::now() + time; Clock::now() < until;) {
+      watcher.read_events();
+    }
+  };
+  watcher.init();
+  { std::ofstream(file) << "a"; }
+  read_for(20ms);
+  REQUIRE(seen == std::vector<fswatch::Event>{fswatch::Event::FILE_CREATED});
+
+  // no handler, no IN_OPEN/IN_CLOSE from the kernel
+  auto events_read = watcher.counters().events_read;
+  touch();
+  read_for(20ms);
+  CHECK(watcher.counters().events_read == events_read);
+
+  // a handler added while watching is merged into the installed watches
+  seen.clear();
+  watcher.on({fswatch::Event::FILE_OPENED, fswatch::Event::FILE_CLOSED},
+             [&seen](const fswatch::EventInfo &event) { seen.push_back(event.type); });
+  touch();
+  read_for(20ms);
+  CHECK(seen == std::vector<fswatch::Event>{fswatch::Event::FILE_OPENED, fswatch::Event::FILE_CLOSED});
+
+  // a narrower subscription replaces the mask
+  seen.clear();
+  events_read = watcher.counters().events_read;
+  watcher.subscribe(root, {fswatch::Event::FILE_CREATED});
+  touch();
+  read_for(20ms);
+  CHECK(seen.empty());
+  CHECK(watcher.counters().events_read == events_read);
+
+  // a new root is not watched before the next init()
+  CHECK_THROWS_AS(watcher.subscribe(root + "/other", {fswatch::Event::FILE_CREATED}), std::runtime_error);
+  watcher.cleanup();
+}
+
+TEST_CASE("fswatch replays a recorded trace with the watches of the recording") {
+  WatchedDir dir;
+  auto trace_path = dir.path.string() + ".trace";
+  std::vector<std::string> recorded;
+  {
+    watch::TraceWriter writer(trace_path);
+    fswatch watcher(dir.path.string());
+    watcher.on({fswatch::Event::FILE_CREATED, fswatch::Event::DIR_CREATED},
+               [&recorded](const fswatch::EventInfo &event) { recorded.push_back(event.path.string()); });
+    watcher.record(&writer);
+    watcher.init();
+    std::filesystem::create_directory(dir.path / "sub");
+    for (auto deadline = Clock::now() + 2s; recorded.empty() && Clock::now() < deadline;) {
+      watcher.read_events();
+    }
+    { std::ofstream(dir.path / "sub" / "a"); }
+    for (auto deadline = Clock::now() + 2s; recorded.size() < 2 && Clock::now() < deadline;) {
+      watcher.read_events();
+    }
+    watcher.cleanup();
+  }
+  REQUIRE(recorded.size() == 2);
+  std::filesystem::remove_all(dir.path);
+
+  std::vector<std::string> replayed;
+  watch::TraceReader trace(trace_path);
+  fswatch watcher(dir.path.string());
+  watcher.on({fswatch::Event::FILE_CREATED, fswatch::Event::DIR_CREATED},
+             [&replayed](const fswatch::EventInfo &event) { replayed.push_back(event.path.string()); });
+  CHECK(watcher.replay(trace) >= 2);
+  CHECK(replayed == recorded);
+  CHECK(watcher.counters().watches == 0);
+  std::filesystem::remove(trace_path);
+}
+
+TEST_CASE("trace reader leaves no descriptor open when it rejects a file") {
+  auto open_fds = [] {
+    return std::distance(std::filesystem::directory_iterator("/proc/self/fd"), std::filesystem::directory_iterator{});
+  };
+  auto path = std::filesystem::temp_directory_path() / ("test_trace_reader_" + std::to_string(::getpid()));
+  auto fds = open_fds();
+  for (int i = 0; i < 8; ++i) {
+    // mapped, but the magic is wrong
+    { std::ofstream(path) << std::string(64, 'x'); }
+    CHECK_THROWS_AS(watch::TraceReader{path.string()}, std::runtime_error);
+    // shorter than the header
+    { std::ofstream(path) << "x"; }
+    CHECK_THROWS_AS(watch::TraceReader{path.string()}, std::runtime_error);
+  }
+  CHECK(open_fds() == fds);
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("fswatch keeps a mirror of the tree without handlers") {
+  WatchedDir dir;
+  std::filesystem::create_directories(dir.path / "s");
+  std::ofstream(dir.path / "a") << "abc";
+  std::ofstream(dir.path / "s" / "b") << "b";
+  auto root = dir.path.string();
+
+  watch::TreeMirror tree;
+  fswatch watcher(root);
+  watcher.mirror(&tree);
+  watcher.run_async();
+  REQUIRE(WaitWatching(watcher));
+
+  CHECK(tree.CountFiles(root) == 2);
+  CHECK(tree.CountFiles(root + "/s") == 1);
+  std::vector<std::string> names;
+  CHECK(tree.List(root, [&](std::string_view name, const watch::TreeMirror::Info&) { names.emplace_back(name); }));
+  std::sort(names.begin(), names.end());
+  CHECK(names == std::vector<std::string>{"a", "s"});
+  auto scanned = tree.Sequence();
+
+  std::ofstream(dir.path / "c") << "hello";
+  std::filesystem::remove(dir.path / "a");
+  std::filesystem::create_directories(dir.path / "t");
+  std::ofstream(dir.path / "t" / "d") << "d";
+  watch::TreeMirror::Info info;
+  for (auto deadline = Clock::now() + 2s; Clock::now() < deadline; std::this_thread::sleep_for(1ms)) {
+    if (tree.Stat(root + "/c", info) && info.size == 5 && tree.CountFiles(root + "/t") == 1 &&
+        !tree.Stat(root + "/a", info)) {
+      break;
+    }
+  }
+  watcher.join();
+
+  REQUIRE(tree.Stat(root + "/c", info));
+  CHECK(info.type == watch::TreeMirror::Type::File);
+  CHECK(info.size == 5);
+  CHECK_FALSE(tree.Stat(root + "/a", info));
+  CHECK(tree.CountFiles(root) == 3);
+
+  std::map<std::string, watch::TreeMirror::Type> changed;
+  CHECK(tree.ChangedSince(scanned, [&](std::string_view path, const watch::TreeMirror::Info& change) {
+    changed.emplace(path.substr(root.size()), change.type);
+  }));
+  CHECK(changed["/c"] == watch::TreeMirror::Type::File);
+  CHECK(changed["/a"] == watch::TreeMirror::Type::Deleted);
+  CHECK(changed["/t/d"] == watch::TreeMirror::Type::File);
+  CHECK(changed.count("/s/b") == 0);
+}
+
+TEST_CASE("fswatch mirror follows the existing subdirectories and renames") {
+  WatchedDir dir;
+  std::filesystem::create_directories(dir.path / "s" / "n");
+  std::ofstream(dir.path / "s" / "b") << "b";
+  auto root = dir.path.string();
+
+  watch::TreeMirror tree;
+  std::mutex mutex;
+  std::vector<std::string> created;
+  fswatch watcher(root);
+  watcher.on(fswatch::Event::FILE_CREATED, [&](const fswatch::EventInfo &event) {
+    std::lock_guard lock(mutex);
+    created.push_back(event.path.string().substr(root.size()));
+  });
+  watcher.mirror(&tree);
+  watcher.run_async();
+  auto wait_for = [](auto &&done) {
+    for (auto deadline = Clock::now() + 2s; Clock::now() < deadline; std::this_thread::sleep_for(1ms)) {
+      if (done()) {
+        return true;
+      }
+    }
+    return false;
+  };
+  REQUIRE(wait_for([&] { return tree.CountFiles(root) == 1; }));
+  // the directories that were there before the start are watched, the
+  // handlers see none of their entries
+  CHECK(watcher.counters().watches == 3);
+
+  std::ofstream(dir.path / "s" / "n" / "e") << "e";
+  CHECK(wait_for([&] { return tree.CountFiles(root + "/s/n") == 1; }));
+  CHECK(tree.CountFiles(root) == 2);
+  {
+    std::lock_guard lock(mutex);
+    CHECK(created == std::vector<std::string>{"/s/n/e"});
+  }
+
+  // renamed with its subtree, which is watched under the new name
+  std::filesystem::rename(dir.path / "s", dir.path / "r");
+  watch::TreeMirror::Info info;
+  REQUIRE(wait_for([&] { return tree.CountFiles(root + "/r") == 2; }));
+  CHECK_FALSE(tree.Stat(root + "/s", info));
+  std::ofstream(dir.path / "r" / "n" / "f") << "f";
+  CHECK(wait_for([&] { return tree.CountFiles(root + "/r/n") == 2; }));
+  std::filesystem::rename(dir.path / "r" / "n" / "f", dir.path / "r" / "g");
+  CHECK(wait_for([&] { return tree.Stat(root + "/r/g", info); }));
+  watcher.join();
+
+  CHECK_FALSE(tree.Stat(root + "/r/n/f", info));
+  CHECK(tree.CountFiles(root) == 3);
+  CHECK(watcher.counters().watches == 0);
+}
+
+TEST_CASE("fswatch tail hands out appended bytes across truncation and rotation") {
+  WatchedDir dir;
+  auto log = (dir.path / "app.log").string();
+  std::ofstream(log) << "old";
+
+  std::mutex mutex;
+  std::string text;
+  watch::FileTail tail(
+      [&](std::string_view path, std::span<const char> bytes) {
+        std::lock_guard lock(mutex);
+        if (path == log) {
+          text.append(bytes.data(), bytes.size());
+        }
+      },
+      watch::FileTail::Start::End);
+  REQUIRE(tail.Follow(log, watch::FileTail::Start::End));
+  fswatch watcher(dir.path.string());
+  watcher.tail(&tail);
+  watcher.run_async();
+  REQUIRE(WaitWatching(watcher));
+
+  auto wait_for = [&](size_t length) {
+    for (auto deadline = Clock::now() + 2s; Clock::now() < deadline; std::this_thread::sleep_for(1ms)) {
+      std::lock_guard lock(mutex);
+      if (text.size() >= length) {
+        return;
+      }
+    }
+  };
+  std::ofstream(log, std::ios::app) << "one\n" << std::flush;
+  wait_for(4);
+  std::ofstream(log, std::ios::app) << "two\n";
+  wait_for(8);
+  // truncated and written again
+  std::ofstream(log, std::ios::trunc) << "three\n";
+  wait_for(14);
+  // rotated: renamed away and created anew
+  std::filesystem::rename(log, log + ".1");
+  std::ofstream(log) << "four\n";
+  wait_for(19);
+  watcher.join();
+
+  CHECK(text == "one\ntwo\nthree\nfour\n");
+  auto counters = tail.GetCounters();
+  CHECK(counters.truncations == 1);
+  CHECK(counters.rotations == 1);
+}
+
+TEST_CASE("fswatch tail follows a file below a directory that existed before the start") {
+  WatchedDir dir;
+  std::filesystem::create_directories(dir.path / "var" / "log");
+  auto log = (dir.path / "var" / "log" / "app.log").string();
+  std::ofstream(log) << "old\n";
+
+  std::mutex mutex;
+  std::string text;
+  watch::FileTail tail([&](std::string_view, std::span<const char> bytes) {
+    std::lock_guard lock(mutex);
+    text.append(bytes.data(), bytes.size());
+  });
+  REQUIRE(tail.Follow(log, watch::FileTail::Start::End));
+  fswatch watcher(dir.path.string());
+  watcher.tail(&tail);
+  watcher.run_async();
+  REQUIRE(WaitWatching(watcher));
+  for (auto deadline = Clock::now() + 2s; watcher.counters().watches < 3 && Clock::now() < deadline;) {
+    std::this_thread::sleep_for(1ms);
+  }
+
+  std::ofstream(log, std::ios::app) << "new\n";
+  for (auto deadline = Clock::now() + 2s; Clock::now() < deadline; std::this_thread::sleep_for(1ms)) {
+    std::lock_guard lock(mutex);
+    if (!text.empty()) {
+      break;
+    }
+  }
+  watcher.join();
+  CHECK(text == "new\n");
+}
+
+TEST_CASE("fswatch attaches a new subtree and reports every entry once") {
+  WatchedDir dir;
+  auto trace_path = dir.path.string() + ".trace";
+  auto top = dir.path / "a";
+  std::map<std::string, int> created;
+  {
+    watch::TraceWriter writer(trace_path);
+    fswatch watcher(dir.path.string());
+    watcher.on({fswatch::Event::FILE_CREATED, fswatch::Event::DIR_CREATED},
+               [&created, &top](const fswatch::EventInfo &event) {
+                 created[event.path.string()]++;
+                 if (event.path == top) {
+                   // after the watch of a, before its scan: the kernel and the scan see these
+                   { std::ofstream(top / "late"); }
+                   std::filesystem::create_directory(top / "late_dir");
+                 }
+               });
+    watcher.record(&writer);
+    watcher.init();
+    // all there before a is watched, mkdir -p style
+    std::filesystem::create_directories(top / "b" / "c");
+    { std::ofstream(top / "b" / "c" / "file"); }
+    { std::ofstream(top / "file"); }
+    for (auto deadline = Clock::now() + 2s; created.size() < 7 && Clock::now() < deadline;) {
+      watcher.read_events();
+    }
+    for (auto until = Clock::now() + 50ms; Clock::now() < until;) {
+      watcher.read_events();
+    }
+    CHECK(watcher.counters().watches == 5);
+    CHECK(watcher.counters().scanned == 6);
+    watcher.cleanup();
+  }
+  std::map<std::string, int> expected;
+  for (auto path : {"a", "a/b", "a/b/c", "a/b/c/file", "a/file", "a/late", "a/late_dir"}) {
+    expected[(dir.path / path).string()] = 1;
+  }
+  CHECK(created == expected);
+
+  // the replay takes the entries from the trace, nothing is scanned
+  std::filesystem::remove_all(dir.path);
+  std::map<std::string, int> replayed;
+  watch::TraceReader trace(trace_path);
+  fswatch watcher(dir.path.string());
+  watcher.on({fswatch::Event::FILE_CREATED, fswatch::Event::DIR_CREATED},
+             [&replayed](const fswatch::EventInfo &event) { replayed[event.path.string()]++; });
+  watcher.replay(trace);
+  CHECK(replayed == expected);
+  std::filesystem::remove(trace_path);
+}
@@ -0,0 +1,131 @@
+#include <doctest/doctest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hsm.hpp"
+
+namespace {
+
+// every state records its entry and exit actions in the context
+struct Log {
+  std::vector<std::string> actions;
+};
+
+// event: go to the target state
+struct Go {
+  state::StateId target;
+};
+
+using Chart = state::StateChart<Log, Go>;
+using Machine = state::StateMachine<Log, Go>;
+
+template <char Name>
+class Logged : public state::HierarchicalState<Log, Go> {
+ public:
+  using HierarchicalState::HierarchicalState;
+  [[nodiscard]] state::Reaction DoHandle(const Go& event) override {
+    return TransitionTo(event.target);
+  }
+
+ protected:
+  void DoEnter() override {
+    m_contextPtr->actions.push_back(std::string("enter ") + Name);
+  }
+  void DoExit() override {
+    m_contextPtr->actions.push_back(std::string("exit ") + Name);
+  }
+};
+
+// A
+// +- B (history)
+// |  +- C
+// |  +- D
+// +- E
+//    +- F
+struct Ids {
+  state::StateId a, b, c, d, e, f;
+};
+
+std::shared_ptr<const Chart> MakeChart(Ids& ids) {
+  auto chart = std::make_shared<Chart>();
+  ids.a = chart->Add<Logged<'A'>>();
+  ids.b = chart->Add<Logged<'B'>>(ids.a, true);
+  ids.c = chart->Add<Logged<'C'>>(ids.b);
+  ids.d = chart->Add<Logged<'D'>>(ids.b);
+  ids.e = chart->Add<Logged<'E'>>(ids.a);
+  ids.f = chart->Add<Logged<'F'>>(ids.e);
+  return chart;
+}
+
+}  // namespace
+
+TEST_CASE("HSM start enters the initial states outermost first") {
+  Ids ids{};
+  Log log;
+  Machine machine(MakeChart(ids), &log);
+  machine.Start();
+
+  CHECK(log.actions == std::vector<std::string>{"enter A", "enter B", "enter C"});
+  CHECK(machine.Current() == ids.c);
+  CHECK(machine.IsIn(ids.a));
+  CHECK_FALSE(machine.IsIn(ids.e));
+}
+
+TEST_CASE("HSM transition exits innermost first up to the common ancestor before entering") {
+  Ids ids{};
+  Log log;
+  Machine machine(MakeChart(ids), &log);
+  machine.Start();
+  log.actions.clear();
+
+  CHECK(machine.Dispatch(Go{ids.f}));
+  CHECK(log.actions == std::vector<std::string>{"exit C", "exit B", "enter E", "enter F"});
+  CHECK(machine.Current() == ids.f);
+
+  // sibling in the same superstate: the superstate is neither left nor entered
+  log.actions.clear();
+  machine.Transit(ids.c);
+  machine.Transit(ids.d);
+  log.actions.erase(log.actions.begin(), log.actions.begin() + 4);
+  CHECK(log.actions == std::vector<std::string>{"exit C", "enter D"});
+}
+
+TEST_CASE("HSM transition to the active state or a superstate leaves and re-enters it") {
+  Ids ids{};
+  Log log;
+  Machine machine(MakeChart(ids), &log);
+  machine.Start();
+
+  log.actions.clear();
+  machine.Transit(ids.c);
+  CHECK(log.actions == std::vector<std::string>{"exit C", "enter C"});
+
+  log.actions.clear();
+  machine.Transit(ids.b);
+  CHECK(log.actions == std::vector<std::string>{"exit C", "exit B", "enter B", "enter C"});
+}
+
+TEST_CASE("HSM shallow history resumes the last active child of a superstate") {
+  Ids ids{};
+  Log log;
+  Machine machine(MakeChart(ids), &log);
+  machine.Start();
+  CHECK(machine.History(ids.b) == state::kNoState);
+
+  machine.Transit(ids.d);
+  machine.Transit(ids.e);
+  CHECK(machine.History(ids.b) == ids.d);
+
+  // entering B resumes D instead of the initial C
+  log.actions.clear();
+  machine.Transit(ids.b);
+  CHECK(log.actions == std::vector<std::string>{"exit F", "exit E", "enter B", "enter D"});
+  CHECK(machine.Current() == ids.d);
+
+  // A has no history, entering it takes the initial child, whose own history still applies
+  log.actions.clear();
+  machine.Transit(ids.a);
+  CHECK(log.actions == std::vector<std::string>{"exit D", "exit B", "exit A", "enter A", "enter B", "enter D"});
+}
@@ -0,0 +1,148 @@
+#include <doctest/doctest.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <latch>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.hpp"
+
+namespace {
+
+// lines of an exposition that start with a prefix, in order
+std::vector<std::string> Lines(const std::string& text, const std::string& prefix) {
+  std::vector<std::string> lines;
+  std::istringstream in(text);
+  for (std::string line; std::getline(in, line);) {
+    if (line.starts_with(prefix)) {
+      lines.push_back(line);
+    }
+  }
+  return lines;
+}
+
+// GET a path from 127.0.0.1:port, the whole response
+std::string Get(uint16_t port, const std::string& path) {
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  REQUIRE(fd >= 0);
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  REQUIRE(::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+  auto request = "GET " + path + " HTTP/1.0\r\nHost: localhost\r\n\r\n";
+  REQUIRE(::send(fd, request.data(), request.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(request.size()));
+  std::string response;
+  char buffer[4096];
+  for (ssize_t length; (length = ::read(fd, buffer, sizeof(buffer))) > 0;) {
+    response.append(buffer, static_cast<size_t>(length));
+  }
+  ::close(fd);
+  return response;
+}
+
+}  // namespace
+
+TEST_CASE("metrics expose counters and gauges one line per series below one header") {
+  auto& registry = metrics::Registry::Instance();
+  auto created = registry.AddCounter("test_format_total", "Events by type.", "type=\"created\"");
+  auto deleted = registry.AddCounter("test_format_total", "Events by type.", "type=\"deleted\"");
+  auto depth = registry.AddGauge("test_format_depth", "Queue depth.");
+  created.Inc(3);
+  deleted.Inc();
+  depth.Set(7);
+  depth.Sub(9);
+
+  auto text = registry.Expose();
+  CHECK(Lines(text, "# HELP test_format_total") ==
+        std::vector<std::string>{"# HELP test_format_total Events by type."});
+  CHECK(Lines(text, "# TYPE test_format_total") == std::vector<std::string>{"# TYPE test_format_total counter"});
+  CHECK(Lines(text, "test_format_total") ==
+        std::vector<std::string>{"test_format_total{type=\"created\"} 3", "test_format_total{type=\"deleted\"} 1"});
+  CHECK(Lines(text, "# TYPE test_format_depth") == std::vector<std::string>{"# TYPE test_format_depth gauge"});
+  CHECK(Lines(text, "test_format_depth") == std::vector<std::string>{"test_format_depth -2"});
+  // a family is written once, its series follow the header
+  auto header = text.find("# TYPE test_format_total");
+  CHECK(text.find("test_format_total{type=\"deleted\"}") > header);
+  CHECK(text.find("# TYPE test_format_total", header + 1) == std::string::npos);
+}
+
+TEST_CASE("metrics expose cumulative histogram buckets with +Inf, sum and count") {
+  auto& registry = metrics::Registry::Instance();
+  auto sizes = registry.AddHistogram("test_sizes", "Sizes.", "kind=\"a\"", 1.0);
+  sizes.Observe(1);
+  sizes.Observe(3);
+  sizes.Observe(1000);
+  sizes.Observe(uint64_t{1} << 62);
+
+  auto text = registry.Expose();
+  CHECK(Lines(text, "# TYPE test_sizes") == std::vector<std::string>{"# TYPE test_sizes histogram"});
+  auto buckets = Lines(text, "test_sizes_bucket");
+  REQUIRE(buckets.size() == metrics::kHistogramBuckets);
+  CHECK(buckets[0] == "test_sizes_bucket{kind=\"a\",le=\"1\"} 1");
+  CHECK(buckets[1] == "test_sizes_bucket{kind=\"a\",le=\"2\"} 1");
+  CHECK(buckets[2] == "test_sizes_bucket{kind=\"a\",le=\"4\"} 2");
+  CHECK(buckets[9] == "test_sizes_bucket{kind=\"a\",le=\"512\"} 2");
+  CHECK(buckets[10] == "test_sizes_bucket{kind=\"a\",le=\"1024\"} 3");
+  CHECK(buckets[metrics::kHistogramBuckets - 2] == "test_sizes_bucket{kind=\"a\",le=\"2.74877907e+11\"} 3");
+  // beyond the last bound
+  CHECK(buckets.back() == "test_sizes_bucket{kind=\"a\",le=\"+Inf\"} 4");
+  CHECK(Lines(text, "test_sizes_sum") == std::vector<std::string>{"test_sizes_sum{kind=\"a\"} 4.61168602e+18"});
+  CHECK(Lines(text, "test_sizes_count") == std::vector<std::string>{"test_sizes_count{kind=\"a\"} 4"});
+}
+
+TEST_CASE("metrics sum the slots of running and exited threads") {
+  auto& registry = metrics::Registry::Instance();
+  auto counter = registry.AddCounter("test_threads_total", "Increments.");
+  counter.Inc(5);
+
+  // exited threads leave their values to the registry
+  std::vector<std::thread> exited;
+  for (int i = 0; i < 4; ++i) {
+    exited.emplace_back([counter] {
+      for (int n = 0; n < 1000; ++n) {
+        counter.Inc();
+      }
+    });
+  }
+  for (auto& thread : exited) {
+    thread.join();
+  }
+  // a running thread is summed from its own slots
+  std::latch counted(1), scraped(1);
+  std::thread running([&] {
+    counter.Inc(100);
+    counted.count_down();
+    scraped.wait();
+  });
+  counted.wait();
+  CHECK(Lines(registry.Expose(), "test_threads_total") == std::vector<std::string>{"test_threads_total 4105"});
+  scraped.count_down();
+  running.join();
+  CHECK(Lines(registry.Expose(), "test_threads_total") == std::vector<std::string>{"test_threads_total 4105"});
+}
+
+TEST_CASE("metrics server answers an HTTP scrape on 127.0.0.1") {
+  auto& registry = metrics::Registry::Instance();
+  registry.AddCounter("test_scrape_total", "Scrapes.").Inc(2);
+  metrics::Server server(registry);
+  auto port = server.ListenTcp(0);
+  REQUIRE(port != 0);
+  server.Start();
+
+  auto response = Get(port, "/metrics");
+  auto body = response.find("\r\n\r\n");
+  REQUIRE(body != std::string::npos);
+  CHECK(response.starts_with("HTTP/1.0 200 OK\r\n"));
+  CHECK(response.find("Content-Type: text/plain; version=0.0.4\r\n") < body);
+  CHECK(response.find("Content-Length: " + std::to_string(response.size() - body - 4) + "\r\n") < body);
+  CHECK(Lines(response.substr(body + 4), "test_scrape_total") == std::vector<std::string>{"test_scrape_total 2"});
+
+  CHECK(Get(port, "/other").starts_with("HTTP/1.0 404 Not Found\r\n"));
+  server.Stop();
+}
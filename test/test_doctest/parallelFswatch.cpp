@@ -0,0 +1,199 @@
+#include <doctest/doctest.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "parallelFswatch.hpp"
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// root with the sub directories a (2 files) and b (1 file), so a and b go
+// to different instances of two
+struct Tree {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() / ("test_parallel_fswatch_" + std::to_string(::getpid()));
+  Tree() {
+    std::filesystem::create_directories(path / "a");
+    std::filesystem::create_directories(path / "b");
+    std::ofstream(path / "a" / "0");
+    std::ofstream(path / "a" / "1");
+    std::ofstream(path / "b" / "0");
+  }
+  ~Tree() { std::filesystem::remove_all(path); }
+};
+
+size_t InstanceOf(const parallel_fswatch& watcher, const std::filesystem::path& root) {
+  for (size_t i = 0; i < watcher.instances(); ++i) {
+    auto& roots = watcher.roots(i);
+    if (std::find(roots.begin(), roots.end(), root) != roots.end()) {
+      return i;
+    }
+  }
+  return watcher.instances();
+}
+
+bool WaitFor(const auto& done) {
+  for (auto deadline = Clock::now() + 2s; Clock::now() < deadline; std::this_thread::sleep_for(1ms)) {
+    if (done()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// create count files in a and in b, interleaved
+void CreateFiles(const Tree& tree, int count) {
+  for (int i = 0; i < count; ++i) {
+    std::ofstream(tree.path / "a" / ("f" + std::to_string(i)));
+    std::ofstream(tree.path / "b" / ("f" + std::to_string(i)));
+  }
+}
+
+// paths below one sub directory, in the order they were seen
+std::vector<std::string> Below(const std::vector<std::string>& paths, const std::filesystem::path& dir) {
+  std::vector<std::string> below;
+  for (auto& path : paths) {
+    if (std::filesystem::path(path).parent_path() == dir) {
+      below.push_back(std::filesystem::path(path).filename().string());
+    }
+  }
+  return below;
+}
+
+std::vector<std::string> Names(int count) {
+  std::vector<std::string> names;
+  for (int i = 0; i < count; ++i) {
+    names.push_back("f" + std::to_string(i));
+  }
+  return names;
+}
+
+}  // namespace
+
+TEST_CASE("parallel_fswatch puts the largest subtree first onto the least loaded instance") {
+  Tree tree;
+  for (int i = 0; i < 8; ++i) {
+    std::ofstream(tree.path / "a" / ("big" + std::to_string(i)));
+  }
+  std::ofstream(tree.path / "top");
+
+  // subtree sizes with the directory itself: a 11, b 2, the root 2 (itself and top)
+  parallel_fswatch watcher({tree.path.string()}, 2);
+  REQUIRE(watcher.instances() == 2);
+  CHECK(watcher.roots(0) == std::vector<std::filesystem::path>{tree.path / "a"});
+  CHECK(watcher.load(0) == 11);
+  // b and the root tie, the root came first
+  CHECK(watcher.roots(1) == std::vector<std::filesystem::path>{tree.path, tree.path / "b"});
+  CHECK(watcher.load(1) == 4);
+}
+
+TEST_CASE("parallel_fswatch has no more instances than subtrees") {
+  Tree tree;
+  parallel_fswatch watcher({tree.path.string()}, 8);
+  CHECK(watcher.instances() == 3);
+  for (size_t i = 0; i < watcher.instances(); ++i) {
+    CHECK(watcher.roots(i).size() == 1);
+  }
+}
+
+TEST_CASE("parallel_fswatch delivers the events of two subtrees on the reader threads") {
+  Tree tree;
+  parallel_fswatch watcher({tree.path.string()}, 2);
+  REQUIRE(InstanceOf(watcher, tree.path / "a") != InstanceOf(watcher, tree.path / "b"));
+  std::mutex mutex;
+  std::vector<std::string> created;
+  std::set<std::thread::id> threads;
+  watcher.on(fswatch::Event::FILE_CREATED, [&](const fswatch::EventInfo& event) {
+    std::lock_guard lock(mutex);
+    created.push_back(event.path.string());
+    threads.insert(std::this_thread::get_id());
+  });
+  watcher.run_async();
+  REQUIRE(WaitFor([&] { return watcher.counters().watches == 3; }));
+
+  CreateFiles(tree, 20);
+  CHECK(WaitFor([&] {
+    std::lock_guard lock(mutex);
+    return created.size() == 40;
+  }));
+  watcher.join();
+
+  CHECK(Below(created, tree.path / "a") == Names(20));
+  CHECK(Below(created, tree.path / "b") == Names(20));
+  CHECK(threads.size() == 2);
+  CHECK(threads.count(std::this_thread::get_id()) == 0);
+}
+
+TEST_CASE("parallel_fswatch merges the events of two subtrees into one ordered stream") {
+  Tree tree;
+  parallel_fswatch watcher({tree.path.string()}, 2, true);
+  std::vector<std::string> created;
+  std::set<std::thread::id> threads;
+  // runs on the thread of start() only, no lock needed
+  watcher.on(fswatch::Event::FILE_CREATED, [&](const fswatch::EventInfo& event) {
+    created.push_back(event.path.string());
+    threads.insert(std::this_thread::get_id());
+    if (created.size() == 40) {
+      throw std::runtime_error("all seen");
+    }
+  });
+  std::jthread writer([&] {
+    if (WaitFor([&] { return watcher.counters().watches == 3; })) {
+      CreateFiles(tree, 20);
+    }
+  });
+  // the callback ends start() once it saw everything
+  CHECK_THROWS_AS(watcher.start({}), std::runtime_error);
+
+  CHECK(created.size() == 40);
+  CHECK(Below(created, tree.path / "a") == Names(20));
+  CHECK(Below(created, tree.path / "b") == Names(20));
+  CHECK(threads == std::set<std::thread::id>{std::this_thread::get_id()});
+}
+
+TEST_CASE("parallel_fswatch rethrows the failure of a reader from start() and join()") {
+  Tree tree;
+  auto fail_in_a = [&tree](const fswatch::EventInfo& event) {
+    if (event.path.parent_path() == tree.path / "a") {
+      throw std::runtime_error("reader failed");
+    }
+  };
+
+  // start() returns once a reader failed, although no stop was requested
+  {
+    parallel_fswatch watcher({tree.path.string()}, 2);
+    watcher.on(fswatch::Event::FILE_CREATED, fail_in_a);
+    std::jthread writer([&] {
+      if (WaitFor([&] { return watcher.counters().watches == 3; })) {
+        CreateFiles(tree, 1);
+      }
+    });
+    CHECK_THROWS_AS(watcher.start({}), std::runtime_error);
+  }
+
+  std::atomic<bool> failed{false};
+  parallel_fswatch watcher({tree.path.string()}, 2);
+  watcher.on(fswatch::Event::FILE_CREATED, [&](const fswatch::EventInfo& event) {
+    failed = true;
+    fail_in_a(event);
+  });
+  watcher.run_async();
+  REQUIRE(WaitFor([&] { return watcher.counters().watches == 3; }));
+  std::ofstream(tree.path / "a" / "g");
+  REQUIRE(WaitFor([&] { return failed.load(); }));
+  CHECK_THROWS_AS(watcher.join(), std::runtime_error);
+  CHECK_NOTHROW(watcher.join());
+}
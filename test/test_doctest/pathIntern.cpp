@@ -0,0 +1,96 @@
+#include <doctest/doctest.h>
+
+#include <string>
+#include <vector>
+
+#include "pathIntern.hpp"
+
+TEST_CASE("InternPool counts references and reuses the ids of released strings") {
+  watch::InternPool pool;
+  auto first = pool.Intern("first");
+  auto second = pool.Intern("second");
+  CHECK(first != second);
+  CHECK(pool.Intern("first") == first);
+  CHECK(pool.Size() == 2);
+
+  // the first of two references keeps the string
+  pool.Release(first);
+  CHECK(pool.Find("first") == first);
+  pool.Release(first);
+  CHECK(pool.Find("first") == watch::InternPool::kNone);
+  CHECK(pool.Size() == 1);
+
+  // a new string takes the released id, the others keep theirs
+  auto third = pool.Intern("third");
+  CHECK(third == first);
+  CHECK(pool.View(third) == "third");
+  CHECK(pool.Find("second") == second);
+  CHECK(pool.View(second) == "second");
+}
+
+TEST_CASE("InternPool compaction keeps ids and strings of the live entries") {
+  watch::InternPool pool;
+  std::vector<watch::InternPool::Id> ids;
+  // enough released bytes to compact, every tenth string stays
+  for (int i = 0; i < 5000; ++i) {
+    ids.push_back(pool.Intern("/some/long/directory/name/" + std::to_string(i)));
+  }
+  CHECK_FALSE(pool.Compact());
+  for (int i = 0; i < 5000; ++i) {
+    if (i % 10 != 0) {
+      pool.Release(ids[i]);
+    }
+  }
+  CHECK(pool.Size() == 500);
+  CHECK(pool.Compact());
+  CHECK_FALSE(pool.Compact());
+
+  size_t mismatches = 0;
+  size_t bytes = 0;
+  for (int i = 0; i < 5000; i += 10) {
+    auto text = "/some/long/directory/name/" + std::to_string(i);
+    bytes += text.size();
+    if (pool.Find(text) != ids[i] || pool.View(ids[i]) != text) {
+      mismatches++;
+    }
+  }
+  CHECK(mismatches == 0);
+  CHECK(pool.Find("/some/long/directory/name/1") == watch::InternPool::kNone);
+  CHECK(pool.Bytes() == bytes);
+
+  // released ids are handed out again, without growing the pool
+  for (int i = 1; i < 10; ++i) {
+    auto id = pool.Intern("again " + std::to_string(i));
+    CHECK(id < 5000);
+  }
+  CHECK(pool.Size() == 509);
+}
+
+TEST_CASE("PathArena joins zero terminated paths until it is reset") {
+  watch::PathArena arena(64);
+  auto path = arena.Join("/srv/data", '/', "file.name");
+  CHECK(path == "/srv/data/file.name");
+  CHECK(path.data()[path.size()] == '\0');
+  // beyond the initial buffer
+  std::string long_name(1000, 'x');
+  auto long_path = arena.Join("/srv", '/', long_name);
+  CHECK(long_path.size() == 1005);
+  CHECK(path == "/srv/data/file.name");
+  arena.Reset();
+  CHECK(arena.Join("a", '/', "b") == "a/b");
+}
+
+TEST_CASE("PathArena grows its buffer to the largest batch") {
+  watch::PathArena arena(64);
+  CHECK(arena.Capacity() == 64);
+  std::string name(100, 'x');
+  for (int i = 0; i < 10; ++i) {
+    CHECK(arena.Join("/srv", '/', name).size() == 105);
+  }
+  arena.Reset();
+  CHECK(arena.Capacity() == 2048);
+  // a smaller batch keeps the buffer
+  CHECK(arena.Join("/srv", '/', name) == "/srv/" + name);
+  arena.Reset();
+  CHECK(arena.Capacity() == 2048);
+}
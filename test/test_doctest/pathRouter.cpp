@@ -0,0 +1,97 @@
+#include <doctest/doctest.h>
+
+#include <string>
+#include <vector>
+
+#include "pathRouter.hpp"
+
+namespace {
+
+std::vector<watch::PathRouter::ContextId> Owners(const watch::PathRouter& router, std::string_view path) {
+  std::vector<watch::PathRouter::ContextId> owners;
+  auto routed = router.Route(path, [&owners](watch::PathRouter::ContextId context) { owners.push_back(context); });
+  CHECK(routed == owners.size());
+  return owners;
+}
+
+using Ids = std::vector<watch::PathRouter::ContextId>;
+
+}  // namespace
+
+TEST_CASE("PathRouter routes a path to the owners of its directories, outer ones first") {
+  watch::PathRouter router;
+  CHECK(router.Add("/srv", 1));
+  CHECK(router.Add("/srv/data", 2));
+  CHECK(router.Add("/srv/data/deep/er", 3));
+
+  CHECK(Owners(router, "/srv/data/deep/er/file") == Ids{1, 2, 3});
+  CHECK(Owners(router, "/srv/data/deep/file") == Ids{1, 2});
+  CHECK(Owners(router, "/srv/data") == Ids{1, 2});
+  // components are compared whole
+  CHECK(Owners(router, "/srv/database/file") == Ids{1});
+  CHECK(Owners(router, "/srvx/file").empty());
+  CHECK(Owners(router, "/other").empty());
+  CHECK(Owners(router, "").empty());
+}
+
+TEST_CASE("PathRouter ignores trailing slashes and lets / own every path") {
+  watch::PathRouter router;
+  CHECK(router.Add("/srv/data/", 1));
+  CHECK_FALSE(router.Add("/srv/data//", 1));
+  CHECK(router.Size() == 1);
+  CHECK(Owners(router, "/srv/data/") == Ids{1});
+  CHECK(Owners(router, "/srv/data/file") == Ids{1});
+
+  CHECK(router.Add("/", 7));
+  CHECK(Owners(router, "/srv/data/file") == Ids{7, 1});
+  CHECK(Owners(router, "/") == Ids{7});
+  CHECK(Owners(router, "/etc/passwd") == Ids{7});
+
+  CHECK(router.Remove("/srv/data", 1));
+  CHECK(Owners(router, "/srv/data/file") == Ids{7});
+  CHECK(router.Remove("//", 7));
+  CHECK(Owners(router, "/srv/data/file").empty());
+  CHECK(router.Size() == 0);
+}
+
+TEST_CASE("PathRouter keeps a directory routed while another owner remains") {
+  watch::PathRouter router;
+  CHECK(router.Add("/srv/data", 1));
+  CHECK(router.Add("/srv/data", 2));
+  CHECK(router.Add("/srv/data", 3));
+  CHECK(router.Size() == 1);
+  CHECK(router.Routes() == 3);
+  CHECK(Owners(router, "/srv/data/file") == Ids{1, 2, 3});
+
+  // the first owner goes, the next one takes its place
+  CHECK(router.Remove("/srv/data", 1));
+  CHECK_FALSE(router.Remove("/srv/data", 1));
+  CHECK(Owners(router, "/srv/data/file") == Ids{2, 3});
+  CHECK(router.Remove("/srv/data", 3));
+  CHECK(Owners(router, "/srv/data/file") == Ids{2});
+  CHECK(router.Size() == 1);
+
+  CHECK(router.Remove("/srv/data", 2));
+  CHECK(router.Size() == 0);
+  CHECK(router.Routes() == 0);
+  CHECK(Owners(router, "/srv/data/file").empty());
+}
+
+TEST_CASE("PathRouter finds every directory after removals shifted the index") {
+  watch::PathRouter router;
+  for (uint32_t i = 0; i < 2000; ++i) {
+    router.Add("/srv/" + std::to_string(i), i);
+  }
+  for (uint32_t i = 0; i < 2000; i += 2) {
+    CHECK(router.Remove("/srv/" + std::to_string(i), i));
+  }
+  size_t mismatches = 0;
+  for (uint32_t i = 0; i < 2000; ++i) {
+    auto owners = Owners(router, "/srv/" + std::to_string(i) + "/file");
+    if (owners != (i % 2 == 0 ? Ids{} : Ids{i})) {
+      mismatches++;
+    }
+  }
+  CHECK(mismatches == 0);
+  CHECK(router.Size() == 1000);
+}
@@ -0,0 +1,152 @@
+#include <doctest/doctest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "timerSet.hpp"
+#include "virtualClock.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+struct KernelTag {};
+using KernelClock = watch::BasicVirtualClock<KernelTag>;
+using Set = watch::TimerSet<std::chrono::milliseconds, KernelClock>;
+
+constexpr int64_t kNever = Set::kNever;
+
+// vector kernels this CPU runs, the scalar one is the reference
+std::vector<watch::simd::Isa> VectorIsas() {
+  switch (watch::simd::Detect()) {
+    case watch::simd::Isa::Avx2:
+      return {watch::simd::Isa::Sse42, watch::simd::Isa::Avx2};
+    case watch::simd::Isa::Sse42:
+      return {watch::simd::Isa::Sse42};
+    default:
+      return {};
+  }
+}
+
+// deadlines around the bound, never running ones and extremes
+std::vector<int64_t> Deadlines(size_t size, int64_t bound, std::mt19937& random) {
+  const int64_t picks[] = {kNever, 0, bound - 1, bound, bound + 1, std::numeric_limits<int64_t>::min(), -1};
+  std::vector<int64_t> data(size);
+  for (auto& value : data) {
+    auto pick = random() % 10;
+    value = pick < std::size(picks) ? picks[pick] : bound - 1000 + static_cast<int64_t>(random() % 2000);
+  }
+  return data;
+}
+
+}  // namespace
+
+TEST_CASE("TimerSet vector kernels match the scalar kernels for every tail length") {
+  std::mt19937 random(7);
+  const int64_t bound = 5000;
+  size_t mismatches = 0;
+  // all tails of the 2, 4 and 8 lane loops, and a long array
+  std::vector<size_t> sizes;
+  for (size_t size = 0; size <= 40; ++size) {
+    sizes.push_back(size);
+  }
+  sizes.push_back(1003);
+  for (auto size : sizes) {
+    for (int round = 0; round < 20; ++round) {
+      auto data = Deadlines(size, bound, random);
+      // the minimum in the tail only
+      if (size > 0 && round == 0) {
+        data.back() = std::numeric_limits<int64_t>::min();
+      }
+      std::vector<uint32_t> scalar_less;
+      std::vector<uint32_t> scalar_both;
+      auto scalar_min = watch::simd::Min(data.data(), size, watch::simd::Isa::Scalar);
+      watch::simd::Less(data.data(), size, bound, scalar_less, watch::simd::Isa::Scalar);
+      auto scalar_less_min = watch::simd::LessMin(data.data(), size, bound, scalar_both, watch::simd::Isa::Scalar);
+      for (auto isa : VectorIsas()) {
+        std::vector<uint32_t> less;
+        std::vector<uint32_t> both;
+        if (watch::simd::Min(data.data(), size, isa) != scalar_min) {
+          mismatches++;
+        }
+        watch::simd::Less(data.data(), size, bound, less, isa);
+        if (less != scalar_less) {
+          mismatches++;
+        }
+        if (watch::simd::LessMin(data.data(), size, bound, both, isa) != scalar_less_min || both != scalar_both) {
+          mismatches++;
+        }
+      }
+    }
+  }
+  CHECK(mismatches == 0);
+}
+
+TEST_CASE("TimerSet expiry and deadline agree across the kernels with stopped and zero timeout timers") {
+  KernelClock::Reset();
+  auto now = [] { return std::chrono::time_point_cast<std::chrono::milliseconds>(KernelClock::now()); };
+  auto start = now();
+  Set timers;
+  std::vector<Set::Timer> handles;
+  // 37 timers: a tail for every vector width
+  for (int i = 0; i < 37; ++i) {
+    handles.push_back(timers.Make());
+    switch (i % 4) {
+      case 0:
+        // never started
+        break;
+      case 1:
+        handles.back().Start(0ms);
+        break;
+      case 2:
+        handles.back().Start(std::chrono::milliseconds(10 * i));
+        break;
+      default:
+        handles.back().Start(std::chrono::milliseconds(10 * i));
+        handles.back().Stop();
+    }
+  }
+  // a zero timeout is elapsed at once, before the clock moves
+  std::vector<uint32_t> expected;
+  auto expected_deadline = timers.NextDeadline(watch::simd::Isa::Scalar);
+  timers.Expired(expected, watch::simd::Isa::Scalar);
+  CHECK(expected.size() == 9);
+  REQUIRE(expected_deadline.has_value());
+  CHECK(*expected_deadline == start - 1ms);
+
+  for (auto isa : VectorIsas()) {
+    std::vector<uint32_t> expired;
+    timers.Expired(expired, isa);
+    CHECK(expired == expected);
+    CHECK(timers.NextDeadline(isa) == expected_deadline);
+    std::vector<uint32_t> polled;
+    CHECK(timers.Poll(now(), polled, isa) == expected_deadline);
+    CHECK(polled == expected);
+  }
+
+  // the shortest running timeout elapses, 20 ms of the third timer
+  KernelClock::Advance(21ms);
+  expected.clear();
+  timers.Expired(expected, watch::simd::Isa::Scalar);
+  CHECK(expected.size() == 10);
+  for (auto isa : VectorIsas()) {
+    std::vector<uint32_t> expired;
+    timers.Expired(expired, isa);
+    CHECK(expired == expected);
+  }
+
+  // only stopped timers left: no deadline
+  for (auto& timer : handles) {
+    timer.Stop();
+  }
+  for (auto isa : VectorIsas()) {
+    std::vector<uint32_t> expired;
+    timers.Expired(expired, isa);
+    CHECK(expired.empty());
+    CHECK_FALSE(timers.NextDeadline(isa).has_value());
+  }
+}
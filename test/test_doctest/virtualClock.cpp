@@ -0,0 +1,76 @@
+#include <doctest/doctest.h>
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+
+#include "contextSimulation.hpp"
+#include "stopTimer.hpp"
+#include "timerSet.hpp"
+#include "virtualClock.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// clocks of their own, the tests do not see each other's time
+struct TimerTag {};
+struct SetTag {};
+using TimerClock = watch::BasicVirtualClock<TimerTag>;
+using SetClock = watch::BasicVirtualClock<SetTag>;
+
+}  // namespace
+
+TEST_CASE("StopTimer on a virtual clock elapses only when the clock is advanced") {
+  TimerClock::Reset();
+  watch::StopTimer<std::chrono::milliseconds, TimerClock> timer;
+  timer.Start(500ms);
+  CHECK(timer.IsElapsed() == false);
+  CHECK(timer.LeftTime() == 500ms);
+
+  TimerClock::Advance(500ms);
+  CHECK(timer.IsElapsed() == false);
+  CHECK(timer.LeftTime() == 0ms);
+
+  TimerClock::Advance(1ms);
+  CHECK(timer.IsElapsed() == true);
+  CHECK(timer.ElapsedTime() == 501ms);
+}
+
+TEST_CASE("TimerSet on a virtual clock reports the expired timers at the simulated time") {
+  SetClock::Reset();
+  watch::TimerSet<std::chrono::milliseconds, SetClock> timers;
+  auto short_timer = timers.Make();
+  auto long_timer = timers.Make();
+  short_timer.Start(10ms);
+  long_timer.Start(6s);
+
+  std::vector<uint32_t> expired;
+  SetClock::Advance(11ms);
+  timers.Expired(expired);
+  CHECK(expired.size() == 1);
+  CHECK(short_timer.IsElapsed() == true);
+  CHECK(long_timer.IsElapsed() == false);
+
+  SetClock::AdvanceTo(SetClock::time_point(6001ms));
+  CHECK(long_timer.IsElapsed() == true);
+}
+
+TEST_CASE("context simulation runs an hour of state changes deterministically") {
+  spdlog::set_level(spdlog::level::warn);
+  uint64_t transitions = 0;
+  {
+    state::ContextSimulation simulation(100);
+    CHECK(state::ContextClock::IsVirtual());
+    auto result = simulation.Run(1h);
+    CHECK(simulation.Now() == 1h);
+    transitions = result.transitions;
+    // state 1 waits 500 ms, state 2 6 s, each elapses one tick after its timeout: 6.502 s per cycle
+    CHECK(transitions == 100 * (2 * (3600000 / 6502) + 1));
+    CHECK(simulation.Context(0).StateId() == simulation.Context(99).StateId());
+  }
+  CHECK_FALSE(state::ContextClock::IsVirtual());
+
+  state::ContextSimulation again(100);
+  CHECK(again.Run(1h).transitions == transitions);
+  spdlog::set_level(spdlog::level::info);
+}
@@ -0,0 +1,101 @@
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "wakeupRouter.hpp"
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+TEST_CASE("WakeupRouter coalesces the notifications of a pending task") {
+  watch::WakeupRouter router;
+  auto task = router.AddTask();
+  for (int i = 0; i < 5; ++i) {
+    router.Wake(task);
+  }
+  auto counters = router.GetCounters();
+  CHECK(counters.notified == 5);
+  CHECK(counters.coalesced == 4);
+  CHECK(counters.woken == 0);
+
+  // one pending notification, consumed by the first wait
+  CHECK(router.Wait(task, 1s));
+  CHECK_FALSE(router.Wait(task, 1ms));
+}
+
+TEST_CASE("WakeupRouter timed wait returns false once the timeout expired") {
+  watch::WakeupRouter router;
+  auto task = router.AddTask();
+  auto start = Clock::now();
+  CHECK_FALSE(router.Wait(task, 20ms));
+  CHECK(Clock::now() - start >= 20ms);
+  CHECK_FALSE(router.Wait(task, 0ns));
+}
+
+TEST_CASE("WakeupRouter wakes a sleeping task with one futex wake") {
+  watch::WakeupRouter router;
+  auto task = router.AddTask();
+  std::atomic<bool> notified{false};
+  std::jthread waiter([&] { notified = router.Wait(task, 10s); });
+  // long enough for the waiter to sleep in the futex
+  std::this_thread::sleep_for(50ms);
+  router.Wake(task);
+  waiter.join();
+  CHECK(notified);
+  CHECK(router.GetCounters().woken == 1);
+}
+
+TEST_CASE("WakeupRouter routes a source to its subscribed tasks only") {
+  watch::WakeupRouter router;
+  auto first = router.AddTask();
+  auto second = router.AddTask();
+  auto third = router.AddTask();
+  router.Subscribe(first, 1);
+  router.Subscribe(second, 1);
+  router.Subscribe(third, 2);
+
+  router.Notify(1);
+  router.Notify(7);
+  CHECK(router.Wait(first, 0ns));
+  CHECK(router.Wait(second, 0ns));
+  CHECK_FALSE(router.Wait(third, 0ns));
+
+  router.NotifyAll();
+  CHECK(router.Wait(first, 0ns));
+  CHECK(router.Wait(second, 0ns));
+  CHECK(router.Wait(third, 0ns));
+}
+
+TEST_CASE("WakeupRouter loses no wakeup racing with a task going to sleep") {
+  watch::WakeupRouter router;
+  auto task = router.AddTask();
+  constexpr int kRounds = 20000;
+  std::atomic<int> consumed{0};
+  std::atomic<int> timeouts{0};
+  // every round the waker notifies once and waits for the notification to be consumed; the wake lands
+  // anywhere in Wait(), also between its exchange and its compare exchange to sleeping
+  std::jthread waiter([&] {
+    while (consumed.load() < kRounds) {
+      if (router.Wait(task, 2s)) {
+        consumed++;
+      } else {
+        timeouts++;
+        return;
+      }
+    }
+  });
+  for (int round = 0; round < kRounds && timeouts.load() == 0; ++round) {
+    for (int spin = round % 64; spin > 0; --spin) {
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+    router.Wake(task);
+    while (consumed.load() == round && timeouts.load() == 0) {
+      std::this_thread::yield();
+    }
+  }
+  waiter.join();
+  CHECK(timeouts == 0);
+  CHECK(consumed == kRounds);
+}